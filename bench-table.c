@@ -0,0 +1,148 @@
+// hosts表查找性能测试
+// 编译: cmake --build <构建目录> --target bench-table，或
+//       gcc -std=c99 -O2 -Iinclude bench-table.c src/dns_table.c src/output_level.c -lws2_32 -o bench-table
+// 用法: bench-table [条目数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dns_table.h"
+
+#define DEFAULT_ENTRY_COUNT 1000000
+#define LOOKUP_COUNT 4000000
+
+// 高精度计时，单位为秒
+static double nowSeconds() {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+// 生成第index个测试域名，miss为1时生成一定不在表中的域名
+static void makeName(char* buf, size_t size, unsigned index, int miss) {
+    snprintf(buf, size, "%s%u.tracker-%u.example%u.com", miss ? "miss" : "ad", index, index % 977, index % 13);
+}
+
+// 简单的xorshift随机数，保证每次运行的访问序列一致
+static unsigned nextRandom(unsigned* state) {
+    unsigned x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// 在与表同样大小的内存上随机追链，测出一次依赖访存（缓存和TLB都未命中）的平均延迟，作为查找耗时的参照
+static double accessLatency(size_t bytes) {
+    size_t line_count = bytes / 64;
+    if (line_count < 2) return 0.0;
+    size_t* lines = malloc(line_count * 64);
+    size_t* order = malloc(line_count * sizeof(size_t));
+    if (!lines || !order) {
+        free(lines);
+        free(order);
+        return 0.0;
+    }
+
+    // Sattolo洗牌得到一个覆盖所有缓存行的单环，每行的第一个字保存下一行的下标
+    unsigned state = 88172645u;
+    for (size_t i = 0; i < line_count; i++) order[i] = i;
+    for (size_t i = line_count - 1; i > 0; i--) {
+        size_t j = nextRandom(&state) % i;
+        size_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (size_t i = 0; i < line_count; i++) {
+        lines[order[i] * 8] = order[(i + 1) % line_count];
+    }
+
+    size_t at = order[0];
+    double start = nowSeconds();
+    for (unsigned i = 0; i < LOOKUP_COUNT; i++) at = lines[at * 8];
+    double elapsed = nowSeconds() - start;
+
+    free(lines);
+    free(order);
+    // 防止编译器把追链优化掉
+    return at == (size_t)-1 ? 0.0 : elapsed * 1e9 / LOOKUP_COUNT;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned entry_count = argc > 1 ? (unsigned)atoi(argv[1]) : DEFAULT_ENTRY_COUNT;
+    if (entry_count == 0) entry_count = DEFAULT_ENTRY_COUNT;
+
+    char name[MAX_DOMAIN_LEN];
+    uint8_t ip[1][4] = { { 0, 0, 0, 0 } };
+    uint8_t result[MAX_IP_COUNT][4];
+    uint8_t result_count;
+
+    initDnsResolver();
+
+    // 模拟拦截列表：绝大多数条目为0.0.0.0，每100个条目中有1个普通映射
+    size_t name_bytes = 0;
+    double start = nowSeconds();
+    for (unsigned i = 0; i < entry_count; i++) {
+        makeName(name, sizeof(name), i, 0);
+        name_bytes += strlen(name);
+        if (i % 100 == 0) {
+            ip[0][0] = 10;
+            ip[0][2] = (uint8_t)(i >> 8);
+            ip[0][3] = (uint8_t)i;
+        } else {
+            memset(ip[0], 0, 4);
+        }
+        insertNode(ip, NULL, 1, name);
+    }
+    double build = nowSeconds() - start;
+    printf("插入 %u 个域名: %.3f s (%.1f ns/条)\n", entry_count, build, build * 1e9 / entry_count);
+
+    size_t table_entries;
+    size_t memory = resolverMemoryUsage(&table_entries);
+    printf("内存占用: %.1f MB, 每条目 %.1f 字节 = 域名平均 %.1f 字节 + 额外开销 %.1f 字节\n",
+           memory / 1048576.0, (double)memory / table_entries, (double)name_bytes / table_entries,
+           (double)(memory - name_bytes) / table_entries);
+
+    // 预先生成查询域名，避免把snprintf的开销计入查找时间
+    char (*queries)[64] = malloc((size_t)LOOKUP_COUNT * 64);
+    if (!queries) return 1;
+    double latency = 0.0;
+
+    for (int round = 0; round < 4; round++) {
+        int miss = round & 1;
+        if (round == 2) {
+            // 后两轮在冻结为最小完美哈希后的表上查询
+            start = nowSeconds();
+            int frozen = freezeDnsResolver();
+            double freeze = nowSeconds() - start;
+            memory = resolverMemoryUsage(&table_entries);
+            printf("构建完美哈希%s: %.3f s, 内存占用 %.1f MB, 额外开销 %.1f 字节/条\n",
+                   frozen ? "成功" : "失败", freeze, memory / 1048576.0,
+                   (double)(memory - name_bytes) / table_entries);
+        }
+        if (round == 0 || round == 2) {
+            latency = accessLatency(memory);
+            printf("在 %.1f MB 内存上随机访存: %.1f ns/次\n", memory / 1048576.0, latency);
+        }
+        unsigned state = 2463534242u;
+        for (unsigned i = 0; i < LOOKUP_COUNT; i++) {
+            makeName(queries[i], 64, nextRandom(&state) % entry_count, miss);
+        }
+
+        unsigned hits = 0;
+        start = nowSeconds();
+        for (unsigned i = 0; i < LOOKUP_COUNT; i++) {
+            hits += queryNode(queries[i], result, &result_count);
+        }
+        double elapsed = nowSeconds() - start;
+        double per_query = elapsed * 1e9 / LOOKUP_COUNT;
+        printf("[%s] 随机%s查询 %u 次: %.3f s (%.1f ns/次, 约 %.1f 次随机访存), 命中 %u 次\n",
+               round < 2 ? "开放寻址" : "完美哈希", miss ? "未命中" : "命中", LOOKUP_COUNT, elapsed, per_query,
+               latency > 0 ? per_query / latency : 0.0, hits);
+    }
+
+    free(queries);
+    destroyDnsResolver();
+    return 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "dns_struct.h"
+
+#define BLOCK_DEFAULT_TTL 300      // 拦截应答的默认TTL（秒），也用作SOA的否定缓存时间
+#define BLOCK_MAX_TTL 2147483647u  // TTL上限，RFC 2181规定TTL不超过2^31-1
+#define BLOCK_SOA_SERIAL 1         // 合成SOA的序列号
+#define BLOCK_SOA_REFRESH 3600
+#define BLOCK_SOA_RETRY 600
+#define BLOCK_SOA_EXPIRE 86400
+#define BLOCK_SOA_RR_MAX 80        // 合成SOA记录的字节数上限，供调用方准备缓冲区
+
+// 拦截方式
+enum BlockMode {
+    BLOCK_MODE_NXDOMAIN = 0,       // NXDOMAIN，授权部分附带合成的SOA，客户端按SOA的MINIMUM缓存否定应答
+    BLOCK_MODE_SINKHOLE            // A查询返回0.0.0.0，AAAA查询返回::，其他类型返回NODATA+SOA
+};
+
+extern int block_mode;             // 当前拦截方式，由-b设置
+extern uint32_t block_ttl;         // 拦截应答的TTL，由-n设置
+
+// 一种查询类型对应的拦截应答，各部分均已按线上格式预编码
+typedef struct BlockResponse {
+    const uint8_t* records;        // 紧跟在问题之后的资源记录，名字为指向问题的压缩指针
+    int length;                    // records的字节数
+    uint16_t ancount;              // 回答记录数
+    uint16_t nscount;              // 授权记录数
+    uint8_t rcode;                 // 响应码
+} BlockResponse;
+
+/**
+ * @brief 按block_mode和block_ttl预编码拦截应答，启动时在解析完命令行参数后调用一次。
+ */
+void initBlockResponses(void);
+
+/**
+ * @brief 取得某种查询类型的拦截应答。返回的记录在程序运行期间保持不变，拦截路径不分配内存。
+ *
+ * @param qtype 查询类型
+ * @return 预编码的拦截应答
+ */
+const BlockResponse* blockResponse(uint16_t qtype);
+
+/**
+ * @brief 取得NODATA应答（NOERROR，无回答，授权部分附带合成的SOA），
+ * 用于hosts表中存在该域名、但没有所查类型地址的情况。
+ *
+ * @return 预编码的NODATA应答
+ */
+const BlockResponse* nodataResponse(void);
+
+/**
+ * @brief 构造本地权威区的NXDOMAIN应答（查询区顶点本身或区内已有的名字时为NODATA），授权部分的SOA以区顶点为所有者名。
+ * 查询区顶点的SOA时，合成的SOA作为回答返回。用于RFC 6303私有反向区等本地直接否定的查询，与拦截方式无关。
+ *
+ * @param apexOffset 区顶点在问题域名（点分形式）中的偏移，线上格式中偏移相同
+ * @param exists 名字在区内存在（例如hosts反向域名或它们的空非终结点），只是没有所查类型的记录
+ * @param qtype 查询类型
+ * @param records 输出缓冲区，至少BLOCK_SOA_RR_MAX字节
+ * @param response 输出参数，records指向传入的缓冲区
+ * @return 写入records的字节数
+ */
+int localZoneResponse(int apexOffset, int exists, uint16_t qtype, uint8_t* records, BlockResponse* response);
+
+/**
+ * @brief 解析-b参数。
+ *
+ * @param text "nx"或"sinkhole"
+ * @return 成功返回1，无法识别返回0
+ */
+int parseBlockMode(const char* text);
@@ -1,29 +1,41 @@
 #pragma once
 #include "dns_struct.h"
 #include "dns_config.h"
+#include "dns_convert.h"
 #include <time.h>
 
 #define MAX_DOMAIN_LEN 256        //最大域名长度
 #define MAX_CACHE_SIZE 1024       // 默认缓存容量
 #define HASH_TABLE_SIZE 2048      // 哈希表大小，通常是缓存容量的2倍
-#define MAX_IP_COUNT 8            // 每个域名最多支持的IP地址数量
+#define MAX_IP_COUNT 8            // 每个域名最多支持的IP地址数量（其他类型同样最多保存这么多条记录）
+#define CACHE_RDATA_MAX 512       // A以外类型的条目中RDATA的总长度上限
+#define CACHE_MAX_CHAIN 8         // 收录上游应答或由缓存拼装应答时，从查询名出发最多跟随的CNAME数
+#define CACHE_HARVEST_MAX 64      // 一个上游应答中最多收录的记录数
+
+extern int cname_flatten;         // 由-F开启：缓存命中CNAME链时只回答最终记录，名字换成查询名，TTL取整条链的最小值
 
 // 数据结构优化：使用双向链表节点
 /**
- * @brief LRU缓存节点结构体
+ * @brief LRU缓存节点结构体，以域名（不区分大小写）和记录类型为键
  * @param domain 域名字符串
+ * @param type 记录类型，A记录的地址存在IPs中，其他类型的RDATA依次存在rdata中
  * @param IPs 多个IPv4地址数组
- * @param ip_count 有效IP地址的数量
+ * @param ip_count 有效记录的数量（A记录即IP地址数）
  * @param ttl DNS记录的生存时间（秒）
+ * @param rdlens 其他类型每条记录的RDATA长度
+ * @param rdata 其他类型的RDATA，其中的域名已展开为不压缩的形式
  * @param insert_time 插入时间戳（用于计算是否过期）
  * @param prev 指向前一个节点的指针
  * @param next 指向下一个节点的指针
  */
 typedef struct lruNode {   
     char domain[MAX_DOMAIN_LEN];  //域名
+    uint16_t type;                //记录类型
     uint8_t IPs[MAX_IP_COUNT][4]; //多个IPv4地址数组，最多MAX_IP_COUNT个
-    uint32_t ttls[MAX_IP_COUNT];  //每个IP地址对应的TTL值（秒）
-    uint8_t ip_count;             //当前记录的有效IP地址数量
+    uint32_t ttls[MAX_IP_COUNT];  //每条记录对应的TTL值（秒）
+    uint8_t ip_count;             //当前记录的有效记录数量
+    uint16_t rdlens[MAX_IP_COUNT];   //A以外类型每条记录的RDATA长度
+    uint8_t rdata[CACHE_RDATA_MAX];  //A以外类型的RDATA，依次存放
     time_t insert_time;           //记录插入时间戳
     struct lruNode *prev;         
     struct lruNode *next;         
@@ -67,6 +79,49 @@ int cacheGet(uint8_t ipv4s[][4], uint8_t* ip_count, char* domain);
  */
 void cachePut(uint8_t ipv4s[][4], const uint32_t ttls[], uint8_t ip_count, char* domain, uint32_t default_ttl);
 
+/**
+ * @brief 在cache中查询某个域名某种类型的记录，A记录的RDATA即4字节地址
+ * @param domain 要查询的域名
+ * @param type 记录类型
+ * @param rdata 输出参数，依次存放未过期记录的RDATA，至少CACHE_RDATA_MAX字节
+ * @param rdlens 输出参数，每条记录的RDATA长度
+ * @param ttls 输出参数，每条记录剩余的TTL（秒）
+ * @return 未过期的记录数，未命中或已过期返回0
+ */
+int cacheGetRecords(const char* domain, uint16_t type, uint8_t* rdata, uint16_t rdlens[], uint32_t ttls[]);
+
+/**
+ * @brief 向缓存中插入某个域名A以外类型的一组记录，已有的同名同类型条目被替换
+ * @param domain 域名
+ * @param type 记录类型
+ * @param rdata 依次存放的RDATA，其中的域名不能含压缩指针
+ * @param rdlens 每条记录的RDATA长度
+ * @param ttls 每条记录的TTL（秒）
+ * @param count 记录数，超过MAX_IP_COUNT或RDATA总长超过CACHE_RDATA_MAX的部分被舍弃
+ */
+void cachePutRecords(const char* domain, uint16_t type, const uint8_t* rdata, const uint16_t rdlens[],
+                     const uint32_t ttls[], uint8_t count);
+
+/**
+ * @brief 把上游应答各部分中可信的记录按各自的TTL收入缓存：
+ * 回答部分中查询名及其CNAME链上的名字的记录；授权部分中查询名自己所在区（包含查询名的最深的区，
+ * 根和顶级域除外）的NS记录；附加部分中这些NS所指服务器的A/AAAA记录，且服务器名须在该区之内（辖区内的粘附记录）。
+ * 每个名字的记录缓存在自己的名字下，CNAME链的每一环单独成为一个条目，查询时由cacheAnswer拼回。
+ * @param msg 解析后的上游应答，rcode不为0或被截断的应答不收录
+ */
+void cacheHarvest(const dns_Message* msg);
+
+/**
+ * @brief 用缓存中的记录拼出应答，不置AA：查询名没有所查类型的记录时沿缓存的CNAME逐级跟随，
+ * 回答部分依次是链上的各条CNAME和最终名字的记录；开启cname_flatten时只回答最终记录
+ * @param query 客户端的查询报文
+ * @param question 查询的问题
+ * @param reply 输出的应答报文
+ * @param limit 应答的长度上限，由客户端能接收的UDP载荷大小决定，不超过DNS_STRING_MAX_SIZE
+ * @return 应答长度，缓存未命中、链不完整或应答超过limit时返回0
+ */
+int cacheAnswer(const uint8_t* query, const dns_question_view* question, uint8_t* reply, int limit);
+
 /**
  * @brief 删除最老的域名及IP地址
  */
@@ -84,3 +139,10 @@ int cacheCleanExpired();
  * @return 1表示已过期，0表示未过期
  */
 int isExpired(lruNode* node);
+
+/**
+ * @brief 从最久未使用到最近使用的顺序遍历所有缓存条目
+ * @param visit 对每个条目调用的回调函数
+ * @param ctx 透传给回调函数的上下文指针
+ */
+void cacheForEach(void (*visit)(lruNode* node, void* ctx), void* ctx);
@@ -12,6 +12,14 @@ extern u_long socketMode;
 extern char* host_path;  
 extern char* LOG_PATH;
 extern char* dnsServerAddress;
+extern char* image_path;
+extern char* pattern_path;
+extern char* forward_path;
+extern char* root_hints_path;
+extern char* listen_address;
+extern char* peer_members;
+extern char* zone_paths[];
+extern int zone_path_count;
 
 // 临时缓冲区
 extern char IPAddr[DNS_RR_NAME_MAX_SIZE];
@@ -31,7 +39,11 @@ void writeLog(char* domain, uint8_t* ip_addr);
 
 // Hosts文件处理
 void readHost();
-void getHostInfo(FILE* ptr);
+void compileHost();
+void readPatterns();
+void readZones();
+void readForwards();
+void readRootHints();
 
 // IP地址转换
 int TranIP(uint8_t* dest, const char* src);
@@ -10,6 +10,15 @@ static const uint32_t RD_MASK = 0x0100;
 static const uint32_t RA_MASK = 0x0080;
 static const uint32_t RCODE_MASK = 0x000F;
 
+// 直接在原始报文上解析出的问题，不分配内存
+typedef struct dns_question_view {
+    char QNAME[DNS_RR_NAME_MAX_SIZE + 1]; // 点分形式的域名
+    size_t nameLength;                    // 域名长度
+    uint16_t QTYPE;
+    uint16_t QCLASS;
+    int end;                              // 问题部分结束处相对报文开头的偏移
+} dns_question_view;
+
 // DNS 报文字串转换为 DNS 结构体
 void str_to_dnsstruct(dns_Message* pmsg, uint8_t* buffer, uint8_t* start);
 
@@ -25,6 +34,9 @@ uint8_t* getDnsquestion(dns_Message* msg, uint8_t* buffer, uint8_t* start);
 // 从字串获取 answer
 uint8_t* getDnsanswer(dns_Message* msg, uint8_t* buffer, uint8_t* start);
 
+// 从字串获取count条资源记录（回答、授权或附加部分），插入list链表
+uint8_t* getDnsrecords(dns_rr** list, int count, uint8_t* buffer, uint8_t* start);
+
 // 从字串获取域名Name
 uint8_t* getDomain(uint8_t* buffer, char* name, uint8_t* start);
 
@@ -43,5 +55,13 @@ uint8_t* setDnsanswer(dns_Message* msg, uint8_t* buffer, uint8_t* ip_addr);
 // 设置域名
 uint8_t* setDomain(uint8_t* buffer, char* name);
 
+// 快速解析只有一个问题的标准查询，不分配内存；其他报文（或问题中含压缩指针）返回0，交给完整解析
+int peekQuestion(const uint8_t* buffer, int msg_size, dns_question_view* question);
+
+// 原样复制查询的报头和问题，再追加预编码的资源记录（依次为回答、授权、附加），拼出应答报文，返回报文长度
+int composeReply(const uint8_t* query, const dns_question_view* question, uint8_t rcode,
+                 const uint8_t* records, int length, uint16_t ancount, uint16_t nscount, uint16_t arcount,
+                 uint8_t* reply);
+
 // 释放空间
 void freeMessage(dns_Message* msg);
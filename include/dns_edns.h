@@ -0,0 +1,62 @@
+#pragma once
+#include "dns_struct.h"
+
+#define DNS_TYPE_OPT 41               // OPT伪记录（RFC 6891）
+#define EDNS_OPT_SIZE 11              // 不带选项的OPT伪记录的长度
+#define EDNS_OPT_KEEP_MAX 512         // 转发上游应答时保留的OPT记录（含选项）的最大长度，更长的换成自己的OPT
+#define EDNS_PLAIN_UDP_SIZE 512       // 不支持EDNS的客户端能接收的UDP应答长度
+#define EDNS_DEFAULT_UDP_SIZE 1232    // 默认通告的UDP载荷大小，避免IP分片（DNS Flag Day 2020）
+#define EDNS_DO_BIT 0x8000            // OPT记录TTL字段低16位中的DO标志
+
+extern uint16_t edns_udp_size;        // 向客户端和上游通告的UDP载荷大小，由-e设置，512~DNS_STRING_MAX_SIZE
+
+// 报文中OPT伪记录的位置和内容
+typedef struct dns_edns {
+    int present;                      // 报文带OPT记录
+    uint16_t udp_size;                // 对方通告的UDP载荷大小（OPT记录的CLASS字段）
+    uint16_t flags;                   // OPT记录TTL字段的低16位，最高位是DO
+    int offset;                       // OPT记录在报文中的偏移
+    int length;                       // OPT记录的长度（含选项）
+    int question_end;                 // 问题部分结束处的偏移
+} dns_edns;
+
+/**
+ * @brief 逐条跳过报文中的问题和记录，在附加部分中找出OPT伪记录。
+ *
+ * @param msg 报文
+ * @param size 报文长度
+ * @param edns 输出OPT记录的位置和内容，没有OPT时present为0
+ * @return 报文结构完整返回1；记录越界等格式错误返回0
+ */
+int ednsParse(const uint8_t* msg, int size, dns_edns* edns);
+
+/**
+ * @brief 客户端能接收的UDP应答长度：没有OPT时为512，
+ * 否则为客户端通告的大小，限制在512和本地通告的大小之间。
+ */
+int ednsPayloadLimit(const dns_edns* client);
+
+/**
+ * @brief 改写将要发往上游的查询，让上游知道本地能接收多大的应答：查询带OPT时只改写其中的UDP载荷大小，
+ * DO等标志和选项原样保留；不带OPT时在末尾追加一条，附加记录数加一。
+ *
+ * @param query 查询报文
+ * @param len 报文长度
+ * @param capacity query缓冲区的大小，放不下追加的OPT时原样发出
+ * @param client 客户端查询的ednsParse()结果
+ * @return 改写后的报文长度
+ */
+int ednsPrepareQuery(uint8_t* query, int len, int capacity, const dns_edns* client);
+
+/**
+ * @brief 发往客户端之前调整应答：客户端用了EDNS时应答带一条OPT（沿用上游的OPT并改写UDP载荷大小，
+ * 没有时追加自己的，DO标志与查询一致）；客户端没用EDNS时去掉上游应答中的OPT。
+ * 超过limit时只保留报头和问题（以及OPT），置TC，让客户端改用TCP。
+ *
+ * @param reply 应答报文
+ * @param len 报文长度
+ * @param limit 应答的长度上限：UDP为ednsPayloadLimit()，TCP为报文的最大长度；不能超过reply缓冲区的大小
+ * @param client 客户端查询的ednsParse()结果
+ * @return 调整后的报文长度；应答格式错误时原样返回len
+ */
+int ednsFitReply(uint8_t* reply, int len, int limit, const dns_edns* client);
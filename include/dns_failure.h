@@ -0,0 +1,49 @@
+#pragma once
+#include "dns_struct.h"
+#include "output_level.h"
+
+#define FAILURE_HOLD_MIN 5            // 第一次失败后屏蔽的秒数
+#define FAILURE_HOLD_MAX 300          // 屏蔽时间的上限（秒），RFC 9520要求失败不得缓存超过5分钟
+#define FAILURE_FORGET 600            // 屏蔽结束后这么多秒内没有再失败，退避从头开始
+#define FAILURE_MAX_ENTRIES 4096      // 失败缓存的条目上限
+#define FAILURE_SUCCESS_SLOTS 4096    // 记录最近一次成功应答时刻的直接映射表的槽数，冲突时新的覆盖旧的
+
+/**
+ * @brief 查询名和类型是否处于失败屏蔽期：上游对它回复了SERVFAIL或直到超时都没有应答，
+ * 屏蔽期内的查询直接回复SERVFAIL，不再发往上游。
+ *
+ * @param name 点分形式的查询名（不区分大小写）
+ * @param qtype 查询类型
+ * @return 屏蔽期剩余的秒数；不在屏蔽期时返回0
+ */
+int failureCheck(const char* name, uint16_t qtype);
+
+/**
+ * @brief 记录一次上游失败：第一次失败屏蔽FAILURE_HOLD_MIN秒，屏蔽结束后
+ * FAILURE_FORGET秒内再次失败时屏蔽时间加倍，最长FAILURE_HOLD_MAX秒。
+ * 查询发出之后同一名字和类型已经有过成功的应答时（例如并发的另一个查询先得到了应答），
+ * 这次失败只说明那一个查询出了问题，不记录。
+ *
+ * @param name 点分形式的查询名
+ * @param qtype 查询类型
+ * @param sent_at 失败的查询最初发出的时刻（GetTickCount64()毫秒）
+ * @param reason 写入日志的失败原因，如"SERVFAIL"、"timeout"
+ */
+void failureRecord(const char* name, uint16_t qtype, uint64_t sent_at, const char* reason);
+
+/**
+ * @brief 上游对查询名给出了正常应答（NOERROR或NXDOMAIN）：删除它的失败记录，退避从头开始；
+ * 记下成功的时刻，在这之前发出的同名查询之后超时或失败时不再记入失败缓存。
+ */
+void failureClear(const char* name, uint16_t qtype);
+
+/**
+ * @brief 删除屏蔽结束且超过FAILURE_FORGET秒没有再失败的条目。
+ * @return 删除的条目数
+ */
+int failureCleanExpired(void);
+
+/**
+ * @brief 释放全部失败记录。
+ */
+void destroyFailureCache(void);
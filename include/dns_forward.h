@@ -0,0 +1,135 @@
+#pragma once
+#include "dns_struct.h"
+#include "output_level.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#define FORWARD_DEFAULT_PORT 53       // 上游地址未写端口时使用的端口
+#define FORWARD_MAX_GROUPS 64         // 上游组数上限，组0是-s指定的默认上游
+#define FORWARD_MAX_SERVERS 8         // 每个上游组的服务器数上限
+#define FORWARD_LINE_MAX 512          // 转发规则文件中每行的最大长度
+#define FORWARD_TIMEOUT_RTT 4000      // 查询超时未应答时，该服务器的平滑RTT至少抬高到这个值（毫秒）
+#define FORWARD_RTT_MAX 60000         // 平滑RTT的上限（毫秒）
+#define FORWARD_RTT_DECAY_MS 1000     // 服务器每这么多毫秒没有新的RTT样本，平滑RTT衰减1/16
+#define FORWARD_NO_GROUP 0xFF         // ForwardTarget.group取此值表示不记账（如热升级接管的查询）
+#define FORWARD_DOWN_TIMEOUTS 3       // 服务器连续超时这么多次后视为不可用，哈希选择暂时跳过它
+#define FORWARD_DOWN_HOLD 30          // 不可用的服务器被跳过的秒数，之后重新分到它的名字，再超时一次就继续跳过
+
+#define FORWARD_SELECT_RTT 0          // 组内选平滑RTT乘以在途查询数最小的服务器
+#define FORWARD_SELECT_HASH 1         // 组内按查询名做最高随机权重（rendezvous）哈希，同一个名字总是发往同一个服务器
+
+extern int forward_select_mode;       // 组内选择服务器的方式，由-g设置
+
+// 一次转发选中的上游：所属组和组内的服务器序号，随ID映射保存，应答或超时时据此记账
+typedef struct ForwardTarget {
+    uint8_t group;
+    uint8_t server;
+} ForwardTarget;
+
+/**
+ * @brief 用-s指定的地址建立默认上游组（组0），未命中任何转发规则的查询都发往这里。
+ *
+ * @param address 点分十进制的IPv4地址，可带":端口"；多个地址以','分隔，最多FORWARD_MAX_SERVERS个
+ * @return 成功返回1，地址无效或过多时返回0
+ */
+int initForwarding(const char* address);
+
+/**
+ * @brief 读取条件转发规则文件，把每条规则的域名后缀按标签倒序插入后缀树。
+ *
+ * 每行一条规则："后缀 上游地址 [上游地址...]"，'#'开头的行为注释，地址可带":端口"。
+ * 上游地址列表相同的规则共用一个上游组，待应答计数和RTT按组记录；
+ * 同一后缀出现多次时以最后一条为准。格式错误的行被跳过并记录日志。
+ *
+ * @param path 规则文件路径
+ * @return 成功加载的规则数；文件无法打开时返回-1
+ */
+int loadForwardFile(const char* path);
+
+/**
+ * @brief 为查询名选择上游：沿后缀树从顶级标签逐级向下，取最长匹配后缀所属的组，
+ * 代价与标签数成正比，与规则数量无关；组内按forward_select_mode选择服务器，并把该组的待应答数加一。
+ *
+ * 哈希方式下，每个服务器的权重是查询名（不区分大小写）与服务器地址组合后的哈希，选权重最大的可用服务器：
+ * 同一个名字总是落在同一个服务器上，上游各自的缓存只需要容纳自己那一份名字；
+ * 某个服务器不可用时，只有原本归它的名字改投权重次大的服务器，其余名字不动。
+ *
+ * @param name 点分形式的查询名
+ * @param len 查询名长度
+ * @param target 输出选中的组和服务器
+ * @return 选中服务器的地址
+ */
+const struct sockaddr_in* forwardSelect(const char* name, size_t len, ForwardTarget* target);
+
+/**
+ * @brief 转发的查询超时后，在同一组内另选一个服务器重发：跳过刚超时的服务器和不可用的服务器，
+ * 按forward_select_mode取代价最小或权重最大的一个，并像forwardSelect()一样记账。
+ *
+ * @param name 点分形式的查询名
+ * @param len 查询名长度
+ * @param target 输入刚超时的组和服务器，成功时改为新选中的服务器
+ * @return 新选中服务器的地址；组内没有别的可用服务器时返回NULL，target不变
+ */
+const struct sockaddr_in* forwardRetry(const char* name, size_t len, ForwardTarget* target);
+
+/**
+ * @brief 查询名的FNV-1a哈希，不区分大小写，忽略末尾的'.'，是最高随机权重哈希的名字部分。
+ */
+uint64_t forwardNameHash(const char* name, size_t len);
+
+/**
+ * @brief 名字哈希与一个地址组合出的随机权重：同一组地址中权重最大的就是这个名字的归属，
+ * 增减一个地址只影响归它的名字。上游的哈希选择和兄弟节点的缓存分片共用这一算法。
+ *
+ * @param key forwardNameHash()的结果
+ * @param address 候选的服务器或节点地址
+ */
+uint64_t forwardHashWeight(uint64_t key, const struct sockaddr_in* address);
+
+/**
+ * @brief 转发时选中的上游服务器的地址，截断的应答据此改经TCP重试。
+ *
+ * @return 服务器地址；target不是有效的组和服务器（如热升级接管的查询）时返回NULL
+ */
+const struct sockaddr_in* forwardAddress(ForwardTarget target);
+
+/**
+ * @brief 查询名按最长匹配后缀落在哪个上游组，不选择服务器也不记账。
+ *
+ * @return 组序号；没有规则命中时为默认组0
+ */
+int forwardMatch(const char* name, size_t len);
+
+/**
+ * @brief 上游应答到达时记账：该组待应答数减一，用本次往返时间更新服务器的平滑RTT。
+ *
+ * @param target 发出查询时选中的上游
+ * @param rtt 本次往返时间（毫秒）
+ */
+void forwardAnswered(ForwardTarget target, uint32_t rtt);
+
+/**
+ * @brief 查询超时未应答时记账：该组待应答数减一，抬高服务器的平滑RTT，使组内其他服务器优先被选中。
+ */
+void forwardTimedOut(ForwardTarget target);
+
+/**
+ * @brief 判断数据报是否来自任一已配置的上游服务器。
+ */
+int isUpstreamAddress(const struct sockaddr_in* addr);
+
+/**
+ * @brief 已加载的转发规则数和上游组数（含默认组）。
+ */
+int forwardRuleCount(void);
+int forwardGroupCount(void);
+
+/**
+ * @brief 把每个上游组的待应答数、收发计数和各服务器的平滑RTT写入调试日志。
+ */
+void logForwardStats(void);
+
+/**
+ * @brief 释放后缀树和全部上游组。
+ */
+void destroyForwarding(void);
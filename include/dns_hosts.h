@@ -0,0 +1,69 @@
+#pragma once
+#include "dns_struct.h"
+#include "dns_table.h"
+
+#define HOSTS_MAX_THREADS 16           // 解析hosts文件的最大线程数
+#define HOSTS_MIN_CHUNK (256 * 1024)   // 每个线程至少分到的字节数，小文件不值得开线程
+#define HOSTS_DEFAULT_TTL HOST_ANSWER_TTL  // 本地hosts记录的TTL，编码进预编码应答
+#define HOSTS_PREFETCH_DISTANCE 16     // 合并时提前预取的记录数
+
+/**
+ * @brief hosts文件加载统计
+ * @param record_count 有效的"IP-域名"记录数（一行多个域名时按域名计）
+ * @param invalid_count 被跳过的无效记录数（格式错误的行和超长的域名）
+ * @param domain_count 加载后表中的不同域名数
+ * @param from_image 是否直接映射了二进制镜像
+ * @param frozen 是否已构建完美哈希
+ */
+typedef struct HostLoadStats {
+    size_t record_count;
+    size_t invalid_count;
+    size_t domain_count;
+    int from_image;
+    int frozen;
+} HostLoadStats;
+
+/**
+ * @brief 以文件映射方式读取hosts文件，按行边界切块后多线程解析，再合并进hosts表。
+ *
+ * 每行格式为"IP 域名 [域名...]"，IP可以是IPv4或IPv6地址，'#'之后为注释；
+ * 同一域名出现在多行时按地址族分别合并，重复的地址只保留一份。
+ * 地址为0.0.0.0或::的域名被拦截；只有一种地址族的域名，查询另一种类型时返回NODATA。
+ * 域名写成"*.example.com"时匹配其所有子域名（不含example.com本身）；
+ * AdBlock风格的"||example.com^"拦截example.com及其所有子域名，'!'开头的行为注释。
+ *
+ * @param path hosts文件路径
+ * @param stats 输出参数，加载统计，可为NULL
+ * @return 成功返回1，文件无法打开或映射返回0
+ */
+int loadHostFile(const char* path, HostLoadStats* stats);
+
+/**
+ * @brief 把hosts文件加载进正在构建的hosts表：二进制镜像直接映射，文本文件并行解析后冻结为完美哈希。
+ * 启动时与重新加载时共用。
+ *
+ * @param path hosts文件或镜像路径
+ * @param stats 输出参数，加载统计，可为NULL
+ * @return 成功返回1；文件无法打开返回0；镜像版本不符或已损坏返回-1
+ */
+int loadHostTable(const char* path, HostLoadStats* stats);
+
+/**
+ * @brief 解析点分十进制IPv4地址，遇到第一个既不是数字也不是'.'的字符时停止。
+ *
+ * @param text 待解析的文本，不要求以'\0'结尾
+ * @param end 文本结束位置
+ * @param dest 输出的4字节地址
+ * @return 成功返回消耗的字符数，格式错误返回0
+ */
+size_t parseIPv4(const char* text, const char* end, uint8_t dest[4]);
+
+/**
+ * @brief 解析IPv6地址，支持"::"压缩和末尾的点分十进制IPv4，遇到第一个不属于地址的字符时停止。
+ *
+ * @param text 待解析的文本，不要求以'\0'结尾
+ * @param end 文本结束位置
+ * @param dest 输出的16字节地址
+ * @return 成功返回消耗的字符数，格式错误返回0
+ */
+size_t parseIPv6(const char* text, const char* end, uint8_t dest[16]);
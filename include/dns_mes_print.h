@@ -13,3 +13,7 @@ void printQuestion(dns_Message* msg);
 
 // 打印Answer（RR）
 void printAnswer(dns_Message* msg);
+
+// 打印Authority和Additional（RR）
+void printAuthority(dns_Message* msg);
+void printAdditional(dns_Message* msg);
@@ -0,0 +1,34 @@
+#pragma once
+#include "dns_struct.h"
+#include "output_level.h"
+
+#define PATTERN_MAX_STATES 16384   // 组合DFA的状态数上限，超过时拒绝导致状态爆炸的规则
+#define PATTERN_MAX_DEPTH 32       // 正则中括号的最大嵌套层数
+#define PATTERN_LINE_MAX 512       // 规则文件中每行的最大长度
+
+/**
+ * @brief 读取模式规则文件，把全部规则编译为一个组合DFA，命中任意规则的域名被拦截。
+ *
+ * 每行一条规则，'#'开头的行为注释：
+ *   - 通配符规则匹配整个域名：'*'匹配任意字符串，'?'匹配任意单个字符，[a-z0-9]为字符类
+ *   - 以'/'开头和结尾的是正则规则，支持 . [] [^] * + ? | () 和\转义，
+ *     默认在域名中任意位置出现即算命中，可用^和$锚定开头和结尾
+ * 匹配不区分大小写。加入某条规则后DFA状态数超过PATTERN_MAX_STATES时，该规则被拒绝并记录日志。
+ *
+ * @param path 规则文件路径
+ * @return 成功加载的规则数；文件无法打开时返回-1
+ */
+int loadPatternFile(const char* path);
+
+/**
+ * @brief 用组合DFA对域名做一次扫描，判断是否命中任意规则。代价只与域名长度有关，与规则数量无关。
+ *
+ * @param domain 查询的域名
+ * @return 命中时返回命中规则的原文（同时命中多条时取最先确定命中的一条），未命中或未加载规则时返回NULL
+ */
+const char* patternMatch(const char* domain);
+
+/**
+ * @brief 释放DFA和规则文本。
+ */
+void destroyPatterns(void);
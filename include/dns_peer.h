@@ -0,0 +1,106 @@
+#pragma once
+#include "dns_struct.h"
+#include "output_level.h"
+#include "dns_convert.h"
+#include "dns_edns.h"
+#include "dns_tcp.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#define PEER_DEFAULT_PORT 5301        // 节点地址未写端口时使用的对等端口
+#define PEER_MAX_MEMBERS 16           // 集群节点数上限（含本节点）
+#define PEER_MAX_PENDING 256          // 同时等待兄弟节点应答的查询数上限，满时直接转发上游
+#define PEER_TIMEOUT 50               // 等待兄弟节点应答的毫秒数，超时后转发上游
+#define PEER_DOWN_TIMEOUTS 3          // 兄弟节点连续超时这么多次后视为不可用，它的名字暂时归其余节点
+#define PEER_DOWN_HOLD 10             // 不可用的兄弟节点被跳过的秒数
+#define PEER_STORE_WINDOW 5           // 回复未命中后接受该节点推送同一问题的秒数，覆盖上游映射的存活时间（ID_EXPIRE_TIME）
+#define PEER_GRANT_MAX 1024           // 记录的未命中数上限，满时覆盖最早的一条
+
+// 对等报文的第一个字节，之后是DNS报文
+#define PEER_MSG_QUERY 1              // 查询：只查对方的缓存，对方不转发也不递归
+#define PEER_MSG_ANSWER 2             // 缓存命中，后面是应答
+#define PEER_MSG_MISS 3               // 缓存未命中，后面只有报头
+#define PEER_MSG_STORE 4              // 推送：名字的归属节点未命中时，查询方把上游的应答推给它收入缓存
+
+/**
+ * @brief 按-P指定的节点列表开启集群缓存：第一个地址是本节点的对等端口，其余是兄弟节点，
+ * 在本节点的地址上以独占方式建立非阻塞的UDP socket（热升级启动时接管旧进程的socket）。各节点列出的集合相同（顺序不限）时，
+ * 每个名字在所有节点上算出的归属节点都相同。
+ *
+ * @param members 以','分隔的"a.b.c.d[:port]"列表，至少两个，最多PEER_MAX_MEMBERS个
+ * @return 成功返回1，地址无效、过多或端口无法绑定时返回0
+ */
+int initPeering(const char* members);
+
+/**
+ * @brief 本地缓存未命中、将要转发上游的查询先问名字的归属节点：查询名与各个可用节点的地址做最高随机权重哈希，
+ * 权重最大的是本节点时不问。问了的查询暂存起来，命中时把对方的应答发给客户端；
+ * 未命中或PEER_TIMEOUT内没有应答时由forwardQuery()转发上游，未命中的还在上游应答到达后推送给归属节点。
+ *
+ * @param query 客户端的查询报文
+ * @param len 报文长度
+ * @param question 查询的问题
+ * @param client 查询的来源
+ * @param edns 客户端查询中的OPT记录
+ * @return 已发给兄弟节点返回1；未开启集群、名字归本节点或等待表已满时返回0，由调用方直接转发上游
+ */
+int peerAsk(const uint8_t* query, int len, const dns_question_view* question, const ClientRoute* client,
+            const dns_edns* edns);
+
+/**
+ * @brief 把上游的应答推送给名字的归属节点，由它收入缓存，之后其他节点问它时能够命中。
+ *
+ * @param member 归属节点的序号，即peerAsk()转发时交给forwardQuery()的值减一
+ * @param response 上游的应答
+ * @param len 应答长度
+ */
+void peerStore(int member, const uint8_t* response, int len);
+
+/**
+ * @brief 为事件循环填写对等socket。
+ *
+ * @param fds 输出的pollfd数组
+ * @param max fds的容量
+ * @return 填写的项数，未开启集群时为0
+ */
+int peerPollFds(struct pollfd* fds, int max);
+
+/**
+ * @brief 处理WSAPoll()返回的对等socket事件：回答兄弟节点的查询，收下推送的应答，把应答交给等待的查询。
+ *
+ * @param fds peerPollFds()填写、经WSAPoll()返回的数组
+ * @param count peerPollFds()的返回值
+ */
+void peerHandlePoll(const struct pollfd* fds, int count);
+
+/**
+ * @brief 非阻塞模式下在事件循环中调用：不等待地读完对等socket上的报文。
+ */
+void peerService(void);
+
+/**
+ * @brief 在事件循环中调用：等待超时的查询转发上游，并记到没有应答的节点上。
+ */
+void peerTick(void);
+
+/**
+ * @brief 最近一个等待中的查询还有多少毫秒超时，供事件循环决定WSAPoll()的等待时间。
+ *
+ * @return 毫秒数；没有等待中的查询时返回-1
+ */
+int peerNextTimeout(void);
+
+/**
+ * @brief 把各节点的询问、命中、未命中、超时和推送计数写入调试日志。
+ */
+void logPeerStats(void);
+
+/**
+ * @brief 返回对等socket，未开启集群时返回INVALID_SOCKET，供热升级交接给新进程。
+ */
+SOCKET peerPortSocket(void);
+
+/**
+ * @brief 关闭对等socket，释放等待中的查询。
+ */
+void closePeering(void);
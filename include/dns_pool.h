@@ -0,0 +1,34 @@
+#pragma once
+#include "dns_struct.h"
+
+#define POOL_BUFFER_SIZE (DNS_STRING_MAX_SIZE + 2)  // 每块缓冲区的大小：本地接受的最大报文，再加上TCP的两字节长度前缀
+#define POOL_PREALLOC 16              // 启动时预先分配的块数
+#define POOL_MAX_FREE 256             // 空闲链表最多保留的块数，多出的归还给系统
+
+/**
+ * @brief 预先分配POOL_PREALLOC块缓冲区。不调用时第一次取用会按需分配。
+ */
+void initBufferPool(void);
+
+/**
+ * @brief 取一块POOL_BUFFER_SIZE字节的报文缓冲区：优先复用空闲链表中的块，没有时才分配。
+ * 缓冲区池只在事件循环所在的线程中使用，不加锁。
+ *
+ * @return 缓冲区；内存不足时返回NULL
+ */
+uint8_t* poolAcquire(void);
+
+/**
+ * @brief 归还poolAcquire()取得的缓冲区，NULL被忽略。
+ */
+void poolRelease(uint8_t* buffer);
+
+/**
+ * @brief 把已分配的块数和空闲的块数写入调试日志。
+ */
+void logPoolStats(void);
+
+/**
+ * @brief 释放空闲链表中的全部缓冲区。
+ */
+void destroyBufferPool(void);
@@ -0,0 +1,97 @@
+#pragma once
+#include "dns_struct.h"
+#include "output_level.h"
+#include "dns_tcp.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#define RECURSOR_MAX_NS 8             // 一个委派中保留的NS数
+#define RECURSOR_MAX_ACTIVE 512       // 同时进行的解析数上限（含为NS找地址的子解析）
+#define RECURSOR_MAX_DEPTH 3          // 为NS找地址而嵌套的子解析层数
+#define RECURSOR_MAX_CNAME 8          // 一次解析最多跟随的CNAME数
+#define RECURSOR_MAX_REFERRALS 16     // 一次解析最多跟随的委派数
+#define RECURSOR_MAX_QUERIES 32       // 一次解析最多发出的查询数
+#define RECURSOR_MAX_RRS 64           // 解析一个应答时最多查看的记录数
+#define RECURSOR_RETRY_MS 800         // 等待单个权威服务器应答的时间，超时后换下一个服务器
+#define RECURSOR_TCP_MS 2000          // 截断的应答改经TCP重试时，等待连接和应答的时间
+#define RECURSOR_DEADLINE_MS 6000     // 整个解析的期限，超过后回复SERVFAIL
+#define RECURSOR_HOLDDOWN 60          // 服务器超时后，这么多秒内同一区的其他服务器优先
+#define RECURSOR_MAX_DELEGATIONS 4096 // 委派缓存的条目上限
+#define RECURSOR_MAX_TTL 172800       // 委派缓存时间的上限（秒）
+#define RECURSOR_REPLY_MAX DNS_STRING_MAX_SIZE // 收集的回答和授权记录的容量；实际按客户端能接收的长度截止，回答放不下时置TC
+#define RECURSOR_LINE_MAX 512         // 根提示文件中每行的最大长度
+#define RECURSOR_PORT_MIN 1024        // 随机源端口的下限
+#define RECURSOR_PORT_ATTEMPTS 8      // 随机端口被占用时重新抽取的次数，之后交给系统分配
+
+extern int recursion_mode;            // 是否由内置的迭代解析器解析未命中的查询，由-R或-H开启
+
+/**
+ * @brief 使用内置的根服务器地址（a至m.root-servers.net的IPv4地址）作为根提示。
+ */
+void initRootHints(void);
+
+/**
+ * @brief 读取named.root格式的根提示文件："." 的NS记录给出根服务器名，
+ * 这些名字的A记录给出地址，地址可写成"地址:端口"；其他记录和';'之后的注释被忽略。
+ * 根服务器不在53端口时，它给出的委派中的服务器也使用同一端口。
+ *
+ * @param path 根提示文件路径
+ * @return 有地址的根服务器数；文件无法打开时返回-1
+ */
+int loadRootHints(const char* path);
+
+/**
+ * @brief 为客户端查询启动一次迭代解析：从委派缓存中最近的区切点（没有时从根）开始，
+ * 逐级跟随委派、使用附加部分的粘附记录，直到拿到权威的回答、NXDOMAIN或NODATA。
+ * 解析是事件循环中的异步状态机，本函数只发出第一个查询就返回。每个查询从单独的socket发出，
+ * 源端口和事务ID都是随机的，带OPT记录通告本地的UDP载荷大小；被截断的应答改经TCP向同一个服务器重试。
+ *
+ * @param query 客户端的查询报文
+ * @param msg_size 报文长度
+ * @param client 客户端地址，TCP查询还有所在的连接
+ * @return 已接手返回1；不是期望递归（RD=1）的标准查询或在途解析已满时返回0，由调用方按原方式转发
+ */
+int recursorStart(const uint8_t* query, int msg_size, const ClientRoute* client);
+
+/**
+ * @brief 为事件循环填写在途查询的socket。
+ *
+ * @param fds 输出的pollfd数组
+ * @param max fds的容量，至少RECURSOR_MAX_ACTIVE
+ * @return 填写的项数
+ */
+int recursorPollFds(struct pollfd* fds, int max);
+
+/**
+ * @brief 处理WSAPoll()返回的查询socket事件：把应答交给等待它的解析，
+ * 事务ID、来源地址和问题都要与发出的查询一致，不符的应答被丢弃；TCP重试的socket在这里完成连接和收发。
+ *
+ * @param fds recursorPollFds()填写、经WSAPoll()返回的数组
+ * @param count recursorPollFds()的返回值
+ */
+void recursorHandlePoll(const struct pollfd* fds, int count);
+
+/**
+ * @brief 非阻塞模式下在事件循环中调用：不等待地轮询一次全部在途查询的socket。
+ */
+void recursorService(void);
+
+/**
+ * @brief 在事件循环中定期调用：超时的查询改发给下一个服务器，超过期限的解析回复SERVFAIL。
+ */
+void recursorTick(void);
+
+/**
+ * @brief 距最近一个查询超时还有多少毫秒，供事件循环决定等待时间；没有在途查询时返回-1。
+ */
+int recursorNextTimeout(void);
+
+/**
+ * @brief 返回进行中的解析数（含子解析），热升级交接后的旧进程据此判断是否已处理完手上的查询。
+ */
+int recursorActiveCount(void);
+
+/**
+ * @brief 终止全部解析，释放委派缓存。
+ */
+void destroyRecursor(void);
@@ -0,0 +1,20 @@
+#pragma once
+#include "dns_struct.h"
+#include "dns_hosts.h"
+
+#define RELOAD_SETTLE_MS 200       // 检测到文件变化后等待写入完成的时间（毫秒）
+
+/**
+ * @brief 启动后台重新加载线程，监视hosts文件所在目录，并响应Ctrl+Break。
+ *
+ * hosts文件的修改时间或大小变化、或在控制台按下Ctrl+Break时，在后台线程中构建新表，
+ * 构建完成后原子地替换查询使用的快照，事件循环无需停顿。加载失败时保留原表。
+ *
+ * @param path hosts文件或镜像路径，需在程序运行期间保持有效
+ */
+void startHostReload(const char* path);
+
+/**
+ * @brief 请求立即重新加载hosts文件，可在任意线程中调用。
+ */
+void requestHostReload(void);
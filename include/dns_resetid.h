@@ -1,18 +1,58 @@
 #pragma once
 #include "dns_cache.h"
+#include "dns_forward.h"
+#include "dns_failure.h"
+#include "dns_edns.h"
+#include "dns_tcp.h"
 #include <winsock2.h> 
 #include <ws2tcpip.h> 
 
 
 #define MAX_ID_SIZE 2048   //ID映射表大小
 #define ID_EXPIRE_TIME 4  // ID过期时间
+#define ID_WIRE_SPAN (65536 / MAX_ID_SIZE) // 同一个映射序号可以对应的事务ID个数，事务ID的高位在其中随机选取
 
 typedef struct {
     uint16_t userId;           // 用户ID
+    uint16_t wireId;           // 发往上游的事务ID：除以MAX_ID_SIZE的余数是映射序号，商随机
     time_t expireTime;         // 过期时间
-    struct sockaddr_in clientAddress; // 客户端地址
+    ClientRoute client;        // 客户端地址，TCP查询还有所在的连接
+    ForwardTarget upstream;    // 查询发往的上游组和服务器
+    uint64_t sentAt;           // 发出时刻（毫秒），用于计算上游RTT；超时重发后是重发的时刻
+    uint64_t firstSentAt;      // 最初发出的时刻（毫秒），这之后查询名已有成功应答时超时不记入失败缓存
+    char qname[DNS_RR_NAME_MAX_SIZE + 1]; // 查询名和类型，超时时据此记入失败缓存；为空表示不记录
+    uint16_t qtype;
+    dns_edns edns;             // 客户端查询中的OPT记录，转发应答时据此调整长度和OPT
+    uint8_t viaTcp;            // 查询经上游TCP连接池发出（含截断后的重试），应答再截断时不再重试
+    uint8_t peerOwner;         // 查询名的归属节点序号加一：它的缓存未命中，应答到达后推送给它；0表示不推送
+    uint8_t heldByOld;         // 热升级后仍由旧进程处理的查询：序号到期前不分配，经UDP到达的应答丢弃
+    uint8_t retried;           // 超时后已在组内另一个服务器上重发过一次，再超时就按失败处理
 } ClientSession;
 
 ClientSession IDList[MAX_ID_SIZE];  // 存储客户端会话信息的数组
 void initIdList();
-uint16_t resetId(uint16_t userId, struct sockaddr_in clientAddress);
+uint16_t resetId(uint16_t userId, const ClientRoute* client);
+
+/**
+ * @brief 按上游应答中的事务ID找到等待它的映射：序号处的映射须未过期，且事务ID与发出时的完全一致。
+ * @return 映射；没有对应的在途查询时返回NULL
+ */
+ClientSession* findSession(uint16_t wireId);
+
+/**
+ * @brief 取一个32位密码学随机数（rand_s），用于对外发出的查询中不能被猜到的事务ID和源端口。
+ */
+uint32_t secureRandom(void);
+
+/**
+ * @brief 在事件循环中调用，每秒最多扫描一次：过期仍未应答的映射按超时处理，记到所选的上游服务器上。
+ * 第一次超时时改发给组内另一个服务器，映射保留；没有别的服务器或重发后仍超时，
+ * 才把查询名和类型记入失败缓存并释放映射。
+ * @return 本次按超时处理的映射数（含重发的）
+ */
+int sweepExpiredIds(void);
+
+/**
+ * @brief 返回还没有应答也没有过期的映射数，热升级交接后的旧进程据此判断是否已处理完手上的查询。
+ */
+int pendingIdCount(void);
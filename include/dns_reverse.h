@@ -0,0 +1,37 @@
+#pragma once
+#include "dns_struct.h"
+
+#define REVERSE_NAME_MAX 73        // 最长的反向域名：IPv6的32个半字节标签加"ip6.arpa"，含结尾的'\0'
+
+extern int private_reverse;        // 是否在本地应答私有地址的反向查询，由-r关闭
+
+/**
+ * @brief 拼出地址对应的反向域名，例如1.2.3.4对应"4.3.2.1.in-addr.arpa"，
+ * IPv6地址按半字节倒序拼在"ip6.arpa"之前。
+ *
+ * @param type DNS_TYPE_A或DNS_TYPE_AAAA
+ * @param address 4字节或16字节的地址
+ * @param name 输出缓冲区，至少REVERSE_NAME_MAX字节
+ * @return 反向域名的长度（不含'\0'）
+ */
+size_t reverseName(uint16_t type, const uint8_t* address, char* name);
+
+/**
+ * @brief 把点分形式的域名编码为线上格式（长度前缀的标签序列，以0字节结尾）。
+ *
+ * @param name 域名，不要求以'\0'结尾
+ * @param len 域名长度
+ * @param wire 输出缓冲区，至少DNS_RR_NAME_MAX_SIZE+1字节
+ * @return 编码后的字节数；有空标签、标签超过63字节或总长超限时返回0
+ */
+size_t wireName(const char* name, size_t len, uint8_t* wire);
+
+/**
+ * @brief 判断域名是否落在RFC 6303列出的本地反向区中（RFC 1918私有地址、回环、链路本地、
+ * 文档地址、IPv6唯一本地地址等）。这些区的反向查询不应发往公共DNS，由本地直接返回NXDOMAIN。
+ *
+ * @param name 点分形式的域名
+ * @param len 域名长度
+ * @return 命中时返回区顶点在name中的偏移；未命中或已用-r关闭时返回-1
+ */
+int privateReverseZone(const char* name, size_t len);
@@ -1,12 +1,14 @@
 #pragma once
 #define DNS_PORT 53
-#define BUFFER_SIZE 1500  // DNS报文的最大尺寸
+#define BUFFER_SIZE DNS_STRING_MAX_SIZE  // 收发报文的缓冲区大小，能放下EDNS通告的最大UDP载荷
 
 #include"dns_config.h"
 #include"dns_convert.h"
 #include"dns_struct.h"
 #include"output_level.h"
 #include"dns_mes_print.h"
+#include"dns_edns.h"
+#include"dns_tcp.h"
 
 u_long socketMode;           // 阻塞/非阻塞模式
 int dnsSocket;               // 统一的DNS socket
@@ -18,11 +20,16 @@ int clientPort;           // 客户端端口号
 char* dnsServerAddress;   // 远程主机
 
 void initSocket();
+void openDnsSocket();
 void closeSocketServer();
 void setNonBlockingMode();
 void setBlockingMode();
 void receiveData();           // 合并后的数据接收函数
 int isFromDnsServer(struct sockaddr_in* addr);   // 判断是否来自DNS服务器
-void handleClientRequest(uint8_t* buffer, int msg_size, struct sockaddr_in* clientAddr);  // 处理客户端请求
+void handleClientRequest(uint8_t* buffer, int msg_size, const ClientRoute* client);  // 处理客户端请求（UDP或TCP）
+void sendToClient(uint8_t* reply, int len, const ClientRoute* client, const dns_edns* edns);  // 调整应答后发给客户端，reply至少BUFFER_SIZE字节
+int replyLimit(const ClientRoute* client, const dns_edns* edns);  // 本地拼出的应答能用的长度：客户端能接收的长度，用了EDNS时再留出OPT记录的位置
+void forwardQuery(uint8_t* buffer, int msg_size, const ClientRoute* client, const dns_edns* edns,
+                  const char* qname, uint16_t qtype, int peer_owner);  // 分配新ID后转发上游，buffer至少BUFFER_SIZE字节；peer_owner非0时应答推送给该兄弟节点（序号加一）
 void handleServerResponse(uint8_t* buffer, int msg_size);  // 处理服务器响应
 
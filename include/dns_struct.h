@@ -44,12 +44,17 @@
 #define DNS_TYPE_MX 15     // MX记录，表示邮件交换记录
 #define DNS_TYPE_TXT 16    // TXT记录，表示文本记录
 #define DNS_TYPE_AAAA 28   // AAAA记录，表示IPv6地址
+#define DNS_TYPE_SRV 33    // SRV记录，表示服务位置
+#define DNS_TYPE_ANY 255   // ANY查询，表示所有类型
 
 #define DNS_CLASS_IN 1   // DNS类，表示地址类型，通常为1，表示因特网
  
 // DNS响应代码，表示查询的返回状态
 #define DNS_RCODE_OK 0  //0表示无错误
+#define DNS_RCODE_FORMERR 1 //1表示格式错误
+#define DNS_RCODE_SERVFAIL 2 //2表示服务器失败
 #define DNS_RCODE_NXDOMAIN 3 //3表示名字错误
+#define DNS_RCODE_NOTIMP 4 //4表示不支持该查询
 
 
 /*DNS 首部 (Header)
@@ -3,12 +3,25 @@
 #include <stdint.h>
 #include <time.h>
 
-#define TABLE_CAPACITY  65536
+#define TABLE_CAPACITY  1024   // 哈希表初始槽位数（2的幂），装载因子超过7/8时自动翻倍
+#define HOST_IMAGE_VERSION 6   // 二进制hosts镜像格式版本，布局变化时递增
+#define HOST_ANSWER_TTL 120    // 本地应答中A/AAAA记录的默认TTL（秒）
+#define HOST_ANSWER_RR_SIZE 16 // 一条预编码A记录的字节数：名字指针2+类型2+类2+TTL4+长度2+地址4
+#define HOST_ANSWER_AAAA_RR_SIZE 28 // 一条预编码AAAA记录的字节数，地址为16字节
+
+// 一次本地查询的结果，records指向按线上格式预编码的同类型记录
+typedef struct HostAnswer {
+    const uint8_t* records;    // 连续的A、AAAA或PTR记录，没有该类型的记录时为NULL
+    int length;                // records的字节数
+    uint8_t count;             // 记录条数，为0表示域名存在但没有该类型的地址（NODATA）
+    uint8_t blocked;           // 是否为拦截条目（0.0.0.0或::）
+} HostAnswer;
 
 /**
  * @brief 初始化DNS解析器系统
  *
- * @param table_capacity 哈希表的期望容量。较大的尺寸可以减少哈希冲突，提高性能。
+ * hosts表采用开放寻址哈希：控制字节按16个一组用SIMD并行探测，槽位内保存哈希值，
+ * 域名集中存放在字符串池中。
  */
 void initDnsResolver();
 
@@ -28,13 +41,140 @@ void destroyDnsResolver(void);
  */
 void insertNode(const uint8_t IPs[][4], const uint32_t ttls[], uint8_t ip_count, const char* domain);
 
+/**
+ * @brief 判断地址是否全为0（0.0.0.0或::），这类地址在hosts文件中表示拦截条目。
+ *
+ * @param address 网络字节序的地址
+ * @param len 地址长度，IPv4为4，IPv6为16
+ * @return 全为0返回1，否则返回0
+ */
+int isZeroAddress(const uint8_t* address, size_t len);
+
+/**
+ * @brief 计算域名在hosts表中使用的哈希值。不访问表，可以在解析线程中预先计算。
+ */
+uint64_t domainHash(const char* domain, size_t len);
+
+/**
+ * @brief 预取哈希值对应的控制字节组和槽位。批量插入时提前若干条调用，掩盖随机访问的缓存未命中。
+ */
+void prefetchNode(uint64_t hash);
+
+/**
+ * @brief 批量插入前预留空间，避免插入过程中反复扩容。
+ *
+ * @param entry_count 预计新增的域名数量
+ * @param name_bytes 预计新增的域名总字节数（每个域名另加2字节）
+ */
+void reserveDnsResolver(size_t entry_count, size_t name_bytes);
+
+/**
+ * @brief 为域名追加一个IPv4或IPv6地址，与已有的同类地址合并，重复的地址只保留一份。
+ * 域名不存在时新建条目。用于加载hosts文件时把同一域名分散在多行的记录合并起来。
+ * type为DNS_TYPE_PTR时domain是反向域名，只保留第一次追加的PTR记录。
+ *
+ * @param type DNS_TYPE_A、DNS_TYPE_AAAA或DNS_TYPE_PTR
+ * @param address 要追加的地址，A为4字节，AAAA为16字节，PTR为线上格式的目标域名
+ * @param ttl 该地址的TTL
+ * @param domain 域名，不要求以'\0'结尾
+ * @param len 域名长度
+ * @param hash domainHash(domain, len)的结果
+ */
+void mergeNode(uint16_t type, const uint8_t* address, uint32_t ttl, const char* domain, size_t len, uint64_t hash);
+
+/**
+ * @brief 登记一个没有任何记录的名字（空非终结点），查询时命中但记录数为0。名字已存在时不做改动。
+ * 用于标出hosts反向域名在RFC 6303私有反向区中的上级名字，使这些名字回复NODATA而不是NXDOMAIN。
+ *
+ * @param domain 域名，不要求以'\0'结尾
+ * @param len 域名长度
+ * @param hash domainHash(domain, len)的结果
+ */
+void markNode(const char* domain, size_t len, uint64_t hash);
+
 /**
  * @brief 在哈希表中查询一个域名。
+ * 先精确匹配；未命中时从最长的父域开始逐级查找以"*."开头的后缀规则，
+ * 例如a.b.example.com依次尝试*.b.example.com、*.example.com、*.com。
  *
  * @param domain 要查询的域名字符串。
  * @param ip_addrs 二维数组，用于存储查询到的多个IP地址。
  * @param ip_count 输出参数，返回找到的IP地址数量。
- * @return 如果找到该域名（命中），返回1；否则返回0（未命中）。
+ * @return 如果找到该域名且有IPv4地址，返回1；否则返回0（未命中）。
  */
 int queryNode(const char* domain, uint8_t ip_addrs[][4], uint8_t* ip_count);
 
+/**
+ * @brief 查询域名对应的预编码应答，用于本地命中时不分配内存地直接拼出应答报文。
+ * 匹配规则与queryNode相同。
+ *
+ * 应答为若干条连续的A记录（每条HOST_ANSWER_RR_SIZE字节）、AAAA记录（每条HOST_ANSWER_AAAA_RR_SIZE字节）或PTR记录，
+ * 整数为网络字节序，名字是指向报文偏移12的压缩指针(0xC00C)，因此应答报文必须原样复制查询的报头和问题。
+ * 返回的指针指向当前快照，在查询线程下一次调用resolverQuiescent()之前有效。
+ *
+ * @param domain 要查询的域名，不要求以'\0'结尾
+ * @param len 域名长度
+ * @param qtype 查询类型，只有A、AAAA和PTR会填充records，其他类型只报告是否命中和是否拦截
+ * @param answer 输出参数，命中时填充
+ * @return 命中返回1，未命中返回0
+ */
+int queryNodeAnswer(const char* domain, size_t len, uint16_t qtype, HostAnswer* answer);
+
+/**
+ * @brief 在已加载的hosts表上构建最小完美哈希和快速排除未命中的过滤器，之后查询不再经过探测。
+ * hosts文件读取完成后调用；冻结后若再调用insertNode，表会自动还原为可插入的形式。
+ *
+ * @return 构建成功返回1；表为空或构建失败返回0，此时继续使用开放寻址表。
+ */
+int freezeDnsResolver(void);
+
+/**
+ * @brief 统计hosts表占用的内存。
+ *
+ * @param entry_count 输出参数，返回表中的域名数量，可为NULL。
+ * @return 槽位、控制字节、去重表以及字符串池和IP池已分配的容量合计的字节数（含尚未使用的余量）。
+ */
+size_t resolverMemoryUsage(size_t* entry_count);
+
+/**
+ * @brief 冻结hosts表并写成二进制镜像，供之后的启动直接映射加载。
+ *
+ * @param path 镜像文件路径，已存在时覆盖。
+ * @return 成功返回1，表为空或写入失败返回0。
+ */
+int saveDnsResolverImage(const char* path);
+
+/**
+ * @brief 以只读文件映射加载二进制镜像，替换当前的hosts表。
+ * 查询直接在映射上进行，无需解析；之后若再调用insertNode，表会先复制到堆上。
+ *
+ * @param path 文件路径。
+ * @return 加载成功返回1；文件不是镜像（例如普通hosts文本）返回0；
+ *         是镜像但版本不符或已损坏返回-1。
+ */
+int loadDnsResolverImage(const char* path);
+
+/**
+ * @brief 开始重新加载：之后的insertNode/mergeNode/镜像加载都作用于一张新表，
+ * 查询继续使用当前快照，互不影响。
+ *
+ * @return 成功返回1；已有重新加载在进行或内存不足返回0。
+ */
+int beginDnsResolverReload(void);
+
+/**
+ * @brief 用一次原子指针交换发布新表，等待查询线程经过静止点后释放旧表。
+ * 在加载线程中调用，可能阻塞至多一个事件循环周期。
+ */
+void commitDnsResolverReload(void);
+
+/**
+ * @brief 放弃正在构建的新表，当前快照保持不变。
+ */
+void abortDnsResolverReload(void);
+
+/**
+ * @brief 查询线程的静止点：在事件循环每轮开始时调用，声明此前的查询都已结束，
+ * 不再持有任何旧快照的引用。
+ */
+void resolverQuiescent(void);
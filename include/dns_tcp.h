@@ -0,0 +1,95 @@
+#pragma once
+#include "dns_struct.h"
+#include "output_level.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#define TCP_MAX_CONNECTIONS 64        // 同时保持的TCP连接数上限，满时关闭最久没有活动的空闲连接
+#define TCP_MAX_PIPELINE 16           // 每个连接同时处理的查询数（含待写出的应答），达到上限时暂停读取
+#define TCP_IDLE_TIMEOUT 10000        // 没有未完成查询的连接空闲这么多毫秒后关闭（RFC 7766）
+#define TCP_STALL_TIMEOUT 30000       // 有未完成查询或待写数据的连接这么多毫秒没有进展时关闭
+#define TCP_BACKLOG 32                // 监听队列长度
+#define TCP_ACCEPT_BATCH 16           // 每轮事件最多接受的新连接数
+
+// 查询的来源：UDP客户端的地址，或者一条TCP连接
+typedef struct ClientRoute {
+    struct sockaddr_in address;       // 客户端地址
+    int tcp;                          // TCP连接的槽位，-1表示UDP
+    uint32_t serial;                  // TCP连接的序号，槽位被新连接复用后据此丢弃发给旧连接的应答
+} ClientRoute;
+
+/**
+ * @brief 在DNS端口上以独占方式（SO_EXCLUSIVEADDRUSE）建立非阻塞的TCP监听socket；热升级启动时直接接管
+ * 旧进程交接来的监听socket。端口被占用时只记录日志，之后由tcpTick()重试。
+ */
+void initTcpListener(void);
+
+/**
+ * @brief 返回TCP监听socket，没有监听时返回INVALID_SOCKET，供热升级交接给新进程。
+ */
+SOCKET tcpListenSocket(void);
+
+/**
+ * @brief 为事件循环填写要等待的TCP socket：监听socket，以及每个连接
+ * （流水线未满时等待可读，有待写数据时等待可写）。
+ *
+ * @param fds 输出的pollfd数组
+ * @param max fds的容量，至少1+TCP_MAX_CONNECTIONS
+ * @return 填写的项数
+ */
+int tcpPollFds(struct pollfd* fds, int max);
+
+/**
+ * @brief 处理WSAPoll()返回的TCP事件：接受新连接，读取并逐个分派完整的查询（按到达顺序交给
+ * handleClientRequest()，应答按完成的先后写回，可以乱序），写出积压的应答。
+ *
+ * @param fds tcpPollFds()填写、经WSAPoll()返回的数组
+ * @param count tcpPollFds()的返回值
+ */
+void tcpHandlePoll(const struct pollfd* fds, int count);
+
+/**
+ * @brief 非阻塞模式下在事件循环中调用：不等待地检查一次全部TCP socket并处理事件。
+ */
+void tcpService(void);
+
+/**
+ * @brief 在事件循环中定期调用：关闭空闲超时和停滞的连接，监听socket尚未建立时重试。
+ */
+void tcpTick(void);
+
+/**
+ * @brief 把应答写给TCP连接：加上两字节的长度前缀，能立即写出的直接写出，其余排队等socket可写。
+ * 连接已关闭（序号不符）时丢弃。每次调用结束连接上的一个查询。
+ *
+ * @param route 查询的来源，tcp为连接槽位
+ * @param reply 应答报文
+ * @param len 报文长度
+ */
+void tcpSend(const ClientRoute* route, const uint8_t* reply, int len);
+
+/**
+ * @brief 查询没有应答就结束了（上游超时、ID映射表已满）：只把连接上的未完成查询数减一。
+ */
+void tcpQueryFinished(const ClientRoute* route);
+
+/**
+ * @brief 热升级交接后旧进程调用：关闭自己的监听socket副本（新进程已接管端口），不再读取各连接上的新查询；
+ * 已读到的查询照常应答，应答全部写出后关闭连接。
+ */
+void tcpDrain(void);
+
+/**
+ * @brief 返回仍然打开的连接数，交接后的旧进程据此判断是否已处理完手上的查询。
+ */
+int tcpOpenCount(void);
+
+/**
+ * @brief 把当前的连接数和累计的连接、查询数写入调试日志。
+ */
+void logTcpStats(void);
+
+/**
+ * @brief 关闭监听socket和全部连接，归还缓冲区。
+ */
+void closeTcpListener(void);
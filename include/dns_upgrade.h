@@ -0,0 +1,59 @@
+#pragma once
+#include "dns_struct.h"
+#include "dns_cache.h"
+#include "dns_resetid.h"
+
+#define UPGRADE_PORT 5300          // 热升级交接使用的本地回环端口
+#define UPGRADE_MAGIC "DNSU"       // 交接报文魔数
+#define UPGRADE_VERSION 5          // 交接协议版本
+#define UPGRADE_KEY_FILE "dns_relay_upgrade.key" // 交接密钥文件，在当前用户的临时目录下，只有所有者能读
+#define UPGRADE_KEY_SIZE 16        // 交接密钥的字节数
+#define UPGRADE_DRAIN_TIMEOUT 8    // 交接后旧进程处理完手上查询的期限（秒），长于ID映射和迭代解析的期限
+
+// 随DNS UDP socket一起交接的其他socket
+#define UPGRADE_SOCKET_TCP 0       // DNS over TCP的监听socket
+#define UPGRADE_SOCKET_PEER 1      // 集群缓存的对等socket
+#define UPGRADE_SOCKET_COUNT 2
+
+// 是否以热升级模式启动（从正在运行的旧进程接管socket与状态）
+extern int upgrade_mode;
+
+/**
+ * @brief 在127.0.0.1:UPGRADE_PORT上创建非阻塞的交接监听socket，等待新进程接管。
+ * 同时生成随机的交接密钥写入密钥文件，新进程须在握手中带上它，写不了密钥文件时不支持热升级。
+ * 端口被占用时记录日志，之后在事件循环中每秒重试一次，这期间程序照常运行但不支持热升级。
+ */
+void upgradeListen();
+
+/**
+ * @brief 返回交接监听socket，未启用时返回INVALID_SOCKET，供事件循环加入poll集合；端口暂时被占用时顺带重试监听。
+ */
+int upgradeListenSocket();
+
+/**
+ * @brief 旧进程在事件循环中调用：若有新进程连接，则完成socket、缓存与IDList的交接。
+ * 来自UDP客户端、经UDP转发的查询交给新进程；TCP客户端的和经上游TCP连接发出的查询留给旧进程处理完。
+ * @return 交接完成返回1（调用者应停止收取新查询，处理完手上的查询或到UPGRADE_DRAIN_TIMEOUT后退出），否则返回0
+ */
+int upgradePoll();
+
+/**
+ * @brief 新进程调用：读出旧进程的交接密钥，连接旧进程并获取其DNS socket的副本。
+ * @return 复制得到的socket，失败时直接退出程序
+ */
+int upgradeAcquireSocket();
+
+/**
+ * @brief 新进程调用：取出旧进程随DNS socket一起交接的TCP监听socket或对等socket，每种只能取一次。
+ * 这些端口以独占方式绑定，新进程无法在旧进程退出前重新绑定，只能接管。
+ *
+ * @param kind UPGRADE_SOCKET_TCP或UPGRADE_SOCKET_PEER
+ * @return 复制得到的socket；不是热升级启动或旧进程没有这个socket时返回INVALID_SOCKET
+ */
+int upgradeTakeSocket(int kind);
+
+/**
+ * @brief 新进程调用：接收旧进程发来的缓存内容和未完成的IDList条目。
+ * 必须在cacheInit()和initIdList()之后调用。交接来的socket到这时还没被取走的（配置中已关闭TCP或集群）一并关闭。
+ */
+void upgradeReceiveState();
@@ -0,0 +1,95 @@
+#pragma once
+#include "dns_struct.h"
+#include "output_level.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#define UPSTREAM_TCP_MAX_CONNECTIONS 32   // 到全部上游的TCP连接总数上限
+#define UPSTREAM_TCP_PER_SERVER 2         // 到同一个上游服务器的连接数上限，前一个连接的流水线满了才开新的
+#define UPSTREAM_TCP_PIPELINE 64          // 一个连接上同时在途的查询数上限
+#define UPSTREAM_TCP_MAX_SERVERS 64       // 记录重连退避状态的上游服务器数上限
+#define UPSTREAM_TCP_CONNECT_TIMEOUT 3000 // 建立连接的超时（毫秒），超时按连接失败处理
+#define UPSTREAM_TCP_QUERY_TIMEOUT 3000   // 在途查询等待应答的时间（毫秒），短于ID映射的过期时间，不会把迟到的应答交给复用了ID的新查询
+#define UPSTREAM_TCP_IDLE_TIMEOUT 60000   // 没有在途查询的连接保持这么多毫秒后关闭
+#define UPSTREAM_TCP_BACKOFF_MIN 1000     // 连接失败后第一次重连前等待的毫秒数，连续失败时加倍
+#define UPSTREAM_TCP_BACKOFF_MAX 30000    // 重连等待时间的上限（毫秒）
+
+extern int upstream_tcp_only;             // 由-t开启：转发的查询全部经TCP连接池发往上游
+
+/**
+ * @brief 经TCP连接池把查询发给上游服务器：优先复用到该服务器的已有连接，流水线都满时再开新连接；
+ * 连接尚未建立时查询先排队，建立后依次写出。应答按事务ID交给handleServerResponse()。
+ * 连接中断时，还没有应答的查询在新连接上重发一次，重发不了（如服务器进入重连退避）时改经UDP发出。
+ *
+ * @param server 上游服务器地址
+ * @param query 查询报文，事务ID是ID映射表的序号
+ * @param len 报文长度
+ * @return 已接手返回1；服务器在重连退避期内、连接数或流水线已满时返回0，由调用方改走UDP或放弃
+ */
+int upstreamTcpSend(const struct sockaddr_in* server, const uint8_t* query, int len);
+
+/**
+ * @brief 上游经UDP返回了TC置位的应答：按应答中的问题重新拼出查询（带本地的OPT，DO标志与客户端一致），
+ * 经TCP连接池发给同一个上游服务器，ID映射保留到TCP应答到达。
+ *
+ * @param id 应答的事务ID，即ID映射表的序号
+ * @param response 截断的应答
+ * @param len 应答长度
+ * @return 已改经TCP重发返回1；映射不是经UDP转发的、问题格式错误或连接池无法接手时返回0，由调用方照常转发截断的应答
+ */
+int upstreamRetryTruncated(uint16_t id, const uint8_t* response, int len);
+
+/**
+ * @brief 热升级交接时旧进程调用：TCP客户端的查询已经经UDP转发，应答会被接管了UDP socket的新进程收走，
+ * 按映射中的查询名和类型重新拼出查询，经TCP连接池再发一次，应答回到旧进程自己的连接上。
+ *
+ * @param id ID映射表的序号
+ * @return 已改经TCP重发返回1；映射已经经TCP发出、没有记录查询名或连接池无法接手时返回0
+ */
+int upstreamResendOverTcp(uint16_t id);
+
+/**
+ * @brief 转发的查询第一次超时：按映射中的查询名和类型重新拼出查询，
+ * 发给同组中另一个可用的服务器（见forwardRetry()），映射的过期时间从现在重新计算。
+ *
+ * @param id ID映射表的序号
+ * @return 已重发返回1；已经重发过、热升级前旧进程的查询、没有记录查询名或组内没有别的可用服务器时返回0
+ */
+int upstreamRetryTimedOut(uint16_t id);
+
+/**
+ * @brief 为事件循环填写要等待的上游TCP连接：正在建立或有待写数据时等待可写，已建立的等待可读。
+ *
+ * @param fds 输出的pollfd数组
+ * @param max fds的容量，至少UPSTREAM_TCP_MAX_CONNECTIONS
+ * @return 填写的项数
+ */
+int upstreamPollFds(struct pollfd* fds, int max);
+
+/**
+ * @brief 处理WSAPoll()返回的上游连接事件：完成连接，写出排队的查询，读取并分派应答。
+ *
+ * @param fds upstreamPollFds()填写、经WSAPoll()返回的数组
+ * @param count upstreamPollFds()的返回值
+ */
+void upstreamHandlePoll(const struct pollfd* fds, int count);
+
+/**
+ * @brief 非阻塞模式下在事件循环中调用：不等待地检查一次全部上游连接并处理事件。
+ */
+void upstreamService(void);
+
+/**
+ * @brief 在事件循环中定期调用：关闭建立超时和空闲超时的连接，丢弃等不到应答的在途查询。
+ */
+void upstreamTick(void);
+
+/**
+ * @brief 把上游TCP连接数和累计的发送、应答、重连计数写入调试日志。
+ */
+void logUpstreamStats(void);
+
+/**
+ * @brief 关闭全部上游连接，释放在途的查询。
+ */
+void closeUpstreamConnections(void);
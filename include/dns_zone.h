@@ -0,0 +1,48 @@
+#pragma once
+#include "dns_struct.h"
+#include "dns_convert.h"
+#include "output_level.h"
+
+#define ZONE_MAX_FILES 16          // -z最多可以指定的区文件数
+#define ZONE_RECORD_MAX 4096       // 一条记录（括号跨行时合并后）的最大长度
+#define ZONE_MAX_TOKENS 128        // 一条记录的最大字段数
+#define ZONE_RDATA_MAX 2048        // 一条记录数据部分的最大字节数
+#define ZONE_DEFAULT_TTL 3600      // 没有$TTL时记录的默认TTL（秒）
+#define ZONE_MAX_CNAME 8           // 区内CNAME链的最大跟随次数
+#define ZONE_MAX_NAMES 32          // 一个应答中参与名字压缩的名字数
+#define ZONE_REPLY_MAX DNS_STRING_MAX_SIZE  // 区应答的最大长度；实际上限由调用方按客户端的UDP载荷大小给出
+
+/**
+ * @brief 读取一个RFC 1035格式的区文件，编译为按名字索引的RRset，每条记录的类型、类、TTL和数据预先编码好。
+ *
+ * 支持$ORIGIN、$TTL、'@'、相对名字、省略所有者（沿用上一条）、括号跨行和';'注释，
+ * 记录类型支持SOA、NS、A、AAAA、CNAME、PTR、MX、TXT、SRV，TTL可带s/m/h/d/w单位。
+ * 每个文件是一个区，第一条记录必须是SOA，其所有者即区顶点；区外的记录、无法解析的记录被跳过并记录日志。
+ *
+ * @param path 区文件路径
+ * @return 成功加载的记录数；文件无法打开时返回-1，文件中没有有效SOA时返回0
+ */
+int loadZoneFile(const char* path);
+
+/**
+ * @brief 若查询落在某个本地区中，以权威身份直接拼出应答：命中的RRset放在回答部分，
+ * 区内的CNAME逐级跟随，NS/MX/SRV目标在本地区中的地址放在附加部分；
+ * 名字不存在返回NXDOMAIN、没有所查类型返回NODATA，两者都在授权部分附带区的SOA。
+ *
+ * @param query 原始查询报文
+ * @param question peekQuestion()解析出的问题
+ * @param reply 输出缓冲区，至少BUFFER_SIZE字节
+ * @param limit 应答的长度上限（不超过ZONE_REPLY_MAX），超出的记录被截去并置TC
+ * @return 应答报文长度；查询不在任何本地区中时返回0
+ */
+int zoneAnswer(const uint8_t* query, const dns_question_view* question, uint8_t* reply, int limit);
+
+/**
+ * @brief 已加载的区数量
+ */
+int zoneCount(void);
+
+/**
+ * @brief 释放全部区。
+ */
+void destroyZones(void);
@@ -0,0 +1,118 @@
+//本文件实现拦截应答：启动时按拦截方式预编码好应答中的资源记录，拦截时直接复制
+#include "dns_block.h"
+
+int block_mode = BLOCK_MODE_NXDOMAIN;
+uint32_t block_ttl = BLOCK_DEFAULT_TTL;
+
+// SOA的MNAME和RNAME："localhost."和"hostmaster.localhost."
+static const uint8_t soaNames[] = {
+    9, 'l', 'o', 'c', 'a', 'l', 'h', 'o', 's', 't', 0,
+    10, 'h', 'o', 's', 't', 'm', 'a', 's', 't', 'e', 'r', 9, 'l', 'o', 'c', 'a', 'l', 'h', 'o', 's', 't', 0
+};
+
+static uint8_t soaRecord[12 + sizeof(soaNames) + 20];   // 合成的SOA记录
+static uint8_t sinkholeA[12 + 4];                       // 0.0.0.0
+static uint8_t sinkholeAAAA[12 + 16];                   // ::
+
+static BlockResponse nxdomainResponse;   // NXDOMAIN+SOA
+static BlockResponse nodataReply;        // NOERROR，无回答，附带SOA
+static BlockResponse sinkholeAResponse;
+static BlockResponse sinkholeAAAAResponse;
+
+// --- 内部辅助函数 ---
+
+static uint8_t* writeUint16(uint8_t* ptr, uint16_t value) {
+    ptr[0] = (uint8_t)(value >> 8);
+    ptr[1] = (uint8_t)value;
+    return ptr + 2;
+}
+
+static uint8_t* writeUint32(uint8_t* ptr, uint32_t value) {
+    ptr = writeUint16(ptr, (uint16_t)(value >> 16));
+    return writeUint16(ptr, (uint16_t)value);
+}
+
+// 写入资源记录的固定部分：指向问题域名的压缩指针、类型、类、TTL和数据长度
+static uint8_t* writeRecordHeader(uint8_t* ptr, uint16_t type, uint32_t ttl, uint16_t rdLength) {
+    ptr = writeUint16(ptr, 0xC00C);
+    ptr = writeUint16(ptr, type);
+    ptr = writeUint16(ptr, DNS_CLASS_IN);
+    ptr = writeUint32(ptr, ttl);
+    return writeUint16(ptr, rdLength);
+}
+
+static void setResponse(BlockResponse* response, const uint8_t* records, int length,
+                        uint16_t ancount, uint16_t nscount, uint8_t rcode) {
+    response->records = records;
+    response->length = length;
+    response->ancount = ancount;
+    response->nscount = nscount;
+    response->rcode = rcode;
+}
+
+// --- 公开接口实现 ---
+
+void initBlockResponses(void) {
+    // 按RFC 2308，否定应答的缓存时间取SOA记录TTL与MINIMUM字段中较小的一个，两者都设为block_ttl
+    uint8_t* ptr = writeRecordHeader(soaRecord, DNS_TYPE_SOA, block_ttl, (uint16_t)(sizeof(soaNames) + 20));
+    memcpy(ptr, soaNames, sizeof(soaNames));
+    ptr += sizeof(soaNames);
+    ptr = writeUint32(ptr, BLOCK_SOA_SERIAL);
+    ptr = writeUint32(ptr, BLOCK_SOA_REFRESH);
+    ptr = writeUint32(ptr, BLOCK_SOA_RETRY);
+    ptr = writeUint32(ptr, BLOCK_SOA_EXPIRE);
+    writeUint32(ptr, block_ttl);
+
+    ptr = writeRecordHeader(sinkholeA, DNS_TYPE_A, block_ttl, 4);
+    memset(ptr, 0, 4);
+    ptr = writeRecordHeader(sinkholeAAAA, DNS_TYPE_AAAA, block_ttl, 16);
+    memset(ptr, 0, 16);
+
+    setResponse(&nxdomainResponse, soaRecord, sizeof(soaRecord), 0, 1, DNS_RCODE_NXDOMAIN);
+    setResponse(&nodataReply, soaRecord, sizeof(soaRecord), 0, 1, DNS_RCODE_OK);
+    setResponse(&sinkholeAResponse, sinkholeA, sizeof(sinkholeA), 1, 0, DNS_RCODE_OK);
+    setResponse(&sinkholeAAAAResponse, sinkholeAAAA, sizeof(sinkholeAAAA), 1, 0, DNS_RCODE_OK);
+}
+
+const BlockResponse* blockResponse(uint16_t qtype) {
+    if (block_mode != BLOCK_MODE_SINKHOLE) return &nxdomainResponse;
+
+    switch (qtype) {
+        case DNS_TYPE_A:
+            return &sinkholeAResponse;
+        case DNS_TYPE_AAAA:
+            return &sinkholeAAAAResponse;
+        default:
+            return &nodataReply; // 名字存在但没有该类型的记录
+    }
+}
+
+const BlockResponse* nodataResponse(void) {
+    return &nodataReply;
+}
+
+int localZoneResponse(int apexOffset, int exists, uint16_t qtype, uint8_t* records, BlockResponse* response) {
+    // 复制合成的SOA，把所有者名改为指向问题域名中区顶点的压缩指针
+    memcpy(records, soaRecord, sizeof(soaRecord));
+    writeUint16(records, (uint16_t)(0xC000 | (12 + apexOffset)));
+    if (apexOffset == 0 && qtype == DNS_TYPE_SOA) {
+        // 查询区顶点的SOA时把合成的SOA放在回答部分
+        setResponse(response, records, sizeof(soaRecord), 1, 0, DNS_RCODE_OK);
+    } else {
+        // 区顶点和区内已有的名字（包括空非终结点）存在，回复NODATA
+        int nodata = apexOffset == 0 || exists;
+        setResponse(response, records, sizeof(soaRecord), 0, 1, nodata ? DNS_RCODE_OK : DNS_RCODE_NXDOMAIN);
+    }
+    return (int)sizeof(soaRecord);
+}
+
+int parseBlockMode(const char* text) {
+    if (strcmp(text, "nx") == 0) {
+        block_mode = BLOCK_MODE_NXDOMAIN;
+    } else if (strcmp(text, "sinkhole") == 0) {
+        block_mode = BLOCK_MODE_SINKHOLE;
+    } else {
+        return 0;
+    }
+    return 1;
+}
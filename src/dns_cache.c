@@ -1,5 +1,8 @@
 #include "dns_cache.h"
+#include "dns_reverse.h"
+#include "dns_pool.h"
 #include "uthash.h"
+#include <ctype.h>
 
 // --- 静态全局变量，用于存储缓存状态 ---
 
@@ -9,17 +12,35 @@ static lruNode *g_head;    // 指向双向链表头部（最近使用的）
 static lruNode *g_tail;    // 指向双向链表尾部（最久未使用的）
 static hashNode **g_hash_table; // 哈希表本体
 
+int cname_flatten = 0;     // 默认返回完整的CNAME链
+
 
 // --- 内部辅助函数 ---
 
 // 使用uthash提供的高质量哈希函数
 // 默认使用Jenkins hash (HASH_JEN)，这是性能和分布都很好的哈希函数
+// 按小写形式计算，大小写不同的同一域名落在同一个桶中
 static unsigned long hashFunction(const char *str) {
+    char lower[MAX_DOMAIN_LEN];
+    unsigned len = 0;
+    while (str[len] && len < MAX_DOMAIN_LEN - 1) {
+        lower[len] = (char)tolower((unsigned char)str[len]);
+        len++;
+    }
     unsigned hashv;
-    HASH_JEN(str, strlen(str), hashv);
+    HASH_JEN(lower, len, hashv);
     return hashv;
 }
 
+// 域名比较不区分大小写（只比较节点能保存的长度），MSVC没有strcasecmp
+static int sameDomain(const char* stored, const char* domain) {
+    size_t i = 0;
+    for (; i < MAX_DOMAIN_LEN - 1 && stored[i]; i++) {
+        if (tolower((unsigned char)stored[i]) != tolower((unsigned char)domain[i])) return 0;
+    }
+    return stored[i] == '\0' && (i == MAX_DOMAIN_LEN - 1 || domain[i] == '\0');
+}
+
 // 检查指定的缓存节点是否已过期
 // 只要有一个IP地址未过期，该节点就被视为未过期
 int isExpired(lruNode* node) {
@@ -64,13 +85,13 @@ static void _addNodeToFront(lruNode* node) {
     }
 }
 
-// 从哈希表中移除一个条目
-static void _removeFromHashTable(const char* domain) {
-    unsigned long index = hashFunction(domain) % HASH_TABLE_SIZE;
+// 从哈希表中移除一个条目（同一域名可能有多种类型的条目，按节点指针匹配）
+static void _removeFromHashTable(lruNode* node) {
+    unsigned long index = hashFunction(node->domain) % HASH_TABLE_SIZE;
     hashNode* current = g_hash_table[index];
     hashNode* prev = NULL;
     while(current) {
-        if (strcmp(current->lru_node_ptr->domain, domain) == 0) {
+        if (current->lru_node_ptr == node) {
             if (prev) {
                 prev->next = current->next;
             } else {
@@ -84,6 +105,69 @@ static void _removeFromHashTable(const char* domain) {
     }
 }
 
+// 把节点从哈希表和链表中删除并释放
+static void _removeNode(lruNode* node) {
+    _removeFromHashTable(node);
+    _unlinkNode(node);
+    free(node);
+    g_size--;
+}
+
+// 查找域名和类型都匹配的节点
+static lruNode* _findNode(const char* domain, uint16_t type) {
+    unsigned long index = hashFunction(domain) % HASH_TABLE_SIZE;
+    for (hashNode* hash_node = g_hash_table[index]; hash_node; hash_node = hash_node->next) {
+        lruNode* lru_node = hash_node->lru_node_ptr;
+        if (lru_node->type == type && sameDomain(lru_node->domain, domain)) {
+            return lru_node;
+        }
+    }
+    return NULL;
+}
+
+// 取得域名和类型对应的节点并移到链表头部，没有则新建（缓存已满时先淘汰最久未使用的条目）
+// created输出是否为新建的节点；内存不足时返回NULL
+static lruNode* _obtainNode(const char* domain, uint16_t type, int* created) {
+    lruNode* lru_node = _findNode(domain, type);
+    if (lru_node) {
+        if (lru_node != g_head) {
+            _unlinkNode(lru_node);
+            _addNodeToFront(lru_node);
+        }
+        *created = 0;
+        return lru_node;
+    }
+
+    if (g_size >= g_capacity) {
+        _removeNode(g_tail);
+    }
+
+    lru_node = (lruNode*)malloc(sizeof(lruNode));
+    hashNode* new_hash_node = (hashNode*)malloc(sizeof(hashNode));
+    if (!lru_node || !new_hash_node) {
+        free(lru_node);
+        free(new_hash_node);
+        return NULL;
+    }
+    strncpy(lru_node->domain, domain, MAX_DOMAIN_LEN - 1);
+    lru_node->domain[MAX_DOMAIN_LEN - 1] = '\0';
+    lru_node->type = type;
+    lru_node->ip_count = 0;
+
+    // 插入到链表头部
+    _addNodeToFront(lru_node);
+
+    // 插入到哈希表
+    unsigned long index = hashFunction(domain) % HASH_TABLE_SIZE;
+    new_hash_node->lru_node_ptr = lru_node;
+    new_hash_node->next = g_hash_table[index]; // 插入到哈希桶链表的头部
+    g_hash_table[index] = new_hash_node;
+
+    g_size++;
+    *created = 1;
+    return lru_node;
+}
+
 // --- 公开接口实现 ---
 // 初始化
 void cacheInit() {
@@ -103,47 +187,35 @@ void cacheInit() {
 int cacheGet(uint8_t ipv4s[][4], uint8_t* ip_count, char* domain) {
     if (!g_hash_table) return 0; // 未初始化
 
-    unsigned long index = hashFunction(domain) % HASH_TABLE_SIZE;
-    hashNode* hash_node = g_hash_table[index];
-    
-    while(hash_node) {
-        if (strcmp(hash_node->lru_node_ptr->domain, domain) == 0) { // 命中
-            lruNode* lru_node = hash_node->lru_node_ptr;
-            
-            // 检查所有IP是否全部过期
-            if (isExpired(lru_node)) {
-                // 所有TTL已过期，从缓存中删除该条目
-                log_message(LOG_DEBUG,"Cache entry for domain '%s' has all IPs expired", domain);
-                _removeFromHashTable(domain);
-                _unlinkNode(lru_node);
-                free(lru_node);
-                g_size--;
-                return 0; // 返回0表示未命中（已过期）
-            }
-            
-            // 至少有一个IP未过期，返回未过期的IP地址
-            time_t current_time = time(NULL);
-            *ip_count = 0;
-            
-            for (int i = 0; i < lru_node->ip_count; i++) {
-                // 只返回未过期的IP地址
-                if ((current_time - lru_node->insert_time) < lru_node->ttls[i]) {
-                    memcpy(ipv4s[*ip_count], lru_node->IPs[i], 4);
-                    (*ip_count)++;
-                }
-            }
+    lruNode* lru_node = _findNode(domain, DNS_TYPE_A);
+    if (!lru_node) return 0; // 返回0表示未命中
 
-            // LRU核心：将命中节点移动到链表头部
-            if (lru_node != g_head) { // 如果不是头部节点才需要移动
-                _unlinkNode(lru_node);
-                _addNodeToFront(lru_node);
-            }
-            return 1; // 返回1表示命中
-        }
-        hash_node = hash_node->next;
+    // 检查所有IP是否全部过期
+    if (isExpired(lru_node)) {
+        // 所有TTL已过期，从缓存中删除该条目
+        log_message(LOG_DEBUG,"Cache entry for domain '%s' has all IPs expired", domain);
+        _removeNode(lru_node);
+        return 0; // 返回0表示未命中（已过期）
     }
     
-    return 0; // 返回0表示未命中
+    // 至少有一个IP未过期，返回未过期的IP地址
+    time_t current_time = time(NULL);
+    *ip_count = 0;
+    
+    for (int i = 0; i < lru_node->ip_count; i++) {
+        // 只返回未过期的IP地址
+        if ((current_time - lru_node->insert_time) < lru_node->ttls[i]) {
+            memcpy(ipv4s[*ip_count], lru_node->IPs[i], 4);
+            (*ip_count)++;
+        }
+    }
+
+    // LRU核心：将命中节点移动到链表头部
+    if (lru_node != g_head) { // 如果不是头部节点才需要移动
+        _unlinkNode(lru_node);
+        _addNodeToFront(lru_node);
+    }
+    return 1; // 返回1表示命中
 }
 
 // 插入操作 - 支持多个IP地址和TTL插入
@@ -156,68 +228,356 @@ void cachePut(uint8_t ipv4s[][4], const uint32_t ttls[], uint8_t ip_count, char*
         ip_count = MAX_IP_COUNT;
         log_message(LOG_DEBUG, "Warning: IP count exceeds maximum limit, truncated to %d", MAX_IP_COUNT);
     }
-	
-    unsigned long index = hashFunction(domain) % HASH_TABLE_SIZE;
-    hashNode* hash_node = g_hash_table[index];
-
-    // 1. 检查域名是否已存在于缓存中
-    while(hash_node) {
-        if (strcmp(hash_node->lru_node_ptr->domain, domain) == 0) {
-            // 已存在：更新IP值、IP数量、每个IP的TTL和时间戳，并移动到链表头部
-            lruNode* lru_node = hash_node->lru_node_ptr;
-            lru_node->ip_count = ip_count;
-            for (int i = 0; i < ip_count; i++) {
-                memcpy(lru_node->IPs[i], ipv4s[i], 4);
-                lru_node->ttls[i] = ttls ? ttls[i] : default_ttl;  // 为每个IP设置TTL
+
+    // 已存在的条目更新IP值、IP数量、每个IP的TTL和时间戳，并移动到链表头部；否则新建条目
+    int created;
+    lruNode* lru_node = _obtainNode(domain, DNS_TYPE_A, &created);
+    if (!lru_node) return;
+
+    lru_node->ip_count = ip_count;
+    for (int i = 0; i < ip_count; i++) {
+        memcpy(lru_node->IPs[i], ipv4s[i], 4);
+        lru_node->ttls[i] = ttls ? ttls[i] : default_ttl;  // 为每个IP设置TTL
+    }
+    lru_node->insert_time = time(NULL);
+
+    log_message(LOG_DEBUG, created ? "Added new cache entry for domain '%s' with %d IPs"
+                                   : "Updated cache entry for domain '%s' with %d IPs",
+               domain, ip_count);
+}
+
+// 查询某种类型的记录，返回未过期的记录及其剩余TTL
+int cacheGetRecords(const char* domain, uint16_t type, uint8_t* rdata, uint16_t rdlens[], uint32_t ttls[]) {
+    if (!g_hash_table) return 0;
+
+    lruNode* lru_node = _findNode(domain, type);
+    if (!lru_node) return 0;
+    if (isExpired(lru_node)) {
+        log_message(LOG_DEBUG, "Cache entry for domain '%s' type %d has expired", domain, type);
+        _removeNode(lru_node);
+        return 0;
+    }
+
+    uint32_t age = (uint32_t)(time(NULL) - lru_node->insert_time);
+    int count = 0;
+    size_t in = 0;
+    size_t out = 0;
+    for (int i = 0; i < lru_node->ip_count; i++) {
+        uint16_t len = type == DNS_TYPE_A ? 4 : lru_node->rdlens[i];
+        if (age < lru_node->ttls[i]) {
+            memcpy(rdata + out, type == DNS_TYPE_A ? lru_node->IPs[i] : lru_node->rdata + in, len);
+            rdlens[count] = len;
+            ttls[count] = lru_node->ttls[i] - age;
+            out += len;
+            count++;
+        }
+        in += len;
+    }
+
+    if (lru_node != g_head) {
+        _unlinkNode(lru_node);
+        _addNodeToFront(lru_node);
+    }
+    return count;
+}
+
+// 插入A以外类型的一组记录，替换已有的同名同类型条目
+void cachePutRecords(const char* domain, uint16_t type, const uint8_t* rdata, const uint16_t rdlens[],
+                     const uint32_t ttls[], uint8_t count) {
+    if (!g_hash_table || count == 0) return;
+
+    int created;
+    lruNode* lru_node = _obtainNode(domain, type, &created);
+    if (!lru_node) return;
+
+    size_t used = 0;
+    uint8_t kept = 0;
+    for (int i = 0; i < count && kept < MAX_IP_COUNT; i++) {
+        if (used + rdlens[i] > CACHE_RDATA_MAX) break;
+        memcpy(lru_node->rdata + used, rdata + used, rdlens[i]);
+        lru_node->rdlens[kept] = rdlens[i];
+        lru_node->ttls[kept] = ttls[i];
+        used += rdlens[i];
+        kept++;
+    }
+    lru_node->ip_count = kept;
+    lru_node->insert_time = time(NULL);
+
+    log_message(LOG_DEBUG, "%s cache entry for domain '%s' type %d with %d records",
+                created ? "Added new" : "Updated", domain, type, kept);
+}
+
+// --- 上游应答的收录与缓存应答 ---
+
+// 两个域名相同（不区分大小写）
+static int namesEqual(const char* a, const char* b) {
+    while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+        a++;
+        b++;
+    }
+    return *a == '\0' && *b == '\0';
+}
+
+// name等于zone或是zone的子域名（不区分大小写）
+static int inZone(const char* name, const char* zone) {
+    size_t n = strlen(name);
+    size_t z = strlen(zone);
+    if (z == 0) return 1;
+    if (n < z || (n > z && name[n - z - 1] != '.')) return 0;
+    return namesEqual(name + n - z, zone);
+}
+
+// 名字至少有两个标签，即不是根也不是顶级域
+static int belowTopLevel(const char* name) {
+    size_t n = strlen(name);
+    if (n > 0 && name[n - 1] == '.') n--;
+    return memchr(name, '.', n) != NULL;
+}
+
+// 把解析出的记录还原为不压缩的RDATA，不支持的类型返回0
+static int encodeRdata(const dns_rr* rr, uint8_t* out) {
+    switch (rr->type) {
+        case DNS_TYPE_AAAA:
+            if (rr->rdLength != 16) return 0;
+            memcpy(out, rr->rdata.AAAA_record.address, 16);
+            return 16;
+        case DNS_TYPE_NS:
+            return (int)wireName(rr->rdata.NS_record.nsdname, strlen(rr->rdata.NS_record.nsdname), out);
+        case DNS_TYPE_CNAME:
+            return (int)wireName(rr->rdata.CNAME_record.cname, strlen(rr->rdata.CNAME_record.cname), out);
+        case DNS_TYPE_PTR:
+            return (int)wireName(rr->rdata.PTR_record.ptrdname, strlen(rr->rdata.PTR_record.ptrdname), out);
+        case DNS_TYPE_MX: {
+            size_t len = wireName(rr->rdata.MX_record.exchange, strlen(rr->rdata.MX_record.exchange), out + 2);
+            if (len == 0) return 0;
+            out[0] = (uint8_t)(rr->rdata.MX_record.preference >> 8);
+            out[1] = (uint8_t)rr->rdata.MX_record.preference;
+            return (int)len + 2;
+        }
+        case DNS_TYPE_TXT:
+            if (rr->rdLength == 0 || rr->rdLength > CACHE_RDATA_MAX) return 0;
+            memcpy(out, rr->rdata.TXT_record.txt_data, rr->rdLength);
+            return rr->rdLength;
+        default:
+            return 0;
+    }
+}
+
+// name是否为某条已收录的NS记录所指的服务器，且在该NS所属的区之内
+static int isInBailiwickGlue(const char* name, dns_rr* const accepted[], int count) {
+    for (int i = 0; i < count; i++) {
+        const dns_rr* rr = accepted[i];
+        if (rr->type == DNS_TYPE_NS && namesEqual(rr->rdata.NS_record.nsdname, name) && inZone(name, rr->name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 把收录的记录按（名字，类型）分组写入缓存
+static void storeRRsets(dns_rr* const accepted[], int count) {
+    int stored[CACHE_HARVEST_MAX] = { 0 };
+    for (int i = 0; i < count; i++) {
+        if (stored[i]) continue;
+        const dns_rr* first = accepted[i];
+
+        uint8_t ips[MAX_IP_COUNT][4];
+        uint8_t rdata[CACHE_RDATA_MAX];
+        uint16_t rdlens[MAX_IP_COUNT];
+        uint32_t ttls[MAX_IP_COUNT];
+        uint8_t n = 0;
+        size_t used = 0;
+        int complete = 1;
+        for (int j = i; j < count; j++) {
+            const dns_rr* rr = accepted[j];
+            if (stored[j] || rr->type != first->type || !namesEqual(rr->name, first->name)) continue;
+            stored[j] = 1;
+            if (rr->ttl == 0) continue;
+            if (n == MAX_IP_COUNT) {
+                complete = 0;
+                continue;
             }
-            lru_node->insert_time = time(NULL);
-            if (lru_node != g_head) {
-                _unlinkNode(lru_node);
-                _addNodeToFront(lru_node);
+
+            if (rr->type == DNS_TYPE_A) {
+                memcpy(ips[n], rr->rdata.A_record.address, 4);
+            } else {
+                uint8_t encoded[CACHE_RDATA_MAX];
+                int len = encodeRdata(rr, encoded);
+                if (len <= 0 || used + len > CACHE_RDATA_MAX) {
+                    complete = 0;
+                    continue;
+                }
+                memcpy(rdata + used, encoded, len);
+                rdlens[n] = (uint16_t)len;
+                used += len;
             }
-            log_message(LOG_DEBUG,"Updated cache entry for domain '%s' with %d IPs", 
-                       domain, ip_count);
-            return;
+            ttls[n++] = rr->ttl;
+        }
+        if (n == 0) continue;
+        // 放不下整个RRset时不缓存，免得缓存命中时只回答其中一部分（例如大的TXT集合或超过MAX_IP_COUNT个地址的A记录），
+        // 这样的名字每次都转发，客户端得到上游的完整应答或TC
+        if (!complete) continue;
+
+        if (first->type == DNS_TYPE_A) {
+            cachePut(ips, ttls, n, first->name, 0);
+        } else {
+            cachePutRecords(first->name, first->type, rdata, rdlens, ttls, n);
         }
-        hash_node = hash_node->next;
     }
+}
 
-    // 2. 是新条目，需要插入
-    // 如果缓存已满，先淘汰最久未使用的条目（尾部节点）
-    if (g_size >= g_capacity) {
-        lruNode* tail_node = g_tail;
-        _removeFromHashTable(tail_node->domain);
-        _unlinkNode(tail_node);
-        free(tail_node);
-        g_size--;
+void cacheHarvest(const dns_Message* msg) {
+    if (!g_hash_table || !msg || !msg->header || !msg->question) return;
+    if (msg->header->RCODE != DNS_RCODE_OK || msg->header->TC) return;
+    const char* qname = msg->question->QNAME;
+
+    // 从查询名出发沿回答部分中的CNAME链可达的名字
+    const char* chain[CACHE_MAX_CHAIN + 1];
+    int chain_len = 1;
+    chain[0] = qname;
+    for (int hop = 0; hop < CACHE_MAX_CHAIN; hop++) {
+        const dns_rr* next = NULL;
+        for (const dns_rr* rr = msg->answer; rr && !next; rr = rr->next) {
+            if (rr->type == DNS_TYPE_CNAME && namesEqual(rr->name, chain[chain_len - 1])) next = rr;
+        }
+        if (!next) break;
+        chain[chain_len++] = next->rdata.CNAME_record.cname;
     }
 
-    // 3. 创建新的双向链表节点和哈希节点
-    lruNode* new_lru_node = (lruNode*)malloc(sizeof(lruNode));
-    strncpy(new_lru_node->domain, domain, MAX_DOMAIN_LEN -1);
-    new_lru_node->domain[MAX_DOMAIN_LEN - 1] = '\0';
-    
-    // 复制所有的IP地址和TTL
-    new_lru_node->ip_count = ip_count;
-    for (int i = 0; i < ip_count; i++) {
-        memcpy(new_lru_node->IPs[i], ipv4s[i], 4);
-        new_lru_node->ttls[i] = ttls ? ttls[i] : default_ttl;  // 为每个IP设置TTL
+    dns_rr* accepted[CACHE_HARVEST_MAX];
+    int count = 0;
+
+    // 回答部分：名字在CNAME链上的记录
+    for (dns_rr* rr = msg->answer; rr && count < CACHE_HARVEST_MAX; rr = rr->next) {
+        if (rr->rrClass != DNS_CLASS_IN) continue;
+        for (int i = 0; i < chain_len; i++) {
+            if (namesEqual(rr->name, chain[i])) {
+                accepted[count++] = rr;
+                break;
+            }
+        }
+    }
+    // 授权部分：只收查询名自己所在的区（包含查询名的最深的区）的NS记录。根和顶级域的NS不收，
+    // 否则一个应答就能替换整个顶级域的委派
+    const char* zone = NULL;
+    for (const dns_rr* rr = msg->authority; rr; rr = rr->next) {
+        if (rr->rrClass == DNS_CLASS_IN && rr->type == DNS_TYPE_NS && belowTopLevel(rr->name) &&
+            inZone(qname, rr->name) && (!zone || strlen(rr->name) > strlen(zone))) {
+            zone = rr->name;
+        }
+    }
+    for (dns_rr* rr = msg->authority; zone && rr && count < CACHE_HARVEST_MAX; rr = rr->next) {
+        if (rr->rrClass == DNS_CLASS_IN && rr->type == DNS_TYPE_NS && namesEqual(rr->name, zone)) {
+            accepted[count++] = rr;
+        }
+    }
+    // 附加部分：上面这些NS所指、且名字在该区之内的粘附地址
+    int before_glue = count;
+    for (dns_rr* rr = msg->additional; rr && count < CACHE_HARVEST_MAX; rr = rr->next) {
+        if (rr->rrClass == DNS_CLASS_IN && (rr->type == DNS_TYPE_A || rr->type == DNS_TYPE_AAAA) &&
+            isInBailiwickGlue(rr->name, accepted, before_glue)) {
+            accepted[count++] = rr;
+        }
     }
-    
-    new_lru_node->insert_time = time(NULL);
 
-    // 插入到链表头部
-    _addNodeToFront(new_lru_node);
+    // 解析得到的各部分链表与报文顺序相反，倒过来按原顺序写入
+    for (int i = 0; i < count / 2; i++) {
+        dns_rr* tmp = accepted[i];
+        accepted[i] = accepted[count - 1 - i];
+        accepted[count - 1 - i] = tmp;
+    }
+    storeRRsets(accepted, count);
+}
 
-    // 插入到哈希表
-    hashNode* new_hash_node = (hashNode*)malloc(sizeof(hashNode));
-    new_hash_node->lru_node_ptr = new_lru_node;
-    new_hash_node->next = g_hash_table[index]; // 插入到哈希桶链表的头部
-    g_hash_table[index] = new_hash_node;
+// 追加一条记录，owner是名字在应答中的偏移（压缩指针）；应答超过limit时返回0
+static int appendCached(uint8_t* records, int* length, int header_len, int limit, int owner, uint16_t type,
+                        uint32_t ttl, const uint8_t* rdata, uint16_t rdlen) {
+    if (header_len + *length + 12 + rdlen > limit) return 0;
+    uint8_t* ptr = records + *length;
+    writeBits(&ptr, 16, 0xC000 | owner);
+    writeBits(&ptr, 16, type);
+    writeBits(&ptr, 16, DNS_CLASS_IN);
+    writeBits(&ptr, 32, (int)ttl);
+    writeBits(&ptr, 16, rdlen);
+    memcpy(ptr, rdata, rdlen);
+    *length += 12 + rdlen;
+    return 1;
+}
 
-    g_size++;
-    log_message(LOG_DEBUG ,"Added new cache entry for domain '%s' with %d IPs", 
-               domain, ip_count);
+// 把不压缩的线格式域名转为点分形式
+static void wireToText(const uint8_t* wire, char* text) {
+    size_t len = 0;
+    while (*wire) {
+        if (len > 0) text[len++] = '.';
+        memcpy(text + len, wire + 1, *wire);
+        len += *wire;
+        wire += *wire + 1;
+    }
+    text[len] = '\0';
+}
+
+// 由缓存拼出应答，records是拼记录用的临时缓冲区，至少DNS_STRING_MAX_SIZE字节
+static int composeCachedAnswer(const uint8_t* query, const dns_question_view* question, uint8_t* reply, int limit,
+                               uint8_t* records) {
+    uint8_t rdata[CACHE_RDATA_MAX];
+    uint16_t rdlens[MAX_IP_COUNT];
+    uint32_t ttls[MAX_IP_COUNT];
+    int length = 0;
+    uint16_t ancount = 0;
+    if (limit > DNS_STRING_MAX_SIZE) limit = DNS_STRING_MAX_SIZE;
+
+    // 当前名字在应答中的位置：先是问题域名，之后是上一条CNAME的RDATA
+    char name[DNS_RR_NAME_MAX_SIZE + 1];
+    strcpy(name, question->QNAME);
+    int owner = 12;
+    uint32_t chain_ttl = UINT32_MAX;
+    int links = 0;
+
+    int count;
+    while ((count = cacheGetRecords(name, question->QTYPE, rdata, rdlens, ttls)) == 0) {
+        if (question->QTYPE == DNS_TYPE_CNAME || links == CACHE_MAX_CHAIN) return 0;
+        if (cacheGetRecords(name, DNS_TYPE_CNAME, rdata, rdlens, ttls) == 0) return 0;
+
+        if (ttls[0] < chain_ttl) chain_ttl = ttls[0];
+        if (!cname_flatten) {
+            int rdata_at = question->end + length + 12;
+            if (!appendCached(records, &length, question->end, limit, owner, DNS_TYPE_CNAME, ttls[0],
+                              rdata, rdlens[0])) {
+                return 0;
+            }
+            ancount++;
+            owner = rdata_at;
+        }
+        wireToText(rdata, name);
+        links++;
+    }
+
+    size_t offset = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t ttl = ttls[i] < chain_ttl ? ttls[i] : chain_ttl; // 扁平化时owner仍是问题域名
+        if (!appendCached(records, &length, question->end, limit, owner, question->QTYPE,
+                          cname_flatten ? ttl : ttls[i], rdata + offset, rdlens[i])) {
+            return 0;
+        }
+        offset += rdlens[i];
+        ancount++;
+    }
+
+    int len = composeReply(query, question, DNS_RCODE_OK, records, length, ancount, 0, 0, reply);
+    reply[2] &= (uint8_t)~(AA_MASK >> 8); // 缓存的记录不是本地的权威数据
+    if (links > 0) {
+        log_message(LOG_DEBUG, "Cache rebuilt %d CNAME links for [Domain: %s]%s", links, question->QNAME,
+                    cname_flatten ? ", flattened" : "");
+    }
+    return len;
+}
+
+int cacheAnswer(const uint8_t* query, const dns_question_view* question, uint8_t* reply, int limit) {
+    uint8_t* records = poolAcquire();
+    if (!records) return 0;
+    int len = composeCachedAnswer(query, question, reply, limit, records);
+    poolRelease(records);
+    return len;
 }
 
 // 检查并清理所有过期的缓存条目
@@ -232,10 +592,7 @@ int cacheCleanExpired() {
         
         if (isExpired(current)) {
             log_message(LOG_DEBUG ,"Cleaning expired cache entry for domain '%s'", current->domain);
-            _removeFromHashTable(current->domain);
-            _unlinkNode(current);
-            free(current);
-            g_size--;
+            _removeNode(current);
             expired_count++;
         }
         
@@ -248,3 +605,15 @@ int cacheCleanExpired() {
     
     return expired_count;
 }
+
+// 从尾部（最久未使用）向头部遍历所有缓存条目
+void cacheForEach(void (*visit)(lruNode* node, void* ctx), void* ctx) {
+    if (!g_hash_table || !visit) return;
+
+    lruNode* current = g_tail;
+    while (current) {
+        lruNode* prev = current->prev; // 先保存前驱节点
+        visit(current, ctx);
+        current = prev;
+    }
+}
@@ -1,8 +1,25 @@
 #include "dns_config.h"
+#include "dns_upgrade.h"
+#include "dns_hosts.h"
+#include "dns_reload.h"
+#include "dns_pattern.h"
+#include "dns_block.h"
+#include "dns_reverse.h"
+#include "dns_zone.h"
+#include "dns_forward.h"
+#include "dns_recursor.h"
+#include "dns_cache.h"
+#include "dns_failure.h"
+#include "dns_edns.h"
+#include "dns_pool.h"
+#include "dns_tcp.h"
+#include "dns_upstream.h"
+#include "dns_peer.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <ctype.h>
 
 // 默认配置值
 static char* DEFAULT_HOST_PATH = "./hosts.txt";
@@ -13,6 +30,14 @@ static char* DEFAULT_DNS_SERVER = "10.3.9.5";
 char* host_path = NULL;
 char* LOG_PATH = NULL;
 char* dnsServerAddress = NULL;
+char* image_path = NULL;  // 非空时把hosts文件编译为二进制镜像后退出
+char* pattern_path = NULL;  // 模式规则文件路径，为空时不启用
+char* forward_path = NULL;  // 条件转发规则文件路径，为空时全部查询发往-s指定的上游
+char* root_hints_path = NULL;  // 根提示文件路径，为空时使用内置的根服务器地址
+char* listen_address = NULL;  // DNS端口监听的地址，为空时监听全部地址
+char* peer_members = NULL;  // 集群节点列表（本节点在前），为空时不与兄弟节点共享缓存
+char* zone_paths[ZONE_MAX_FILES];  // 本地权威区文件，由-z逐个指定
+int zone_path_count = 0;
 int log_mode = 0;      // 默认不开启日志记录
 u_long socketMode = 0;    // 默认非阻塞模式
 
@@ -42,9 +67,25 @@ void printHelpInfo() {
     printf("|   -l                         日志记录                                        |\n");
     printf("|   -d                         查看收发信息                                    |\n");
     printf("|   -dd                        开启调试模式                                    |\n");
-    printf("|   -s [server_address]        设置远程DNS服务器地址                           |\n");
+    printf("|   -s [server_address]        设置远程DNS服务器地址，多个以','分隔            |\n");
     printf("|   -m [mode]                  设置程序的运行模式:0/1  非阻塞/阻塞             |\n");
     printf("|   -p [path]                  设置hosts文件路径                               |\n");
+    printf("|   -u                         热升级：从正在运行的实例接管socket和缓存        |\n");
+    printf("|   -c [image_path]            将hosts文件编译为二进制镜像后退出               |\n");
+    printf("|   -x [path]                  设置通配符/正则拦截规则文件路径                 |\n");
+    printf("|   -b [nx|sinkhole]           拦截方式：NXDOMAIN+SOA 或 返回0.0.0.0/::        |\n");
+    printf("|   -n [ttl]                   拦截应答的TTL（秒），客户端据此缓存，默认300    |\n");
+    printf("|   -r                         私有地址的反向查询转发上游（默认本地NXDOMAIN）  |\n");
+    printf("|   -z [path]                  加载权威区文件，可多次指定                      |\n");
+    printf("|   -f [path]                  条件转发规则文件：按域名后缀选择上游组          |\n");
+    printf("|   -R                         递归模式：未命中的查询从根开始迭代解析          |\n");
+    printf("|   -H [path]                  递归模式使用的根提示文件（named.root格式）      |\n");
+    printf("|   -F                         CNAME扁平化：缓存命中时直接回答最终地址         |\n");
+    printf("|   -e [size]                  EDNS通告的UDP载荷大小（512~4096），默认1232     |\n");
+    printf("|   -t                         转发的查询全部经TCP长连接发往上游               |\n");
+    printf("|   -g [rtt|hash]              组内选上游：RTT最小 或 按查询名一致性哈希       |\n");
+    printf("|   -a [address]               只在指定地址上监听DNS端口（默认全部地址）       |\n");
+    printf("|   -P [self,peer,...]         集群缓存：本节点和兄弟节点的对等地址，','分隔   |\n");
     printf("+------------------------------------------------------------------------------+\n");
 }
 
@@ -63,6 +104,12 @@ void configInit(int argc, char* argv[]) {
     // 获取程序运行参数
     getConfig(argc, argv);
 
+    // 离线编译模式：只构建hosts表并写出镜像，不启动服务
+    if (image_path) {
+        compileHost();
+        exit(EXIT_SUCCESS);
+    }
+
     // 打印调试信息
     printf("配置初始化完成:\n");
     if(argc>=2) set_log_level(argv[1]);
@@ -71,13 +118,44 @@ void configInit(int argc, char* argv[]) {
     printf("  - DNS server: %s\n", dnsServerAddress);
     printf("  - Socket mode: %s\n", socketMode == 0 ? "非阻塞" : "阻塞");
     printf("  - Log mode: %s\n", log_mode ? "开启" : "关闭");
+    printf("  - Hot upgrade: %s\n", upgrade_mode ? "接管运行中的实例" : "关闭");
+    printf("  - Pattern rules: %s\n", pattern_path ? pattern_path : "关闭");
+    printf("  - Block mode: %s, TTL %u\n", block_mode == BLOCK_MODE_SINKHOLE ? "sinkhole" : "NXDOMAIN+SOA",
+           (unsigned)block_ttl);
+    printf("  - Zone files: %d\n", zone_path_count);
+    printf("  - Forward rules: %s\n", forward_path ? forward_path : "关闭");
+    printf("  - Recursion: %s\n", !recursion_mode ? "关闭（转发上游）" :
+           root_hints_path ? root_hints_path : "内置根提示");
+    printf("  - Private reverse zones: %s\n", private_reverse ? "本地NXDOMAIN" : "转发上游");
+    printf("  - CNAME flattening: %s\n", cname_flatten ? "开启" : "关闭（返回完整的CNAME链）");
+    printf("  - EDNS UDP payload: %u\n", (unsigned)edns_udp_size);
+    printf("  - Upstream selection: %s\n", forward_select_mode == FORWARD_SELECT_HASH ? "按查询名一致性哈希" : "平滑RTT最小");
+    printf("  - Upstream transport: %s\n", upstream_tcp_only ? "TCP长连接" : "UDP，截断的应答改经TCP重试");
+    printf("  - Listen address: %s\n", listen_address ? listen_address : "全部地址");
+    printf("  - Cache peering: %s\n", peer_members ? peer_members : "关闭");
 
     // 初始化各子系统
+    initBlockResponses();
+    initBufferPool();
     initSocket();
     initDnsResolver();
     cacheInit();
     initIdList();
+    // 热升级时旧进程在新进程连上来之前一直照常服务，先加载完全部表，缩短两个进程都不收包的间隙
     readHost();
+    readPatterns();
+    readZones();
+    readForwards();
+    readRootHints();
+    openDnsSocket();
+    initTcpListener();
+    if (peer_members && !initPeering(peer_members)) {
+        fprintf(stderr, "无效的集群节点列表或对等端口无法绑定: %s\n", peer_members);
+        exit(EXIT_FAILURE);
+    }
+    upgradeReceiveState();
+    startHostReload(host_path);
+    upgradeListen();
 
 
     switch (socketMode) {
@@ -114,6 +192,9 @@ void getConfig(int argc, char* argv[]) {
         else if (strcmp(argv[index], "-m") == 0 && index + 1 < argc) {
             // 设置程序的运行模式
             socketMode = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "-u") == 0) {
+            upgrade_mode = 1;    // 热升级模式
         }else if(strcmp(argv[index], "-p") == 0 && index + 1 < argc){
             free(host_path);
             host_path = strdup(argv[++index]);
@@ -121,84 +202,198 @@ void getConfig(int argc, char* argv[]) {
                 log_message(ERROR, "路径地址内存分配失败\n");
                 exit(EXIT_FAILURE);
             }
+        }else if(strcmp(argv[index], "-x") == 0 && index + 1 < argc){
+            free(pattern_path);
+            pattern_path = strdup(argv[++index]);
+            if (!pattern_path) {
+                log_message(ERROR, "路径地址内存分配失败\n");
+                exit(EXIT_FAILURE);
+            }
+        }else if(strcmp(argv[index], "-b") == 0 && index + 1 < argc){
+            if (!parseBlockMode(argv[++index])) {
+                fprintf(stderr, "无效的拦截方式: %s（可选nx或sinkhole）\n", argv[index]);
+                exit(EXIT_FAILURE);
+            }
+        }else if(strcmp(argv[index], "-n") == 0 && index + 1 < argc){
+            char* end = NULL;
+            const char* value = argv[++index];
+            unsigned long ttl = strtoul(value, &end, 10);
+            if (end == value || *end != '\0' || value[0] == '-' || ttl > BLOCK_MAX_TTL) {
+                fprintf(stderr, "无效的拦截应答TTL: %s（0~%u）\n", value, BLOCK_MAX_TTL);
+                exit(EXIT_FAILURE);
+            }
+            block_ttl = (uint32_t)ttl;
+        }else if(strcmp(argv[index], "-z") == 0 && index + 1 < argc){
+            if (zone_path_count >= ZONE_MAX_FILES) {
+                fprintf(stderr, "区文件过多，最多%d个\n", ZONE_MAX_FILES);
+                exit(EXIT_FAILURE);
+            }
+            zone_paths[zone_path_count] = strdup(argv[++index]);
+            if (!zone_paths[zone_path_count]) {
+                log_message(ERROR, "路径地址内存分配失败\n");
+                exit(EXIT_FAILURE);
+            }
+            zone_path_count++;
+        }else if(strcmp(argv[index], "-f") == 0 && index + 1 < argc){
+            free(forward_path);
+            forward_path = strdup(argv[++index]);
+            if (!forward_path) {
+                log_message(ERROR, "路径地址内存分配失败\n");
+                exit(EXIT_FAILURE);
+            }
+        }else if(strcmp(argv[index], "-R") == 0){
+            recursion_mode = 1;    // 未命中的查询由内置解析器迭代解析
+        }else if(strcmp(argv[index], "-H") == 0 && index + 1 < argc){
+            free(root_hints_path);
+            root_hints_path = strdup(argv[++index]);
+            if (!root_hints_path) {
+                log_message(ERROR, "路径地址内存分配失败\n");
+                exit(EXIT_FAILURE);
+            }
+            recursion_mode = 1;
+        }else if(strcmp(argv[index], "-F") == 0){
+            cname_flatten = 1;    // 缓存命中CNAME链时直接回答最终地址
+        }else if(strcmp(argv[index], "-e") == 0 && index + 1 < argc){
+            char* end = NULL;
+            const char* value = argv[++index];
+            unsigned long size = strtoul(value, &end, 10);
+            // 只接受纯数字：strtoul会跳过前导空白、接受正负号，"1232abc"也会读出1232
+            if (!isdigit((unsigned char)value[0]) || *end != '\0' || size < EDNS_PLAIN_UDP_SIZE ||
+                size > DNS_STRING_MAX_SIZE) {
+                fprintf(stderr, "无效的EDNS载荷大小: %s（%d~%d）\n", value, EDNS_PLAIN_UDP_SIZE, DNS_STRING_MAX_SIZE);
+                exit(EXIT_FAILURE);
+            }
+            edns_udp_size = (uint16_t)size;
+        }else if(strcmp(argv[index], "-g") == 0 && index + 1 < argc){
+            index++;
+            if (strcmp(argv[index], "rtt") == 0) {
+                forward_select_mode = FORWARD_SELECT_RTT;
+            } else if (strcmp(argv[index], "hash") == 0) {
+                forward_select_mode = FORWARD_SELECT_HASH;
+            } else {
+                fprintf(stderr, "无效的上游选择方式: %s（可选rtt或hash）\n", argv[index]);
+                exit(EXIT_FAILURE);
+            }
+        }else if(strcmp(argv[index], "-a") == 0 && index + 1 < argc){
+            free(listen_address);
+            listen_address = strdup(argv[++index]);
+            if (!listen_address) {
+                log_message(ERROR, "监听地址内存分配失败\n");
+                exit(EXIT_FAILURE);
+            }
+        }else if(strcmp(argv[index], "-P") == 0 && index + 1 < argc){
+            free(peer_members);
+            peer_members = strdup(argv[++index]);
+            if (!peer_members) {
+                log_message(ERROR, "集群节点列表内存分配失败\n");
+                exit(EXIT_FAILURE);
+            }
+        }else if(strcmp(argv[index], "-t") == 0){
+            upstream_tcp_only = 1;    // 转发的查询全部经上游TCP连接池发出
+        }else if(strcmp(argv[index], "-r") == 0){
+            private_reverse = 0;    // 私有地址的反向查询交给上游
+        }else if(strcmp(argv[index], "-c") == 0 && index + 1 < argc){
+            free(image_path);
+            image_path = strdup(argv[++index]);
+            if (!image_path) {
+                log_message(ERROR, "路径地址内存分配失败\n");
+                exit(EXIT_FAILURE);
+            }
         }
     }
 }
 
 // 读取hosts文件
 void readHost() {
-    FILE* hostFile = fopen(host_path, "r");
-
-    if (!hostFile) {
+    HostLoadStats stats;
+    int loaded = loadHostTable(host_path, &stats);
+    if (loaded < 0) {
+        fprintf(stderr, "错误：hosts镜像版本不符或已损坏: %s\n", host_path);
+        exit(EXIT_FAILURE);
+    }
+    if (loaded == 0) {
         fprintf(stderr, "错误：无法打开hosts文件: %s\n", host_path);
         exit(EXIT_FAILURE);
     }
 
-    getHostInfo(hostFile);
-    fclose(hostFile);
+    if (stats.from_image) {
+        printf("已映射hosts镜像：%u 个域名\n\n", (unsigned)stats.domain_count);
+        return;
+    }
+    if (stats.invalid_count > 0) {
+        printf("警告:跳过 %u 条无效记录\n", (unsigned)stats.invalid_count);
+    }
+    printf("已加载 %u 条域名地址信息，共 %u 个不同域名\n\n", (unsigned)stats.record_count,
+           (unsigned)stats.domain_count);
+    if (stats.frozen) {
+        size_t entry_count;
+        size_t memory = resolverMemoryUsage(&entry_count);
+        printf("hosts表已构建完美哈希：%u 个域名，占用 %.1f KB\n\n", (unsigned)entry_count, memory / 1024.0);
+    }
 }
 
-// 解析hosts文件内容
-void getHostInfo(FILE* file) {
-    if (!file) return;
+// 读取模式规则文件，未指定时不启用
+void readPatterns() {
+    if (!pattern_path) return;
+    int loaded = loadPatternFile(pattern_path);
+    if (loaded < 0) {
+        fprintf(stderr, "错误：无法打开模式规则文件: %s\n", pattern_path);
+        exit(EXIT_FAILURE);
+    }
+    printf("已加载 %d 条模式拦截规则\n\n", loaded);
+}
 
-    int count = 0;
-    int domain_count = 0;
-    char ipBuffer[64];
-    char domainBuffer[DNS_RR_NAME_MAX_SIZE];
-    char currentDomain[DNS_RR_NAME_MAX_SIZE] = {0};
-    uint8_t ipArray[MAX_IP_COUNT][4]; // 使用MAX_IP_COUNT存储多个IP
-    uint8_t ip_count = 0;
-    
-    // 按行读取hosts文件
-    while (fscanf(file, "%63s %s", ipBuffer, domainBuffer) == 2) {
-        uint8_t ipBytes[4] = {0};
-        
-        // 转换IP地址字符串为字节数组
-        if (TranIP(ipBytes, ipBuffer)) {
-            // 检查是否与上一个域名相同
-            if (strlen(currentDomain) > 0 && strcmp(currentDomain, domainBuffer) != 0) {
-                // 域名不同，将上一个域名的所有IP插入到域名解析表
-                uint32_t ttls[MAX_IP_COUNT];
-                // 为本地hosts记录设置默认TTL (24小时)
-                for (int i = 0; i < ip_count; i++) {
-                    ttls[i] = 86400;
-                }
-                insertNode(ipArray, ttls, ip_count, currentDomain);
-                domain_count++;
-                // 重置IP计数
-                ip_count = 0;
-            }
-            
-            // 保存当前域名
-            strncpy(currentDomain, domainBuffer, DNS_RR_NAME_MAX_SIZE - 1);
-            currentDomain[DNS_RR_NAME_MAX_SIZE - 1] = '\0';
-            
-            // 添加当前IP地址到数组（如果还有空间）
-            if (ip_count < MAX_IP_COUNT) {
-                memcpy(ipArray[ip_count], ipBytes, 4);
-                ip_count++;
-                count++;
-            } else {
-                printf("警告:域名 %s 的IP地址数量超过最大限制 %d\n", domainBuffer, MAX_IP_COUNT);
-            }
-        } else {
-            printf("警告:无效的IP地址格式: %s\n", ipBuffer);
+// 读取本地权威区文件
+void readZones() {
+    for (int i = 0; i < zone_path_count; i++) {
+        int loaded = loadZoneFile(zone_paths[i]);
+        if (loaded < 0) {
+            fprintf(stderr, "错误：无法打开区文件: %s\n", zone_paths[i]);
+            exit(EXIT_FAILURE);
         }
+        printf("已加载区文件 %s：%d 条记录\n", zone_paths[i], loaded);
     }
-    
-    // 处理最后一个域名
-    if (strlen(currentDomain) > 0 && ip_count > 0) {
-        uint32_t ttls[MAX_IP_COUNT];
-        // 为本地hosts记录设置默认TTL (24小时)
-        for (int i = 0; i < ip_count; i++) {
-            ttls[i] = 86400;
-        }
-        insertNode(ipArray, ttls, ip_count, currentDomain);
-        domain_count++;
+    if (zone_path_count > 0) printf("\n");
+}
+
+// 读取条件转发规则文件，未指定时全部查询发往默认上游
+void readForwards() {
+    if (!forward_path) return;
+    int loaded = loadForwardFile(forward_path);
+    if (loaded < 0) {
+        fprintf(stderr, "错误：无法打开转发规则文件: %s\n", forward_path);
+        exit(EXIT_FAILURE);
     }
+    printf("已加载 %d 条转发规则，共 %d 个上游组（含默认组）\n\n", forwardRuleCount(), forwardGroupCount());
+}
 
-    printf("已加载 %d 条域名地址信息，共 %d 个不同域名\n\n", count, domain_count);
+// 递归模式下加载根提示，未指定文件时使用内置的根服务器地址
+void readRootHints() {
+    if (!recursion_mode) return;
+    initRootHints();
+    if (!root_hints_path) return;
+    int loaded = loadRootHints(root_hints_path);
+    if (loaded < 0) {
+        fprintf(stderr, "错误：无法打开根提示文件: %s\n", root_hints_path);
+        exit(EXIT_FAILURE);
+    }
+    if (loaded == 0) {
+        fprintf(stderr, "错误：根提示文件中没有带地址的根服务器: %s\n", root_hints_path);
+        exit(EXIT_FAILURE);
+    }
+    printf("已加载根提示：%d 个根服务器\n\n", loaded);
+}
+
+// 把hosts文件编译为二进制镜像
+void compileHost() {
+    initDnsResolver();
+    readHost();
+    if (!saveDnsResolverImage(image_path)) {
+        fprintf(stderr, "错误：写入hosts镜像失败: %s\n", image_path);
+        exit(EXIT_FAILURE);
+    }
+    printf("hosts镜像已写入: %s\n", image_path);
+    destroyDnsResolver();
 }
 
 // 记录DNS查询日志
@@ -237,8 +432,31 @@ void cleanupConfig() {
     free(host_path);
     free(LOG_PATH);
     free(dnsServerAddress);
+    free(image_path);
+    free(pattern_path);
+    free(forward_path);
+    free(root_hints_path);
+    free(listen_address);
+    free(peer_members);
+    destroyPatterns();
+    destroyForwarding();
+    destroyRecursor();
+    destroyFailureCache();
+    destroyBufferPool();
+    destroyZones();
+    for (int i = 0; i < zone_path_count; i++) {
+        free(zone_paths[i]);
+        zone_paths[i] = NULL;
+    }
+    zone_path_count = 0;
     
     host_path = NULL;
+    image_path = NULL;
+    pattern_path = NULL;
+    forward_path = NULL;
+    listen_address = NULL;
+    peer_members = NULL;
+    root_hints_path = NULL;
     LOG_PATH = NULL;
     dnsServerAddress = NULL;
 }
@@ -247,17 +465,8 @@ void cleanupConfig() {
 // 返回1表示成功，0表示失败
 int TranIP(uint8_t* dest, const char* src) {
     if (!dest || !src) return 0;
-    
-    int values[4];
-    int count = sscanf(src, "%d.%d.%d.%d", &values[0], &values[1], &values[2], &values[3]);
-    
-    if (count != 4) return 0;
-    
-    // 验证每个值是否在有效范围内
-    for (int i = 0; i < 4; i++) {
-        if (values[i] < 0 || values[i] > 255) return 0;
-        dest[i] = (uint8_t)values[i];
-    }
-    
-    return 1;
-}
\ No newline at end of file
+
+    const char* end = src + strlen(src);
+    size_t used = parseIPv4(src, end, dest);
+    return used > 0 && src + used == end;
+}
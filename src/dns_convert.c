@@ -45,6 +45,8 @@ void str_to_dnsstruct(dns_Message* pmsg, uint8_t* buffer, uint8_t* start) {
 
     pmsg->question = NULL; // 初始化为NULL，在getDnsquestion中动态添加
     pmsg->answer = NULL;   // 初始化为NULL，在getDnsanswer中动态添加
+    pmsg->authority = NULL;
+    pmsg->additional = NULL;
 
     log_message(LOG_DEBUG,"报文如下：");
 
@@ -59,6 +61,12 @@ void str_to_dnsstruct(dns_Message* pmsg, uint8_t* buffer, uint8_t* start) {
     // 获取应答内容
     buffer = getDnsanswer(pmsg, buffer, start);  // buffer指向读取完应答内容后的地址
     printAnswer(pmsg);
+
+    // 获取授权和附加内容，其中的NS记录和粘附地址可以收入缓存
+    buffer = getDnsrecords(&pmsg->authority, pmsg->header->NSCOUNT, buffer, start);
+    buffer = getDnsrecords(&pmsg->additional, pmsg->header->ARCOUNT, buffer, start);
+    printAuthority(pmsg);
+    printAdditional(pmsg);
 }
 
 // 从缓冲区中读取DNS报文头信息并存储到msg结构体中
@@ -134,11 +142,19 @@ uint8_t* getDnsquestion(dns_Message* msg, uint8_t* buffer, uint8_t* start) {
 
 // 从缓冲区中读取DNS回答信息并存储到msg结构体中
 uint8_t* getDnsanswer(dns_Message* msg, uint8_t* buffer, uint8_t* start) {
-    if (!msg || !buffer || !start) {
+    if (!msg || !msg->header) {
+        return buffer;
+    }
+    return getDnsrecords(&msg->answer, msg->header->ANCOUNT, buffer, start);
+}
+
+// 从缓冲区中读取count条资源记录，插入到list链表的头部
+uint8_t* getDnsrecords(dns_rr** list, int count, uint8_t* buffer, uint8_t* start) {
+    if (!list || !buffer || !start) {
         return buffer;
     }
 
-    for (int i = 0; i < msg->header->ANCOUNT; ++i) {
+    for (int i = 0; i < count; ++i) {
         char name[DNS_RR_NAME_MAX_SIZE] = { 0 };
         dns_rr* p = malloc(sizeof(dns_rr));
         if (!p) continue; // 内存分配失败，尝试下一个
@@ -181,10 +197,33 @@ uint8_t* getDnsanswer(dns_Message* msg, uint8_t* buffer, uint8_t* start) {
                 }
                 break;
             case DNS_TYPE_AAAA: // IPv6地址
+                if (p->rdLength != 16) {
+                    buffer += p->rdLength;
+                    break;
+                }
                 for (int j = 0; j < 16; j++) {
                     p->rdata.AAAA_record.address[j] = readBits(&buffer, 8);
                 }
                 break;
+            case DNS_TYPE_NS:  // NS记录
+            case DNS_TYPE_PTR: // PTR记录，与NS一样只有一个域名
+                {
+                    char target[DNS_RR_NAME_MAX_SIZE] = {0};
+                    buffer = getDomain(buffer, target, start);
+
+                    char* copy = malloc(strlen(target) + 1);
+                    if (!copy) {
+                        allocation_failed = true;
+                        break;
+                    }
+                    strcpy(copy, target);
+                    if (p->type == DNS_TYPE_NS) {
+                        p->rdata.NS_record.nsdname = copy;
+                    } else {
+                        p->rdata.PTR_record.ptrdname = copy;
+                    }
+                }
+                break;
             case DNS_TYPE_CNAME: // CNAME记录
                 {
                     char cname[DNS_RR_NAME_MAX_SIZE] = {0};
@@ -201,7 +240,7 @@ uint8_t* getDnsanswer(dns_Message* msg, uint8_t* buffer, uint8_t* start) {
                 break;
             case DNS_TYPE_MX: // MX记录
                 p->rdata.MX_record.preference = readBits(&buffer, 16);
-                p->rdata.MX_record.exchange = malloc(p->rdLength - 2 + 1);
+                p->rdata.MX_record.exchange = malloc(DNS_RR_NAME_MAX_SIZE); // 压缩的名字展开后可能比RDATA长
                 if (!p->rdata.MX_record.exchange) {
                     allocation_failed = true;
                     break;
@@ -251,9 +290,9 @@ uint8_t* getDnsanswer(dns_Message* msg, uint8_t* buffer, uint8_t* start) {
             continue;
         }
 
-        // 将新回答插入到回答链表的头部
-        p->next = msg->answer;
-        msg->answer = p;
+        // 将新记录插入到链表的头部
+        p->next = *list;
+        *list = p;
     }
 
     return buffer;
@@ -382,8 +421,10 @@ uint8_t* setDnsheader(dns_Message* msg, uint8_t* buffer, uint8_t* ip_addr) {
         header->RCODE = 3;  // 名字错误
     }
     
-    // 设置实际回答数
+    // 设置实际回答数；授权和附加部分不写出（查询带的OPT由发送前的EDNS处理补上）
     header->ANCOUNT = answerCount;
+    header->NSCOUNT = 0;
+    header->ARCOUNT = 0;
 
     writeBits(&buffer, 16, header->ID); // 设置ID
 
@@ -513,35 +554,86 @@ uint8_t* setDomain(uint8_t* buffer, char* name) {
     return buffer;
 }
 
-// 释放DNS报文结构体所占的内存
-void freeMessage(dns_Message* msg) {
-    if (!msg) return;
+// 快速解析只有一个问题的标准查询，直接从原始报文中取出域名、类型和类
+int peekQuestion(const uint8_t* buffer, int msg_size, dns_question_view* question) {
+    if (!buffer || !question || msg_size < 12 + 5) {
+        return 0;
+    }
 
-    // 释放头部
-    if (msg->header) {
-        free(msg->header);
+    // 只处理标准查询：QR=0，Opcode=0，一个问题，没有回答和授权记录（附加部分的OPT记录可以忽略）
+    uint16_t flags = (uint16_t)((buffer[2] << 8) | buffer[3]);
+    if ((flags & QR_MASK) || (flags & OPCODE_MASK) ||
+        buffer[4] != 0 || buffer[5] != 1 || buffer[6] || buffer[7] || buffer[8] || buffer[9]) {
+        return 0;
     }
 
-    // 释放问题链表
-    dns_question* p = msg->question;
-    while (p) {
-        dns_question* tmp = p;
-        p = p->next;
-        
-        if (tmp->QNAME) {
-            free(tmp->QNAME);
+    const uint8_t* ptr = buffer + 12;
+    const uint8_t* end = buffer + msg_size;
+    size_t len = 0;
+    while (ptr < end && *ptr != 0) {
+        uint8_t labelLen = *ptr++;
+        // 问题中出现压缩指针或超长标签时交给完整解析
+        if (labelLen > DNSDNS_RR_NAME_SINGLE_MAX_SIZE || ptr + labelLen > end ||
+            len + labelLen + 1 > DNS_RR_NAME_MAX_SIZE - 1) {
+            return 0;
         }
-        free(tmp);
+        if (len > 0) question->QNAME[len++] = '.';
+        memcpy(question->QNAME + len, ptr, labelLen);
+        len += labelLen;
+        ptr += labelLen;
+    }
+    if (ptr + 5 > end || len == 0) {
+        return 0; // 报文被截断，或者查询的是根域
+    }
+    ptr++; // 跳过结束的0字节
+
+    question->QNAME[len] = '\0';
+    question->nameLength = len;
+    question->QTYPE = (uint16_t)((ptr[0] << 8) | ptr[1]);
+    question->QCLASS = (uint16_t)((ptr[2] << 8) | ptr[3]);
+    question->end = (int)(ptr + 4 - buffer);
+    return 1;
+}
+
+// 原样复制查询的报头和问题，改写标志和计数，再追加预编码的资源记录
+int composeReply(const uint8_t* query, const dns_question_view* question, uint8_t rcode,
+                 const uint8_t* records, int length, uint16_t ancount, uint16_t nscount, uint16_t arcount,
+                 uint8_t* reply) {
+    memcpy(reply, query, question->end);
+
+    // 保留查询的Opcode和RD，置QR、AA、RA，其余标志清零
+    uint16_t flags = (uint16_t)((query[2] << 8) | query[3]);
+    flags = (uint16_t)((flags & (OPCODE_MASK | RD_MASK)) | QR_MASK | AA_MASK | RA_MASK | (rcode & RCODE_MASK));
+    uint8_t* ptr = reply + 2;
+    writeBits(&ptr, 16, flags);
+    writeBits(&ptr, 16, 1);        // 问题数
+    writeBits(&ptr, 16, ancount);  // 回答数
+    writeBits(&ptr, 16, nscount);  // 授权记录数
+    writeBits(&ptr, 16, arcount);  // 附加记录数
+
+    // 记录中的名字是指向偏移12的压缩指针，正好指向复制过来的问题域名
+    if (length > 0) {
+        memcpy(reply + question->end, records, length);
     }
+    return question->end + length;
+}
 
-    // 释放回答链表
-    dns_rr* q = msg->answer;
+// 释放资源记录链表
+static void freeRecords(dns_rr* q) {
     while (q) {
         dns_rr* tmp = q;
         q = q->next;
         
         // 根据记录类型释放相应的资源
         switch (tmp->type) {
+            case DNS_TYPE_NS:
+                if (tmp->rdata.NS_record.nsdname)
+                    free(tmp->rdata.NS_record.nsdname);
+                break;
+            case DNS_TYPE_PTR:
+                if (tmp->rdata.PTR_record.ptrdname)
+                    free(tmp->rdata.PTR_record.ptrdname);
+                break;
             case DNS_TYPE_CNAME:
                 if (tmp->rdata.CNAME_record.cname)
                     free(tmp->rdata.CNAME_record.cname);
@@ -567,12 +659,32 @@ void freeMessage(dns_Message* msg) {
         }
         free(tmp);
     }
-
-    free(msg);
 }
 
+// 释放DNS报文各部分所占的内存（结构体本身通常在栈上，不释放）
+void freeMessage(dns_Message* msg) {
+    if (!msg) return;
 
+    // 释放头部
+    if (msg->header) {
+        free(msg->header);
+    }
 
+    // 释放问题链表
+    dns_question* p = msg->question;
+    while (p) {
+        dns_question* tmp = p;
+        p = p->next;
+        
+        if (tmp->QNAME) {
+            free(tmp->QNAME);
+        }
+        free(tmp);
+    }
 
-
-
+    // 释放回答、授权和附加记录链表
+    freeRecords(msg->answer);
+    freeRecords(msg->authority);
+    freeRecords(msg->additional);
+    memset(msg, 0, sizeof(*msg));
+}
@@ -0,0 +1,142 @@
+//本文件实现EDNS0（RFC 6891）：解析客户端的OPT记录，向上游通告本地的UDP载荷大小，按客户端的能力调整应答
+#include "dns_edns.h"
+#include "dns_convert.h"
+
+uint16_t edns_udp_size = EDNS_DEFAULT_UDP_SIZE;
+
+// --- 内部辅助函数 ---
+
+static uint16_t get16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void put16(uint8_t* p, uint16_t value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+// 跳过从offset开始的域名（可以以压缩指针结尾），返回域名之后的偏移；越界或标签类型非法时返回-1
+static int skipName(const uint8_t* msg, int size, int offset) {
+    while (offset < size) {
+        uint8_t len = msg[offset];
+        if ((len & 0xC0) == 0xC0) return offset + 2 <= size ? offset + 2 : -1;
+        if (len & 0xC0) return -1;
+        if (len == 0) return offset + 1;
+        offset += 1 + len;
+    }
+    return -1;
+}
+
+// 写一条不带选项的OPT记录：所有者为根，CLASS是UDP载荷大小，TTL依次是扩展RCODE、版本0和标志
+static void writeOpt(uint8_t* p, uint16_t udp_size, uint16_t flags) {
+    p[0] = 0;
+    put16(p + 1, DNS_TYPE_OPT);
+    put16(p + 3, udp_size);
+    p[5] = 0;
+    p[6] = 0;
+    put16(p + 7, flags);
+    put16(p + 9, 0);
+}
+
+// --- 公开接口实现 ---
+
+int ednsParse(const uint8_t* msg, int size, dns_edns* edns) {
+    memset(edns, 0, sizeof(*edns));
+    if (size < 12) return 0;
+
+    int qdcount = get16(msg + 4);
+    int answers = get16(msg + 6) + get16(msg + 8);
+    int total = answers + get16(msg + 10);
+
+    int offset = 12;
+    for (int i = 0; i < qdcount; i++) {
+        offset = skipName(msg, size, offset);
+        if (offset < 0 || offset + 4 > size) return 0;
+        offset += 4;
+    }
+    edns->question_end = offset;
+
+    for (int i = 0; i < total; i++) {
+        int start = offset;
+        offset = skipName(msg, size, offset);
+        if (offset < 0 || offset + 10 > size) return 0;
+        uint16_t type = get16(msg + offset);
+        int end = offset + 10 + get16(msg + offset + 8);
+        if (end > size) return 0;
+        // 只认附加部分中的第一条OPT
+        if (i >= answers && type == DNS_TYPE_OPT && !edns->present) {
+            edns->present = 1;
+            edns->udp_size = get16(msg + offset + 2);
+            edns->flags = get16(msg + offset + 6);
+            edns->offset = start;
+            edns->length = end - start;
+        }
+        offset = end;
+    }
+    return 1;
+}
+
+int ednsPayloadLimit(const dns_edns* client) {
+    if (!client->present || client->udp_size <= EDNS_PLAIN_UDP_SIZE) return EDNS_PLAIN_UDP_SIZE;
+    return client->udp_size < edns_udp_size ? client->udp_size : edns_udp_size;
+}
+
+int ednsPrepareQuery(uint8_t* query, int len, int capacity, const dns_edns* client) {
+    if (client->present) {
+        put16(query + client->offset + 3, edns_udp_size);
+        return len;
+    }
+    if (len + EDNS_OPT_SIZE > capacity) return len;
+    writeOpt(query + len, edns_udp_size, 0);
+    put16(query + 10, (uint16_t)(get16(query + 10) + 1));
+    return len + EDNS_OPT_SIZE;
+}
+
+int ednsFitReply(uint8_t* reply, int len, int limit, const dns_edns* client) {
+    dns_edns opt;
+    if (!ednsParse(reply, len, &opt)) return len;
+
+    uint8_t keep[EDNS_OPT_KEEP_MAX];
+    int keep_len = 0;
+    int in_place = 0;              // OPT留在原处，不必再追加
+    if (opt.present) {
+        if (opt.offset + opt.length == len) {
+            // OPT是最后一条记录（通常如此）：先取下来，调整长度之后再决定是否放回
+            if (client->present && opt.length <= EDNS_OPT_KEEP_MAX) {
+                memcpy(keep, reply + opt.offset, opt.length);
+                keep_len = opt.length;
+            }
+            len = opt.offset;
+            put16(reply + 10, (uint16_t)(get16(reply + 10) - 1));
+        } else if (client->present) {
+            // OPT后面还有记录（如TSIG），移走它会打乱后面的压缩指针，只改写UDP载荷大小
+            put16(reply + opt.offset + 3, edns_udp_size);
+            in_place = 1;
+        }
+    }
+    if (client->present && !in_place) {
+        if (keep_len == 0) {
+            writeOpt(keep, edns_udp_size, client->flags & EDNS_DO_BIT);
+            keep_len = EDNS_OPT_SIZE;
+        }
+        put16(keep + 3, edns_udp_size);
+    }
+
+    if (len + keep_len > limit) {
+        // 放不下：只保留报头和问题，置TC；OPT换成不带选项的，保证截断后的应答一定放得下
+        len = opt.question_end;
+        memset(reply + 6, 0, 6);
+        reply[2] |= (uint8_t)(TC_MASK >> 8);
+        keep_len = 0;
+        if (client->present) {
+            writeOpt(keep, edns_udp_size, client->flags & EDNS_DO_BIT);
+            keep_len = EDNS_OPT_SIZE;
+        }
+    }
+    if (keep_len > 0) {
+        memcpy(reply + len, keep, keep_len);
+        put16(reply + 10, (uint16_t)(get16(reply + 10) + 1));
+        len += keep_len;
+    }
+    return len;
+}
@@ -0,0 +1,149 @@
+//本文件实现上游失败缓存：上游对某个查询名和类型回复SERVFAIL或超时后，短时间内直接回复SERVFAIL，失败持续时屏蔽时间指数退避
+#include "dns_failure.h"
+#include "uthash.h"
+#include <ctype.h>
+#include <time.h>
+
+#define FAILURE_KEY_MAX (DNS_RR_NAME_MAX_SIZE + 8)  // "类型/小写查询名"形式的键
+
+typedef struct FailureEntry {
+    char key[FAILURE_KEY_MAX];
+    uint32_t hold;                 // 本次屏蔽的秒数，再次失败时以它为基础加倍
+    time_t until;                  // 屏蔽结束的时刻
+    uint32_t failures;             // 连续失败次数
+    UT_hash_handle hh;
+} FailureEntry;
+
+// 最近一次成功应答的时刻，按键的哈希直接映射；槽被别的名字占用时查不到，照常记录失败
+typedef struct SuccessSlot {
+    uint64_t hash;
+    uint64_t at;                   // GetTickCount64()毫秒，0表示空槽
+} SuccessSlot;
+
+static FailureEntry* entries = NULL;
+static SuccessSlot successes[FAILURE_SUCCESS_SLOTS];
+
+// --- 内部辅助函数 ---
+
+// 拼出键：类型和小写的查询名，去掉末尾的'.'；名字过长时返回0
+static int makeKey(const char* name, uint16_t qtype, char* key) {
+    int len = snprintf(key, FAILURE_KEY_MAX, "%u/", (unsigned)qtype);
+    for (const char* p = name; *p; p++) {
+        if (len >= FAILURE_KEY_MAX - 1) return 0;
+        key[len++] = (char)tolower((unsigned char)*p);
+    }
+    if (len > 0 && key[len - 1] == '.') len--;
+    key[len] = '\0';
+    return 1;
+}
+
+// 键的FNV-1a哈希
+static uint64_t keyHash(const char* key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char* p = key; *p; p++) {
+        hash ^= (uint8_t)*p;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static FailureEntry* findEntry(const char* name, uint16_t qtype) {
+    char key[FAILURE_KEY_MAX];
+    if (!makeKey(name, qtype, key)) return NULL;
+    FailureEntry* entry = NULL;
+    HASH_FIND_STR(entries, key, entry);
+    return entry;
+}
+
+// --- 公开接口实现 ---
+
+int failureCheck(const char* name, uint16_t qtype) {
+    if (!entries) return 0;
+    FailureEntry* entry = findEntry(name, qtype);
+    if (!entry) return 0;
+    time_t now = time(NULL);
+    return entry->until > now ? (int)(entry->until - now) : 0;
+}
+
+void failureRecord(const char* name, uint16_t qtype, uint64_t sent_at, const char* reason) {
+    char key[FAILURE_KEY_MAX];
+    if (!makeKey(name, qtype, key)) return;
+    time_t now = time(NULL);
+
+    uint64_t hash = keyHash(key);
+    const SuccessSlot* slot = &successes[hash % FAILURE_SUCCESS_SLOTS];
+    if (slot->at != 0 && slot->hash == hash && slot->at >= sent_at) {
+        log_message(LOG_DEBUG, "Upstream %s for [%s] type %u ignored, answered since the query was sent",
+                    reason, name, (unsigned)qtype);
+        return;
+    }
+
+    FailureEntry* entry = NULL;
+    HASH_FIND_STR(entries, key, entry);
+    if (entry && entry->until + FAILURE_FORGET < now) {
+        // 上次屏蔽早已结束，这次失败不算连续失败
+        entry->hold = 0;
+        entry->failures = 0;
+    }
+    if (!entry) {
+        if (HASH_COUNT(entries) >= FAILURE_MAX_ENTRIES && failureCleanExpired() == 0) {
+            log_message(LOG_DEBUG, "Failure cache full, not recording [%s] type %u", name, (unsigned)qtype);
+            return;
+        }
+        entry = (FailureEntry*)calloc(1, sizeof(FailureEntry));
+        if (!entry) return;
+        strcpy(entry->key, key);
+        HASH_ADD_STR(entries, key, entry);
+    } else if (entry->until > now) {
+        // 屏蔽期内发出的查询（屏蔽开始前已在途）失败，不再加倍
+        return;
+    }
+
+    uint32_t hold = entry->hold == 0 ? FAILURE_HOLD_MIN : entry->hold * 2;
+    entry->hold = hold > FAILURE_HOLD_MAX ? FAILURE_HOLD_MAX : hold;
+    entry->until = now + entry->hold;
+    entry->failures++;
+    log_message(LOG_INFO, "Upstream %s for [%s] type %u, answering SERVFAIL for %u s (failure %u)",
+                reason, name, (unsigned)qtype, (unsigned)entry->hold, (unsigned)entry->failures);
+}
+
+void failureClear(const char* name, uint16_t qtype) {
+    char key[FAILURE_KEY_MAX];
+    if (!makeKey(name, qtype, key)) return;
+    uint64_t hash = keyHash(key);
+    SuccessSlot* slot = &successes[hash % FAILURE_SUCCESS_SLOTS];
+    slot->hash = hash;
+    slot->at = GetTickCount64();
+
+    if (!entries) return;
+    FailureEntry* entry = NULL;
+    HASH_FIND_STR(entries, key, entry);
+    if (!entry) return;
+    HASH_DEL(entries, entry);
+    free(entry);
+}
+
+int failureCleanExpired(void) {
+    time_t now = time(NULL);
+    int removed = 0;
+    FailureEntry* entry;
+    FailureEntry* tmp;
+    HASH_ITER(hh, entries, entry, tmp) {
+        if (entry->until + FAILURE_FORGET < now) {
+            HASH_DEL(entries, entry);
+            free(entry);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+void destroyFailureCache(void) {
+    FailureEntry* entry;
+    FailureEntry* tmp;
+    HASH_ITER(hh, entries, entry, tmp) {
+        HASH_DEL(entries, entry);
+        free(entry);
+    }
+    memset(successes, 0, sizeof(successes));
+}
@@ -0,0 +1,476 @@
+//本文件实现条件转发：按域名后缀把查询分流到不同的上游组，组内按平滑RTT选择服务器
+#include "dns_forward.h"
+#include "dns_hosts.h"
+#include "uthash.h"
+#include <ctype.h>
+#include <time.h>
+
+typedef struct UpstreamServer {
+    struct sockaddr_in address;
+    uint32_t srtt;                 // 平滑RTT（毫秒），0表示尚无样本
+    uint64_t decay_at;             // 平滑RTT上次更新或衰减的时刻（毫秒）
+    uint32_t outstanding;          // 已发出、还没有应答也没有超时的查询数
+    uint32_t sent;
+    uint32_t answered;
+    uint32_t timeouts;
+    uint32_t failures;             // 连续超时次数，收到应答后清零
+    time_t down_until;             // 连续超时达到上限后视为不可用，到这个时刻为止哈希选择跳过它
+} UpstreamServer;
+
+typedef struct UpstreamGroup {
+    UpstreamServer servers[FORWARD_MAX_SERVERS];
+    int server_count;
+    int pending;                   // 已发出、尚未应答也未超时的查询数
+} UpstreamGroup;
+
+// 后缀树节点：根的子节点是顶级标签，逐级向下对应域名从右到左的各个标签
+typedef struct ForwardNode {
+    char* label;                   // 小写的标签
+    int group;                     // 以该节点为后缀的规则所属的组，-1表示这里没有规则
+    struct ForwardNode* children;
+    UT_hash_handle hh;
+} ForwardNode;
+
+static UpstreamGroup groups[FORWARD_MAX_GROUPS];
+static int group_count = 0;
+static ForwardNode* rootChildren = NULL;
+static int rule_count = 0;
+
+int forward_select_mode = FORWARD_SELECT_RTT;
+
+// --- 内部辅助函数 ---
+
+// 解析"a.b.c.d[:port]"，成功返回1
+static int parseUpstream(const char* text, struct sockaddr_in* address) {
+    uint8_t ip[4];
+    const char* end = text + strlen(text);
+    size_t used = parseIPv4(text, end, ip);
+    if (used == 0) return 0;
+
+    unsigned long port = FORWARD_DEFAULT_PORT;
+    if (text[used] == ':') {
+        char* stop;
+        port = strtoul(text + used + 1, &stop, 10);
+        if (stop == text + used + 1 || *stop != '\0' || port == 0 || port > 65535) return 0;
+    } else if (text[used] != '\0') {
+        return 0;
+    }
+
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    memcpy(&address->sin_addr.s_addr, ip, 4);
+    address->sin_port = htons((u_short)port);
+    return 1;
+}
+
+static int sameAddress(const struct sockaddr_in* a, const struct sockaddr_in* b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+// 查找地址列表完全相同的组，没有则新建，组数已满时返回-1
+static int findOrAddGroup(const struct sockaddr_in* addresses, int count) {
+    for (int g = 1; g < group_count; g++) {
+        if (groups[g].server_count != count) continue;
+        int same = 1;
+        for (int i = 0; i < count && same; i++) {
+            same = sameAddress(&groups[g].servers[i].address, &addresses[i]);
+        }
+        if (same) return g;
+    }
+    if (group_count >= FORWARD_MAX_GROUPS) return -1;
+
+    UpstreamGroup* group = &groups[group_count];
+    memset(group, 0, sizeof(*group));
+    for (int i = 0; i < count; i++) group->servers[i].address = addresses[i];
+    group->server_count = count;
+    return group_count++;
+}
+
+static ForwardNode* findChild(ForwardNode* children, const char* label, size_t len) {
+    ForwardNode* node = NULL;
+    HASH_FIND(hh, children, label, len, node);
+    return node;
+}
+
+// 沿后缀的标签从右到左插入后缀树，返回后缀对应的节点
+static ForwardNode* insertSuffix(const char* suffix, size_t len) {
+    ForwardNode** children = &rootChildren;
+    ForwardNode* node = NULL;
+    size_t end = len;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && suffix[start - 1] != '.') start--;
+        size_t label_len = end - start;
+        if (label_len == 0 || label_len > DNSDNS_RR_NAME_SINGLE_MAX_SIZE) return NULL;
+
+        node = findChild(*children, suffix + start, label_len);
+        if (!node) {
+            node = (ForwardNode*)calloc(1, sizeof(ForwardNode));
+            if (!node) return NULL;
+            node->label = (char*)malloc(label_len + 1);
+            if (!node->label) {
+                free(node);
+                return NULL;
+            }
+            memcpy(node->label, suffix + start, label_len);
+            node->label[label_len] = '\0';
+            node->group = -1;
+            HASH_ADD_KEYPTR(hh, *children, node->label, label_len, node);
+        }
+        children = &node->children;
+        end = start > 0 ? start - 1 : 0;
+    }
+    return node;
+}
+
+// 取出下一个以空白分隔的字段并就地截断，没有更多字段时返回NULL
+static char* nextToken(char** cursor) {
+    char* p = *cursor;
+    while (*p && isspace((unsigned char)*p)) p++;
+    if (*p == '\0') return NULL;
+    char* token = p;
+    while (*p && !isspace((unsigned char)*p)) p++;
+    if (*p) *p++ = '\0';
+    *cursor = p;
+    return token;
+}
+
+static void freeNodes(ForwardNode** children) {
+    ForwardNode* node;
+    ForwardNode* tmp;
+    HASH_ITER(hh, *children, node, tmp) {
+        HASH_DEL(*children, node);
+        freeNodes(&node->children);
+        free(node->label);
+        free(node);
+    }
+}
+
+// 解析一行规则并加入后缀树，成功返回1
+static int addRule(char* line, int line_no) {
+    char* cursor = line;
+    char* suffix = nextToken(&cursor);
+    struct sockaddr_in addresses[FORWARD_MAX_SERVERS];
+    int count = 0;
+    for (char* token = nextToken(&cursor); token; token = nextToken(&cursor)) {
+        if (count == FORWARD_MAX_SERVERS) {
+            log_message(LOG_ERROR, "Forward: too many upstreams at line %d, at most %d", line_no, FORWARD_MAX_SERVERS);
+            return 0;
+        }
+        if (!parseUpstream(token, &addresses[count])) {
+            log_message(LOG_ERROR, "Forward: invalid upstream at line %d: %s", line_no, token);
+            return 0;
+        }
+        count++;
+    }
+    if (count == 0) {
+        log_message(LOG_ERROR, "Forward: no upstream at line %d", line_no);
+        return 0;
+    }
+
+    // 统一为小写、去掉末尾的'.'
+    size_t len = strlen(suffix);
+    if (len > 0 && suffix[len - 1] == '.') suffix[--len] = '\0';
+    for (size_t i = 0; i < len; i++) suffix[i] = (char)tolower((unsigned char)suffix[i]);
+
+    ForwardNode* node = len > 0 && len < DNS_RR_NAME_MAX_SIZE ? insertSuffix(suffix, len) : NULL;
+    if (!node) {
+        log_message(LOG_ERROR, "Forward: invalid suffix at line %d: %s", line_no, suffix);
+        return 0;
+    }
+    int group = findOrAddGroup(addresses, count);
+    if (group < 0) {
+        log_message(LOG_ERROR, "Forward: too many upstream groups at line %d, at most %d", line_no, FORWARD_MAX_GROUPS);
+        return 0;
+    }
+    if (node->group < 0) rule_count++;
+    node->group = group;
+    return 1;
+}
+
+static char* trimLine(char* line) {
+    while (*line && isspace((unsigned char)*line)) line++;
+    size_t len = strlen(line);
+    while (len > 0 && isspace((unsigned char)line[len - 1])) line[--len] = '\0';
+    return line;
+}
+
+// 64位整数的混合函数（splitmix64的终结步骤），输入相差一位时输出的每一位都以一半的概率翻转
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// 组内按最高随机权重选服务器：跳过不可用的，全部不可用时仍按权重选，不让查询无处可去
+static int selectByHash(const UpstreamGroup* group, const char* name, size_t len) {
+    uint64_t key = forwardNameHash(name, len);
+    time_t now = time(NULL);
+    int best = -1;
+    int fallback = 0;
+    uint64_t best_weight = 0;
+    uint64_t fallback_weight = 0;
+    for (int i = 0; i < group->server_count; i++) {
+        uint64_t weight = forwardHashWeight(key, &group->servers[i].address);
+        if (i == 0 || weight > fallback_weight) {
+            fallback = i;
+            fallback_weight = weight;
+        }
+        if (group->servers[i].down_until > now) continue;
+        if (best < 0 || weight > best_weight) {
+            best = i;
+            best_weight = weight;
+        }
+    }
+    return best >= 0 ? best : fallback;
+}
+
+// 平滑RTT按时间衰减：每FORWARD_RTT_DECAY_MS没有新样本就减去1/16，一次慢速或超时之后仍会重新得到机会，
+// 衰减的快慢与查询量无关
+static void decayRtt(UpstreamServer* server, uint64_t now) {
+    if (server->decay_at == 0) {
+        server->decay_at = now;
+        return;
+    }
+    uint64_t steps = (now - server->decay_at) / FORWARD_RTT_DECAY_MS;
+    server->decay_at += steps * FORWARD_RTT_DECAY_MS;
+    if (steps > 64) steps = 64; // 64步后RTT已不到原来的2%，不必再算
+    while (steps-- > 0) server->srtt -= server->srtt >> 4;
+}
+
+// 选择时使用的代价：预计的等待时间，即平滑RTT乘以连同这次在内排队的查询数，在途查询多的服务器让出流量。
+// 尚无样本的服务器先被选中一次以获得测量，有在途查询时按超时处理，不会因为RTT为0而持续独占流量
+static uint64_t selectionCost(const UpstreamServer* server) {
+    if (server->answered == 0 && server->timeouts == 0) return server->outstanding > 0 ? FORWARD_TIMEOUT_RTT : 0;
+    return (uint64_t)server->srtt * (server->outstanding + 1);
+}
+
+// 组内选代价最小的服务器，跳过连续超时而被屏蔽的；全部被屏蔽时仍按代价选，不让查询无处可去
+static int selectByRtt(UpstreamGroup* group) {
+    uint64_t now_ms = GetTickCount64();
+    time_t now = time(NULL);
+    int best = -1;
+    int fallback = 0;
+    for (int i = 0; i < group->server_count; i++) {
+        UpstreamServer* server = &group->servers[i];
+        decayRtt(server, now_ms);
+        uint64_t cost = selectionCost(server);
+        if (cost < selectionCost(&group->servers[fallback])) fallback = i;
+        if (server->down_until > now) continue;
+        if (best < 0 || cost < selectionCost(&group->servers[best])) best = i;
+    }
+    return best >= 0 ? best : fallback;
+}
+
+// 沿后缀树查找最长匹配后缀所属的组，没有规则命中时为默认组0
+static int matchGroup(const char* name, size_t len) {
+    ForwardNode* children = rootChildren;
+    int group = 0;
+    size_t end = len;
+    if (end > 0 && name[end - 1] == '.') end--;
+    while (end > 0 && children) {
+        size_t start = end;
+        while (start > 0 && name[start - 1] != '.') start--;
+        size_t label_len = end - start;
+        if (label_len == 0 || label_len > DNSDNS_RR_NAME_SINGLE_MAX_SIZE) break;
+
+        char label[DNSDNS_RR_NAME_SINGLE_MAX_SIZE];
+        for (size_t i = 0; i < label_len; i++) label[i] = (char)tolower((unsigned char)name[start + i]);
+        ForwardNode* node = findChild(children, label, label_len);
+        if (!node) break;
+        if (node->group >= 0) group = node->group;
+        children = node->children;
+        end = start > 0 ? start - 1 : 0;
+    }
+    return group;
+}
+
+// --- 公开接口实现 ---
+
+int initForwarding(const char* address) {
+    memset(&groups[0], 0, sizeof(groups[0]));
+    char list[FORWARD_LINE_MAX];
+    if (strlen(address) >= sizeof(list)) return 0;
+    strcpy(list, address);
+
+    int count = 0;
+    for (char* token = strtok(list, ","); token; token = strtok(NULL, ",")) {
+        if (count == FORWARD_MAX_SERVERS || !parseUpstream(token, &groups[0].servers[count].address)) return 0;
+        count++;
+    }
+    if (count == 0) return 0;
+    groups[0].server_count = count;
+    if (group_count == 0) group_count = 1;
+    return 1;
+}
+
+int loadForwardFile(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+
+    int loaded = 0;
+    char line[FORWARD_LINE_MAX];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_no++;
+        char* rule = trimLine(line);
+        if (*rule == '\0' || *rule == '#') continue;
+        loaded += addRule(rule, line_no);
+    }
+    fclose(file);
+    return loaded;
+}
+
+const struct sockaddr_in* forwardSelect(const char* name, size_t len, ForwardTarget* target) {
+    int g = matchGroup(name, len);
+    UpstreamGroup* group = &groups[g];
+    int best = forward_select_mode == FORWARD_SELECT_HASH ? selectByHash(group, name, len) : selectByRtt(group);
+
+    UpstreamServer* server = &group->servers[best];
+    server->outstanding++;
+    server->sent++;
+    group->pending++;
+    target->group = (uint8_t)g;
+    target->server = (uint8_t)best;
+    return &group->servers[best].address;
+}
+
+const struct sockaddr_in* forwardRetry(const char* name, size_t len, ForwardTarget* target) {
+    if (target->group >= group_count) return NULL;
+    UpstreamGroup* group = &groups[target->group];
+    uint64_t key = forwardNameHash(name, len);
+    uint64_t now_ms = GetTickCount64();
+    time_t now = time(NULL);
+
+    // 哈希方式下取权重次大的服务器，与该名字的归属服务器不可用时的改投对象一致
+    int best = -1;
+    uint64_t best_score = 0;
+    for (int i = 0; i < group->server_count; i++) {
+        UpstreamServer* server = &group->servers[i];
+        if (i == target->server || server->down_until > now) continue;
+        decayRtt(server, now_ms);
+        uint64_t score = forward_select_mode == FORWARD_SELECT_HASH ? ~forwardHashWeight(key, &server->address)
+                                                                     : selectionCost(server);
+        if (best < 0 || score < best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    if (best < 0) return NULL;
+
+    UpstreamServer* server = &group->servers[best];
+    server->outstanding++;
+    server->sent++;
+    group->pending++;
+    target->server = (uint8_t)best;
+    return &server->address;
+}
+
+uint64_t forwardNameHash(const char* name, size_t len) {
+    if (len > 0 && name[len - 1] == '.') len--;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)tolower((unsigned char)name[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t forwardHashWeight(uint64_t key, const struct sockaddr_in* address) {
+    uint64_t seed = ((uint64_t)ntohl(address->sin_addr.s_addr) << 16) | ntohs(address->sin_port);
+    return mix64(key ^ mix64(seed));
+}
+
+const struct sockaddr_in* forwardAddress(ForwardTarget target) {
+    if (target.group >= group_count || target.server >= groups[target.group].server_count) return NULL;
+    return &groups[target.group].servers[target.server].address;
+}
+
+int forwardMatch(const char* name, size_t len) {
+    return matchGroup(name, len);
+}
+
+void forwardAnswered(ForwardTarget target, uint32_t rtt) {
+    if (target.group >= group_count || target.server >= groups[target.group].server_count) return;
+    UpstreamGroup* group = &groups[target.group];
+    UpstreamServer* server = &group->servers[target.server];
+
+    if (group->pending > 0) group->pending--;
+    if (rtt == 0) rtt = 1;
+    if (rtt > FORWARD_RTT_MAX) rtt = FORWARD_RTT_MAX;
+    // 与TCP的SRTT相同，新样本占1/8的权重
+    server->srtt = server->answered == 0 && server->timeouts == 0 ? rtt : (server->srtt * 7 + rtt) / 8;
+    server->answered++;
+    server->decay_at = GetTickCount64();
+    if (server->outstanding > 0) server->outstanding--;
+    if (server->down_until != 0) {
+        log_message(LOG_INFO, "Upstream %s:%d answering again", inet_ntoa(server->address.sin_addr),
+                    ntohs(server->address.sin_port));
+    }
+    server->failures = 0;
+    server->down_until = 0;
+}
+
+void forwardTimedOut(ForwardTarget target) {
+    if (target.group >= group_count || target.server >= groups[target.group].server_count) return;
+    UpstreamGroup* group = &groups[target.group];
+    UpstreamServer* server = &group->servers[target.server];
+
+    if (group->pending > 0) group->pending--;
+    uint32_t srtt = server->srtt * 2;
+    if (srtt < FORWARD_TIMEOUT_RTT) srtt = FORWARD_TIMEOUT_RTT;
+    server->srtt = srtt > FORWARD_RTT_MAX ? FORWARD_RTT_MAX : srtt;
+    server->timeouts++;
+    server->decay_at = GetTickCount64();
+    if (server->outstanding > 0) server->outstanding--;
+
+    // 连续超时的服务器暂时视为不可用；屏蔽结束后再超时一次就重新屏蔽
+    time_t now = time(NULL);
+    server->failures++;
+    if (server->failures >= FORWARD_DOWN_TIMEOUTS && server->down_until <= now) {
+        server->down_until = now + FORWARD_DOWN_HOLD;
+        log_message(LOG_INFO, "Upstream %s:%d timed out %u times in a row, skipped for %d s",
+                    inet_ntoa(server->address.sin_addr), ntohs(server->address.sin_port),
+                    (unsigned)server->failures, FORWARD_DOWN_HOLD);
+    }
+}
+
+int isUpstreamAddress(const struct sockaddr_in* addr) {
+    for (int g = 0; g < group_count; g++) {
+        for (int i = 0; i < groups[g].server_count; i++) {
+            if (sameAddress(addr, &groups[g].servers[i].address)) return 1;
+        }
+    }
+    return 0;
+}
+
+int forwardRuleCount(void) {
+    return rule_count;
+}
+
+int forwardGroupCount(void) {
+    return group_count;
+}
+
+void logForwardStats(void) {
+    for (int g = 0; g < group_count; g++) {
+        const UpstreamGroup* group = &groups[g];
+        log_message(LOG_DEBUG, "Upstream group %d: %d pending", g, group->pending);
+        for (int i = 0; i < group->server_count; i++) {
+            const UpstreamServer* server = &group->servers[i];
+            log_message(LOG_DEBUG, "  %s:%d srtt %ums, %u outstanding, sent %u, answered %u, timeouts %u%s",
+                        inet_ntoa(server->address.sin_addr), ntohs(server->address.sin_port),
+                        (unsigned)server->srtt, (unsigned)server->outstanding, (unsigned)server->sent, (unsigned)server->answered,
+                        (unsigned)server->timeouts, server->down_until > time(NULL) ? ", down" : "");
+        }
+    }
+}
+
+void destroyForwarding(void) {
+    freeNodes(&rootChildren);
+    rule_count = 0;
+    group_count = 0;
+}
@@ -0,0 +1,410 @@
+//本文件实现hosts文件的并行加载：文件映射后按行边界切块，多线程解析，再合并进hosts表
+#include "dns_hosts.h"
+#include "dns_reverse.h"
+#include <ctype.h>
+
+// 一条解析结果，域名直接指向映射中的文本
+typedef struct HostRecord {
+    const char* name;
+    uint64_t hash;                 // 在解析线程中预先计算，合并时不再计算
+    uint32_t len;
+    uint16_t type;                 // DNS_TYPE_A或DNS_TYPE_AAAA
+    uint8_t address[16];           // A记录只用前4字节
+    int wildcard;                  // 是否为"||域名^"展开出的"*.域名"规则，域名本身不含"*."前缀
+} HostRecord;
+
+// 一个解析线程负责的文本块及其结果
+typedef struct HostChunk {
+    const char* begin;
+    const char* end;
+    HostRecord* records;
+    size_t count;
+    size_t cap;
+    size_t name_bytes;
+    size_t invalid;
+    int failed;
+} HostChunk;
+
+// --- 内部辅助函数 ---
+
+static int isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// 跳到下一行的开头
+static const char* skipLine(const char* p, const char* end) {
+    const char* newline = (const char*)memchr(p, '\n', (size_t)(end - p));
+    return newline ? newline + 1 : end;
+}
+
+// 拼出"*.域名"形式的后缀规则，返回其长度
+static size_t wildcardName(char* buf, const char* name, size_t len) {
+    buf[0] = '*';
+    buf[1] = '.';
+    memcpy(buf + 2, name, len);
+    return len + 2;
+}
+
+static int appendRecord(HostChunk* chunk, const char* name, size_t len, uint16_t type, const uint8_t* address, int wildcard) {
+    if (chunk->count == chunk->cap) {
+        size_t new_cap = chunk->cap ? chunk->cap * 2 : 1024;
+        HostRecord* new_records = (HostRecord*)realloc(chunk->records, new_cap * sizeof(HostRecord));
+        if (!new_records) return 0;
+        chunk->records = new_records;
+        chunk->cap = new_cap;
+    }
+    HostRecord* record = &chunk->records[chunk->count++];
+    record->name = name;
+    record->len = (uint32_t)len;
+    record->wildcard = wildcard;
+    record->type = type;
+    memcpy(record->address, address, type == DNS_TYPE_AAAA ? 16 : 4);
+    if (wildcard) {
+        char buf[MAX_DOMAIN_LEN + 2];
+        record->hash = domainHash(buf, wildcardName(buf, name, len));
+        len += 2;
+    } else {
+        record->hash = domainHash(name, len);
+    }
+    chunk->name_bytes += len + 2;
+    return 1;
+}
+
+// 解析AdBlock风格的"||域名^"规则：拦截该域名及其所有子域名，'^'之后的选项被忽略
+static int parseAdblockRule(HostChunk* chunk, const char* p, const char* end) {
+    static const uint8_t blocked[4] = { 0, 0, 0, 0 };
+    const char* name = p + 2;
+    const char* q = name;
+    while (q < end && *q != '^' && *q != '$' && *q != '\n' && !isBlank(*q)) q++;
+    size_t len = (size_t)(q - name);
+    if (len == 0 || len + 2 >= MAX_DOMAIN_LEN || q >= end || *q != '^') {
+        chunk->invalid++;
+        return 1;
+    }
+    return appendRecord(chunk, name, len, DNS_TYPE_A, blocked, 0) &&
+           appendRecord(chunk, name, len, DNS_TYPE_A, blocked, 1);
+}
+
+// 解析一个文本块：每行"IP 域名 [域名...]"或"||域名^"，'#'和'!'开始注释
+static void parseChunk(HostChunk* chunk) {
+    const char* p = chunk->begin;
+    const char* end = chunk->end;
+
+    // 按平均每行约24字节预估记录数，减少扩容次数
+    chunk->cap = (size_t)(end - p) / 24 + 16;
+    chunk->records = (HostRecord*)malloc(chunk->cap * sizeof(HostRecord));
+    if (!chunk->records) {
+        chunk->failed = 1;
+        return;
+    }
+
+    while (p < end) {
+        while (p < end && isBlank(*p)) p++;
+        if (p >= end) break;
+        if (*p == '\n' || *p == '#' || *p == '!') {
+            p = skipLine(p, end);
+            continue;
+        }
+        if (p + 1 < end && p[0] == '|' && p[1] == '|') {
+            if (!parseAdblockRule(chunk, p, end)) {
+                chunk->failed = 1;
+                return;
+            }
+            p = skipLine(p, end);
+            continue;
+        }
+
+        // 先按IPv4解析，失败时再按IPv6解析
+        uint8_t address[16];
+        uint16_t type = DNS_TYPE_A;
+        size_t used = parseIPv4(p, end, address);
+        if (used == 0) {
+            used = parseIPv6(p, end, address);
+            type = DNS_TYPE_AAAA;
+        }
+        if (used == 0 || (p + used < end && !isBlank(p[used]))) {
+            chunk->invalid++;
+            p = skipLine(p, end);
+            continue;
+        }
+        p += used;
+
+        // 同一行可以有多个域名
+        while (p < end) {
+            while (p < end && isBlank(*p)) p++;
+            if (p >= end || *p == '\n' || *p == '#') break;
+
+            const char* name = p;
+            while (p < end && !isBlank(*p) && *p != '\n' && *p != '#') p++;
+            size_t len = (size_t)(p - name);
+            if (len >= MAX_DOMAIN_LEN) {
+                // 超长的域名与格式错误的行一样计入无效记录，同一行的其他域名照常加载
+                chunk->invalid++;
+                continue;
+            }
+            if (!appendRecord(chunk, name, len, type, address, 0)) {
+                chunk->failed = 1;
+                return;
+            }
+        }
+        p = skipLine(p, end);
+    }
+}
+
+static DWORD WINAPI parseWorker(LPVOID param) {
+    parseChunk((HostChunk*)param);
+    return 0;
+}
+
+// 根据文件大小和CPU核数决定线程数
+static int chooseThreadCount(size_t size) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    size_t threads = info.dwNumberOfProcessors;
+    if (threads > HOSTS_MAX_THREADS) threads = HOSTS_MAX_THREADS;
+    if (threads > size / HOSTS_MIN_CHUNK) threads = size / HOSTS_MIN_CHUNK;
+    return threads < 1 ? 1 : (int)threads;
+}
+
+// 把文本均分为若干块，每块的边界向后移动到换行符之后
+static int splitChunks(const char* data, size_t size, HostChunk* chunks, int count) {
+    const char* end = data + size;
+    const char* begin = data;
+    int used = 0;
+    for (int i = 0; i < count && begin < end; i++) {
+        const char* stop = (i == count - 1) ? end : data + size / count * (i + 1);
+        if (stop < begin) stop = begin;
+        if (stop < end) stop = skipLine(stop, end);
+        memset(&chunks[used], 0, sizeof(HostChunk));
+        chunks[used].begin = begin;
+        chunks[used].end = stop;
+        used++;
+        begin = stop;
+    }
+    return used;
+}
+
+// 多线程解析各块，线程创建失败时在当前线程中解析
+static void parseChunks(HostChunk* chunks, int count) {
+    HANDLE threads[HOSTS_MAX_THREADS];
+    int started[HOSTS_MAX_THREADS];
+
+    // 第0块由当前线程解析
+    for (int i = 1; i < count; i++) {
+        threads[i] = CreateThread(NULL, 0, parseWorker, &chunks[i], 0, NULL);
+        started[i] = threads[i] != NULL;
+    }
+    parseChunk(&chunks[0]);
+    for (int i = 1; i < count; i++) {
+        if (started[i]) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        } else {
+            parseChunk(&chunks[i]);
+        }
+    }
+}
+
+// 为一条hosts记录建立反向索引：反向域名指向该记录的域名，拦截记录和后缀规则不参与
+// 反向域名落在RFC 6303私有反向区时，同时登记它到区顶点之间的空非终结点
+static void mergeReverse(const HostRecord* record) {
+    size_t address_len = record->type == DNS_TYPE_AAAA ? 16 : 4;
+    if (record->name[0] == '*' || isZeroAddress(record->address, address_len)) return;
+
+    uint8_t target[DNS_RR_NAME_MAX_SIZE + 1];
+    if (wireName(record->name, record->len, target) == 0) return;
+
+    char name[REVERSE_NAME_MAX];
+    size_t len = reverseName(record->type, record->address, name);
+    mergeNode(DNS_TYPE_PTR, target, HOSTS_DEFAULT_TTL, name, len, domainHash(name, len));
+
+    // 私有反向区中，反向域名和区顶点之间的上级名字是空非终结点，登记后查询它们得到NODATA
+    int apex = privateReverseZone(name, len);
+    for (int i = 0; i + 1 < apex; i++) {
+        if (name[i] == '.') markNode(name + i + 1, len - i - 1, domainHash(name + i + 1, len - i - 1));
+    }
+}
+
+// --- 公开接口实现 ---
+
+size_t parseIPv4(const char* text, const char* end, uint8_t dest[4]) {
+    const char* p = text;
+    for (int part = 0; part < 4; part++) {
+        if (part > 0) {
+            if (p >= end || *p != '.') return 0;
+            p++;
+        }
+        unsigned value = 0;
+        int digits = 0;
+        while (p < end && *p >= '0' && *p <= '9' && digits < 3) {
+            value = value * 10 + (unsigned)(*p - '0');
+            p++;
+            digits++;
+        }
+        if (digits == 0 || value > 255) return 0;
+        dest[part] = (uint8_t)value;
+    }
+    // 多出的数字或'.'说明格式不对，例如"1.2.3.4.5"或"1.2.3.4567"
+    if (p < end && (*p == '.' || (*p >= '0' && *p <= '9'))) return 0;
+    return (size_t)(p - text);
+}
+
+size_t parseIPv6(const char* text, const char* end, uint8_t dest[16]) {
+    uint8_t words[16];
+    int count = 0;          // 已解析的字节数
+    int gap = -1;           // "::"所在的字节位置
+    const char* p = text;
+
+    if (p + 1 < end && p[0] == ':' && p[1] == ':') {
+        gap = 0;
+        p += 2;
+    }
+    while (p < end && count < 16) {
+        // 末尾可以是点分十进制的IPv4地址，例如"::ffff:1.2.3.4"
+        const char* q = p;
+        while (q < end && isxdigit((unsigned char)*q)) q++;
+        if (q < end && *q == '.' && count <= 12) {
+            size_t used = parseIPv4(p, end, words + count);
+            if (used == 0) return 0;
+            p += used;
+            count += 4;
+            break;
+        }
+        if (q == p || q - p > 4) break;
+
+        unsigned value = 0;
+        for (; p < q; p++) {
+            value = value * 16 + (unsigned)(isdigit((unsigned char)*p) ? *p - '0' : (tolower((unsigned char)*p) - 'a' + 10));
+        }
+        words[count++] = (uint8_t)(value >> 8);
+        words[count++] = (uint8_t)value;
+
+        if (p >= end || *p != ':') break;
+        if (p + 1 < end && p[1] == ':') {
+            if (gap >= 0) return 0; // 只能有一个"::"
+            gap = count;
+            p += 2;
+        } else {
+            p++;
+            // 单个':'之后必须还有一组
+            if (p >= end || !isxdigit((unsigned char)*p)) return 0;
+        }
+    }
+
+    // 多出的十六进制数字、':'或'.'说明格式不对
+    if (p < end && (isxdigit((unsigned char)*p) || *p == ':' || *p == '.')) return 0;
+    if (gap < 0 ? count != 16 : count > 14) return 0;
+
+    // 把"::"之后的部分移到末尾，中间补0
+    size_t tail = gap < 0 ? 0 : (size_t)(count - gap);
+    memset(dest, 0, 16);
+    if (gap < 0) {
+        memcpy(dest, words, 16);
+    } else {
+        memcpy(dest, words, (size_t)gap);
+        memcpy(dest + 16 - tail, words + gap, tail);
+    }
+    return (size_t)(p - text);
+}
+
+int loadHostFile(const char* path, HostLoadStats* stats) {
+    if (stats) memset(stats, 0, sizeof(HostLoadStats));
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return 0;
+    }
+    if (file_size.QuadPart == 0) {
+        // 空文件无法创建映射，视为没有记录
+        CloseHandle(file);
+        return 1;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const char* data = mapping ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!data) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return 0;
+    }
+
+    size_t size = (size_t)file_size.QuadPart;
+    HostChunk chunks[HOSTS_MAX_THREADS];
+    int count = splitChunks(data, size, chunks, chooseThreadCount(size));
+    parseChunks(chunks, count);
+
+    // 先按记录总数一次性预留空间
+    size_t total = 0;
+    size_t name_bytes = 0;
+    for (int i = 0; i < count; i++) {
+        total += chunks[i].count;
+        name_bytes += chunks[i].name_bytes;
+    }
+    reserveDnsResolver(total, name_bytes);
+
+    // 按块的顺序依次合并，hosts表本身不是线程安全的
+    size_t records = 0;
+    size_t invalid = 0;
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        failed |= chunks[i].failed;
+        invalid += chunks[i].invalid;
+        for (size_t j = 0; j < chunks[i].count; j++) {
+            if (j + HOSTS_PREFETCH_DISTANCE < chunks[i].count) {
+                prefetchNode(chunks[i].records[j + HOSTS_PREFETCH_DISTANCE].hash);
+            }
+            const HostRecord* record = &chunks[i].records[j];
+            if (record->wildcard) {
+                char buf[MAX_DOMAIN_LEN + 2];
+                size_t len = wildcardName(buf, record->name, record->len);
+                mergeNode(record->type, record->address, HOSTS_DEFAULT_TTL, buf, len, record->hash);
+            } else {
+                mergeNode(record->type, record->address, HOSTS_DEFAULT_TTL, record->name, record->len, record->hash);
+                mergeReverse(record);
+            }
+        }
+        records += chunks[i].count;
+        free(chunks[i].records);
+    }
+
+    UnmapViewOfFile(data);
+    CloseHandle(mapping);
+    CloseHandle(file);
+
+    if (failed) {
+        log_message(LOG_ERROR, "Hosts: out of memory while parsing %s, some records were dropped", path);
+    }
+    if (stats) {
+        stats->record_count = records;
+        stats->invalid_count = invalid;
+        resolverMemoryUsage(&stats->domain_count);
+    }
+    return 1;
+}
+
+int loadHostTable(const char* path, HostLoadStats* stats) {
+    HostLoadStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(HostLoadStats));
+
+    // 路径指向编译好的二进制镜像时直接映射，无需解析
+    int image = loadDnsResolverImage(path);
+    if (image < 0) return -1;
+    if (image > 0) {
+        stats->from_image = 1;
+        stats->frozen = 1;
+        resolverMemoryUsage(&stats->domain_count);
+        return 1;
+    }
+
+    if (!loadHostFile(path, stats)) return 0;
+
+    // hosts表此后不再变化，构建最小完美哈希
+    stats->frozen = freezeDnsResolver();
+    return 1;
+}
@@ -22,6 +22,8 @@ const char* type_to_string(uint16_t type) {
         case DNS_TYPE_MX: return "MX";
         case DNS_TYPE_TXT: return "TXT";
         case DNS_TYPE_AAAA: return "AAAA";
+        case DNS_TYPE_SRV: return "SRV";
+        case DNS_TYPE_ANY: return "ANY";
         default: return "Unknown";
     }
 }
@@ -192,6 +194,35 @@ void printAnswer(dns_Message* msg) {
     log_message(LOG_DEBUG, "--------------------------------------------------------------------");
 }
 
+// 打印授权或附加部分的全部记录，部分为空时不输出
+static void printSection(const char* title, const dns_rr* rr) {
+    if (!rr) return;
+    log_message(LOG_DEBUG, "-------------------------DNS %s Section-------------------------", title);
+    int count = 1;
+    while (rr) {
+        log_message(LOG_DEBUG, "[%d]", count++);
+        printRR(rr);
+        rr = rr->next;
+    }
+    log_message(LOG_DEBUG, "--------------------------------------------------------------------");
+}
+
+/**
+ * @brief 打印DNS报文的授权部分。
+ * @param msg 指向包含已解析报文的dns_Message结构体。
+ */
+void printAuthority(dns_Message* msg) {
+    if (msg) printSection("Authority", msg->authority);
+}
+
+/**
+ * @brief 打印DNS报文的附加部分。
+ * @param msg 指向包含已解析报文的dns_Message结构体。
+ */
+void printAdditional(dns_Message* msg) {
+    if (msg) printSection("Additional", msg->additional);
+}
+
 /**
  * @brief 答应问题和回答数以及问题和回答种类
  */
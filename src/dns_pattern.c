@@ -0,0 +1,719 @@
+//本文件实现模式规则引擎：通配符和正则规则先构造为NFA，再用子集构造合并为一个DFA，
+//查询时对域名只做一次扫描，代价与规则数量无关
+#include "dns_pattern.h"
+#include "uthash.h"
+#include <ctype.h>
+
+// --- NFA（Thompson构造） ---
+
+enum NfaType {
+    NFA_SET,                       // 接受set中的一个字节后转到out
+    NFA_SPLIT,                     // 空转移到out和out1（out1为-1时只有一条）
+    NFA_MATCH                      // 规则rule匹配成功
+};
+
+typedef struct NfaState {
+    int type;
+    int out;
+    int out1;
+    int rule;
+    int sticky;                    // MATCH状态之后可接任意字符串，一旦到达即可判定命中
+    uint32_t set[8];               // 256位字节集合
+} NfaState;
+
+typedef struct Nfa {
+    NfaState* states;
+    int count;
+    int cap;
+} Nfa;
+
+// NFA片段：end是一个尚未连接出口的SPLIT状态
+typedef struct Frag {
+    int start;
+    int end;
+} Frag;
+
+// 解析状态
+typedef struct Parser {
+    const char* p;
+    const char* end;
+    Nfa* nfa;
+    int depth;
+    int error;
+    int sticky;                    // 规则以任意字符串结尾，省去末尾的".*"
+} Parser;
+
+// --- DFA ---
+
+typedef struct PatternDfa {
+    uint8_t classes[256];          // 字节到等价类的映射
+    int class_count;
+    int state_count;
+    int start;
+    uint16_t* trans;               // state_count * class_count 的转移表，0为死状态
+    int32_t* accept;               // 每个状态命中的规则编号，-1表示不接受
+} PatternDfa;
+
+// 子集构造中NFA状态集合到DFA状态的映射
+typedef struct DfaKey {
+    int id;
+    int count;
+    int* states;
+    UT_hash_handle hh;
+} DfaKey;
+
+static PatternDfa* g_dfa = NULL;   // 当前使用的DFA
+static char** g_rules = NULL;      // 被接受的规则原文，下标即规则编号
+static int g_rule_count = 0;
+
+// --- NFA构造 ---
+
+static int nfaAdd(Nfa* nfa, int type) {
+    if (nfa->count == nfa->cap) {
+        int new_cap = nfa->cap ? nfa->cap * 2 : 256;
+        NfaState* states = (NfaState*)realloc(nfa->states, new_cap * sizeof(NfaState));
+        if (!states) return -1;
+        nfa->states = states;
+        nfa->cap = new_cap;
+    }
+    NfaState* state = &nfa->states[nfa->count];
+    memset(state, 0, sizeof(NfaState));
+    state->type = type;
+    state->out = -1;
+    state->out1 = -1;
+    state->rule = -1;
+    return nfa->count++;
+}
+
+static void setAdd(uint32_t* set, int c) {
+    set[c >> 5] |= 1u << (c & 31);
+}
+
+static int setHas(const uint32_t* set, int c) {
+    return (set[c >> 5] >> (c & 31)) & 1;
+}
+
+// 不区分大小写：字母的另一种大小写也加入集合
+static void setAddFolded(uint32_t* set, int c) {
+    setAdd(set, c);
+    if (c >= 'a' && c <= 'z') setAdd(set, c - 'a' + 'A');
+    if (c >= 'A' && c <= 'Z') setAdd(set, c - 'A' + 'a');
+}
+
+static Frag fragFail(Parser* ps) {
+    Frag f = { -1, -1 };
+    ps->error = 1;
+    return f;
+}
+
+static Frag fragSet(Parser* ps, const uint32_t* set) {
+    int s = nfaAdd(ps->nfa, NFA_SET);
+    int e = nfaAdd(ps->nfa, NFA_SPLIT);
+    if (s < 0 || e < 0) return fragFail(ps);
+    memcpy(ps->nfa->states[s].set, set, sizeof(ps->nfa->states[s].set));
+    ps->nfa->states[s].out = e;
+    Frag f = { s, e };
+    return f;
+}
+
+static Frag fragAny(Parser* ps) {
+    uint32_t set[8];
+    memset(set, 0xFF, sizeof(set));
+    return fragSet(ps, set);
+}
+
+static Frag fragChar(Parser* ps, int c) {
+    uint32_t set[8] = { 0 };
+    setAddFolded(set, c);
+    return fragSet(ps, set);
+}
+
+static Frag fragEmpty(Parser* ps) {
+    int e = nfaAdd(ps->nfa, NFA_SPLIT);
+    if (e < 0) return fragFail(ps);
+    Frag f = { e, e };
+    return f;
+}
+
+static Frag fragConcat(Parser* ps, Frag a, Frag b) {
+    if (ps->error) return a;
+    ps->nfa->states[a.end].out = b.start;
+    Frag f = { a.start, b.end };
+    return f;
+}
+
+static Frag fragAlt(Parser* ps, Frag a, Frag b) {
+    if (ps->error) return a;
+    int s = nfaAdd(ps->nfa, NFA_SPLIT);
+    int e = nfaAdd(ps->nfa, NFA_SPLIT);
+    if (s < 0 || e < 0) return fragFail(ps);
+    ps->nfa->states[s].out = a.start;
+    ps->nfa->states[s].out1 = b.start;
+    ps->nfa->states[a.end].out = e;
+    ps->nfa->states[b.end].out = e;
+    Frag f = { s, e };
+    return f;
+}
+
+// op为'*'、'+'或'?'
+static Frag fragRepeat(Parser* ps, Frag a, char op) {
+    if (ps->error) return a;
+    int s = nfaAdd(ps->nfa, NFA_SPLIT);
+    int e = nfaAdd(ps->nfa, NFA_SPLIT);
+    if (s < 0 || e < 0) return fragFail(ps);
+    NfaState* states = ps->nfa->states;
+    states[s].out = a.start;
+    states[s].out1 = e;
+    // '*'和'+'在片段结束后回到分支点，'?'直接结束
+    states[a.end].out = (op == '?') ? e : s;
+    Frag f = { op == '+' ? a.start : s, e };
+    return f;
+}
+
+// 解析字符类，ps->p指向'['之后
+static Frag parseClass(Parser* ps) {
+    uint32_t set[8] = { 0 };
+    int negate = 0;
+    int items = 0;
+    if (ps->p < ps->end && *ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+    while (ps->p < ps->end && *ps->p != ']') {
+        int lo = (unsigned char)*ps->p++;
+        if (lo == '\\' && ps->p < ps->end) lo = (unsigned char)*ps->p++;
+        int hi = lo;
+        if (ps->p + 1 < ps->end && *ps->p == '-' && ps->p[1] != ']') {
+            hi = (unsigned char)ps->p[1];
+            ps->p += 2;
+            if (hi < lo) return fragFail(ps);
+        }
+        for (int c = lo; c <= hi; c++) setAddFolded(set, c);
+        items++;
+    }
+    if (ps->p >= ps->end || items == 0) return fragFail(ps); // 缺少']'或字符类为空
+    ps->p++;
+    if (negate) {
+        for (int i = 0; i < 8; i++) set[i] = ~set[i];
+    }
+    return fragSet(ps, set);
+}
+
+static Frag parseAlt(Parser* ps);
+
+static Frag parseAtom(Parser* ps) {
+    char c = *ps->p++;
+    switch (c) {
+        case '(': {
+            if (++ps->depth > PATTERN_MAX_DEPTH) return fragFail(ps);
+            Frag f = parseAlt(ps);
+            ps->depth--;
+            if (ps->error || ps->p >= ps->end || *ps->p != ')') return fragFail(ps);
+            ps->p++;
+            return f;
+        }
+        case '[':
+            return parseClass(ps);
+        case '.':
+            return fragAny(ps);
+        case '\\':
+            if (ps->p >= ps->end) return fragFail(ps);
+            return fragChar(ps, (unsigned char)*ps->p++);
+        case '*':
+        case '+':
+        case '?':
+        case ')':
+        case '|':
+            return fragFail(ps); // 重复符号前没有内容，或括号不匹配
+        default:
+            return fragChar(ps, (unsigned char)c);
+    }
+}
+
+static Frag parseRepeatExpr(Parser* ps) {
+    Frag f = parseAtom(ps);
+    while (!ps->error && ps->p < ps->end && (*ps->p == '*' || *ps->p == '+' || *ps->p == '?')) {
+        f = fragRepeat(ps, f, *ps->p++);
+    }
+    return f;
+}
+
+static Frag parseConcat(Parser* ps) {
+    Frag f = fragEmpty(ps);
+    while (!ps->error && ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+        f = fragConcat(ps, f, parseRepeatExpr(ps));
+    }
+    return f;
+}
+
+static Frag parseAlt(Parser* ps) {
+    Frag f = parseConcat(ps);
+    while (!ps->error && ps->p < ps->end && *ps->p == '|') {
+        ps->p++;
+        f = fragAlt(ps, f, parseConcat(ps));
+    }
+    return f;
+}
+
+// 通配符规则：'*'、'?'、字符类和转义，其余字符按字面匹配
+static Frag parseGlob(Parser* ps) {
+    Frag f = fragEmpty(ps);
+    while (!ps->error && ps->p < ps->end) {
+        char c = *ps->p++;
+        Frag atom;
+        if (c == '*' && ps->p == ps->end) {
+            ps->sticky = 1;
+            break;
+        } else if (c == '*') {
+            atom = fragRepeat(ps, fragAny(ps), '*');
+        } else if (c == '?') {
+            atom = fragAny(ps);
+        } else if (c == '[') {
+            atom = parseClass(ps);
+        } else if (c == '\\' && ps->p < ps->end) {
+            atom = fragChar(ps, (unsigned char)*ps->p++);
+        } else {
+            atom = fragChar(ps, (unsigned char)c);
+        }
+        f = fragConcat(ps, f, atom);
+    }
+    return f;
+}
+
+// 把一条规则编译进NFA，成功时返回其起始状态，失败返回-1。
+// 开头未锚定的规则不自带前缀".*"，*floating置1，由调用方挂到所有规则共用的前缀循环上
+static int compileRule(Nfa* nfa, const char* rule, int rule_id, int* floating) {
+    size_t len = strlen(rule);
+    Parser ps = { rule, rule + len, nfa, 0, 0, 0 };
+    Frag f;
+
+    if (len >= 2 && rule[0] == '/' && rule[len - 1] == '/') {
+        // 正则规则：未锚定的开头可从任意位置开始，未锚定的结尾视为可接任意字符串
+        const char* body = rule + 1;
+        const char* body_end = rule + len - 1;
+        int anchor_start = body < body_end && *body == '^';
+        int anchor_end = body_end > body + anchor_start && body_end[-1] == '$' &&
+                         !(body_end - 1 > body && body_end[-2] == '\\');
+        ps.p = body + anchor_start;
+        ps.end = body_end - anchor_end;
+
+        f = parseAlt(&ps);
+        if (!ps.error && ps.p != ps.end) return -1; // 多余的')'
+        *floating = !anchor_start;
+        ps.sticky = !anchor_end;
+    } else {
+        // 通配符以'*'开头时同样改用共用的前缀循环
+        *floating = rule[0] == '*';
+        ps.p += *floating;
+        f = parseGlob(&ps);
+    }
+    if (ps.error) return -1;
+
+    int match = nfaAdd(nfa, NFA_MATCH);
+    if (match < 0) return -1;
+    nfa->states[match].rule = rule_id;
+    nfa->states[match].sticky = ps.sticky;
+    nfa->states[f.end].out = match;
+    return f.start;
+}
+
+// --- 子集构造 ---
+
+// 按所有NFA字节集合细分出等价类：同一类中的字节在任何状态下的转移都相同
+static int computeClasses(const Nfa* nfa, uint8_t classes[256]) {
+    int class_count = 1;
+    memset(classes, 0, 256);
+    int remap[512];
+    for (int i = 0; i < nfa->count; i++) {
+        if (nfa->states[i].type != NFA_SET) continue;
+        for (int k = 0; k < class_count * 2; k++) remap[k] = -1;
+        int next = 0;
+        for (int c = 0; c < 256; c++) {
+            int key = classes[c] * 2 + setHas(nfa->states[i].set, c);
+            if (remap[key] < 0) remap[key] = next++;
+            classes[c] = (uint8_t)remap[key];
+        }
+        class_count = next;
+    }
+    return class_count;
+}
+
+static int compareInt(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// 求空转移闭包，结果只保留SET和MATCH状态并排序，作为DFA状态的标识
+static int closure(const Nfa* nfa, const int* seeds, int seed_count, int* out, int* stack, int* mark, int stamp) {
+    int top = 0;
+    int count = 0;
+    for (int i = 0; i < seed_count; i++) {
+        if (mark[seeds[i]] != stamp) {
+            mark[seeds[i]] = stamp;
+            stack[top++] = seeds[i];
+        }
+    }
+    while (top > 0) {
+        int s = stack[--top];
+        const NfaState* state = &nfa->states[s];
+        if (state->type != NFA_SPLIT) {
+            out[count++] = s;
+            continue;
+        }
+        if (state->out >= 0 && mark[state->out] != stamp) {
+            mark[state->out] = stamp;
+            stack[top++] = state->out;
+        }
+        if (state->out1 >= 0 && mark[state->out1] != stamp) {
+            mark[state->out1] = stamp;
+            stack[top++] = state->out1;
+        }
+    }
+    qsort(out, count, sizeof(int), compareInt);
+    return count;
+}
+
+// 集合中有可接任意后缀的MATCH状态时，之后无论输入什么都会命中，整个集合收缩为这一个状态，
+// 避免已命中的规则与其他规则的进度组合出大量无用的DFA状态
+static int collapseSticky(const Nfa* nfa, int* states, int count) {
+    int sticky = -1;
+    for (int i = 0; i < count; i++) {
+        const NfaState* state = &nfa->states[states[i]];
+        if (state->type == NFA_MATCH && state->sticky &&
+            (sticky < 0 || state->rule < nfa->states[sticky].rule)) {
+            sticky = states[i];
+        }
+    }
+    if (sticky < 0) return count;
+    states[0] = sticky;
+    return 1;
+}
+
+static void freeDfa(PatternDfa* dfa) {
+    if (!dfa) return;
+    free(dfa->trans);
+    free(dfa->accept);
+    free(dfa);
+}
+
+// 查找或新建NFA状态集合对应的DFA状态，返回其编号；超过上限或内存不足返回-1
+static int internState(DfaKey** index, PatternDfa* dfa, const Nfa* nfa, const int* states, int count,
+                       DfaKey*** order, int* order_cap) {
+    DfaKey* key = NULL;
+    HASH_FIND(hh, *index, states, count * sizeof(int), key);
+    if (key) return key->id;
+    if (dfa->state_count >= PATTERN_MAX_STATES) return -1;
+
+    if (dfa->state_count == *order_cap) {
+        int new_cap = *order_cap * 2;
+        DfaKey** new_order = (DfaKey**)realloc(*order, new_cap * sizeof(DfaKey*));
+        uint16_t* trans = (uint16_t*)realloc(dfa->trans, (size_t)new_cap * dfa->class_count * sizeof(uint16_t));
+        if (trans) dfa->trans = trans;
+        int32_t* accept = (int32_t*)realloc(dfa->accept, new_cap * sizeof(int32_t));
+        if (accept) dfa->accept = accept;
+        if (new_order) *order = new_order;
+        if (!new_order || !trans || !accept) return -1;
+        *order_cap = new_cap;
+    }
+
+    key = (DfaKey*)malloc(sizeof(DfaKey));
+    int* copy = (int*)malloc((count ? count : 1) * sizeof(int));
+    if (!key || !copy) {
+        free(key);
+        free(copy);
+        return -1;
+    }
+    if (count > 0) memcpy(copy, states, count * sizeof(int));
+    key->id = dfa->state_count++;
+    key->count = count;
+    key->states = copy;
+    HASH_ADD_KEYPTR(hh, *index, key->states, count * sizeof(int), key);
+    (*order)[key->id] = key;
+
+    // 集合中编号最小的规则作为命中规则
+    int rule = -1;
+    for (int i = 0; i < count; i++) {
+        const NfaState* state = &nfa->states[states[i]];
+        if (state->type == NFA_MATCH && (rule < 0 || state->rule < rule)) rule = state->rule;
+    }
+    dfa->accept[key->id] = rule;
+    return key->id;
+}
+
+// 把一组规则编译为DFA；rule_ids[i]是第i条规则在g_rules中的编号
+static PatternDfa* buildDfa(char** rules, const int* rule_ids, int rule_count) {
+    Nfa nfa = { NULL, 0, 0 };
+    PatternDfa* dfa = NULL;
+    DfaKey* index = NULL;
+    DfaKey** order = NULL;
+    int* work = NULL;
+    int* seeds = NULL;
+    int seed_cap = 0;
+    int* stack = NULL;
+    int* mark = NULL;
+    int* class_begin = NULL;
+    uint8_t* class_list = NULL;
+    int ok = 0;
+
+    // 总起点root分出两条SPLIT链：锚定开头的规则直接挂在root上，
+    // 未锚定的规则挂在共用的前缀循环loop上，这样每个DFA状态只含一份".*"
+    int heads[2] = { -1, -1 };     // [0]锚定链，[1]前缀循环链
+    for (int i = 0; i < rule_count; i++) {
+        int floating = 0;
+        int start = compileRule(&nfa, rules[i], rule_ids[i], &floating);
+        int link = nfaAdd(&nfa, NFA_SPLIT);
+        if (start < 0 || link < 0) goto cleanup;
+        nfa.states[link].out = start;
+        nfa.states[link].out1 = heads[floating];
+        heads[floating] = link;
+    }
+    int root = nfaAdd(&nfa, NFA_SPLIT);
+    int loop = nfaAdd(&nfa, NFA_SPLIT);
+    int any = nfaAdd(&nfa, NFA_SET);
+    if (root < 0 || loop < 0 || any < 0) goto cleanup;
+    nfa.states[root].out = heads[0];
+    nfa.states[root].out1 = heads[1] >= 0 ? loop : -1;  // 全是锚定规则时不需要前缀循环
+    nfa.states[loop].out = any;
+    nfa.states[loop].out1 = heads[1];
+    memset(nfa.states[any].set, 0xFF, sizeof(nfa.states[any].set));
+    nfa.states[any].out = loop;
+
+    dfa = (PatternDfa*)calloc(1, sizeof(PatternDfa));
+    if (!dfa) goto cleanup;
+    dfa->class_count = computeClasses(&nfa, dfa->classes);
+
+    int order_cap = 64;
+    order = (DfaKey**)malloc(order_cap * sizeof(DfaKey*));
+    dfa->trans = (uint16_t*)malloc((size_t)order_cap * dfa->class_count * sizeof(uint16_t));
+    dfa->accept = (int32_t*)malloc(order_cap * sizeof(int32_t));
+    work = (int*)malloc(nfa.count * sizeof(int));
+    stack = (int*)malloc(nfa.count * sizeof(int));
+    mark = (int*)calloc(nfa.count, sizeof(int));
+    class_begin = (int*)calloc(nfa.count + 1, sizeof(int));
+    if (!order || !dfa->trans || !dfa->accept || !work || !stack || !mark || !class_begin) goto cleanup;
+
+    // 预先列出每个SET状态接受的等价类，转移时只需遍历这些类
+    int representative[256];
+    for (int c = 255; c >= 0; c--) representative[dfa->classes[c]] = c;
+    int list_size = 0;
+    for (int i = 0; i < nfa.count; i++) {
+        class_begin[i] = list_size;
+        if (nfa.states[i].type != NFA_SET) continue;
+        for (int cls = 0; cls < dfa->class_count; cls++) {
+            list_size += setHas(nfa.states[i].set, representative[cls]);
+        }
+    }
+    class_begin[nfa.count] = list_size;
+    class_list = (uint8_t*)malloc(list_size ? list_size : 1);
+    if (!class_list) goto cleanup;
+    for (int i = 0, k = 0; i < nfa.count; i++) {
+        if (nfa.states[i].type != NFA_SET) continue;
+        for (int cls = 0; cls < dfa->class_count; cls++) {
+            if (setHas(nfa.states[i].set, representative[cls])) class_list[k++] = (uint8_t)cls;
+        }
+    }
+
+    // 状态0是空集合（死状态），状态1是起点
+    int stamp = 1;
+    if (internState(&index, dfa, &nfa, NULL, 0, &order, &order_cap) != 0) goto cleanup;
+    int start_count = collapseSticky(&nfa, work, closure(&nfa, &root, 1, work, stack, mark, stamp++));
+    dfa->start = internState(&index, dfa, &nfa, work, start_count, &order, &order_cap);
+    if (dfa->start < 0) goto cleanup;
+
+    // 按编号顺序处理，新状态总是追加在末尾，相当于一个队列
+    int bucket[257];
+    for (int id = 0; id < dfa->state_count; id++) {
+        const DfaKey* key = order[id];
+
+        // 一次遍历把各NFA状态的后继按等价类分桶，得到每个类的种子集合
+        memset(bucket, 0, sizeof(bucket));
+        for (int i = 0; i < key->count; i++) {
+            int s = key->states[i];
+            if (nfa.states[s].type == NFA_MATCH && nfa.states[s].sticky) {
+                for (int cls = 0; cls < dfa->class_count; cls++) bucket[cls + 1]++;
+            }
+            for (int k = class_begin[s]; k < class_begin[s + 1]; k++) bucket[class_list[k] + 1]++;
+        }
+        for (int cls = 0; cls < dfa->class_count; cls++) bucket[cls + 1] += bucket[cls];
+        if (bucket[dfa->class_count] > seed_cap) {
+            seed_cap = bucket[dfa->class_count] * 2;
+            int* grown = (int*)realloc(seeds, seed_cap * sizeof(int));
+            if (!grown) goto cleanup;
+            seeds = grown;
+        }
+        for (int i = 0; i < key->count; i++) {
+            int s = key->states[i];
+            if (nfa.states[s].type == NFA_MATCH && nfa.states[s].sticky) {
+                for (int cls = 0; cls < dfa->class_count; cls++) seeds[bucket[cls]++] = s;
+            }
+            for (int k = class_begin[s]; k < class_begin[s + 1]; k++) seeds[bucket[class_list[k]]++] = nfa.states[s].out;
+        }
+
+        // 分桶后bucket[cls]指向第cls类的末尾，也就是第cls+1类的开头
+        int begin = 0;
+        for (int cls = 0; cls < dfa->class_count; cls++) {
+            int count = closure(&nfa, seeds + begin, bucket[cls] - begin, work, stack, mark, stamp++);
+            begin = bucket[cls];
+            count = collapseSticky(&nfa, work, count);
+            int next = internState(&index, dfa, &nfa, work, count, &order, &order_cap);
+            if (next < 0) goto cleanup; // 状态数超过上限
+            dfa->trans[(size_t)id * dfa->class_count + cls] = (uint16_t)next;
+        }
+    }
+    ok = 1;
+
+cleanup:
+    {
+        DfaKey* key;
+        DfaKey* tmp;
+        HASH_ITER(hh, index, key, tmp) {
+            HASH_DEL(index, key);
+            free(key->states);
+            free(key);
+        }
+    }
+    free(order);
+    free(work);
+    free(seeds);
+    free(class_begin);
+    free(class_list);
+    free(stack);
+    free(mark);
+    free(nfa.states);
+    if (!ok) {
+        freeDfa(dfa);
+        return NULL;
+    }
+    return dfa;
+}
+
+// 去掉行首尾的空白
+static char* trimLine(char* line) {
+    while (*line && isspace((unsigned char)*line)) line++;
+    size_t len = strlen(line);
+    while (len > 0 && isspace((unsigned char)line[len - 1])) line[--len] = '\0';
+    return line;
+}
+
+// --- 公开接口实现 ---
+
+int loadPatternFile(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+
+    destroyPatterns();
+
+    // 读入全部规则，语法错误的规则直接跳过
+    int cap = 64;
+    char** rules = (char**)malloc(cap * sizeof(char*));
+    int count = 0;
+    char line[PATTERN_LINE_MAX];
+    int line_no = 0;
+    while (rules && fgets(line, sizeof(line), file)) {
+        line_no++;
+        char* rule = trimLine(line);
+        if (*rule == '\0' || *rule == '#') continue;
+
+        Nfa probe = { NULL, 0, 0 };
+        int floating;
+        int valid = compileRule(&probe, rule, 0, &floating) >= 0;
+        free(probe.states);
+        if (!valid) {
+            log_message(LOG_ERROR, "Pattern: syntax error at line %d: %s", line_no, rule);
+            continue;
+        }
+
+        // 单独一条就会超限的规则提前拒绝，避免整体构建反复失败
+        int zero = 0;
+        PatternDfa* solo = buildDfa(&rule, &zero, 1);
+        if (!solo) {
+            log_message(LOG_ERROR, "Pattern: rule rejected at line %d, DFA would exceed %d states: %s",
+                        line_no, PATTERN_MAX_STATES, rule);
+            continue;
+        }
+        freeDfa(solo);
+        if (count == cap) {
+            cap *= 2;
+            char** grown = (char**)realloc(rules, cap * sizeof(char*));
+            if (!grown) break;
+            rules = grown;
+        }
+        rules[count] = strdup(rule);
+        if (rules[count]) count++;
+    }
+    fclose(file);
+    if (!rules) return 0;
+
+    int* ids = (int*)malloc((count ? count : 1) * sizeof(int));
+    if (!ids) {
+        for (int i = 0; i < count; i++) free(rules[i]);
+        free(rules);
+        return 0;
+    }
+    for (int i = 0; i < count; i++) ids[i] = i;
+
+    // 先整体构建；状态数超限时分批加入，某批失败就减半重试，直到定位并拒绝使DFA超限的单条规则
+    PatternDfa* dfa = count > 0 ? buildDfa(rules, ids, count) : NULL;
+    int accepted = count;
+    char** pending = (count > 0 && !dfa) ? (char**)malloc(count * sizeof(char*)) : NULL;
+    if (pending) {
+        memcpy(pending, rules, count * sizeof(char*));
+        accepted = 0;
+        int batch = count / 2 > 0 ? count / 2 : 1;
+        for (int i = 0; i < count;) {
+            int n = count - i < batch ? count - i : batch;
+            memcpy(rules + accepted, pending + i, n * sizeof(char*));
+            PatternDfa* trial = buildDfa(rules, ids, accepted + n);
+            if (trial) {
+                freeDfa(dfa);
+                dfa = trial;
+                accepted += n;
+                i += n;
+            } else if (n > 1) {
+                batch = n / 2;
+            } else {
+                log_message(LOG_ERROR, "Pattern: rule rejected, DFA would exceed %d states: %s",
+                            PATTERN_MAX_STATES, pending[i]);
+                free(pending[i]);
+                i++;
+            }
+        }
+        free(pending);
+    } else if (count > 0 && !dfa) {
+        accepted = 0;
+        for (int i = 0; i < count; i++) free(rules[i]);
+    }
+    free(ids);
+
+    g_dfa = dfa;
+    g_rules = rules;
+    g_rule_count = accepted;
+    if (dfa) {
+        log_message(LOG_INFO, "Pattern: %d rules compiled into %d DFA states, %d byte classes",
+                    accepted, dfa->state_count, dfa->class_count);
+    }
+    return accepted;
+}
+
+const char* patternMatch(const char* domain) {
+    const PatternDfa* dfa = g_dfa;
+    if (!dfa) return NULL;
+
+    int state = dfa->start;
+    for (const unsigned char* p = (const unsigned char*)domain; *p; p++) {
+        state = dfa->trans[(size_t)state * dfa->class_count + dfa->classes[*p]];
+        if (state == 0) return NULL; // 死状态，任何规则都不可能再命中
+    }
+    int rule = dfa->accept[state];
+    return rule >= 0 ? g_rules[rule] : NULL;
+}
+
+void destroyPatterns(void) {
+    freeDfa(g_dfa);
+    g_dfa = NULL;
+    for (int i = 0; i < g_rule_count; i++) free(g_rules[i]);
+    free(g_rules);
+    g_rules = NULL;
+    g_rule_count = 0;
+}
@@ -0,0 +1,499 @@
+//本文件实现兄弟节点之间的缓存分片：本地未命中的查询先经UDP问名字的归属节点，对方只查自己的缓存，未命中或超时再转发上游
+#include "dns_peer.h"
+#include "dns_server.h"
+#include "dns_forward.h"
+#include "dns_hosts.h"
+#include "dns_cache.h"
+#include "dns_pool.h"
+#include "dns_upgrade.h"
+#include "dns_resetid.h"
+#include <ctype.h>
+
+#define PEER_LIST_MAX 512             // -P参数的最大长度
+#define PEER_RECV_BATCH 64            // 每轮事件最多读取的对等报文数
+
+// 集群中的一个节点，members[0]是本节点
+typedef struct PeerMember {
+    struct sockaddr_in address;
+    uint32_t failures;                // 连续超时的次数，收到应答后清零
+    time_t down_until;                // 在此之前视为不可用，名字改归其余节点
+    uint32_t asked;                   // 问它的查询数
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t timeouts;
+    uint32_t stored;                  // 推送给它的应答数
+} PeerMember;
+
+// 等待兄弟节点应答的查询
+typedef struct PeerWait {
+    uint8_t* query;                   // 客户端查询的副本，未命中或超时时据此转发上游；NULL表示槽位空闲
+    int len;
+    uint16_t id;                      // 发给兄弟节点的事务ID，随机选取
+    int member;
+    ClientRoute client;
+    dns_edns edns;
+    uint64_t deadline;                // 超时时刻（毫秒）
+} PeerWait;
+
+// 本节点回复过未命中的问题：只有在期限内、由同一个节点推送的这个问题的应答才收入缓存
+typedef struct PeerGrant {
+    char name[DNS_RR_NAME_MAX_SIZE + 1];
+    uint16_t qtype;
+    int member;
+    uint64_t expire;                  // 过期时刻（毫秒），0表示空闲或已用掉
+} PeerGrant;
+
+static SOCKET peerSocket = INVALID_SOCKET;
+static PeerMember members[PEER_MAX_MEMBERS];
+static int member_count = 0;
+static PeerWait waits[PEER_MAX_PENDING];
+static int wait_count = 0;
+static int next_slot = 0;
+static PeerGrant grants[PEER_GRANT_MAX];
+static int next_grant = 0;
+static uint32_t served_hits = 0;      // 兄弟节点来问、本节点缓存命中的次数
+static uint32_t served_misses = 0;
+static uint32_t stores_received = 0;
+
+// --- 内部辅助函数 ---
+
+static uint16_t get16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void put16(uint8_t* p, uint16_t value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+// 域名比较不区分大小写，MSVC没有strcasecmp
+static int sameName(const char* a, const char* b) {
+    while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+        a++;
+        b++;
+    }
+    return tolower((unsigned char)*a) == tolower((unsigned char)*b);
+}
+
+static int sameAddress(const struct sockaddr_in* a, const struct sockaddr_in* b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+// 解析"a.b.c.d[:port]"，成功返回1
+static int parseMember(const char* text, struct sockaddr_in* address) {
+    uint8_t ip[4];
+    const char* end = text + strlen(text);
+    size_t used = parseIPv4(text, end, ip);
+    if (used == 0) return 0;
+
+    unsigned long port = PEER_DEFAULT_PORT;
+    if (text[used] == ':') {
+        char* stop;
+        port = strtoul(text + used + 1, &stop, 10);
+        if (stop == text + used + 1 || *stop != '\0' || port == 0 || port > 65535) return 0;
+    } else if (text[used] != '\0') {
+        return 0;
+    }
+
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    memcpy(&address->sin_addr.s_addr, ip, 4);
+    address->sin_port = htons((u_short)port);
+    return 1;
+}
+
+// 报文来自哪个兄弟节点，不是集群成员时返回-1
+static int findMember(const struct sockaddr_in* from) {
+    for (int i = 1; i < member_count; i++) {
+        if (sameAddress(&members[i].address, from)) return i;
+    }
+    return -1;
+}
+
+// 名字的归属节点：本节点和可用的兄弟节点中随机权重最大的一个，0表示本节点
+static int ownerOf(const char* name, size_t len) {
+    uint64_t key = forwardNameHash(name, len);
+    time_t now = time(NULL);
+    int best = 0;
+    uint64_t best_weight = forwardHashWeight(key, &members[0].address);
+    for (int i = 1; i < member_count; i++) {
+        if (members[i].down_until > now) continue;
+        uint64_t weight = forwardHashWeight(key, &members[i].address);
+        if (weight > best_weight) {
+            best = i;
+            best_weight = weight;
+        }
+    }
+    return best;
+}
+
+static void releaseWait(PeerWait* w) {
+    free(w->query);
+    w->query = NULL;
+    wait_count--;
+}
+
+// 兄弟节点没能回答：把暂存的查询转发上游，push_to非0时上游的应答到达后推送给该节点
+static void forwardWait(PeerWait* w, int push_to) {
+    uint8_t* buffer = poolAcquire();
+    dns_question_view question;
+    if (!buffer || !peekQuestion(w->query, w->len, &question)) {
+        poolRelease(buffer);
+        if (w->client.tcp >= 0) tcpQueryFinished(&w->client);
+        releaseWait(w);
+        return;
+    }
+    memcpy(buffer, w->query, w->len);
+    forwardQuery(buffer, w->len, &w->client, &w->edns, question.QNAME, question.QTYPE, push_to);
+    poolRelease(buffer);
+    releaseWait(w);
+}
+
+// 回复未命中时记下问题和节点，查询方转发上游后会把应答推送回来
+static void grantStore(const dns_question_view* question, int member) {
+    PeerGrant* g = &grants[next_grant];
+    next_grant = (next_grant + 1) % PEER_GRANT_MAX;
+    strcpy(g->name, question->QNAME);
+    g->qtype = question->QTYPE;
+    g->member = member;
+    g->expire = GetTickCount64() + PEER_STORE_WINDOW * 1000;
+}
+
+// 推送的应答是否对应本节点回复过的未命中；对应时用掉这条记录，同一个未命中只接受一次推送
+static int takeGrant(const char* name, uint16_t qtype, int member) {
+    uint64_t now = GetTickCount64();
+    for (int i = 0; i < PEER_GRANT_MAX; i++) {
+        PeerGrant* g = &grants[i];
+        if (g->expire <= now || g->member != member || g->qtype != qtype || !sameName(g->name, name)) continue;
+        g->expire = 0;
+        return 1;
+    }
+    return 0;
+}
+
+// 兄弟节点来问：只查本节点的缓存，命中时回复应答，否则回复只有报头的未命中
+static void answerSibling(const uint8_t* query, int len, int member, const struct sockaddr_in* from) {
+    uint8_t* reply = poolAcquire();
+    if (!reply) return;
+
+    dns_question_view question;
+    int reply_len = 0;
+    int valid = peekQuestion(query, len, &question) && question.QCLASS == DNS_CLASS_IN;
+    if (valid) {
+        // 留出OPT记录的位置，查询方按自己客户端的EDNS能力调整应答时不会越界
+        reply_len = cacheAnswer(query, &question, reply + 1, BUFFER_SIZE - EDNS_OPT_SIZE);
+    }
+    if (reply_len > 0) {
+        reply[0] = PEER_MSG_ANSWER;
+        served_hits++;
+        log_message(LOG_DEBUG, "Peer: answered [Domain: %s] for %s:%d from cache", question.QNAME,
+                    inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+    } else {
+        reply[0] = PEER_MSG_MISS;
+        memcpy(reply + 1, query, 12);
+        memset(reply + 5, 0, 8);
+        reply[3] |= (uint8_t)(QR_MASK >> 8);
+        reply_len = 12;
+        served_misses++;
+        if (valid) grantStore(&question, member);
+    }
+    sendto(peerSocket, reply, reply_len + 1, 0, (const struct sockaddr*)from, sizeof(*from));
+    poolRelease(reply);
+}
+
+// 兄弟节点推送来的上游应答：先按边界走一遍各部分的记录，只收本节点刚向它回复过未命中的问题，
+// 再与转发上游得到的应答一样收入缓存
+static void storeFromSibling(int member, uint8_t* response, int len) {
+    dns_edns opt;
+    if (!ednsParse(response, len, &opt) || get16(response + 4) != 1) return;
+    dns_Message msg;
+    str_to_dnsstruct(&msg, response, response);
+    if (!takeGrant(msg.question->QNAME, msg.question->QTYPE, member)) {
+        log_message(LOG_DEBUG, "Peer: unsolicited store [Domain: %s] from %s:%d dropped", msg.question->QNAME,
+                    inet_ntoa(members[member].address.sin_addr), ntohs(members[member].address.sin_port));
+        freeMessage(&msg);
+        return;
+    }
+    cacheHarvest(&msg);
+    stores_received++;
+    log_message(LOG_DEBUG, "Peer: stored [Domain: %s], type %d pushed by a sibling", msg.question->QNAME,
+                msg.question->QTYPE);
+    freeMessage(&msg);
+}
+
+// 等待指定节点、事务ID相同的查询，没有时返回NULL
+static PeerWait* findWait(int member, uint16_t id) {
+    for (int i = 0; i < PEER_MAX_PENDING; i++) {
+        PeerWait* w = &waits[i];
+        if (w->query && w->id == id && w->member == member) return w;
+    }
+    return NULL;
+}
+
+// 兄弟节点的应答或未命中：交给等待它的查询
+static void finishWait(int member, const uint8_t* body, int len, int hit) {
+    uint16_t id = get16(body);
+    PeerWait* w = findWait(member, id);
+    if (!w) {
+        log_message(LOG_DEBUG, "Peer: late or unknown reply [ID: %d] from %s", id, inet_ntoa(members[member].address.sin_addr));
+        return;
+    }
+    members[member].failures = 0;
+    members[member].down_until = 0;
+
+    if (!hit) {
+        members[member].misses++;
+        forwardWait(w, member + 1);
+        return;
+    }
+
+    uint8_t* reply = poolAcquire();
+    if (!reply) {
+        forwardWait(w, 0);
+        return;
+    }
+    members[member].hits++;
+    memcpy(reply, body, len);
+    memcpy(reply, w->query, 2); // 换回客户端的事务ID
+    sendToClient(reply, len, &w->client, &w->edns);
+    log_message(LOG_INFO, "Answered from sibling %s:%d [ID: %d]", inet_ntoa(members[member].address.sin_addr),
+                ntohs(members[member].address.sin_port), get16(reply));
+    poolRelease(reply);
+    releaseWait(w);
+}
+
+// 读完对等socket上的报文，按第一个字节分派；不是集群成员发来的报文被丢弃
+static void receivePeers(void) {
+    uint8_t* buffer = poolAcquire();
+    if (!buffer) return;
+    for (int n = 0; n < PEER_RECV_BATCH; n++) {
+        struct sockaddr_in from;
+        int from_len = sizeof(from);
+        int len = recvfrom(peerSocket, buffer, POOL_BUFFER_SIZE, 0, (struct sockaddr*)&from, &from_len);
+        if (len <= 0) break;
+
+        int member = findMember(&from);
+        if (member < 0 || len < 13) {
+            log_message(LOG_DEBUG, "Peer: dropped %d bytes from %s:%d", len, inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+            continue;
+        }
+        uint8_t* body = buffer + 1;
+        int body_len = len - 1;
+        if (body_len > BUFFER_SIZE - EDNS_OPT_SIZE) continue;
+        switch (buffer[0]) {
+            case PEER_MSG_QUERY:
+                answerSibling(body, body_len, member, &from);
+                break;
+            case PEER_MSG_ANSWER:
+                finishWait(member, body, body_len, 1);
+                break;
+            case PEER_MSG_MISS:
+                finishWait(member, body, body_len, 0);
+                break;
+            case PEER_MSG_STORE:
+                storeFromSibling(member, body, body_len);
+                break;
+            default:
+                break;
+        }
+    }
+    poolRelease(buffer);
+}
+
+// 热升级时接管旧进程交接来的对等socket；绑定的地址与本节点的地址不同（配置改了）时关掉它，返回INVALID_SOCKET
+static SOCKET adoptPeerSocket(void) {
+    SOCKET sock = upgradeTakeSocket(UPGRADE_SOCKET_PEER);
+    if (sock == INVALID_SOCKET) return INVALID_SOCKET;
+    struct sockaddr_in bound;
+    int bound_len = sizeof(bound);
+    u_long nonBlocking = 1;
+    if (getsockname(sock, (struct sockaddr*)&bound, &bound_len) != 0 || !sameAddress(&bound, &members[0].address) ||
+        ioctlsocket(sock, FIONBIO, &nonBlocking) != 0) {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+// 以独占方式绑定本节点的对等地址，其他进程不能绑到同一端口上冒充本节点收发
+static SOCKET bindPeerSocket(void) {
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET) return INVALID_SOCKET;
+    const int EXCLUSIVE_OPTION = 1;
+    u_long nonBlocking = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (char*)&EXCLUSIVE_OPTION, sizeof(int)) == SOCKET_ERROR ||
+        bind(sock, (struct sockaddr*)&members[0].address, sizeof(members[0].address)) == SOCKET_ERROR ||
+        ioctlsocket(sock, FIONBIO, &nonBlocking) != 0) {
+        log_message(LOG_ERROR, "Peer: bind to %s:%d failed: %d", inet_ntoa(members[0].address.sin_addr),
+                    ntohs(members[0].address.sin_port), WSAGetLastError());
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+// --- 公开接口实现 ---
+
+int initPeering(const char* list) {
+    char copy[PEER_LIST_MAX];
+    if (strlen(list) >= sizeof(copy)) return 0;
+    strcpy(copy, list);
+
+    member_count = 0;
+    for (char* token = strtok(copy, ","); token; token = strtok(NULL, ",")) {
+        if (member_count == PEER_MAX_MEMBERS) return 0;
+        PeerMember* m = &members[member_count];
+        memset(m, 0, sizeof(*m));
+        if (!parseMember(token, &m->address)) return 0;
+        for (int i = 0; i < member_count; i++) {
+            if (sameAddress(&members[i].address, &m->address)) return 0;
+        }
+        member_count++;
+    }
+    if (member_count < 2) return 0;
+
+    SOCKET sock = adoptPeerSocket();
+    int adopted = sock != INVALID_SOCKET;
+    if (!adopted) sock = bindPeerSocket();
+    if (sock == INVALID_SOCKET) return 0;
+    peerSocket = sock;
+    memset(waits, 0, sizeof(waits));
+    memset(grants, 0, sizeof(grants));
+    wait_count = 0;
+    printf("%s on %s:%d with %d siblings\n", adopted ? "Took over peering" : "Peering",
+           inet_ntoa(members[0].address.sin_addr), ntohs(members[0].address.sin_port), member_count - 1);
+    return 1;
+}
+
+int peerAsk(const uint8_t* query, int len, const dns_question_view* question, const ClientRoute* client,
+            const dns_edns* edns) {
+    if (peerSocket == INVALID_SOCKET || wait_count == PEER_MAX_PENDING) return 0;
+    int member = ownerOf(question->QNAME, question->nameLength);
+    if (member == 0) return 0;
+
+    while (waits[next_slot].query) next_slot = (next_slot + 1) % PEER_MAX_PENDING;
+    PeerWait* w = &waits[next_slot];
+    w->query = malloc(len);
+    uint8_t* packet = poolAcquire();
+    if (!w->query || !packet) {
+        free(w->query);
+        w->query = NULL;
+        poolRelease(packet);
+        return 0;
+    }
+    memcpy(w->query, query, len);
+    w->len = len;
+    // 事务ID随机选取，且不与等待同一节点的查询重复，网络上的第三方猜不中
+    w->member = member;
+    do {
+        w->id = (uint16_t)secureRandom();
+    } while (findWait(member, w->id) != w);
+    w->client = *client;
+    w->edns = *edns;
+    w->deadline = GetTickCount64() + PEER_TIMEOUT;
+    wait_count++;
+    next_slot = (next_slot + 1) % PEER_MAX_PENDING;
+
+    // 只发报头和问题：对方按问题查缓存，OPT由本节点按客户端的能力处理
+    packet[0] = PEER_MSG_QUERY;
+    memcpy(packet + 1, query, question->end);
+    put16(packet + 1, w->id);
+    memset(packet + 7, 0, 6);
+    sendto(peerSocket, packet, question->end + 1, 0, (struct sockaddr*)&members[member].address,
+           sizeof(members[member].address));
+    poolRelease(packet);
+    members[member].asked++;
+    log_message(LOG_INFO, "Asking sibling %s:%d for [Domain: %s]", inet_ntoa(members[member].address.sin_addr),
+                ntohs(members[member].address.sin_port), question->QNAME);
+    return 1;
+}
+
+void peerStore(int member, const uint8_t* response, int len) {
+    if (peerSocket == INVALID_SOCKET || member <= 0 || member >= member_count) return;
+    if (len < 12 || len > BUFFER_SIZE - EDNS_OPT_SIZE) return;
+    // 只推送缓存会收录的应答
+    if ((response[3] & 0x0F) != DNS_RCODE_OK || (response[2] & (TC_MASK >> 8)) || get16(response + 6) == 0) return;
+
+    uint8_t* packet = poolAcquire();
+    if (!packet) return;
+    packet[0] = PEER_MSG_STORE;
+    memcpy(packet + 1, response, len);
+    sendto(peerSocket, packet, len + 1, 0, (struct sockaddr*)&members[member].address,
+           sizeof(members[member].address));
+    poolRelease(packet);
+    members[member].stored++;
+}
+
+int peerPollFds(struct pollfd* fds, int max) {
+    if (peerSocket == INVALID_SOCKET || max < 1) return 0;
+    fds[0].fd = peerSocket;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    return 1;
+}
+
+void peerHandlePoll(const struct pollfd* fds, int count) {
+    // 兄弟节点停机时发给它的报文引起的ICMP错误挂在socket上，也要读一次把它清掉
+    if (count > 0 && (fds[0].revents & (POLLIN | POLLERR))) receivePeers();
+}
+
+void peerService(void) {
+    if (peerSocket != INVALID_SOCKET) receivePeers();
+}
+
+void peerTick(void) {
+    if (wait_count == 0) return;
+    uint64_t now = GetTickCount64();
+    for (int i = 0; i < PEER_MAX_PENDING; i++) {
+        PeerWait* w = &waits[i];
+        if (!w->query || w->deadline > now) continue;
+        PeerMember* m = &members[w->member];
+        m->timeouts++;
+        if (++m->failures >= PEER_DOWN_TIMEOUTS) {
+            if (m->down_until <= time(NULL)) {
+                log_message(LOG_INFO, "Peer: sibling %s:%d not answering, skipped for %d s",
+                            inet_ntoa(m->address.sin_addr), ntohs(m->address.sin_port), PEER_DOWN_HOLD);
+            }
+            m->down_until = time(NULL) + PEER_DOWN_HOLD;
+        }
+        log_message(LOG_DEBUG, "Peer: sibling %s:%d timed out [ID: %d], forwarding upstream",
+                    inet_ntoa(m->address.sin_addr), ntohs(m->address.sin_port), w->id);
+        forwardWait(w, 0);
+    }
+}
+
+int peerNextTimeout(void) {
+    if (wait_count == 0) return -1;
+    uint64_t now = GetTickCount64();
+    uint64_t earliest = UINT64_MAX;
+    for (int i = 0; i < PEER_MAX_PENDING; i++) {
+        if (waits[i].query && waits[i].deadline < earliest) earliest = waits[i].deadline;
+    }
+    return earliest <= now ? 0 : (int)(earliest - now);
+}
+
+void logPeerStats(void) {
+    if (peerSocket == INVALID_SOCKET) return;
+    log_message(LOG_DEBUG, "Peer: %d waiting, served %u hits / %u misses, %u answers stored from siblings",
+                wait_count, served_hits, served_misses, stores_received);
+    for (int i = 1; i < member_count; i++) {
+        const PeerMember* m = &members[i];
+        log_message(LOG_DEBUG, "  sibling %s:%d: asked %u, hits %u, misses %u, timeouts %u, pushed %u%s",
+                    inet_ntoa(m->address.sin_addr), ntohs(m->address.sin_port), m->asked, m->hits, m->misses,
+                    m->timeouts, m->stored, m->down_until > time(NULL) ? " (down)" : "");
+    }
+}
+
+SOCKET peerPortSocket(void) {
+    return peerSocket;
+}
+
+void closePeering(void) {
+    for (int i = 0; i < PEER_MAX_PENDING; i++) {
+        if (waits[i].query) releaseWait(&waits[i]);
+    }
+    if (peerSocket != INVALID_SOCKET) {
+        closesocket(peerSocket);
+        peerSocket = INVALID_SOCKET;
+    }
+}
@@ -0,0 +1,67 @@
+//本文件实现报文缓冲区池：固定大小的缓冲区用完放回空闲链表，收发报文时不再在栈上开大数组，也不反复分配
+#include "dns_pool.h"
+#include "output_level.h"
+
+// 空闲的块用开头的几个字节链接成单链表
+typedef struct PoolBlock {
+    struct PoolBlock* next;
+} PoolBlock;
+
+static PoolBlock* free_list = NULL;
+static int free_count = 0;
+static int allocated = 0;          // 已分配且尚未归还给系统的块数（含空闲的）
+
+// --- 公开接口实现 ---
+
+void initBufferPool(void) {
+    for (int i = 0; i < POOL_PREALLOC; i++) {
+        PoolBlock* block = (PoolBlock*)malloc(POOL_BUFFER_SIZE);
+        if (!block) break;
+        allocated++;
+        poolRelease((uint8_t*)block);
+    }
+}
+
+uint8_t* poolAcquire(void) {
+    if (free_list) {
+        PoolBlock* block = free_list;
+        free_list = block->next;
+        free_count--;
+        return (uint8_t*)block;
+    }
+    uint8_t* buffer = (uint8_t*)malloc(POOL_BUFFER_SIZE);
+    if (!buffer) {
+        log_message(LOG_ERROR, "Buffer pool: out of memory");
+        return NULL;
+    }
+    allocated++;
+    return buffer;
+}
+
+void poolRelease(uint8_t* buffer) {
+    if (!buffer) return;
+    if (free_count >= POOL_MAX_FREE) {
+        free(buffer);
+        allocated--;
+        return;
+    }
+    PoolBlock* block = (PoolBlock*)buffer;
+    block->next = free_list;
+    free_list = block;
+    free_count++;
+}
+
+void logPoolStats(void) {
+    log_message(LOG_DEBUG, "Buffer pool: %d buffers allocated, %d in use, %d free",
+                allocated, allocated - free_count, free_count);
+}
+
+void destroyBufferPool(void) {
+    while (free_list) {
+        PoolBlock* block = free_list;
+        free_list = block->next;
+        free(block);
+        allocated--;
+    }
+    free_count = 0;
+}
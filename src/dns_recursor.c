@@ -0,0 +1,1141 @@
+//本文件实现内置的迭代解析器：从根提示出发逐级跟随委派，每次解析是事件循环中的一个异步状态机
+#include "dns_recursor.h"
+#include "dns_server.h"
+#include "dns_cache.h"
+#include "dns_convert.h"
+#include "dns_reverse.h"
+#include "dns_failure.h"
+#include "dns_edns.h"
+#include "dns_pool.h"
+#include "dns_resetid.h"
+#include "uthash.h"
+#include <ctype.h>
+
+int recursion_mode = 0;
+
+// 一个区切点：区名和负责它的NS，NS的地址来自粘附记录、缓存或子解析
+typedef struct Delegation {
+    char zone[DNS_RR_NAME_MAX_SIZE + 1];                    // 小写的区名，根为空串
+    char ns[RECURSOR_MAX_NS][DNS_RR_NAME_MAX_SIZE + 1];
+    uint8_t addr[RECURSOR_MAX_NS][4];
+    uint16_t port[RECURSOR_MAX_NS];                        // 服务器端口（网络字节序）
+    uint8_t has_addr[RECURSOR_MAX_NS];
+    time_t bad_until[RECURSOR_MAX_NS];                     // 服务器超时后暂不优先选择的截止时刻
+    int ns_count;
+    time_t expire;
+    UT_hash_handle hh;
+} Delegation;
+
+// 应答中的一条记录，名字已展开为小写的点分形式，数据部分仍指向原报文
+typedef struct RecordView {
+    int section;                   // 0回答 1授权 2附加
+    char owner[DNS_RR_NAME_MAX_SIZE + 1];
+    uint16_t type;
+    uint16_t rrclass;
+    uint32_t ttl;
+    int rdata;
+    uint16_t rdlength;
+} RecordView;
+
+typedef struct Resolution {
+    char origin[DNS_RR_NAME_MAX_SIZE + 1];  // 最初要解析的名字（小写）
+    char qname[DNS_RR_NAME_MAX_SIZE + 1];   // 当前要解析的名字，跟随CNAME后改变
+    uint16_t qtype;
+    Delegation cut;                         // 当前区切点的副本，委派缓存淘汰它时不受影响
+    uint8_t tried[RECURSOR_MAX_NS];
+    int start;                              // 选择服务器的起始位置，把负载分散到同一区的各个服务器
+    int queries;
+    int referrals;
+    int cnames;
+    int depth;
+    uint64_t expire;                        // 整个解析的期限
+
+    // 在途查询，每个查询从自己的随机端口发出
+    int in_flight;
+    SOCKET sock;
+    uint16_t txid;
+    int server_ns;                          // 在途查询发给了区切点的第几个NS
+    struct sockaddr_in server;
+    uint64_t deadline;
+    int plain;                              // 服务器不认OPT（回复FORMERR或NOTIMP）后，本次解析的查询不再带EDNS
+
+    // 应答被截断后向同一个服务器经TCP重试：查询带两字节长度前缀，应答读入缓冲区池中的一块
+    int via_tcp;
+    int tcp_connected;
+    uint8_t tcp_out[2 + 12 + DNS_RR_NAME_MAX_SIZE + 1 + 4 + EDNS_OPT_SIZE];
+    int tcp_out_len;
+    int tcp_out_sent;
+    uint8_t* tcp_in;
+    int tcp_in_len;
+
+    // 为父解析的某个NS找地址的子解析
+    struct Resolution* parent;
+    int parent_ns;
+    struct Resolution* child;
+
+    // 客户端查询，只有顶层解析有
+    int has_client;
+    ClientRoute client;
+    uint8_t query[12 + DNS_RR_NAME_MAX_SIZE + 1 + 4];
+    dns_question_view question;
+    dns_edns edns;                          // 客户端查询中的OPT记录
+    int limit;                              // 应答能用的长度，见replyLimit()
+
+    // 收集到的应答记录，名字不压缩
+    uint8_t answer[RECURSOR_REPLY_MAX];
+    int answer_len;
+    uint16_t ancount;
+    uint8_t authority[RECURSOR_REPLY_MAX];
+    int authority_len;
+    uint16_t nscount;
+    int truncated;
+    uint8_t addrs[MAX_IP_COUNT][4];         // 最终的A记录，解析完成后写入缓存
+    uint32_t ttls[MAX_IP_COUNT];
+    uint8_t addr_count;
+
+    struct Resolution* prev;
+    struct Resolution* next;
+    UT_hash_handle hh;                      // 按socket索引在途查询
+} Resolution;
+
+static const struct {
+    const char* name;
+    const char* address;
+} builtinRoots[] = {
+    { "a.root-servers.net", "198.41.0.4" },
+    { "b.root-servers.net", "170.247.170.2" },
+    { "c.root-servers.net", "192.33.4.12" },
+    { "d.root-servers.net", "199.7.91.13" },
+    { "e.root-servers.net", "192.203.230.10" },
+    { "f.root-servers.net", "192.5.5.241" },
+    { "g.root-servers.net", "192.112.36.4" },
+    { "h.root-servers.net", "198.97.190.53" },
+    { "i.root-servers.net", "192.36.148.17" },
+    { "j.root-servers.net", "192.58.128.30" },
+    { "k.root-servers.net", "193.0.14.129" },
+    { "l.root-servers.net", "199.7.83.42" },
+    { "m.root-servers.net", "202.12.27.33" },
+};
+
+static Delegation rootHints;
+static Delegation* delegations = NULL;     // 委派缓存，按区名索引，按插入顺序淘汰
+static Resolution* inflight = NULL;        // 在途查询，按socket索引
+static Resolution* active = NULL;          // 全部进行中的解析
+static int active_count = 0;
+
+static void nextServer(Resolution* r);
+static void startName(Resolution* r);
+
+// --- 内部辅助函数 ---
+
+static uint64_t nowMs(void) {
+    return GetTickCount64();
+}
+
+static uint8_t* putUint16(uint8_t* ptr, uint16_t value) {
+    ptr[0] = (uint8_t)(value >> 8);
+    ptr[1] = (uint8_t)value;
+    return ptr + 2;
+}
+
+static uint16_t getUint16(const uint8_t* ptr) {
+    return (uint16_t)((ptr[0] << 8) | ptr[1]);
+}
+
+static uint32_t getUint32(const uint8_t* ptr) {
+    return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) | ((uint32_t)ptr[2] << 8) | ptr[3];
+}
+
+static void lowerCopy(char* dest, const char* src) {
+    while (*src) *dest++ = (char)tolower((unsigned char)*src++);
+    *dest = '\0';
+}
+
+// name是否等于zone或是zone的子域名，zone为空串（根）时总是成立
+static int isSubdomain(const char* name, const char* zone) {
+    size_t name_len = strlen(name);
+    size_t zone_len = strlen(zone);
+    if (zone_len == 0) return 1;
+    if (name_len < zone_len || strcmp(name + name_len - zone_len, zone) != 0) return 0;
+    return name_len == zone_len || name[name_len - zone_len - 1] == '.';
+}
+
+// 把报文中offset处可能含压缩指针的名字展开为不压缩的线上格式，*next为名字在报文中结束之后的偏移
+// 返回展开后的字节数，格式错误返回0
+static int readName(const uint8_t* msg, int size, int offset, uint8_t* wire, int* next) {
+    int out = 0;
+    int jumps = 0;
+    int pos = offset;
+    *next = -1;
+    while (pos < size) {
+        uint8_t len = msg[pos];
+        if ((len & 0xC0) == 0xC0) {
+            if (pos + 1 >= size || ++jumps > 16) return 0;
+            if (*next < 0) *next = pos + 2;
+            pos = ((len & 0x3F) << 8) | msg[pos + 1];
+            continue;
+        }
+        if (len & 0xC0) return 0;
+        if (len == 0) {
+            wire[out++] = 0;
+            if (*next < 0) *next = pos + 1;
+            return out;
+        }
+        if (pos + 1 + len > size || out + len + 2 > DNS_RR_NAME_MAX_SIZE) return 0;
+        memcpy(wire + out, msg + pos, len + 1);
+        out += len + 1;
+        pos += len + 1;
+    }
+    return 0;
+}
+
+// 线上格式的名字转为小写的点分形式，根为空串
+static void wireToText(const uint8_t* wire, char* text) {
+    size_t out = 0;
+    while (*wire) {
+        uint8_t len = *wire++;
+        if (out > 0) text[out++] = '.';
+        for (uint8_t i = 0; i < len; i++) text[out++] = (char)tolower(wire[i]);
+        wire += len;
+    }
+    text[out] = '\0';
+}
+
+static int readTextName(const uint8_t* msg, int size, int offset, char* text) {
+    uint8_t wire[DNS_RR_NAME_MAX_SIZE + 1];
+    int next;
+    if (!readName(msg, size, offset, wire, &next)) return 0;
+    wireToText(wire, text);
+    return 1;
+}
+
+// 检查应答的问题是否就是发出的查询，返回问题之后的偏移，不符返回0
+static int questionMatches(const Resolution* r, const uint8_t* msg, int size) {
+    if (getUint16(msg + 4) != 1) return 0;
+    uint8_t wire[DNS_RR_NAME_MAX_SIZE + 1];
+    char name[DNS_RR_NAME_MAX_SIZE + 1];
+    int next;
+    if (!readName(msg, size, 12, wire, &next) || next + 4 > size) return 0;
+    wireToText(wire, name);
+    if (strcmp(name, r->qname) != 0) return 0;
+    if (getUint16(msg + next) != r->qtype || getUint16(msg + next + 2) != DNS_CLASS_IN) return 0;
+    return next + 4;
+}
+
+// 依次解析回答、授权、附加三部分的记录，超过RECURSOR_MAX_RRS的记录不再查看；报文格式错误返回-1
+static int parseRecords(const uint8_t* msg, int size, int offset, RecordView* rrs) {
+    int counts[3] = { getUint16(msg + 6), getUint16(msg + 8), getUint16(msg + 10) };
+    int count = 0;
+    for (int section = 0; section < 3; section++) {
+        for (int k = 0; k < counts[section]; k++) {
+            if (count == RECURSOR_MAX_RRS) return count;
+            RecordView* rr = &rrs[count];
+            uint8_t wire[DNS_RR_NAME_MAX_SIZE + 1];
+            int next;
+            if (!readName(msg, size, offset, wire, &next) || next + 10 > size) return -1;
+            wireToText(wire, rr->owner);
+            rr->section = section;
+            rr->type = getUint16(msg + next);
+            rr->rrclass = getUint16(msg + next + 2);
+            rr->ttl = getUint32(msg + next + 4);
+            if (rr->ttl > 0x7FFFFFFF) rr->ttl = 0; // RFC 2181：最高位为1的TTL按0处理
+            rr->rdlength = getUint16(msg + next + 8);
+            rr->rdata = next + 10;
+            if (rr->rdata + rr->rdlength > size) return -1;
+            offset = rr->rdata + rr->rdlength;
+            count++;
+        }
+    }
+    return count;
+}
+
+// 复制记录的数据部分，其中的名字展开为不压缩的形式，返回写入的字节数；放不下或格式错误返回-1
+static int expandRdata(const uint8_t* msg, int size, const RecordView* rr, uint8_t* out, int cap) {
+    int prefix = 0;
+    int names = 1;
+    int suffix = 0;
+    switch (rr->type) {
+        case DNS_TYPE_NS:
+        case DNS_TYPE_CNAME:
+        case DNS_TYPE_PTR:
+            break;
+        case DNS_TYPE_MX:
+            prefix = 2;
+            break;
+        case DNS_TYPE_SRV:
+            prefix = 6;
+            break;
+        case DNS_TYPE_SOA:
+            names = 2;
+            suffix = 20;
+            break;
+        default:
+            if (rr->rdlength > cap) return -1;
+            memcpy(out, msg + rr->rdata, rr->rdlength);
+            return rr->rdlength;
+    }
+
+    int end = rr->rdata + rr->rdlength;
+    int pos = rr->rdata;
+    if (pos + prefix > end || prefix > cap) return -1;
+    memcpy(out, msg + pos, prefix);
+    int len = prefix;
+    pos += prefix;
+    for (int i = 0; i < names; i++) {
+        uint8_t wire[DNS_RR_NAME_MAX_SIZE + 1];
+        int next;
+        int n = readName(msg, size, pos, wire, &next);
+        if (n == 0 || next > end || len + n > cap) return -1;
+        memcpy(out + len, wire, n);
+        len += n;
+        pos = next;
+    }
+    if (pos + suffix > end || len + suffix > cap) return -1;
+    memcpy(out + len, msg + pos, suffix);
+    return len + suffix;
+}
+
+// 把记录追加到收集的回答或授权部分；与客户端问题同名的记录用指向问题的压缩指针，保留客户端的大小写
+static void appendRecord(Resolution* r, int authority, const uint8_t* msg, int size, const RecordView* rr) {
+    uint8_t record[RECURSOR_REPLY_MAX];
+    size_t n;
+    if (r->has_client && strcmp(rr->owner, r->origin) == 0) {
+        putUint16(record, 0xC00C);
+        n = 2;
+    } else if (rr->owner[0] == '\0') {
+        record[0] = 0;
+        n = 1;
+    } else {
+        n = wireName(rr->owner, strlen(rr->owner), record);
+        if (n == 0) return;
+    }
+
+    int rdlength = expandRdata(msg, size, rr, record + n + 10, (int)(sizeof(record) - n - 10));
+    int question_end = r->has_client ? r->question.end : 0;
+    int total = (int)n + 10 + rdlength;
+    if (rdlength < 0 || question_end + r->answer_len + r->authority_len + total > r->limit) {
+        if (!authority) r->truncated = 1; // 授权部分放不下时直接省略，回答放不下时置TC
+        return;
+    }
+    uint8_t* ptr = putUint16(record + n, rr->type);
+    ptr = putUint16(ptr, rr->rrclass);
+    ptr = putUint16(ptr, (uint16_t)(rr->ttl >> 16));
+    ptr = putUint16(ptr, (uint16_t)rr->ttl);
+    putUint16(ptr, (uint16_t)rdlength);
+
+    if (authority) {
+        memcpy(r->authority + r->authority_len, record, total);
+        r->authority_len += total;
+        r->nscount++;
+    } else {
+        memcpy(r->answer + r->answer_len, record, total);
+        r->answer_len += total;
+        r->ancount++;
+    }
+}
+
+// 否定应答：把授权部分中包含查询名的区的SOA带给客户端
+static void appendSoa(Resolution* r, const uint8_t* msg, int size, const RecordView* rrs, int count) {
+    for (int i = 0; i < count; i++) {
+        if (rrs[i].section == 1 && rrs[i].type == DNS_TYPE_SOA && isSubdomain(r->qname, rrs[i].owner)) {
+            appendRecord(r, 1, msg, size, &rrs[i]);
+            return;
+        }
+    }
+}
+
+static Resolution* newResolution(const char* name, uint16_t qtype) {
+    if (active_count >= RECURSOR_MAX_ACTIVE) return NULL;
+    Resolution* r = (Resolution*)calloc(1, sizeof(Resolution));
+    if (!r) return NULL;
+    lowerCopy(r->origin, name);
+    strcpy(r->qname, r->origin);
+    r->qtype = qtype;
+    r->expire = nowMs() + RECURSOR_DEADLINE_MS;
+    r->limit = RECURSOR_REPLY_MAX;
+    r->sock = INVALID_SOCKET;
+
+    r->next = active;
+    if (active) active->prev = r;
+    active = r;
+    active_count++;
+    return r;
+}
+
+static void clearInFlight(Resolution* r) {
+    if (!r->in_flight) return;
+    HASH_DEL(inflight, r);
+    closesocket(r->sock);
+    r->sock = INVALID_SOCKET;
+    r->in_flight = 0;
+    poolRelease(r->tcp_in);
+    r->tcp_in = NULL;
+}
+
+static void freeResolution(Resolution* r) {
+    clearInFlight(r);
+    if (r->prev) r->prev->next = r->next;
+    else active = r->next;
+    if (r->next) r->next->prev = r->prev;
+    active_count--;
+    free(r);
+}
+
+static void sendAnswer(Resolution* r, uint8_t rcode) {
+    // 记录和应答都放在池中的缓冲区里，解析结束时不在栈上占用数KB
+    uint8_t* records = poolAcquire();
+    uint8_t* reply = poolAcquire();
+    if (!records || !reply) {
+        poolRelease(records);
+        poolRelease(reply);
+        return;
+    }
+    memcpy(records, r->answer, r->answer_len);
+    memcpy(records + r->answer_len, r->authority, r->authority_len);
+
+    int len = composeReply(r->query, &r->question, rcode, records, r->answer_len + r->authority_len,
+                           r->ancount, r->nscount, 0, reply);
+    // 迭代解析得到的应答不是本地的权威数据
+    reply[2] &= (uint8_t)~(AA_MASK >> 8);
+    if (r->truncated) reply[2] |= (uint8_t)(TC_MASK >> 8);
+    sendToClient(reply, len, &r->client, &r->edns);
+    poolRelease(records);
+    poolRelease(reply);
+    log_message(LOG_INFO, "Recursion finished [Domain: %s], rcode %d, %d answers, %d queries",
+                r->question.QNAME, rcode, r->ancount, r->queries);
+}
+
+// 结束一次解析：顶层解析回复客户端，子解析把找到的地址交给父解析，父解析随即继续
+static void finish(Resolution* r, uint8_t rcode) {
+    clearInFlight(r);
+    if (r->child) {
+        r->child->parent = NULL; // 子解析继续进行，结果只写入缓存
+        r->child = NULL;
+    }
+    if (rcode == DNS_RCODE_OK && r->addr_count > 0) {
+        // 地址缓存在最终的名字下，经过的CNAME已逐个写入缓存，查询时由缓存拼回整条链
+        cachePut(r->addrs, r->ttls, r->addr_count, r->qname, 86400);
+    }
+    if (r->has_client) {
+        sendAnswer(r, rcode);
+        // 解析失败记入失败缓存，屏蔽期内同样的查询直接回复SERVFAIL，不再重新迭代
+        if (rcode == DNS_RCODE_SERVFAIL) {
+            failureRecord(r->question.QNAME, r->question.QTYPE, r->expire - RECURSOR_DEADLINE_MS, "resolution failure");
+        } else {
+            failureClear(r->question.QNAME, r->question.QTYPE);
+        }
+    }
+
+    Resolution* parent = r->parent;
+    if (parent) {
+        parent->child = NULL;
+        if (rcode == DNS_RCODE_OK && r->addr_count > 0) {
+            memcpy(parent->cut.addr[r->parent_ns], r->addrs[0], 4);
+            parent->cut.has_addr[r->parent_ns] = 1;
+            parent->tried[r->parent_ns] = 0;
+        }
+    }
+    freeResolution(r);
+    if (parent) nextServer(parent);
+}
+
+// 为一个查询打开UDP socket并绑定到随机的源端口；端口被占用时换一个，多次失败后交给系统分配。
+// 事务ID和源端口是伪造应答要猜中的全部随机性，都取自secureRandom()
+static SOCKET openQuerySocket(void) {
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) return INVALID_SOCKET;
+
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    int bound = 0;
+    for (int attempt = 0; attempt < RECURSOR_PORT_ATTEMPTS && !bound; attempt++) {
+        uint32_t port = RECURSOR_PORT_MIN + secureRandom() % (65536 - RECURSOR_PORT_MIN);
+        local.sin_port = htons((uint16_t)port);
+        bound = bind(sock, (struct sockaddr*)&local, sizeof(local)) == 0;
+    }
+    local.sin_port = 0;
+    u_long nonBlocking = 1;
+    if ((!bound && bind(sock, (struct sockaddr*)&local, sizeof(local)) != 0) ||
+        ioctlsocket(sock, FIONBIO, &nonBlocking) != 0) {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+// 拼出发给权威服务器的查询，事务ID取新的随机数；除非服务器不认，都带OPT记录通告本地的UDP载荷大小，
+// 较大的应答（DNSSEC、长的NS集合）不必被截断。packet至少12 + DNS_RR_NAME_MAX_SIZE + 1 + 4 + EDNS_OPT_SIZE字节
+static int buildQuery(Resolution* r, uint8_t* packet) {
+    memset(packet, 0, 12);
+    r->txid = (uint16_t)secureRandom();
+    putUint16(packet, r->txid);
+    putUint16(packet + 4, 1); // 迭代查询不置RD
+    size_t n = wireName(r->qname, strlen(r->qname), packet + 12);
+    uint8_t* ptr = putUint16(packet + 12 + n, r->qtype);
+    ptr = putUint16(ptr, DNS_CLASS_IN);
+    int len = (int)(ptr - packet);
+    if (r->plain) return len;
+
+    dns_edns none;
+    memset(&none, 0, sizeof(none));
+    return ednsPrepareQuery(packet, len, len + EDNS_OPT_SIZE, &none);
+}
+
+// 把在途查询登记到按socket的索引中，开始计时
+static void addInFlight(Resolution* r, SOCKET sock, int timeout) {
+    r->in_flight = 1;
+    r->sock = sock;
+    HASH_ADD(hh, inflight, sock, sizeof(SOCKET), r);
+    r->queries++;
+    r->deadline = nowMs() + timeout;
+}
+
+// 发出查询，打不开socket时返回0
+static int sendQuery(Resolution* r, int ns) {
+    const uint8_t* address = r->cut.addr[ns];
+    SOCKET sock = openQuerySocket();
+    if (sock == INVALID_SOCKET) {
+        log_message(LOG_ERROR, "Recursion: cannot open query socket: %d", WSAGetLastError());
+        return 0;
+    }
+    uint8_t packet[12 + DNS_RR_NAME_MAX_SIZE + 1 + 4 + EDNS_OPT_SIZE];
+    int len = buildQuery(r, packet);
+
+    memset(&r->server, 0, sizeof(r->server));
+    r->server.sin_family = AF_INET;
+    r->server.sin_port = r->cut.port[ns];
+    memcpy(&r->server.sin_addr.s_addr, address, 4);
+    sendto(sock, packet, len, 0, (struct sockaddr*)&r->server, sizeof(r->server));
+
+    r->server_ns = ns;
+    r->via_tcp = 0;
+    addInFlight(r, sock, RECURSOR_RETRY_MS);
+    log_message(LOG_DEBUG, "Recursion: ask %s:%d for [%s] type %d (zone '%s')",
+                inet_ntoa(r->server.sin_addr), ntohs(r->server.sin_port), r->qname, r->qtype, r->cut.zone);
+    return 1;
+}
+
+// 应答被截断：向同一个服务器经TCP重发查询。连接以非阻塞方式建立，在事件循环中完成收发；打不开连接时返回0
+static int sendQueryTcp(Resolution* r) {
+    if (r->queries >= RECURSOR_MAX_QUERIES) return 0;
+    uint8_t* in = poolAcquire();
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    u_long nonBlocking = 1;
+    if (!in || sock == INVALID_SOCKET || ioctlsocket(sock, FIONBIO, &nonBlocking) != 0) {
+        if (sock != INVALID_SOCKET) closesocket(sock);
+        poolRelease(in);
+        return 0;
+    }
+    if (connect(sock, (struct sockaddr*)&r->server, sizeof(r->server)) == SOCKET_ERROR) {
+        int error = WSAGetLastError();
+        if (error != WSAEWOULDBLOCK && error != WSAEINPROGRESS) {
+            closesocket(sock);
+            poolRelease(in);
+            return 0;
+        }
+    }
+
+    int len = buildQuery(r, r->tcp_out + 2);
+    putUint16(r->tcp_out, (uint16_t)len);
+    r->tcp_out_len = len + 2;
+    r->tcp_out_sent = 0;
+    r->tcp_connected = 0;
+    r->tcp_in = in;
+    r->tcp_in_len = 0;
+    r->via_tcp = 1;
+    addInFlight(r, sock, RECURSOR_TCP_MS);
+    log_message(LOG_DEBUG, "Recursion: truncated answer for [%s], asking %s:%d over TCP", r->qname,
+                inet_ntoa(r->server.sin_addr), ntohs(r->server.sin_port));
+    return 1;
+}
+
+static void setCut(Resolution* r, const Delegation* cut) {
+    r->cut = *cut;
+    memset(r->tried, 0, sizeof(r->tried));
+    r->start = cut->ns_count > 0 ? rand() % cut->ns_count : 0;
+}
+
+static int startChild(Resolution* parent, int ns) {
+    Resolution* child = newResolution(parent->cut.ns[ns], DNS_TYPE_A);
+    if (!child) return 0;
+    child->depth = parent->depth + 1;
+    child->expire = parent->expire;
+    child->parent = parent;
+    child->parent_ns = ns;
+    parent->child = child;
+    log_message(LOG_DEBUG, "Recursion: resolving address of name server %s", child->qname);
+    startName(child);
+    return 1;
+}
+
+// 向当前区切点的下一个服务器发查询；所有服务器都试过时回复SERVFAIL
+static void nextServer(Resolution* r) {
+    if (r->queries >= RECURSOR_MAX_QUERIES || nowMs() >= r->expire) {
+        finish(r, DNS_RCODE_SERVFAIL);
+        return;
+    }
+    Delegation* cut = &r->cut;
+    int n = cut->ns_count;
+
+    // 先用已知地址、最近没有超时过的服务器，都超时过时再用超时过的
+    time_t now = time(NULL);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int k = 0; k < n; k++) {
+            int i = (r->start + k) % n;
+            if (!r->tried[i] && cut->has_addr[i] && (pass == 1 || cut->bad_until[i] <= now)) {
+                r->tried[i] = 1;
+                if (!sendQuery(r, i)) finish(r, DNS_RCODE_SERVFAIL);
+                return;
+            }
+        }
+    }
+    // 再看缓存中有没有服务器名的地址
+    for (int k = 0; k < n; k++) {
+        int i = (r->start + k) % n;
+        uint8_t ips[MAX_IP_COUNT][4];
+        uint8_t ip_count = 0;
+        if (!r->tried[i] && !cut->has_addr[i] && cacheGet(ips, &ip_count, cut->ns[i]) && ip_count > 0) {
+            memcpy(cut->addr[i], ips[0], 4);
+            cut->has_addr[i] = 1;
+            r->tried[i] = 1;
+            if (!sendQuery(r, i)) finish(r, DNS_RCODE_SERVFAIL);
+            return;
+        }
+    }
+    // 另起子解析找服务器名的地址；名字在本区之内却没有粘附记录的服务器无从找起
+    if (r->depth < RECURSOR_MAX_DEPTH) {
+        for (int k = 0; k < n; k++) {
+            int i = (r->start + k) % n;
+            if (!r->tried[i] && !cut->has_addr[i] && !isSubdomain(cut->ns[i], cut->zone)) {
+                r->tried[i] = 1;
+                if (startChild(r, i)) return;
+            }
+        }
+    }
+    log_message(LOG_INFO, "Recursion: no usable server for [%s] in zone '%s'", r->qname, cut->zone);
+    finish(r, DNS_RCODE_SERVFAIL);
+}
+
+static void storeDelegation(const Delegation* delegation) {
+    Delegation* entry = NULL;
+    HASH_FIND_STR(delegations, delegation->zone, entry);
+    if (entry) {
+        HASH_DEL(delegations, entry);
+    } else {
+        if (HASH_COUNT(delegations) >= RECURSOR_MAX_DELEGATIONS) {
+            // 先清掉过期的条目，仍然满时淘汰最早插入的
+            time_t now = time(NULL);
+            Delegation* tmp;
+            HASH_ITER(hh, delegations, entry, tmp) {
+                if (entry->expire <= now) {
+                    HASH_DEL(delegations, entry);
+                    free(entry);
+                }
+            }
+            if (HASH_COUNT(delegations) >= RECURSOR_MAX_DELEGATIONS) {
+                entry = delegations;
+                HASH_DEL(delegations, entry);
+                free(entry);
+            }
+        }
+        entry = (Delegation*)malloc(sizeof(Delegation));
+        if (!entry) return;
+    }
+    *entry = *delegation;
+    HASH_ADD_STR(delegations, zone, entry);
+}
+
+// 跟随委派：记下新区切点的NS和区内的粘附地址，写入委派缓存和地址缓存，然后向新区的服务器查询
+static void followReferral(Resolution* r, const uint8_t* msg, int size, const RecordView* rrs, int count,
+                           const char* zone) {
+    if (++r->referrals > RECURSOR_MAX_REFERRALS) {
+        finish(r, DNS_RCODE_SERVFAIL);
+        return;
+    }
+
+    Delegation cut;
+    memset(&cut, 0, sizeof(cut));
+    strcpy(cut.zone, zone);
+    uint32_t ttl = RECURSOR_MAX_TTL;
+    for (int i = 0; i < count && cut.ns_count < RECURSOR_MAX_NS; i++) {
+        if (rrs[i].section != 1 || rrs[i].type != DNS_TYPE_NS || strcmp(rrs[i].owner, zone) != 0) continue;
+        char name[DNS_RR_NAME_MAX_SIZE + 1];
+        if (!readTextName(msg, size, rrs[i].rdata, name) || name[0] == '\0') continue;
+        int duplicate = 0;
+        for (int j = 0; j < cut.ns_count && !duplicate; j++) duplicate = strcmp(cut.ns[j], name) == 0;
+        if (duplicate) continue;
+        strcpy(cut.ns[cut.ns_count++], name);
+        if (rrs[i].ttl < ttl) ttl = rrs[i].ttl;
+    }
+    if (cut.ns_count == 0) {
+        nextServer(r);
+        return;
+    }
+
+    // 粘附记录只接受落在发出委派的服务器所辖范围内的名字，防止缓存被污染；
+    // 委派中的服务器沿用发出委派的服务器的端口，根提示指定了非53端口时整个层次都用这个端口
+    for (int n = 0; n < cut.ns_count; n++) {
+        cut.port[n] = r->server.sin_port;
+        uint8_t ips[MAX_IP_COUNT][4];
+        uint32_t ttls[MAX_IP_COUNT];
+        uint8_t ip_count = 0;
+        for (int i = 0; i < count && ip_count < MAX_IP_COUNT; i++) {
+            if (rrs[i].section == 2 && rrs[i].type == DNS_TYPE_A && rrs[i].rdlength == 4 &&
+                strcmp(rrs[i].owner, cut.ns[n]) == 0 && isSubdomain(rrs[i].owner, r->cut.zone)) {
+                memcpy(ips[ip_count], msg + rrs[i].rdata, 4);
+                ttls[ip_count++] = rrs[i].ttl;
+            }
+        }
+        if (ip_count > 0) {
+            memcpy(cut.addr[n], ips[0], 4);
+            cut.has_addr[n] = 1;
+            cachePut(ips, ttls, ip_count, cut.ns[n], ttl);
+        }
+    }
+    cut.expire = time(NULL) + ttl;
+    storeDelegation(&cut);
+    log_message(LOG_DEBUG, "Recursion: referral to zone '%s' with %d name servers", cut.zone, cut.ns_count);
+
+    setCut(r, &cut);
+    nextServer(r);
+}
+
+static void handleReply(Resolution* r, const uint8_t* msg, int size, int offset) {
+    uint16_t flags = getUint16(msg + 2);
+    int rcode = flags & RCODE_MASK;
+    // 经UDP收到的截断应答改经TCP向同一个服务器重试，TCP上仍截断或连不上时才换下一个服务器
+    if ((flags & TC_MASK) && !r->via_tcp && sendQueryTcp(r)) return;
+    // 不认EDNS的老服务器回复FORMERR或NOTIMP：去掉OPT再问它一次
+    if ((rcode == DNS_RCODE_FORMERR || rcode == DNS_RCODE_NOTIMP) && !r->plain) {
+        r->plain = 1;
+        log_message(LOG_DEBUG, "Recursion: %s rejected EDNS, asking again without it", inet_ntoa(r->server.sin_addr));
+        if (!sendQuery(r, r->server_ns)) finish(r, DNS_RCODE_SERVFAIL);
+        return;
+    }
+    if ((flags & TC_MASK) || (rcode != DNS_RCODE_OK && rcode != DNS_RCODE_NXDOMAIN)) {
+        log_message(LOG_DEBUG, "Recursion: %s answered rcode %d%s, trying next server",
+                    inet_ntoa(r->server.sin_addr), rcode, (flags & TC_MASK) ? " (truncated)" : "");
+        nextServer(r);
+        return;
+    }
+    RecordView rrs[RECURSOR_MAX_RRS];
+    int count = parseRecords(msg, size, offset, rrs);
+    if (count < 0) {
+        nextServer(r);
+        return;
+    }
+
+    // 回答部分：所查类型的记录即最终结果；只有CNAME时在本应答内继续跟随。
+    // 只接受名字落在当前区切点之内的记录，服务器对区外的名字没有权威，它给出的记录可能是伪造的
+    int chased = 0;
+    for (;;) {
+        int found = 0;
+        for (int i = 0; i < count; i++) {
+            const RecordView* rr = &rrs[i];
+            if (rr->section != 0 || rr->rrclass != DNS_CLASS_IN || strcmp(rr->owner, r->qname) != 0) continue;
+            if (!isSubdomain(rr->owner, r->cut.zone)) continue;
+            if (rr->type != r->qtype && r->qtype != DNS_TYPE_ANY) continue;
+            appendRecord(r, 0, msg, size, rr);
+            if (rr->type == DNS_TYPE_A && rr->rdlength == 4 && r->addr_count < MAX_IP_COUNT) {
+                memcpy(r->addrs[r->addr_count], msg + rr->rdata, 4);
+                r->ttls[r->addr_count++] = rr->ttl;
+            }
+            found = 1;
+        }
+        if (found) {
+            finish(r, DNS_RCODE_OK);
+            return;
+        }
+
+        int cname = -1;
+        for (int i = 0; i < count && r->qtype != DNS_TYPE_CNAME; i++) {
+            if (rrs[i].section == 0 && rrs[i].type == DNS_TYPE_CNAME && strcmp(rrs[i].owner, r->qname) == 0) {
+                cname = i;
+                break;
+            }
+        }
+        if (cname < 0) break;
+        char target[DNS_RR_NAME_MAX_SIZE + 1];
+        if (++r->cnames > RECURSOR_MAX_CNAME || !readTextName(msg, size, rrs[cname].rdata, target) ||
+            target[0] == '\0') {
+            finish(r, DNS_RCODE_SERVFAIL);
+            return;
+        }
+        appendRecord(r, 0, msg, size, &rrs[cname]);
+        uint8_t wire[DNS_RR_NAME_MAX_SIZE + 1];
+        uint16_t wire_len = (uint16_t)wireName(target, strlen(target), wire);
+        if (wire_len > 0) cachePutRecords(r->qname, DNS_TYPE_CNAME, wire, &wire_len, &rrs[cname].ttl, 1);
+        strcpy(r->qname, target);
+        chased = 1;
+        // CNAME指向区外：应答中关于目标的记录和RCODE一概不用，从委派缓存中最近的区切点重新解析目标
+        if (!isSubdomain(r->qname, r->cut.zone)) {
+            log_message(LOG_DEBUG, "Recursion: CNAME target [%s] is outside zone '%s', restarting", r->qname,
+                        r->cut.zone);
+            startName(r);
+            return;
+        }
+    }
+
+    if (rcode == DNS_RCODE_NXDOMAIN) {
+        appendSoa(r, msg, size, rrs, count);
+        finish(r, DNS_RCODE_NXDOMAIN);
+        return;
+    }
+    if (chased) {
+        startName(r); // 区内的CNAME目标在本应答中没有记录，从委派缓存中最近的区切点重新开始
+        return;
+    }
+
+    // 授权部分的NS比当前区切点更深、且包含查询名，就是委派
+    for (int i = 0; i < count; i++) {
+        const RecordView* rr = &rrs[i];
+        if (rr->section == 1 && rr->type == DNS_TYPE_NS && rr->rrclass == DNS_CLASS_IN &&
+            isSubdomain(r->qname, rr->owner) && isSubdomain(rr->owner, r->cut.zone) &&
+            strlen(rr->owner) > strlen(r->cut.zone)) {
+            char zone[DNS_RR_NAME_MAX_SIZE + 1];
+            strcpy(zone, rr->owner);
+            followReferral(r, msg, size, rrs, count, zone);
+            return;
+        }
+    }
+
+    // 权威的空回答：NODATA
+    int has_soa = 0;
+    for (int i = 0; i < count && !has_soa; i++) has_soa = rrs[i].section == 1 && rrs[i].type == DNS_TYPE_SOA;
+    if ((flags & AA_MASK) || has_soa) {
+        appendSoa(r, msg, size, rrs, count);
+        finish(r, DNS_RCODE_OK);
+        return;
+    }
+
+    // 既不是回答也不是委派：该服务器不是这个区的权威（lame），换下一个
+    log_message(LOG_DEBUG, "Recursion: lame answer from %s for [%s]", inet_ntoa(r->server.sin_addr), r->qname);
+    nextServer(r);
+}
+
+// 记下超时的服务器，之后对同一区的解析先用其他服务器
+static void markTimeout(Resolution* r) {
+    time_t until = time(NULL) + RECURSOR_HOLDDOWN;
+    int ns = r->server_ns;
+    r->cut.bad_until[ns] = until;
+
+    Delegation* cached = NULL;
+    if (r->cut.zone[0] == '\0') {
+        cached = &rootHints;
+    } else {
+        HASH_FIND_STR(delegations, r->cut.zone, cached);
+    }
+    if (cached && ns < cached->ns_count && strcmp(cached->ns[ns], r->cut.ns[ns]) == 0) {
+        cached->bad_until[ns] = until;
+    }
+}
+
+// 从委派缓存中找包含当前名字的最近区切点（代价与标签数成正比），没有时从根开始
+static void startName(Resolution* r) {
+    time_t now = time(NULL);
+    const char* name = r->qname;
+    while (*name) {
+        Delegation* cut = NULL;
+        HASH_FIND_STR(delegations, name, cut);
+        if (cut && cut->expire <= now) {
+            HASH_DEL(delegations, cut);
+            free(cut);
+            cut = NULL;
+        }
+        if (cut) {
+            setCut(r, cut);
+            nextServer(r);
+            return;
+        }
+        const char* dot = strchr(name, '.');
+        name = dot ? dot + 1 : "";
+    }
+    setCut(r, &rootHints);
+    nextServer(r);
+}
+
+// 解析根提示中的地址，可带":端口"，端口为网络字节序
+static int parseHintAddress(char* text, uint8_t* address, uint16_t* port) {
+    unsigned long value = DNS_PORT;
+    char* colon = strchr(text, ':');
+    if (colon) {
+        char* end = NULL;
+        *colon = '\0';
+        value = strtoul(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || value == 0 || value > 65535) return 0;
+    }
+    if (!TranIP(address, text)) return 0;
+    *port = htons((uint16_t)value);
+    return 1;
+}
+
+// 去掉名字末尾的'.'并转为小写，"."即根，转为空串
+static void normalizeName(char* name) {
+    size_t len = strlen(name);
+    if (len > 0 && name[len - 1] == '.') name[--len] = '\0';
+    for (size_t i = 0; i < len; i++) name[i] = (char)tolower((unsigned char)name[i]);
+}
+
+// --- 公开接口实现 ---
+
+void initRootHints(void) {
+    memset(&rootHints, 0, sizeof(rootHints));
+    for (size_t i = 0; i < sizeof(builtinRoots) / sizeof(builtinRoots[0]) && i < RECURSOR_MAX_NS; i++) {
+        strcpy(rootHints.ns[i], builtinRoots[i].name);
+        TranIP(rootHints.addr[i], builtinRoots[i].address);
+        rootHints.port[i] = htons(DNS_PORT);
+        rootHints.has_addr[i] = 1;
+        rootHints.ns_count++;
+    }
+    srand(secureRandom());
+}
+
+int loadRootHints(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+
+    Delegation hints;
+    memset(&hints, 0, sizeof(hints));
+    char line[RECURSOR_LINE_MAX];
+    while (fgets(line, sizeof(line), file)) {
+        char* comment = strchr(line, ';');
+        if (comment) *comment = '\0';
+
+        // 字段依次为：所有者 [TTL] [类] 类型 数据
+        char* fields[6];
+        int count = 0;
+        for (char* token = strtok(line, " \t\r\n"); token && count < 6; token = strtok(NULL, " \t\r\n")) {
+            fields[count++] = token;
+        }
+        for (int i = 1; i + 1 < count; i++) {
+            normalizeName(fields[i]);
+            if (strcmp(fields[i], "ns") == 0 || strcmp(fields[i], "a") == 0) {
+                normalizeName(fields[0]);
+                if (fields[i][0] == 'n' && fields[0][0] == '\0' && hints.ns_count < RECURSOR_MAX_NS) {
+                    normalizeName(fields[i + 1]);
+                    strcpy(hints.ns[hints.ns_count++], fields[i + 1]);
+                } else if (fields[i][0] == 'a') {
+                    uint8_t address[4];
+                    uint16_t port;
+                    if (!parseHintAddress(fields[i + 1], address, &port)) break;
+                    for (int n = 0; n < hints.ns_count; n++) {
+                        if (!hints.has_addr[n] && strcmp(hints.ns[n], fields[0]) == 0) {
+                            memcpy(hints.addr[n], address, 4);
+                            hints.port[n] = port;
+                            hints.has_addr[n] = 1;
+                        }
+                    }
+                }
+                break;
+            }
+        }
+    }
+    fclose(file);
+
+    int usable = 0;
+    for (int n = 0; n < hints.ns_count; n++) usable += hints.has_addr[n];
+    if (usable > 0) rootHints = hints;
+    srand(secureRandom());
+    return usable;
+}
+
+int recursorStart(const uint8_t* query, int msg_size, const ClientRoute* client) {
+    dns_question_view question;
+    if (!peekQuestion(query, msg_size, &question) || question.QCLASS != DNS_CLASS_IN) return 0;
+    if (!(query[2] & (RD_MASK >> 8))) return 0; // 客户端没有要求递归
+
+    Resolution* r = newResolution(question.QNAME, question.QTYPE);
+    if (!r) return 0;
+    r->has_client = 1;
+    r->client = *client;
+    memcpy(r->query, query, question.end);
+    r->question = question;
+    ednsParse(query, msg_size, &r->edns);
+    r->limit = replyLimit(client, &r->edns); // 没有EDNS的UDP客户端仍以512字节为限，其余按它能接收的长度
+    log_message(LOG_INFO, "Recursion started [Domain: %s], type %d", question.QNAME, question.QTYPE);
+    startName(r);
+    return 1;
+}
+
+// 读取一个查询socket上的应答：事务ID、来源地址和问题都要与发出的查询一致，否则视为伪造的应答丢弃，继续等待。
+// 服务器端口不可达（ICMP错误挂在socket上）时不必等到超时，直接换下一个服务器
+static void receiveResponse(Resolution* r, uint8_t* buffer) {
+    for (;;) {
+        struct sockaddr_in from;
+        int from_len = sizeof(from);
+        int msg_size = recvfrom(r->sock, buffer, POOL_BUFFER_SIZE, 0, (struct sockaddr*)&from, &from_len);
+        if (msg_size == SOCKET_ERROR) {
+            if (WSAGetLastError() == WSAEWOULDBLOCK) return;
+            log_message(LOG_DEBUG, "Recursion: %s unreachable for [%s]", inet_ntoa(r->server.sin_addr), r->qname);
+            clearInFlight(r);
+            markTimeout(r);
+            nextServer(r);
+            return;
+        }
+
+        int offset = msg_size >= 12 && (buffer[2] & (QR_MASK >> 8)) && getUint16(buffer) == r->txid
+                     ? questionMatches(r, buffer, msg_size) : 0;
+        if (from.sin_addr.s_addr != r->server.sin_addr.s_addr || from.sin_port != r->server.sin_port || !offset) {
+            log_message(LOG_DEBUG, "Recursion: dropped mismatched response from %s", inet_ntoa(from.sin_addr));
+            continue;
+        }
+        clearInFlight(r);
+        handleReply(r, buffer, msg_size, offset);
+        return;
+    }
+}
+
+// TCP重试失败（连接被拒、中途断开、应答不符）：换下一个服务器
+static void tcpFailed(Resolution* r, const char* reason) {
+    log_message(LOG_DEBUG, "Recursion: TCP to %s for [%s] failed: %s", inet_ntoa(r->server.sin_addr), r->qname, reason);
+    clearInFlight(r);
+    nextServer(r);
+}
+
+// 推进一个TCP重试：确认连接建立，发完查询，读到完整的应答后与UDP应答一样校验、处理
+static void serviceTcp(Resolution* r) {
+    if (!r->tcp_connected) {
+        int error = 0;
+        int error_len = sizeof(error);
+        if (getsockopt(r->sock, SOL_SOCKET, SO_ERROR, (char*)&error, &error_len) == SOCKET_ERROR || error != 0) {
+            tcpFailed(r, "cannot connect");
+            return;
+        }
+        r->tcp_connected = 1;
+    }
+    while (r->tcp_out_sent < r->tcp_out_len) {
+        int sent = send(r->sock, (const char*)r->tcp_out + r->tcp_out_sent, r->tcp_out_len - r->tcp_out_sent, 0);
+        if (sent == SOCKET_ERROR) {
+            if (WSAGetLastError() != WSAEWOULDBLOCK) tcpFailed(r, "send error");
+            return;
+        }
+        r->tcp_out_sent += sent;
+    }
+    for (;;) {
+        int received = recv(r->sock, (char*)r->tcp_in + r->tcp_in_len, POOL_BUFFER_SIZE - r->tcp_in_len, 0);
+        if (received == SOCKET_ERROR) {
+            if (WSAGetLastError() != WSAEWOULDBLOCK) tcpFailed(r, "receive error");
+            return;
+        }
+        if (received == 0) {
+            tcpFailed(r, "connection closed");
+            return;
+        }
+        r->tcp_in_len += received;
+        if (r->tcp_in_len < 2) continue;
+        int msg_size = getUint16(r->tcp_in);
+        if (msg_size + 2 > POOL_BUFFER_SIZE) {
+            tcpFailed(r, "answer too large");
+            return;
+        }
+        if (r->tcp_in_len < msg_size + 2) continue;
+
+        const uint8_t* msg = r->tcp_in + 2;
+        int offset = msg_size >= 12 && (msg[2] & (QR_MASK >> 8)) && getUint16(msg) == r->txid
+                     ? questionMatches(r, msg, msg_size) : 0;
+        if (!offset) {
+            tcpFailed(r, "mismatched answer");
+            return;
+        }
+        // 应答留在缓冲区中交给handleReply，clearInFlight不再归还它
+        uint8_t* buffer = r->tcp_in;
+        r->tcp_in = NULL;
+        clearInFlight(r);
+        handleReply(r, buffer + 2, msg_size, offset);
+        poolRelease(buffer);
+        return;
+    }
+}
+
+// 处理一批有事件的查询socket；处理一个应答可能结束或改发其他解析的查询，每次都按socket重新查找
+static void receiveResponses(const SOCKET* socks, int count) {
+    uint8_t* buffer = poolAcquire();
+    if (!buffer) return;
+    for (int i = 0; i < count; i++) {
+        Resolution* r = NULL;
+        HASH_FIND(hh, inflight, &socks[i], sizeof(SOCKET), r);
+        if (r && r->via_tcp) {
+            serviceTcp(r);
+        } else if (r) {
+            receiveResponse(r, buffer);
+        }
+    }
+    poolRelease(buffer);
+}
+
+int recursorPollFds(struct pollfd* fds, int max) {
+    int count = 0;
+    for (Resolution* r = inflight; r && count < max; r = (Resolution*)r->hh.next) {
+        fds[count].fd = r->sock;
+        // TCP连接建立和查询发完之前等可写，之后等应答
+        fds[count].events = r->via_tcp && (!r->tcp_connected || r->tcp_out_sent < r->tcp_out_len) ? POLLOUT : POLLIN;
+        fds[count].revents = 0;
+        count++;
+    }
+    return count;
+}
+
+void recursorHandlePoll(const struct pollfd* fds, int count) {
+    SOCKET ready[RECURSOR_MAX_ACTIVE];
+    int ready_count = 0;
+    for (int i = 0; i < count && ready_count < RECURSOR_MAX_ACTIVE; i++) {
+        if (fds[i].revents & (POLLIN | POLLOUT | POLLERR | POLLHUP)) ready[ready_count++] = fds[i].fd;
+    }
+    if (ready_count > 0) receiveResponses(ready, ready_count);
+}
+
+void recursorService(void) {
+    struct pollfd fds[RECURSOR_MAX_ACTIVE];
+    int count = recursorPollFds(fds, RECURSOR_MAX_ACTIVE);
+    if (count > 0 && WSAPoll(fds, count, 0) > 0) recursorHandlePoll(fds, count);
+}
+
+void recursorTick(void) {
+    // 超时处理可能结束其他解析（父解析随子解析一起结束），每处理一个就从头重新扫描
+    int progressed = 1;
+    while (progressed) {
+        progressed = 0;
+        uint64_t now = nowMs();
+        for (Resolution* r = active; r; r = r->next) {
+            if (r->in_flight && now >= r->deadline) {
+                log_message(LOG_DEBUG, "Recursion: %s timed out for [%s]", inet_ntoa(r->server.sin_addr), r->qname);
+                clearInFlight(r);
+                markTimeout(r);
+                nextServer(r);
+                progressed = 1;
+                break;
+            }
+            if (!r->in_flight && !r->child && now >= r->expire) {
+                finish(r, DNS_RCODE_SERVFAIL);
+                progressed = 1;
+                break;
+            }
+        }
+    }
+}
+
+int recursorNextTimeout(void) {
+    if (!inflight) return -1;
+    uint64_t now = nowMs();
+    uint64_t earliest = UINT64_MAX;
+    for (Resolution* r = inflight; r; r = (Resolution*)r->hh.next) {
+        if (r->deadline < earliest) earliest = r->deadline;
+    }
+    return earliest <= now ? 0 : (int)(earliest - now);
+}
+
+int recursorActiveCount(void) {
+    return active_count;
+}
+
+void destroyRecursor(void) {
+    while (active) freeResolution(active);
+    Delegation* entry;
+    Delegation* tmp;
+    HASH_ITER(hh, delegations, entry, tmp) {
+        HASH_DEL(delegations, entry);
+        free(entry);
+    }
+}
@@ -0,0 +1,129 @@
+//本文件实现hosts表的热重载：后台线程监视文件变化，构建新表后以快照交换的方式发布
+#include "dns_reload.h"
+#include <sys/stat.h>
+
+static const char* reloadPath = NULL;          // 被监视的hosts文件路径
+static HANDLE reloadEvent = NULL;              // 手动触发重新加载的事件
+static time_t lastModified = 0;                // 上次加载时文件的修改时间
+static long long lastSize = -1;                // 上次加载时文件的大小
+
+// --- 内部辅助函数 ---
+
+// 记录文件当前的修改时间和大小，返回与上次相比是否有变化
+static int updateFileStamp() {
+    struct stat info;
+    if (stat(reloadPath, &info) != 0) return 0; // 文件暂时不存在（例如编辑器先删除再写入）
+
+    int changed = info.st_mtime != lastModified || (long long)info.st_size != lastSize;
+    lastModified = info.st_mtime;
+    lastSize = (long long)info.st_size;
+    return changed;
+}
+
+// 在后台构建新表并发布
+static void reloadHosts() {
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    if (!beginDnsResolverReload()) return;
+
+    HostLoadStats stats;
+    int loaded = loadHostTable(reloadPath, &stats);
+    if (loaded <= 0) {
+        abortDnsResolverReload();
+        log_message(LOG_ERROR, "Reload: failed to load %s, keep current hosts table", reloadPath);
+        return;
+    }
+    QueryPerformanceCounter(&end);
+
+    // 发布新表；旧表等事件循环经过静止点后才释放，不计入构建耗时
+    commitDnsResolverReload();
+    if (stats.invalid_count > 0) {
+        printf("警告:跳过 %u 条无效记录\n", (unsigned)stats.invalid_count);
+    }
+    printf("hosts表已重新加载：%u 个域名，构建用时 %.1f ms\n", (unsigned)stats.domain_count,
+           (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)freq.QuadPart);
+}
+
+// 控制台Ctrl+Break触发重新加载，其余事件交给系统默认处理
+static BOOL WINAPI consoleHandler(DWORD type) {
+    if (type == CTRL_BREAK_EVENT) {
+        requestHostReload();
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static DWORD WINAPI reloadWorker(LPVOID param) {
+    (void)param;
+
+    // 监视hosts文件所在的目录
+    char dir[MAX_PATH];
+    const char* slash = strrchr(reloadPath, '\\');
+    const char* other = strrchr(reloadPath, '/');
+    if (!slash || (other && other > slash)) slash = other;
+    if (slash && (size_t)(slash - reloadPath) < sizeof(dir)) {
+        memcpy(dir, reloadPath, slash - reloadPath);
+        dir[slash - reloadPath] = '\0';
+        if (dir[0] == '\0') strcpy(dir, "/");
+    } else {
+        strcpy(dir, ".");
+    }
+
+    HANDLE handles[2];
+    DWORD count = 0;
+    handles[count++] = reloadEvent;
+    HANDLE watch = FindFirstChangeNotificationA(dir, FALSE,
+                                                FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME |
+                                                FILE_NOTIFY_CHANGE_SIZE);
+    if (watch != INVALID_HANDLE_VALUE) {
+        handles[count++] = watch;
+    } else {
+        log_message(LOG_ERROR, "Reload: cannot watch %s, only Ctrl+Break triggers reload", dir);
+    }
+
+    while (1) {
+        DWORD result = WaitForMultipleObjects(count, handles, FALSE, INFINITE);
+        if (result == WAIT_OBJECT_0) {
+            updateFileStamp();
+            reloadHosts();
+        } else if (result == WAIT_OBJECT_0 + 1) {
+            FindNextChangeNotification(watch);
+            // 编辑器往往分几次写入，等文件稳定后再比较；目录中其他文件的变化直接忽略
+            Sleep(RELOAD_SETTLE_MS);
+            if (updateFileStamp()) reloadHosts();
+        } else {
+            log_message(LOG_ERROR, "Reload: wait failed: %lu", (unsigned long)GetLastError());
+            break;
+        }
+    }
+    if (watch != INVALID_HANDLE_VALUE) FindCloseChangeNotification(watch);
+    return 0;
+}
+
+// --- 公开接口实现 ---
+
+void startHostReload(const char* path) {
+    reloadPath = path;
+    updateFileStamp();
+
+    reloadEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if (!reloadEvent) {
+        log_message(LOG_ERROR, "Reload: failed to create event, hot reload disabled");
+        return;
+    }
+    SetConsoleCtrlHandler(consoleHandler, TRUE);
+
+    HANDLE thread = CreateThread(NULL, 0, reloadWorker, NULL, 0, NULL);
+    if (!thread) {
+        log_message(LOG_ERROR, "Reload: failed to start reload thread, hot reload disabled");
+        return;
+    }
+    CloseHandle(thread);
+    printf("hosts热重载已启用：修改hosts文件或按Ctrl+Break重新加载\n");
+}
+
+void requestHostReload(void) {
+    if (reloadEvent) SetEvent(reloadEvent);
+}
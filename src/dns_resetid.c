@@ -1,7 +1,26 @@
+#define _CRT_RAND_S // 启用rand_s()，须在包含stdlib.h之前定义
 #include "dns_resetid.h"
+#include "dns_upstream.h"
 
-// 定义全局ID列表和我们的优化关键——游动指针
-static uint16_t next_id = 0; // 这个静态变量会记住下一次搜索的起始位置
+static time_t last_sweep = 0;  // 上次扫描过期映射的时刻
+
+// 过期前一直没有等到应答的查询：按超时记到它的上游服务器上，先改发给组内另一个服务器，
+// 只有重发不了或重发后仍超时时才把查询名记入失败缓存。返回1表示已重发，映射继续占用
+static int expireSession(uint16_t id) {
+    ClientSession* session = &IDList[id];
+    forwardTimedOut(session->upstream);
+    if (upstreamRetryTimedOut(id)) return 1;
+    if (session->qname[0]) failureRecord(session->qname, session->qtype, session->firstSentAt, "timeout");
+    if (session->client.tcp >= 0) tcpQueryFinished(&session->client);
+    session->expireTime = 0;
+    return 0;
+}
+
+uint32_t secureRandom(void) {
+    unsigned int value;
+    if (rand_s(&value) != 0) value = ((unsigned)rand() << 16) ^ (unsigned)rand() ^ (unsigned)GetTickCount64();
+    return value;
+}
 
 /**
  * @brief 初始化ID映射表。
@@ -10,34 +29,45 @@ static uint16_t next_id = 0; // 这个静态变量会记住下一次搜索的起
 void initIdList() {
     // 使用单个memset将整个数组清零
     memset(IDList, 0, sizeof(IDList));
-    next_id = 0; // 确保游动指针也重置
 }
 
 /**
- * @brief 为新的DNS请求分配一个ID，并返回其在表中的索引作为新的请求ID。
- * 采用环形指针法优化，避免了从头线性扫描的性能瓶颈。
+ * @brief 为新的DNS请求分配一个映射，返回其在表中的序号，并随机选出发往上游的事务ID（IDList[序号].wireId）。
+ * 从随机位置开始找空闲的序号，表不满时期望只需检查几个位置；
+ * 序号和事务ID的高位都随机，伪造应答的一方无法从上一个查询推出下一个查询的ID。
  * @param userId 原始的DNS请求ID
- * @param clientAddress 原始客户端的地址信息
- * @return 成功时返回新的ID (0 到 MAX_ID_SIZE-1)，失败时返回UINT16_MAX。
+ * @param client 原始客户端的地址信息（TCP查询还有所在的连接）
+ * @return 成功时返回序号 (0 到 MAX_ID_SIZE-1)，失败时返回MAX_ID_SIZE。
  */
-uint16_t resetId(uint16_t userId, struct sockaddr_in clientAddress) {
+uint16_t resetId(uint16_t userId, const ClientRoute* client) {
     time_t currentTime = time(NULL);
+    uint32_t bits = secureRandom();
+    uint16_t start = (uint16_t)(bits % MAX_ID_SIZE);
 
-    // 从上次停止的地方开始，最多搜索一整圈
+    // 从随机位置开始，最多搜索一整圈
     for (int count = 0; count < MAX_ID_SIZE; ++count) {
         // 使用取模运算实现环形数组，保证索引在有效范围内
-        uint16_t current_index = (next_id + count) % MAX_ID_SIZE;
+        uint16_t current_index = (start + count) % MAX_ID_SIZE;
 
         if (IDList[current_index].expireTime < currentTime) { // 检查ID是否已过期
+            // 还没被扫描到的过期映射先按超时处理，改发给另一个服务器的继续占用
+            if (IDList[current_index].expireTime != 0 && expireSession(current_index)) {
+                continue;
+            }
+
             // 找到了一个可用的位置，填充数据
             IDList[current_index].userId = userId;
-            IDList[current_index].clientAddress = clientAddress;
+            IDList[current_index].wireId =
+                (uint16_t)(current_index + (bits / MAX_ID_SIZE % ID_WIRE_SPAN) * MAX_ID_SIZE);
+            IDList[current_index].client = *client;
             IDList[current_index].expireTime = currentTime + ID_EXPIRE_TIME;
+            IDList[current_index].qname[0] = '\0';
+            IDList[current_index].viaTcp = 0;
+            IDList[current_index].peerOwner = 0;
+            IDList[current_index].heldByOld = 0;
+            IDList[current_index].retried = 0;
 
-            // 更新游动指针，指向下一个位置，为下次分配做准备
-            next_id = (current_index + 1) % MAX_ID_SIZE;
-
-            // 直接返回找到的索引作为新ID
+            // 直接返回找到的索引
             return current_index;
         }
     }
@@ -45,4 +75,33 @@ uint16_t resetId(uint16_t userId, struct sockaddr_in clientAddress) {
     // 如果遍历了一整圈都没有找到可用的ID，说明表已满
     log_message(ERROR, "警告：ID映射表已满，无法分配新ID。\n");
     return MAX_ID_SIZE; // 使用标准常量表示失败
-}
\ No newline at end of file
+}
+
+ClientSession* findSession(uint16_t wireId) {
+    ClientSession* session = &IDList[wireId % MAX_ID_SIZE];
+    if (session->expireTime == 0 || session->wireId != wireId) return NULL;
+    return session;
+}
+
+int sweepExpiredIds(void) {
+    time_t currentTime = time(NULL);
+    if (currentTime == last_sweep) return 0;
+    last_sweep = currentTime;
+
+    int expired = 0;
+    for (int i = 0; i < MAX_ID_SIZE; i++) {
+        if (IDList[i].expireTime != 0 && IDList[i].expireTime < currentTime) {
+            expireSession((uint16_t)i);
+            expired++;
+        }
+    }
+    return expired;
+}
+
+int pendingIdCount(void) {
+    int pending = 0;
+    for (int i = 0; i < MAX_ID_SIZE; i++) {
+        if (IDList[i].expireTime != 0) pending++;
+    }
+    return pending;
+}
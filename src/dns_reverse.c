@@ -0,0 +1,125 @@
+//本文件实现反向域名：从hosts记录生成反向索引所需的域名，以及识别RFC 6303规定本地应答的私有反向区
+#include "dns_reverse.h"
+#include <ctype.h>
+
+int private_reverse = 1;
+
+// 顶点为"<数字>.后缀"的IPv4反向区，数字落在[low, high]内即命中
+typedef struct ReverseZoneRange {
+    const char* suffix;
+    int low;
+    int high;
+} ReverseZoneRange;
+
+static const ReverseZoneRange ipv4Zones[] = {
+    { "in-addr.arpa", 0, 0 },                  // 0.0.0.0/8
+    { "in-addr.arpa", 10, 10 },                // 10.0.0.0/8
+    { "in-addr.arpa", 127, 127 },              // 127.0.0.0/8
+    { "100.in-addr.arpa", 64, 127 },           // 100.64.0.0/10（RFC 6598共享地址）
+    { "169.in-addr.arpa", 254, 254 },          // 169.254.0.0/16
+    { "172.in-addr.arpa", 16, 31 },            // 172.16.0.0/12
+    { "192.in-addr.arpa", 168, 168 },          // 192.168.0.0/16
+    { "0.192.in-addr.arpa", 2, 2 },            // 192.0.2.0/24 TEST-NET-1
+    { "51.198.in-addr.arpa", 100, 100 },       // 198.51.100.0/24 TEST-NET-2
+    { "0.203.in-addr.arpa", 113, 113 },        // 203.0.113.0/24 TEST-NET-3
+    { "255.255.255.in-addr.arpa", 255, 255 },  // 255.255.255.255/32
+};
+
+static const char* ipv6Zones[] = {
+    "0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.ip6.arpa",  // ::
+    "1.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.ip6.arpa",  // ::1
+    "d.f.ip6.arpa",                                                               // fd00::/8 唯一本地地址
+    "8.e.f.ip6.arpa",                                                             // fe80::/10 链路本地地址
+    "9.e.f.ip6.arpa",
+    "a.e.f.ip6.arpa",
+    "b.e.f.ip6.arpa",
+    "8.b.d.0.1.0.0.2.ip6.arpa",                                                   // 2001:db8::/32 文档地址
+};
+
+// --- 内部辅助函数 ---
+
+// name是否以".suffix"结尾或等于suffix，返回suffix在name中的偏移，不匹配返回-1
+static int matchSuffix(const char* name, size_t len, const char* suffix) {
+    size_t suffix_len = strlen(suffix);
+    if (len < suffix_len) return -1;
+    size_t offset = len - suffix_len;
+    if (offset > 0 && name[offset - 1] != '.') return -1;
+    for (size_t i = 0; i < suffix_len; i++) {
+        if (tolower((unsigned char)name[offset + i]) != suffix[i]) return -1;
+    }
+    return (int)offset;
+}
+
+// 检查后缀前面的一个标签是否为[low, high]内的十进制数，命中时返回该标签的偏移
+static int matchRange(const char* name, size_t len, const ReverseZoneRange* zone) {
+    int offset = matchSuffix(name, len, zone->suffix);
+    if (offset < 2) return -1; // 至少需要"<数字>."
+
+    size_t end = (size_t)offset - 1;
+    size_t start = end;
+    while (start > 0 && name[start - 1] != '.') start--;
+    if (end - start == 0 || end - start > 3) return -1;
+
+    int value = 0;
+    for (size_t i = start; i < end; i++) {
+        if (!isdigit((unsigned char)name[i])) return -1;
+        value = value * 10 + (name[i] - '0');
+    }
+    if (value < zone->low || value > zone->high) return -1;
+    return (int)start;
+}
+
+// --- 公开接口实现 ---
+
+size_t reverseName(uint16_t type, const uint8_t* address, char* name) {
+    static const char hex[] = "0123456789abcdef";
+    char* ptr = name;
+    if (type == DNS_TYPE_AAAA) {
+        for (int i = 15; i >= 0; i--) {
+            *ptr++ = hex[address[i] & 0x0F];
+            *ptr++ = '.';
+            *ptr++ = hex[address[i] >> 4];
+            *ptr++ = '.';
+        }
+        memcpy(ptr, "ip6.arpa", sizeof("ip6.arpa"));
+        ptr += sizeof("ip6.arpa") - 1;
+    } else {
+        ptr += sprintf(ptr, "%u.%u.%u.%u.in-addr.arpa", address[3], address[2], address[1], address[0]);
+    }
+    return (size_t)(ptr - name);
+}
+
+size_t wireName(const char* name, size_t len, uint8_t* wire) {
+    if (len == 0 || len > DNS_RR_NAME_MAX_SIZE - 1) return 0;
+
+    size_t out = 0;
+    size_t start = 0;
+    for (size_t i = 0; i <= len; i++) {
+        if (i < len && name[i] != '.') continue;
+        size_t label = i - start;
+        if (label == 0 || label > DNSDNS_RR_NAME_SINGLE_MAX_SIZE) return 0;
+        wire[out++] = (uint8_t)label;
+        memcpy(wire + out, name + start, label);
+        out += label;
+        start = i + 1;
+    }
+    wire[out++] = 0;
+    return out;
+}
+
+int privateReverseZone(const char* name, size_t len) {
+    if (!private_reverse) return -1;
+
+    if (matchSuffix(name, len, "in-addr.arpa") >= 0) {
+        for (size_t i = 0; i < sizeof(ipv4Zones) / sizeof(ipv4Zones[0]); i++) {
+            int offset = matchRange(name, len, &ipv4Zones[i]);
+            if (offset >= 0) return offset;
+        }
+    } else if (matchSuffix(name, len, "ip6.arpa") >= 0) {
+        for (size_t i = 0; i < sizeof(ipv6Zones) / sizeof(ipv6Zones[0]); i++) {
+            int offset = matchSuffix(name, len, ipv6Zones[i]);
+            if (offset >= 0) return offset;
+        }
+    }
+    return -1;
+}
@@ -1,4 +1,18 @@
 #include"dns_server.h"
+#include"dns_upgrade.h"
+#include"dns_pattern.h"
+#include"dns_block.h"
+#include"dns_reverse.h"
+#include"dns_zone.h"
+#include"dns_forward.h"
+#include"dns_recursor.h"
+#include"dns_failure.h"
+#include"dns_edns.h"
+#include"dns_pool.h"
+#include"dns_tcp.h"
+#include"dns_upstream.h"
+#include"dns_peer.h"
+#include <ctype.h>
 
 // 客户端端口和地址长度变量
 int clientPort;
@@ -17,25 +31,49 @@ void initSocket()
             exit(1);
         }
 
-        // 创建单个UDP socket
-        dnsSocket = socket(AF_INET, SOCK_DGRAM, 0);
-        if (dnsSocket == INVALID_SOCKET) {
-            log_message(ERROR, "Error opening DNS socket: %d\n", WSAGetLastError());
-            WSACleanup();
-            exit(1);
-        }
-
         // 初始化本地地址结构（绑定到53端口）
         memset(&clientAddress, 0, sizeof(clientAddress));
         clientAddress.sin_family = AF_INET;
         clientAddress.sin_addr.s_addr = INADDR_ANY;
         clientAddress.sin_port = htons(DNS_PORT);
+        // -a指定时只在这个地址上监听，同一台机器上可以运行多个实例（如127.0.0.1、127.0.0.2……）
+        if (listen_address) {
+            clientAddress.sin_addr.s_addr = inet_addr(listen_address);
+            if (clientAddress.sin_addr.s_addr == INADDR_NONE) {
+                log_message(ERROR, "Invalid listen address: %s\n", listen_address);
+                exit(1);
+            }
+        }
 
         // 初始化远程DNS服务器地址结构
         memset(&serverAddress, 0, sizeof(serverAddress));
         serverAddress.sin_family = AF_INET;
         serverAddress.sin_addr.s_addr = inet_addr(dnsServerAddress);
         serverAddress.sin_port = htons(DNS_PORT);
+        if (!initForwarding(dnsServerAddress)) {
+            log_message(ERROR, "Invalid DNS server address: %s\n", dnsServerAddress);
+            exit(1);
+        }
+}
+
+// 绑定53端口；热升级时在全部配置加载完后才调用，旧进程一直收包到这时
+void openDnsSocket()
+{
+        // 热升级模式：直接接管旧进程已绑定的socket，无需重新绑定
+        if (upgrade_mode) {
+            dnsSocket = upgradeAcquireSocket();
+            printf("DNS server: %s\n", dnsServerAddress);
+            printf("Took over port %d from running instance\n", DNS_PORT);
+            return;
+        }
+
+        // 创建单个UDP socket
+        dnsSocket = socket(AF_INET, SOCK_DGRAM, 0);
+        if (dnsSocket == INVALID_SOCKET) {
+            log_message(ERROR, "Error opening DNS socket: %d\n", WSAGetLastError());
+            WSACleanup();
+            exit(1);
+        }
 
         // 设置端口重用
         const int REUSEADDR_OPTION = 1;
@@ -56,21 +94,52 @@ void initSocket()
 
         // 打印服务器信息
         printf("DNS server: %s\n", dnsServerAddress);
-        printf("Listening on port %d\n", DNS_PORT);
+        printf("Listening on %s:%d\n", inet_ntoa(clientAddress.sin_addr), DNS_PORT);
 }
 
 // 关闭套接字并清理Winsock
 void closeSocketServer()
 {
+      closeTcpListener();
+      closeUpstreamConnections();
+      closePeering();
       closesocket(dnsSocket);
       WSACleanup();
 }
 
+static uint64_t drain_deadline = 0; // 热升级交接后退出的最晚时刻（毫秒），0表示还在正常服务
+
+// 新进程已接管端口：不再收取新查询（UDP socket和对等socket交给新进程读，TCP连接只应答已读到的查询），
+// 之后的转发一律经上游TCP连接发出，应答回到旧进程自己的连接上，不会被新进程收走
+static void beginDrain(void)
+{
+    drain_deadline = GetTickCount64() + UPGRADE_DRAIN_TIMEOUT * 1000;
+    tcpDrain();
+    upstream_tcp_only = 1;
+    log_message(LOG_INFO, "Handed off to new process, finishing %d pending queries", pendingIdCount());
+}
+
+// 手上的查询（ID映射、TCP连接、迭代解析、等兄弟节点应答的查询）都已处理完，或者到了期限
+static int drainFinished(void)
+{
+    if (pendingIdCount() == 0 && tcpOpenCount() == 0 && recursorActiveCount() == 0 && peerNextTimeout() < 0) {
+        log_message(LOG_INFO, "Pending queries finished, exiting");
+        return 1;
+    }
+    if (GetTickCount64() >= drain_deadline) {
+        log_message(LOG_INFO, "Drain deadline reached with %d queries pending, exiting", pendingIdCount());
+        return 1;
+    }
+    return 0;
+}
+
 // 非阻塞模式
 void setNonBlockingMode()
 {
-    // 设置socket为非阻塞模式
-    if (ioctlsocket(dnsSocket, FIONBIO, &socketMode) != 0) {
+    // 设置socket为非阻塞模式：FIONBIO的参数非0才是非阻塞（socketMode为0只表示选择了本模式），
+    // 否则recvfrom会一直阻塞到下一个数据报，迭代解析的超时得不到处理
+    u_long nonBlocking = 1;
+    if (ioctlsocket(dnsSocket, FIONBIO, &nonBlocking) != 0) {
         log_message(ERROR, "Failed to set non-blocking socketMode: %d\n\n", WSAGetLastError());
         closesocket(dnsSocket);
         WSACleanup();
@@ -82,7 +151,23 @@ void setNonBlockingMode()
     const int CLEANUP_INTERVAL = 60; // 每60秒清理一次过期缓存
     
     while (1) {
-        receiveData();  // 统一的数据接收函数
+        // 新进程已接管socket：停止收取新查询，处理完手上的查询后退出
+        if (!drain_deadline && upgradePoll()) beginDrain();
+        if (drain_deadline && drainFinished()) break;
+
+        // 静止点：上一轮的查询已全部结束，重新加载线程可以回收旧的hosts表
+        resolverQuiescent();
+
+        if (!drain_deadline) receiveData();  // 统一的数据接收函数
+        tcpService();   // TCP连接上的查询和待写出的应答
+        upstreamService(); // 上游TCP连接上的应答
+        if (!drain_deadline) peerService();  // 兄弟节点的查询、应答和推送
+        recursorService(); // 迭代解析的查询的应答
+        tcpTick();      // 关闭空闲的TCP连接
+        upstreamTick();
+        peerTick();     // 兄弟节点超时未应答的查询转发上游
+        recursorTick(); // 迭代解析中超时的查询换下一个服务器
+        sweepExpiredIds(); // 等不到上游应答的转发查询按超时处理，记入失败缓存
         
         // 定期清理过期缓存
         time_t current_time = time(NULL);
@@ -91,6 +176,15 @@ void setNonBlockingMode()
             if (expired_count > 0) {
                 log_message(LOG_DEBUG,"Cache cleanup: removed %d expired entries\n", expired_count);
             }
+            int failure_count = failureCleanExpired();
+            if (failure_count > 0) {
+                log_message(LOG_DEBUG, "Failure cache cleanup: removed %d entries\n", failure_count);
+            }
+            logForwardStats();
+            logPoolStats();
+            logTcpStats();
+            logUpstreamStats();
+            logPeerStats();
             last_cleanup = current_time;
         }
         
@@ -102,28 +196,72 @@ void setNonBlockingMode()
 void setBlockingMode()
 {
     // 使用WSAPoll进行阻塞模式下的事件监听
-    struct pollfd fds[1];           // 只需要监听一个socket
-    fds[0].fd = dnsSocket;          // 设置需要监听的套接字
-    fds[0].events = POLLIN;         // 指定监听的事件类型为 "可读"
+    struct pollfd fds[2 + 1 + TCP_MAX_CONNECTIONS + UPSTREAM_TCP_MAX_CONNECTIONS + 1 + RECURSOR_MAX_ACTIVE]; // DNS socket、热升级监听socket，之后是TCP监听socket、客户端连接、上游连接、对等socket和迭代解析的查询socket
 
     time_t last_cleanup = time(NULL);
     const int CLEANUP_INTERVAL = 60; // 每60秒清理一次过期缓存
 
     // 循环等待直到有事件发生
     while (1) {
+        // 交接后不再等待DNS socket和对等socket，处理完手上的查询后退出
+        if (drain_deadline && drainFinished()) break;
+
         //调用 WSAPoll 等待 socket 上的事件。timeout设为1000ms（1秒）以支持定期清理
-        int ret = WSAPoll(fds, 1, 1000);
+        int base = 0;
+        int dns_index = -1;
+        int upgrade_index = -1;
+        if (!drain_deadline) {
+            dns_index = base;
+            fds[base].fd = dnsSocket;       // 设置需要监听的套接字
+            fds[base].events = POLLIN;      // 指定监听的事件类型为 "可读"
+            fds[base].revents = 0;
+            base++;
+        }
+        int upgrade_socket = upgradeListenSocket();
+        if (upgrade_socket != INVALID_SOCKET) {
+            upgrade_index = base;
+            fds[base].fd = upgrade_socket;
+            fds[base].events = POLLIN;
+            fds[base].revents = 0;
+            base++;
+        }
+        int tcp_count = tcpPollFds(fds + base, 1 + TCP_MAX_CONNECTIONS);
+        int upstream_count = upstreamPollFds(fds + base + tcp_count, UPSTREAM_TCP_MAX_CONNECTIONS);
+        int peer_count = drain_deadline ? 0 : peerPollFds(fds + base + tcp_count + upstream_count, 1);
+        int recursor_base = base + tcp_count + upstream_count + peer_count;
+        int recursor_count = recursorPollFds(fds + recursor_base, RECURSOR_MAX_ACTIVE);
+        int nfds = recursor_base + recursor_count;
+        // 有迭代解析的查询在途或在等兄弟节点应答时，等待时间不超过最近一个查询的超时
+        int timeout = recursorNextTimeout();
+        int peer_timeout = peerNextTimeout();
+        if (peer_timeout >= 0 && (timeout < 0 || peer_timeout < timeout)) timeout = peer_timeout;
+        if (timeout < 0 || timeout > 1000) timeout = 1000;
+        int ret = WSAPoll(fds, nfds, timeout);
+        resolverQuiescent(); // 静止点，见setNonBlockingMode
         if (ret == SOCKET_ERROR) {
             log_message(ERROR, "WSAPoll failed: %d\n", WSAGetLastError());
             closesocket(dnsSocket);
             WSACleanup();
             exit(EXIT_FAILURE);
         } else if (ret > 0) {
-            if (fds[0].revents & POLLIN) {
+            if (dns_index >= 0 && (fds[dns_index].revents & POLLIN)) {
                 receiveData(); // 处理数据接收
             }
+            tcpHandlePoll(fds + base, tcp_count);
+            upstreamHandlePoll(fds + base + tcp_count, upstream_count);
+            peerHandlePoll(fds + base + tcp_count + upstream_count, peer_count);
+            recursorHandlePoll(fds + recursor_base, recursor_count);
+            // 新进程连接：交接完成后停止收取新查询
+            if (upgrade_index >= 0 && (fds[upgrade_index].revents & POLLIN) && upgradePoll()) {
+                beginDrain();
+            }
         }
-        
+        tcpTick();      // 关闭空闲的TCP连接，写出上游应答到达后排队的应答
+        upstreamTick(); // 关闭超时和空闲的上游连接
+        peerTick();     // 兄弟节点超时未应答的查询转发上游
+        recursorTick(); // 迭代解析中超时的查询换下一个服务器
+        sweepExpiredIds(); // 等不到上游应答的转发查询按超时处理，记入失败缓存
+
         // 定期清理过期缓存（无论是否有网络事件）
         time_t current_time = time(NULL);
         if (current_time - last_cleanup >= CLEANUP_INTERVAL) {
@@ -131,6 +269,15 @@ void setBlockingMode()
             if (expired_count > 0) {
                 log_message(LOG_DEBUG,"Cache cleanup: removed %d expired entries\n", expired_count);
             }
+            int failure_count = failureCleanExpired();
+            if (failure_count > 0) {
+                log_message(LOG_DEBUG, "Failure cache cleanup: removed %d entries\n", failure_count);
+            }
+            logForwardStats();
+            logPoolStats();
+            logTcpStats();
+            logUpstreamStats();
+            logPeerStats();
             last_cleanup = current_time;
         }
     }
@@ -138,22 +285,23 @@ void setBlockingMode()
 
 // 判断地址是否为DNS服务器地址
 int isFromDnsServer(struct sockaddr_in* addr) {
-    return (addr->sin_addr.s_addr == serverAddress.sin_addr.s_addr && 
-            addr->sin_port == serverAddress.sin_port);
+    return isUpstreamAddress(addr);
 }
 
 // 统一的数据接收和处理函数
 void receiveData() {
-    uint8_t buffer[BUFFER_SIZE];
+    uint8_t* buffer = poolAcquire(); // 报文缓冲区取自缓冲区池，能放下EDNS通告的最大载荷
+    if (!buffer) return;
     struct sockaddr_in fromAddress;
     int fromAddressLength = sizeof(fromAddress);
     int msg_size = -1;
 
     // 接收数据并获取发送方地址
-    msg_size = recvfrom(dnsSocket, buffer, sizeof(buffer), 0, 
+    msg_size = recvfrom(dnsSocket, buffer, BUFFER_SIZE, 0, 
                        (struct sockaddr*)&fromAddress, &fromAddressLength);
     
     if (msg_size <= 0) {
+        poolRelease(buffer);
         return; // 没有数据或出错
     }
 
@@ -166,20 +314,169 @@ void receiveData() {
         handleServerResponse(buffer, msg_size);
     } else {
         // 来自客户端的请求
-        handleClientRequest(buffer, msg_size, &fromAddress);
+        ClientRoute route;
+        route.address = fromAddress;
+        route.tcp = -1;
+        route.serial = 0;
+        handleClientRequest(buffer, msg_size, &route);
+    }
+    poolRelease(buffer);
+}
+
+// 应答的长度上限：UDP是客户端能接收的载荷大小，TCP是报文的最大长度
+static int clientLimit(const ClientRoute* client, const dns_edns* edns) {
+    return client->tcp >= 0 ? BUFFER_SIZE : ednsPayloadLimit(edns);
+}
+
+int replyLimit(const ClientRoute* client, const dns_edns* edns) {
+    return clientLimit(client, edns) - (edns->present ? EDNS_OPT_SIZE : 0);
+}
+
+// 按客户端的EDNS能力调整应答（OPT记录、长度上限和TC）后发给客户端：UDP直接发出，TCP交给所在的连接
+void sendToClient(uint8_t* reply, int len, const ClientRoute* client, const dns_edns* edns) {
+    len = ednsFitReply(reply, len, clientLimit(client, edns), edns);
+    if (client->tcp >= 0) {
+        tcpSend(client, reply, len);
+        return;
+    }
+    sendto(dnsSocket, reply, len, 0, (struct sockaddr*)&client->address, sizeof(client->address));
+}
+
+// 私有反向区（RFC 6303）中的查询在本地否定应答：exists为1时名字存在，回复NODATA，否则回复NXDOMAIN
+// 名字不在私有反向区或已用-r关闭时返回0
+static int answerPrivateReverse(uint8_t* buffer, const dns_question_view* question, int exists,
+                                const ClientRoute* clientAddr, const dns_edns* edns, uint8_t* reply) {
+    int apex = privateReverseZone(question->QNAME, question->nameLength);
+    if (apex < 0) return 0;
+
+    uint8_t records[BLOCK_SOA_RR_MAX];
+    BlockResponse response;
+    localZoneResponse(apex, exists, question->QTYPE, records, &response);
+    int len = composeReply(buffer, question, response.rcode, response.records, response.length,
+                           response.ancount, response.nscount, 0, reply);
+    sendToClient(reply, len, clientAddr, edns);
+    log_message(LOG_INFO, "Private reverse zone [Domain: %s], answered locally", question->QNAME);
+    return 1;
+}
+
+// 本地应答的快速路径：查询命中hosts表或拦截规则时，用预编码的记录直接拼出应答，不分配内存
+// 已发出应答返回1；本地未命中（或命中的不是拦截条目且查询类型不是A）返回0，由调用方继续查缓存或转发
+// reply是调用方从缓冲区池取得的应答缓冲区
+static int answerLocally(uint8_t* buffer, const dns_question_view* question, const ClientRoute* clientAddr,
+                         const dns_edns* edns, uint8_t* reply) {
+    static const uint8_t blocked[4] = { 0, 0, 0, 0 };
+    HostAnswer answer;
+
+    if (!queryNodeAnswer(question->QNAME, question->nameLength, question->QTYPE, &answer)) {
+        /* 本地权威区中的名字直接以权威身份应答 */
+        int zone_len = zoneAnswer(buffer, question, reply, replyLimit(clientAddr, edns));
+        if (zone_len > 0) {
+            sendToClient(reply, zone_len, clientAddr, edns);
+            log_message(LOG_INFO, "Answered from local zone [Domain: %s]", question->QNAME);
+            return 1;
+        }
+
+        /* 私有地址的反向查询不发往上游，按RFC 6303直接返回NXDOMAIN */
+        if (answerPrivateReverse(buffer, question, 0, clientAddr, edns, reply)) return 1;
+
+        /* hosts表未命中时再匹配通配符/正则拦截规则 */
+        const char* rule = patternMatch(question->QNAME);
+        if (!rule) return 0;
+        log_message(LOG_DEBUG, "Pattern rule matched: [Domain: %s] [Rule: %s]", question->QNAME, rule);
+        memset(&answer, 0, sizeof(answer));
+        answer.blocked = 1;
+    }
+
+    int len;
+    const uint8_t* log_ip = NULL;
+    if (answer.blocked) {
+        // 拦截条目对任何类型的查询都用预编码的拦截应答回复
+        const BlockResponse* response = blockResponse(question->QTYPE);
+        len = composeReply(buffer, question, response->rcode, response->records, response->length,
+                           response->ancount, response->nscount, 0, reply);
+        log_ip = blocked;
+        log_message(LOG_INFO, "此网站已被拦截");
+    } else if (answer.count == 0 && answerPrivateReverse(buffer, question, 1, clientAddr, edns, reply)) {
+        return 1; // 私有反向区中存在的名字（hosts反向域名或它们的空非终结点）没有所查类型的记录，回复NODATA
+    } else if (question->QTYPE != DNS_TYPE_A && question->QTYPE != DNS_TYPE_AAAA && question->QTYPE != DNS_TYPE_PTR) {
+        return 0; // hosts表只有A、AAAA和PTR记录，其他类型交给上游
+    } else if (answer.count > 0) {
+        len = composeReply(buffer, question, DNS_RCODE_OK, answer.records, answer.length,
+                           answer.count, 0, 0, reply);
+        if (question->QTYPE == DNS_TYPE_A) log_ip = answer.records + 12;
+    } else {
+        // 域名在hosts中没有所查类型的记录（例如只有另一种地址族）：回复NODATA，不再把查询转发给上游
+        const BlockResponse* response = nodataResponse();
+        len = composeReply(buffer, question, response->rcode, response->records, response->length,
+                           response->ancount, response->nscount, 0, reply);
+    }
+
+    sendToClient(reply, len, clientAddr, edns);
+    log_message(LOG_INFO, "Send to the client from local hosts [Domain: %s] with %d addresses",
+                question->QNAME, answer.blocked ? 0 : answer.count);
+
+    if (log_mode == 1 && log_ip) {
+        writeLog((char*)question->QNAME, (uint8_t*)log_ip);
+    }
+    return 1;
+}
+
+// 把查询转发给上游：分配新ID，记下会话信息，按查询名选择上游后经UDP或上游TCP连接池发出
+void forwardQuery(uint8_t* buffer, int msg_size, const ClientRoute* client, const dns_edns* edns,
+                  const char* qname, uint16_t qtype, int peer_owner) {
+    uint16_t userId = (uint16_t)((buffer[0] << 8) | buffer[1]);
+    /* 给将要发给远程DNS服务器的包分配新ID */
+    uint16_t newID = resetId(userId, client);
+    if (newID == MAX_ID_SIZE) {
+        log_message(LOG_DEBUG,"ID list is full.");
+        if (client->tcp >= 0) tcpQueryFinished(client);
+        return;
     }
+    uint16_t newID_net = htons(IDList[newID].wireId); // 随机的事务ID，转换为网络字节序
+    memcpy(buffer, &newID_net, sizeof(uint16_t));
+    /* 向上游通告本地能接收的UDP载荷大小，记下客户端的EDNS能力，应答回来时据此调整 */
+    msg_size = ednsPrepareQuery(buffer, msg_size, BUFFER_SIZE, edns);
+    IDList[newID].edns = *edns;
+    /* 按查询名的最长匹配后缀选择上游组，记下选中的服务器和发出时刻 */
+    const struct sockaddr_in* upstream = forwardSelect(qname, strlen(qname), &IDList[newID].upstream);
+    IDList[newID].sentAt = GetTickCount64();
+    IDList[newID].firstSentAt = IDList[newID].sentAt;
+    strncpy(IDList[newID].qname, qname, DNS_RR_NAME_MAX_SIZE);
+    IDList[newID].qname[DNS_RR_NAME_MAX_SIZE] = '\0';
+    IDList[newID].qtype = qtype;
+    IDList[newID].peerOwner = (uint8_t)peer_owner;
+    /* -t时经上游TCP连接池发出，连接池无法接手（重连退避中、连接已满）时改走UDP */
+    IDList[newID].viaTcp = upstream_tcp_only && upstreamTcpSend(upstream, buffer, msg_size);
+    if (!IDList[newID].viaTcp) {
+        sendto(dnsSocket, buffer, msg_size, 0, (struct sockaddr*)upstream, sizeof(*upstream));
+    }
+    log_message(LOG_DEBUG,"NewID: %d, OldID: %d", IDList[newID].wireId, userId);
+    log_message(LOG_INFO,"Send to remote server [ID: %d], [Domain: %s]%s", IDList[newID].wireId, qname,
+                IDList[newID].viaTcp ? " over TCP" : "");
+    log_message(LOG_INFO, "====================================================\n\n");
 }
 
-// 处理客户端请求
-void handleClientRequest(uint8_t* buffer, int msg_size, struct sockaddr_in* clientAddr) {
-    uint8_t buffer_new[BUFFER_SIZE];  // 回复给客户端的报文
+// 处理客户端请求，buffer_new是回复给客户端的报文的缓冲区
+static void processClientRequest(uint8_t* buffer, int msg_size, const ClientRoute* clientAddr, uint8_t* buffer_new) {
     dns_Message msg;                  // 报文结构体
     uint8_t ip_addrs[MAX_IP_COUNT][4] = { {0} };  // 查询域名得到的多个IP地址
     uint8_t ip_count = 0;            // IP地址数量
     int is_found = 0;                 // 是否查到
+    int local_checked = 0;            // 快速路径是否已经查过hosts表和拦截规则
 
     log_message(LOG_INFO,"Processing client request");
 
+    /* 客户端的OPT记录决定应答能有多长；格式错误的报文按不支持EDNS处理 */
+    dns_edns edns;
+    ednsParse(buffer, msg_size, &edns);
+
+    /* 快速路径：先查hosts表，A/AAAA/PTR查询命中或域名被拦截时直接用预编码的记录应答 */
+    dns_question_view question;
+    if (peekQuestion(buffer, msg_size, &question) && question.QCLASS == DNS_CLASS_IN) {
+        if (answerLocally(buffer, &question, clientAddr, &edns, buffer_new)) return;
+        local_checked = 1;
+    }
+
     uint8_t* start = buffer;
 
     /* 解析客户端发来的DNS报文，将其保存到msg结构体内 */
@@ -198,9 +495,20 @@ void handleClientRequest(uint8_t* buffer, int msg_size, struct sockaddr_in* clie
         }
     }
 
-    /* 若cache未查到，则从host文件查找 */
+    /* 若cache未查到，则从host文件查找（快速路径已经查过的不再重复） */
     if (is_found == 0 || msg.question->QTYPE != DNS_TYPE_A) {
-        is_found = queryNode(msg.question->QNAME, ip_addrs, &ip_count);
+        is_found = local_checked ? 0 : queryNode(msg.question->QNAME, ip_addrs, &ip_count);
+
+        /* hosts表未命中时再匹配通配符/正则拦截规则，命中则按0.0.0.0处理 */
+        if (!is_found && !local_checked) {
+            const char* rule = patternMatch(msg.question->QNAME);
+            if (rule) {
+                log_message(LOG_DEBUG, "Pattern rule matched: [Domain: %s] [Rule: %s]", msg.question->QNAME, rule);
+                memset(ip_addrs[0], 0, 4);
+                ip_count = 1;
+                is_found = 1;
+            }
+        }
         if(is_found && msg.question->QTYPE == DNS_TYPE_A){
             log_message(LOG_DEBUG, "Found in local hosts file: [Domain: %s] with %d IP addresses", 
                        msg.question->QNAME, ip_count);
@@ -221,18 +529,43 @@ void handleClientRequest(uint8_t* buffer, int msg_size, struct sockaddr_in* clie
 
             /* 若未查到，则上交远程DNS服务器处理*/
             if (is_found == 0) {
-                /* 给将要发给远程DNS服务器的包分配新ID */
-                uint16_t newID = resetId(msg.header->ID, *clientAddr);
-                if (newID == MAX_ID_SIZE) {
-                    log_message(LOG_DEBUG,"ID list is full.");
-                } else {
-                    uint16_t newID_net = htons(newID); // 转换为网络字节序
-                    memcpy(buffer, &newID_net, sizeof(uint16_t));
-                    sendto(dnsSocket, buffer, msg_size, 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress));
-                    log_message(LOG_DEBUG,"NewID: %d, OldID: %d", newID, msg.header->ID);
-                    log_message(LOG_INFO,"Send to remote server [ID: %d], [Domain: %s]", newID,msg.question->QNAME);
+                /* 缓存中有从上游应答收录的记录（A查询直接命中的已在前面回答），或者能沿缓存的CNAME拼出完整的链 */
+                if (local_checked) {
+                    int cached_len = cacheAnswer(buffer, &question, buffer_new, replyLimit(clientAddr, &edns));
+                    if (cached_len > 0) {
+                        sendToClient(buffer_new, cached_len, clientAddr, &edns);
+                        log_message(LOG_INFO, "Cache hit for [Domain: %s], type %d", question.QNAME, question.QTYPE);
+                        log_message(LOG_INFO, "====================================================\n\n");
+                        return;
+                    }
+
+                    /* 上游近期对这个名字和类型回复过SERVFAIL或超时，屏蔽期内直接回复SERVFAIL，不再转发 */
+                    int hold = failureCheck(question.QNAME, question.QTYPE);
+                    if (hold > 0) {
+                        int failure_len = composeReply(buffer, &question, DNS_RCODE_SERVFAIL, NULL, 0, 0, 0, 0, buffer_new);
+                        buffer_new[2] &= (uint8_t)~(AA_MASK >> 8);
+                        sendToClient(buffer_new, failure_len, clientAddr, &edns);
+                        log_message(LOG_INFO, "Upstream failure cached for [Domain: %s], type %d, answered SERVFAIL (%d s left)",
+                                    question.QNAME, question.QTYPE, hold);
+                        log_message(LOG_INFO, "====================================================\n\n");
+                        return;
+                    }
+                }
+
+                /* 递归模式下，没有命中条件转发规则的查询由内置的解析器从根开始迭代解析 */
+                if (recursion_mode && forwardMatch(msg.question->QNAME, strlen(msg.question->QNAME)) == 0 &&
+                    recursorStart(buffer, msg_size, clientAddr)) {
+                    log_message(LOG_INFO, "====================================================\n\n");
+                    return;
+                }
+
+                /* 集群模式下先问查询名归属的兄弟节点，它的缓存命中时直接应答，未命中或超时后再转发上游 */
+                if (local_checked && peerAsk(buffer, msg_size, &question, clientAddr, &edns)) {
                     log_message(LOG_INFO, "====================================================\n\n");
+                    return;
                 }
+
+                forwardQuery(buffer, msg_size, clientAddr, &edns, msg.question->QNAME, msg.question->QTYPE, 0);
                 return;
             }
         }
@@ -290,7 +623,7 @@ void handleClientRequest(uint8_t* buffer, int msg_size, struct sockaddr_in* clie
     int len = end - buffer_new;
     
     /* 将DNS应答报文发回客户端 */
-    sendto(dnsSocket, buffer_new, len, 0, (struct sockaddr*)clientAddr, sizeof(*clientAddr));
+    sendToClient(buffer_new, len, clientAddr, &edns);
 
     if (log_mode == 1) {
         // 记录第一个IP地址到日志
@@ -307,6 +640,33 @@ void handleClientRequest(uint8_t* buffer, int msg_size, struct sockaddr_in* clie
     }
 }
 
+// 处理客户端请求：应答缓冲区取自缓冲区池
+void handleClientRequest(uint8_t* buffer, int msg_size, const ClientRoute* client) {
+    uint8_t* reply = poolAcquire();
+    if (!reply) {
+        if (client->tcp >= 0) tcpQueryFinished(client);
+        return;
+    }
+    processClientRequest(buffer, msg_size, client, reply);
+    poolRelease(reply);
+}
+
+// 应答是否恰有一个IN类的问题，且就是映射记下的查询名（不区分大小写）和类型；
+// 热升级交接过来的映射没有记录查询名，只检查问题的个数和类
+static int questionMatches(const ClientSession* session, const dns_Message* msg) {
+    const dns_question* question = msg->question;
+    if (msg->header->QDCOUNT != 1 || !question || !question->QNAME || question->QCLASS != DNS_CLASS_IN) return 0;
+    if (!session->qname[0]) return 1;
+    if (question->QTYPE != session->qtype) return 0;
+    const char* a = question->QNAME;
+    const char* b = session->qname;
+    while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+        a++;
+        b++;
+    }
+    return *a == '\0' && *b == '\0';
+}
+
 // 处理服务器响应
 void handleServerResponse(uint8_t* buffer, int msg_size) {
     dns_Message msg;
@@ -320,74 +680,64 @@ void handleServerResponse(uint8_t* buffer, int msg_size) {
     uint16_t receivedID_net;
     memcpy(&receivedID_net, buffer, sizeof(uint16_t));
     uint16_t receivedID = ntohs(receivedID_net); // 转换为主机字节序
-    log_message(LOG_INFO, "Received from server [ID: %d], [Domain: %s]", receivedID, msg.question->QNAME);
+    log_message(LOG_INFO, "Received from server [ID: %d], [Domain: %s]", receivedID,
+                msg.question ? msg.question->QNAME : "");
     printQuestionAndAnswer(msg);
     
-    /* ID转换 - 将新ID转换回原始ID */
-    if (receivedID < MAX_ID_SIZE && IDList[receivedID].expireTime > 0) {
-        uint16_t originalID = IDList[receivedID].userId;
+    /* ID转换 - 将新ID转换回原始ID；热升级前的旧进程还在处理的查询，其应答由旧进程经TCP收取，这里丢弃 */
+    ClientSession* session = findSession(receivedID);
+    if (session && !session->heldByOld) {
+        uint16_t index = (uint16_t)(receivedID % MAX_ID_SIZE);
+        /* 问题与发出的查询不一致的应答（伪造或串号）丢弃，映射继续等真正的应答 */
+        if (!questionMatches(session, &msg)) {
+            log_message(LOG_ERROR, "Warning: response [ID: %d] does not match the query for [%s], dropped",
+                        receivedID, session->qname);
+            freeMessage(&msg);
+            log_message(LOG_INFO, "====================================================\n\n");
+            return;
+        }
+        /* 经UDP收到的截断应答改经TCP向同一个上游重试，映射保留到TCP应答到达；重试不了时照常转发截断的应答 */
+        if ((buffer[2] & (TC_MASK >> 8)) && upstreamRetryTruncated(index, buffer, msg_size)) {
+            log_message(LOG_INFO, "Truncated response [ID: %d], retrying over TCP", receivedID);
+            freeMessage(&msg);
+            log_message(LOG_INFO, "====================================================\n\n");
+            return;
+        }
+        uint16_t originalID = IDList[index].userId;
         uint16_t originalID_net = htons(originalID);
         memcpy(buffer, &originalID_net, sizeof(uint16_t));  // 把待发回客户端的包ID改回原ID
-        struct sockaddr_in originalClientAddress = IDList[receivedID].clientAddress;
-        IDList[receivedID].expireTime = 0; // 清除ID映射
-        sendto(dnsSocket, buffer, msg_size, 0, (struct sockaddr*)&originalClientAddress, sizeof(originalClientAddress));
+        ClientRoute originalClient = IDList[index].client;
+        IDList[index].expireTime = 0; // 清除ID映射
+        forwardAnswered(IDList[index].upstream, (uint32_t)(GetTickCount64() - IDList[index].sentAt));
+        // SERVFAIL记入失败缓存；正常的应答（含NXDOMAIN）说明上游已恢复，清除失败记录
+        if (IDList[index].qname[0]) {
+            if (msg.header->RCODE == DNS_RCODE_SERVFAIL) {
+                failureRecord(IDList[index].qname, IDList[index].qtype, IDList[index].firstSentAt,
+                              "SERVFAIL");
+            } else if (msg.header->RCODE == DNS_RCODE_OK || msg.header->RCODE == DNS_RCODE_NXDOMAIN) {
+                failureClear(IDList[index].qname, IDList[index].qtype);
+            }
+        }
+        // 归属的兄弟节点没有缓存这个名字：趁应答还没按客户端的能力截短，推给它收入缓存，之后其他节点问它时能够命中
+        if (IDList[index].peerOwner) peerStore(IDList[index].peerOwner - 1, buffer, msg_size);
+        sendToClient(buffer, msg_size, &originalClient, &IDList[index].edns);
         log_message(LOG_INFO, "Forwarded response to client [ID: %d], [Domain: %s]", originalID, msg.question->QNAME);
-        
-        // 从DNS响应中提取所有A记录的IP地址
-        if (msg.question && msg.question->QNAME) {
-            uint8_t ip_addrs[MAX_IP_COUNT][4] = { {0} };
-            uint8_t ip_count = 0;
-            
-            // 遍历所有回答记录，收集A记录的IP地址
+
+        // 收录回答、授权和附加部分中可信的记录：查询名和CNAME链上的每个名字各自缓存自己的记录，
+        // 再加上所在区的NS和辖区内的粘附地址；CNAME链在查询时由缓存逐级拼回
+        cacheHarvest(&msg);
+
+        // 记录到日志中，使用回答中的第一个A记录；没有A记录时记为未找到
+        if (log_mode == 1 && msg.question && msg.question->QNAME) {
             dns_rr* current = msg.answer;
-            while (current && ip_count < MAX_IP_COUNT) {
-                if (current->type == DNS_TYPE_A && current->rrClass == DNS_CLASS_IN && current->rdLength == 4) {
-                    // 复制IP地址
-                    memcpy(ip_addrs[ip_count], current->rdata.A_record.address, 4);
-                    ip_count++;
-                }
+            while (current && !(current->type == DNS_TYPE_A && current->rrClass == DNS_CLASS_IN && current->rdLength == 4)) {
                 current = current->next;
             }
-            
-            // 如果找到了IP地址，添加到缓存
-            if (ip_count > 0) {
-                // 收集所有A记录的TTL值
-                uint32_t ttls[MAX_IP_COUNT] = {0};
-                
-                // 遍历回答记录再次，收集每个IP对应的TTL值
-                current = msg.answer;
-                int ttl_idx = 0;
-                while (current && ttl_idx < ip_count) {
-                    if (current->type == DNS_TYPE_A && current->rrClass == DNS_CLASS_IN && current->rdLength == 4) {
-                        ttls[ttl_idx] = current->ttl;
-                        ttl_idx++;
-                    }
-                    current = current->next;
-                }
-                
-                // 加入缓存，每个IP使用对应的TTL值
-                cachePut(ip_addrs, ttls, ip_count, msg.question->QNAME, 86400);
-                
-                log_message(LOG_DEBUG, "Added to cache: %s with %d IP addresses", 
-                           msg.question->QNAME, ip_count);
-                for (int i = 0; i < ip_count; i++) {
-                    log_message(LOG_DEBUG, "IP %d: %d.%d.%d.%d", i+1, 
-                               ip_addrs[i][0], ip_addrs[i][1], ip_addrs[i][2], ip_addrs[i][3]);
-                }
-                
-                // 记录到日志中，使用第一个IP地址
-                if (log_mode == 1) {
-                    writeLog(msg.question->QNAME, ip_addrs[0]);
-                }
-            } else {
-                // 如果没有找到A记录或格式不正确，记录为未找到
-                if (log_mode == 1) {
-                    writeLog(msg.question->QNAME, NULL);
-                }
-            }
+            writeLog(msg.question->QNAME, current ? current->rdata.A_record.address : NULL);
         }
     } else {
         log_message(LOG_ERROR,"Warning: Invalid or expired ID mapping: %d\n\n", receivedID);
     }
+    freeMessage(&msg);
     log_message(LOG_INFO, "====================================================\n\n");
 }
\ No newline at end of file
@@ -1,130 +1,1352 @@
 #include "dns_table.h"
 
-// --- 哈希表实现 ---
-
-// 1. 哈希表中的单个条目结构体
-typedef struct HashEntry {
-    char domain[MAX_DOMAIN_LEN];
-    uint8_t IPs[MAX_IP_COUNT][4];  // 多个IPv4地址数组
-    uint32_t ttls[MAX_IP_COUNT];   // 每个IP地址对应的TTL值
-    uint8_t ip_count;              // 当前记录的IP地址数量
-    struct HashEntry *next; // 指向下一个节点，用于处理哈希冲突
-} HashEntry;
-
-// 2. 哈希表的全局变量
-static HashEntry **hashTable = NULL; // 哈希表本体（一个指针数组）
-static int hashTableSize = 0;        // 哈希表的大小
-
-// djb2哈希函数：一个简单且高效的字符串哈希算法
-static unsigned long hash_function(const char *str) {
-    unsigned long hash = 5381;
-    int c;
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TABLE_USE_SSE2 1
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// --- 哈希表实现（开放寻址，控制字节分组探测） ---
+//
+// 每个槽位对应一个控制字节：0x80表示空槽，0x00~0x7F保存哈希值的低7位(H2)。
+// 查找时一次取出16个控制字节，用SSE2与H2做并行比较，只有控制字节匹配的槽位
+// 才会去比较槽位中保存的完整哈希，哈希也一致时才去字符串池里比较域名。
+//
+// 为了容纳百万级的拦截列表，条目采用紧凑布局：
+//   - 槽位只有12字节：哈希、域名偏移、IP集合偏移
+//   - 域名以"长度字节+域名+'\0'"的形式连续存放在字符串池中
+//   - IP集合按内容去重后存放在IP池中，多个域名共享同一集合
+//   - IP集合直接以应答报文中A/AAAA记录的线上格式保存，名字是指向问题的压缩指针，
+//     本地命中时把整段复制到应答报文末尾即可，不需要逐条构造资源记录
+//   - 只包含0.0.0.0或::的拦截条目不占用IP池，用IPSET_BLOCKED表示
+//   - 反向域名（in-addr.arpa/ip6.arpa）与普通域名存放在同一张表中，IP集合里只有一条预编码的PTR记录
+//
+// hosts文件加载完成后表不再变化，freezeDnsResolver()会在其上构建最小完美哈希：
+// 所有条目按哈希分桶，每个桶找到一个参数(pilot)使桶内条目映射到互不冲突的位置，
+// 条目最终存放在一个长度恰好为条目数的扁平数组中。查询时只需计算桶号、读取pilot、
+// 定位条目并做一次哈希和域名比较，没有链表也没有探测循环。
+//
+// 冻结时还会构建一个按64位字分块的Bloom过滤器：每个域名只在一个字中置若干位，
+// 查询先检查这一个字，绝大多数未命中的查询在这里就返回，不再访问pilot和条目数组。
+//
+// 冻结后的表可以整体写成二进制镜像（saveDnsResolverImage），启动时直接用文件映射
+// 加载（loadDnsResolverImage），无需逐行解析hosts文件，多个进程共享同一份页缓存。
+
+#define GROUP_WIDTH 16             // 每组控制字节数
+#define CTRL_EMPTY ((int8_t)0x80)  // 空槽标记
+#define MAX_LOAD_NUM 7             // 最大装载因子 7/8
+#define MAX_LOAD_DEN 8
+#define IPSET_BLOCKED 0xFFFFFFFFu  // 拦截条目的IP集合偏移
+#define IPSET_HEADER_SIZE 3        // IP集合开头的A、AAAA、PTR记录数各占1字节
+#define PTR_RR_MAX (12 + DNS_RR_NAME_MAX_SIZE + 1)  // 一条预编码PTR记录的最大字节数
+#define MPH_BUCKET_LOAD 4          // 完美哈希平均每桶条目数
+#define MPH_MAX_PILOT (1u << 20)   // 每个桶最多尝试的pilot数量
+#define PILOT_DIRECT 0x80000000u   // 单条目桶直接记录位置
+#define FILTER_BITS_PER_KEY 8      // 过滤器每个域名占用的位数，误判率约3%
+#define FILTER_HASHES 4            // 每个域名在所属的字中置的位数
+#define IMAGE_MAGIC "DNSHOSTS"     // 二进制镜像魔数
+#define IMAGE_MAX_SECTIONS 16      // 镜像头中预留的段数量
+#define IMAGE_ALIGN 64             // 每段按缓存行对齐
+
+// 镜像中的各段
+enum ImageSection {
+    SECTION_ENTRIES = 0,           // 扁平条目数组
+    SECTION_PILOTS,                // 每个桶的pilot
+    SECTION_NAMES,                 // 字符串池
+    SECTION_IPSETS,                // IP池
+    SECTION_FILTER,                // 快速排除未命中的过滤器
+    SECTION_COUNT
+};
+
+// 镜像文件头，所有字段均为小端序
+typedef struct HostImageHeader {
+    char magic[8];                 // IMAGE_MAGIC
+    uint32_t version;              // HOST_IMAGE_VERSION，布局变化时递增
+    uint32_t section_count;        // 有效段数量
+    uint64_t entry_count;          // 条目数
+    uint64_t bucket_count;         // 完美哈希的桶数
+    uint64_t wildcard_count;       // "*.后缀"规则数
+    struct {
+        uint64_t offset;           // 段在文件中的偏移
+        uint64_t length;           // 段长度（字节）
+    } sections[IMAGE_MAX_SECTIONS];
+} HostImageHeader;
+
+// 1. 槽位结构体
+typedef struct HostSlot {
+    uint32_t hash;                 // 完整哈希的低32位，用于在比较字符串前快速排除
+    uint32_t name_off;             // 域名在字符串池中的偏移（指向长度字节）
+    uint32_t ipset;                // IP集合在IP池中的偏移，或IPSET_BLOCKED
+} HostSlot;
+
+// 2. 可增长的字节池，字符串池与IP池共用
+typedef struct BytePool {
+    uint8_t* data;
+    size_t len;
+    size_t cap;
+} BytePool;
+
+// 3. 哈希表结构体
+typedef struct HostTable {
+    int8_t* ctrl;                  // 控制字节数组，长度为capacity
+    HostSlot* slots;               // 槽位数组，长度为capacity
+    size_t capacity;               // 槽位数，2的幂且不小于GROUP_WIDTH
+    size_t size;                   // 已使用的槽位数
+    BytePool names;                // 字符串池
+    BytePool ipsets;               // IP池：每个集合为A、AAAA、PTR记录数各1字节，随后是预编码的A、AAAA和PTR记录
+    uint32_t* ipset_index;         // IP集合去重用的开放寻址表，保存偏移+1，0表示空
+    size_t ipset_index_cap;        // 去重表容量（2的幂）
+    size_t ipset_count;            // 不同IP集合的数量
+    int frozen;                    // 是否已冻结为最小完美哈希
+    HostSlot* entries;             // 冻结后的扁平条目数组，长度为size
+    uint32_t* pilots;              // 每个桶的pilot，最高位为1时低31位直接是条目位置
+    size_t bucket_count;           // 完美哈希的桶数
+    uint64_t* filter;              // 冻结后的分块Bloom过滤器，内存不足时为NULL
+    size_t filter_words;           // 过滤器的64位字数
+    size_t wildcard_count;         // "*.后缀"规则数，为0时查询不做逐级探测
+    int mapped;                    // 数组和池是否指向只读的镜像映射
+    HANDLE image_file;             // 镜像文件句柄
+    HANDLE image_mapping;          // 文件映射对象句柄
+    const void* image_view;        // 映射视图基址
+} HostTable;
+
+// 4. 哈希表的全局变量
+//
+// 查询只读取g_current指向的快照，加载只修改g_table指向的表。重新加载时在一张新表上
+// 完成构建，再用一次原子指针交换发布；旧表要等查询线程经过静止点后才释放，
+// 因此queryNode既不加锁，也不会因为重新加载而等待。
+static HostTable* g_table;                 // 正在构建的表，只由加载线程访问
+static HostTable* volatile g_current;      // 查询使用的快照
+static volatile LONG64 g_epoch = 1;        // 每发布一次快照加1
+static volatile LONG64 g_reader_epoch = 0; // 查询线程最近一次静止点看到的纪元，0表示尚未开始查询
+static int g_initialized = 0;
+
+// 按8字节一组处理的64位字符串哈希，末尾用splitmix64的混合函数打散
+static uint64_t hash_function(const char* str, size_t len) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ (uint64_t)len;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, str, 8);
+        hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 31;
+        str += 8;
+        len -= 8;
     }
+    uint64_t tail = 0;
+    memcpy(&tail, str, len);
+    hash ^= tail;
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
     return hash;
 }
 
+// 返回最低位1的下标
+static int lowestBit(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// 在一组控制字节中找出等于value的位置，结果为16位掩码
+static uint32_t groupMatch(const int8_t* group, int8_t value) {
+#ifdef TABLE_USE_SSE2
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        if (group[i] == value) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+// 在字节池末尾追加数据，返回其偏移
+static int poolAppend(BytePool* pool, const void* data, size_t len, uint32_t* offset) {
+    if (pool->len + len > pool->cap) {
+        size_t new_cap = pool->cap ? pool->cap * 2 : 4096;
+        while (new_cap < pool->len + len) new_cap *= 2;
+        uint8_t* new_data = (uint8_t*)realloc(pool->data, new_cap);
+        if (!new_data) return 0;
+        pool->data = new_data;
+        pool->cap = new_cap;
+    }
+    memcpy(pool->data + pool->len, data, len);
+    *offset = (uint32_t)pool->len;
+    pool->len += len;
+    return 1;
+}
+
+// 在字符串池中追加一个域名，格式为长度字节+域名+'\0'
+static int nameAppend(HostTable* table, const char* domain, size_t len, uint32_t* offset) {
+    uint8_t record[MAX_DOMAIN_LEN + 1];
+    record[0] = (uint8_t)len;
+    memcpy(record + 1, domain, len);
+    record[len + 1] = '\0';
+    return poolAppend(&table->names, record, len + 2, offset);
+}
+
+// 一个域名的全部地址，合并记录时先解码成这种形式，修改后再编码回IP池
+typedef struct HostAddresses {
+    uint8_t v4[MAX_IP_COUNT][4];
+    uint32_t v4_ttl[MAX_IP_COUNT];
+    uint8_t v4_count;
+    uint8_t v6[MAX_IP_COUNT][16];
+    uint32_t v6_ttl[MAX_IP_COUNT];
+    uint8_t v6_count;
+    uint8_t ptr[PTR_RR_MAX];       // 预编码的PTR记录，反向域名只保留第一个指向的域名
+    size_t ptr_length;
+    uint8_t ptr_count;
+} HostAddresses;
+
+// IP集合中AAAA记录的起始位置
+static const uint8_t* ipsetAAAA(const uint8_t* set) {
+    return set + IPSET_HEADER_SIZE + (size_t)set[0] * HOST_ANSWER_RR_SIZE;
+}
+
+// IP集合中PTR记录的起始位置
+static const uint8_t* ipsetPTR(const uint8_t* set) {
+    return ipsetAAAA(set) + (size_t)set[1] * HOST_ANSWER_AAAA_RR_SIZE;
+}
+
+// PTR记录长度不定，逐条按数据长度字段跳过
+static size_t ptrRecordsSize(const uint8_t* set) {
+    const uint8_t* rr = ipsetPTR(set);
+    size_t size = 0;
+    for (int i = 0; i < set[2]; i++) {
+        size_t rr_size = 12 + (((size_t)rr[size + 10] << 8) | rr[size + 11]);
+        size += rr_size;
+    }
+    return size;
+}
+
+// IP集合在池中的字节数
+static size_t ipsetSize(const uint8_t* set) {
+    return (size_t)(ipsetPTR(set) - set) + ptrRecordsSize(set);
+}
+
+// 按线上格式编码一条A、AAAA或PTR记录：名字为指向报文偏移12（问题域名）的压缩指针，整数为网络字节序
+static void answerEncode(uint8_t* rr, uint16_t type, const uint8_t* address, size_t address_len, uint32_t ttl) {
+    rr[0] = 0xC0;
+    rr[1] = 0x0C;
+    rr[2] = 0;
+    rr[3] = (uint8_t)type;
+    rr[4] = 0;
+    rr[5] = DNS_CLASS_IN;
+    rr[6] = (uint8_t)(ttl >> 24);
+    rr[7] = (uint8_t)(ttl >> 16);
+    rr[8] = (uint8_t)(ttl >> 8);
+    rr[9] = (uint8_t)ttl;
+    rr[10] = (uint8_t)(address_len >> 8);
+    rr[11] = (uint8_t)address_len;
+    memcpy(rr + 12, address, address_len);
+}
+
+// 从预编码的记录中取出TTL
+static uint32_t answerTtl(const uint8_t* rr) {
+    return ((uint32_t)rr[6] << 24) | ((uint32_t)rr[7] << 16) | ((uint32_t)rr[8] << 8) | rr[9];
+}
+
+// 线上格式域名的字节数，包括结尾的0字节
+static size_t wireNameLength(const uint8_t* name) {
+    size_t len = 0;
+    while (name[len]) len += name[len] + 1u;
+    return len + 1;
+}
+
+int isZeroAddress(const uint8_t* address, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (address[i]) return 0;
+    }
+    return 1;
+}
+
+// 把IP集合加入IP池，内容相同的集合只保存一份
+static int ipsetIntern(HostTable* table, const uint8_t* set, size_t size, uint32_t* offset) {
+    // 去重表装载因子超过1/2时翻倍重建
+    if ((table->ipset_count + 1) * 2 > table->ipset_index_cap) {
+        size_t new_cap = table->ipset_index_cap ? table->ipset_index_cap * 2 : 256;
+        uint32_t* new_index = (uint32_t*)calloc(new_cap, sizeof(uint32_t));
+        if (!new_index) return 0;
+        for (size_t i = 0; i < table->ipset_index_cap; i++) {
+            uint32_t entry = table->ipset_index[i];
+            if (!entry) continue;
+            const uint8_t* old_set = table->ipsets.data + entry - 1;
+            size_t pos = hash_function((const char*)old_set, ipsetSize(old_set)) & (new_cap - 1);
+            while (new_index[pos]) pos = (pos + 1) & (new_cap - 1);
+            new_index[pos] = entry;
+        }
+        free(table->ipset_index);
+        table->ipset_index = new_index;
+        table->ipset_index_cap = new_cap;
+    }
+
+    size_t mask = table->ipset_index_cap - 1;
+    size_t pos = hash_function((const char*)set, size) & mask;
+    while (table->ipset_index[pos]) {
+        const uint8_t* existing = table->ipsets.data + table->ipset_index[pos] - 1;
+        if (ipsetSize(existing) == size && memcmp(existing, set, size) == 0) {
+            *offset = table->ipset_index[pos] - 1;
+            return 1;
+        }
+        pos = (pos + 1) & mask;
+    }
+
+    if (!poolAppend(&table->ipsets, set, size, offset)) return 0;
+    table->ipset_index[pos] = *offset + 1;
+    table->ipset_count++;
+    return 1;
+}
+
+// 按三角数序列在各组之间探测，查找域名所在的槽位；未找到时返回-1
+static long findSlot(const HostTable* table, const char* domain, size_t len, uint64_t hash) {
+    size_t group_mask = table->capacity / GROUP_WIDTH - 1;
+    size_t group = (size_t)(hash >> 7) & group_mask;
+    int8_t h2 = (int8_t)(hash & 0x7F);
+
+    for (size_t step = 1; ; step++) {
+        const int8_t* ctrl = table->ctrl + group * GROUP_WIDTH;
+        uint32_t match = groupMatch(ctrl, h2);
+        while (match) {
+            size_t index = group * GROUP_WIDTH + lowestBit(match);
+            const HostSlot* slot = &table->slots[index];
+            const uint8_t* name = table->names.data + slot->name_off;
+            if (slot->hash == (uint32_t)hash && name[0] == len && memcmp(name + 1, domain, len) == 0) {
+                return (long)index;
+            }
+            match &= match - 1;
+        }
+        // 组内还有空槽，说明域名不存在（表中没有删除操作，不需要墓碑标记）
+        if (groupMatch(ctrl, CTRL_EMPTY)) return -1;
+        group = (group + step) & group_mask;
+    }
+}
+
+// 为新哈希值找到第一个空槽
+static size_t findEmptySlot(const HostTable* table, uint64_t hash) {
+    size_t group_mask = table->capacity / GROUP_WIDTH - 1;
+    size_t group = (size_t)(hash >> 7) & group_mask;
+
+    for (size_t step = 1; ; step++) {
+        uint32_t empty = groupMatch(table->ctrl + group * GROUP_WIDTH, CTRL_EMPTY);
+        if (empty) return group * GROUP_WIDTH + lowestBit(empty);
+        group = (group + step) & group_mask;
+    }
+}
+
+// 分配指定容量的控制字节和槽位数组
+static int allocSlots(HostTable* table, size_t capacity) {
+    int8_t* ctrl = (int8_t*)malloc(capacity);
+    HostSlot* slots = (HostSlot*)malloc(capacity * sizeof(HostSlot));
+    if (!ctrl || !slots) {
+        free(ctrl);
+        free(slots);
+        return 0;
+    }
+    memset(ctrl, CTRL_EMPTY, capacity);
+    table->ctrl = ctrl;
+    table->slots = slots;
+    table->capacity = capacity;
+    return 1;
+}
+
+// 容量翻倍并重新放置所有条目，字符串池不需要移动
+static int growTable(HostTable* table) {
+    int8_t* old_ctrl = table->ctrl;
+    HostSlot* old_slots = table->slots;
+    size_t old_capacity = table->capacity;
+
+    if (!allocSlots(table, old_capacity * 2)) return 0;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_ctrl[i] == CTRL_EMPTY) continue;
+        const HostSlot* slot = &old_slots[i];
+        const uint8_t* name = table->names.data + slot->name_off;
+        uint64_t hash = hash_function((const char*)name + 1, name[0]);
+        size_t index = findEmptySlot(table, hash);
+        table->ctrl[index] = (int8_t)(hash & 0x7F);
+        table->slots[index] = *slot;
+    }
+
+    free(old_ctrl);
+    free(old_slots);
+    return 1;
+}
+
+// --- 最小完美哈希 ---
+
+// 把32位值均匀映射到[0, n)，用乘法代替取模
+static uint32_t fastRange(uint32_t value, size_t n) {
+    return (uint32_t)(((uint64_t)value * n) >> 32);
+}
+
+// 由哈希的高32位决定所在的桶
+static uint32_t mphBucket(uint64_t hash, size_t bucket_count) {
+    return fastRange((uint32_t)(hash >> 32), bucket_count);
+}
+
+// 由哈希和桶的pilot计算条目在扁平数组中的位置
+static uint32_t mphPosition(uint64_t hash, uint32_t pilot, size_t n) {
+    if (pilot & PILOT_DIRECT) return pilot & ~PILOT_DIRECT;
+    uint64_t x = hash ^ ((uint64_t)pilot * 0x9E3779B97F4A7C15ULL);
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 32;
+    return fastRange((uint32_t)x, n);
+}
+
+// 为一个多条目桶寻找pilot，成功时占用对应位置并写入条目
+static int mphPlaceBucket(const uint64_t* hashes, const HostSlot* keys, const uint32_t* members, size_t count,
+                          uint8_t* taken, HostSlot* entries, size_t n, uint32_t* pilot_out) {
+    uint32_t positions[64];
+    if (count > 64) return 0;
+
+    // 桶内出现完整哈希相同的条目时任何pilot都无法区分
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = i + 1; j < count; j++) {
+            if (hashes[members[i]] == hashes[members[j]]) return 0;
+        }
+    }
+
+    for (uint32_t pilot = 0; pilot < MPH_MAX_PILOT; pilot++) {
+        size_t placed = 0;
+        for (; placed < count; placed++) {
+            uint32_t pos = mphPosition(hashes[members[placed]], pilot, n);
+            if (taken[pos]) break;
+            taken[pos] = 1; // 暂时占用，用于检测桶内冲突
+            positions[placed] = pos;
+        }
+        if (placed == count) {
+            for (size_t i = 0; i < count; i++) {
+                entries[positions[i]] = keys[members[i]];
+            }
+            *pilot_out = pilot;
+            return 1;
+        }
+        for (size_t i = 0; i < placed; i++) {
+            taken[positions[i]] = 0;
+        }
+    }
+    return 0;
+}
+
+// 由哈希计算过滤器中的字下标和该字中要检查的位
+static size_t filterProbe(uint64_t hash, size_t words, uint64_t* mask) {
+    // 重新混合，使过滤器与完美哈希的分桶相互独立
+    uint64_t x = hash * 0xD6E8FEB86659FD93ULL;
+    x ^= x >> 32;
+    x *= 0xD6E8FEB86659FD93ULL;
+    uint64_t bits = 0;
+    for (int i = 0; i < FILTER_HASHES; i++) {
+        bits |= 1ULL << ((x >> (40 + i * 6)) & 63);
+    }
+    *mask = bits;
+    return fastRange((uint32_t)x, words);
+}
+
+// 用全部条目的哈希构建过滤器
+static void filterBuild(HostTable* table, const uint64_t* hashes, size_t n) {
+    size_t words = (n * FILTER_BITS_PER_KEY + 63) / 64;
+    uint64_t* filter = (uint64_t*)calloc(words, sizeof(uint64_t));
+    if (!filter) {
+        log_message(LOG_DEBUG, "Filter: out of memory, lookups go straight to the table");
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint64_t mask;
+        filter[filterProbe(hashes[i], words, &mask)] |= mask;
+    }
+    table->filter = filter;
+    table->filter_words = words;
+}
+
+// 过滤器判定一定不存在时返回0，可能存在时返回1
+static int filterMayContain(const HostTable* table, uint64_t hash) {
+    if (!table->filter) return 1;
+    uint64_t mask;
+    return (table->filter[filterProbe(hash, table->filter_words, &mask)] & mask) == mask;
+}
+
+// 在当前条目上构建完美哈希，成功后写入entries和pilots
+static int mphBuild(HostTable* table) {
+    size_t n = table->size;
+    size_t bucket_count = n / MPH_BUCKET_LOAD + 1;
+    int ok = 0;
+
+    HostSlot* keys = (HostSlot*)malloc(n * sizeof(HostSlot));
+    uint64_t* hashes = (uint64_t*)malloc(n * sizeof(uint64_t));
+    uint32_t* bucket_start = (uint32_t*)calloc(bucket_count + 1, sizeof(uint32_t));
+    uint32_t* members = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint32_t* bucket_order = (uint32_t*)malloc(bucket_count * sizeof(uint32_t));
+    uint8_t* taken = (uint8_t*)calloc(n, 1);
+    HostSlot* entries = (HostSlot*)malloc(n * sizeof(HostSlot));
+    uint32_t* pilots = (uint32_t*)calloc(bucket_count, sizeof(uint32_t));
+    if (!keys || !hashes || !bucket_start || !members || !bucket_order || !taken || !entries || !pilots) {
+        goto cleanup;
+    }
+
+    // 收集所有条目及其完整哈希
+    size_t k = 0;
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->ctrl[i] == CTRL_EMPTY) continue;
+        const uint8_t* name = table->names.data + table->slots[i].name_off;
+        keys[k] = table->slots[i];
+        hashes[k] = hash_function((const char*)name + 1, name[0]);
+        k++;
+    }
+
+    // 按桶计数排序：bucket_start[b]..bucket_start[b+1]是桶b的成员
+    for (size_t i = 0; i < n; i++) {
+        bucket_start[mphBucket(hashes[i], bucket_count) + 1]++;
+    }
+    for (size_t b = 0; b < bucket_count; b++) {
+        bucket_start[b + 1] += bucket_start[b];
+    }
+    {
+        uint32_t* cursor = (uint32_t*)malloc(bucket_count * sizeof(uint32_t));
+        if (!cursor) goto cleanup;
+        memcpy(cursor, bucket_start, bucket_count * sizeof(uint32_t));
+        for (size_t i = 0; i < n; i++) {
+            members[cursor[mphBucket(hashes[i], bucket_count)]++] = (uint32_t)i;
+        }
+        free(cursor);
+    }
+
+    // 桶按大小降序处理：大桶在表还空的时候最容易放下
+    {
+        uint32_t size_count[66] = { 0 };
+        for (size_t b = 0; b < bucket_count; b++) {
+            uint32_t size = bucket_start[b + 1] - bucket_start[b];
+            size_count[size > 64 ? 65 : size]++;
+        }
+        if (size_count[65]) goto cleanup; // 桶过大，哈希分布异常
+        uint32_t offset = 0;
+        for (int size = 64; size >= 0; size--) {
+            uint32_t count = size_count[size];
+            size_count[size] = offset;
+            offset += count;
+        }
+        for (size_t b = 0; b < bucket_count; b++) {
+            uint32_t size = bucket_start[b + 1] - bucket_start[b];
+            bucket_order[size_count[size]++] = (uint32_t)b;
+        }
+    }
+
+    size_t free_cursor = 0;
+    for (size_t i = 0; i < bucket_count; i++) {
+        uint32_t b = bucket_order[i];
+        uint32_t size = bucket_start[b + 1] - bucket_start[b];
+        if (size == 0) break;
+        if (size == 1) {
+            // 单条目桶无需搜索pilot，直接放进下一个空位
+            while (taken[free_cursor]) free_cursor++;
+            taken[free_cursor] = 1;
+            entries[free_cursor] = keys[members[bucket_start[b]]];
+            pilots[b] = PILOT_DIRECT | (uint32_t)free_cursor;
+            continue;
+        }
+        if (!mphPlaceBucket(hashes, keys, members + bucket_start[b], size, taken, entries, n, &pilots[b])) {
+            log_message(LOG_DEBUG, "Perfect hash: no pilot found for bucket of size %u", size);
+            goto cleanup;
+        }
+    }
+
+    table->entries = entries;
+    table->pilots = pilots;
+    table->bucket_count = bucket_count;
+    entries = NULL;
+    pilots = NULL;
+    filterBuild(table, hashes, n);
+    ok = 1;
+
+cleanup:
+    free(keys);
+    free(hashes);
+    free(bucket_start);
+    free(members);
+    free(bucket_order);
+    free(taken);
+    free(entries);
+    free(pilots);
+    return ok;
+}
+
+// 关闭镜像映射及其句柄
+static void unmapImage(HostTable* table) {
+    if (table->image_view) UnmapViewOfFile(table->image_view);
+    if (table->image_mapping) CloseHandle(table->image_mapping);
+    if (table->image_file && table->image_file != INVALID_HANDLE_VALUE) CloseHandle(table->image_file);
+    table->image_view = NULL;
+    table->image_mapping = NULL;
+    table->image_file = NULL;
+    table->mapped = 0;
+}
+
+// 复制一段内存到堆上
+static void* heapCopy(const void* data, size_t len) {
+    void* copy = malloc(len ? len : 1);
+    if (copy && len) memcpy(copy, data, len);
+    return copy;
+}
+
+// 把映射中的数组和池复制到堆上并解除映射，使表可以被修改
+static int detachImage(HostTable* table) {
+    HostSlot* entries = (HostSlot*)heapCopy(table->entries, table->size * sizeof(HostSlot));
+    uint32_t* pilots = (uint32_t*)heapCopy(table->pilots, table->bucket_count * sizeof(uint32_t));
+    uint8_t* names = (uint8_t*)heapCopy(table->names.data, table->names.len);
+    uint8_t* ipsets = (uint8_t*)heapCopy(table->ipsets.data, table->ipsets.len);
+    if (!entries || !pilots || !names || !ipsets) {
+        free(entries);
+        free(pilots);
+        free(names);
+        free(ipsets);
+        return 0;
+    }
+
+    unmapImage(table);
+    table->entries = entries;
+    table->pilots = pilots;
+    table->filter = NULL; // 过滤器只在冻结状态下使用，随后的还原会丢弃它
+    table->filter_words = 0;
+    table->names.data = names;
+    table->names.cap = table->names.len;
+    table->ipsets.data = ipsets;
+    table->ipsets.cap = table->ipsets.len;
+
+    // 镜像中不保存去重表，遍历IP池重新建立
+    size_t count = 0;
+    for (size_t offset = 0; offset < table->ipsets.len; offset += ipsetSize(ipsets + offset)) count++;
+    size_t cap = 256;
+    while ((count + 1) * 2 > cap) cap *= 2;
+    table->ipset_index = (uint32_t*)calloc(cap, sizeof(uint32_t));
+    if (!table->ipset_index) return 0;
+    table->ipset_index_cap = cap;
+    table->ipset_count = count;
+    for (size_t offset = 0; offset < table->ipsets.len; offset += ipsetSize(ipsets + offset)) {
+        size_t pos = hash_function((const char*)ipsets + offset, ipsetSize(ipsets + offset)) & (cap - 1);
+        while (table->ipset_index[pos]) pos = (pos + 1) & (cap - 1);
+        table->ipset_index[pos] = (uint32_t)offset + 1;
+    }
+    return 1;
+}
+
+// 冻结后又有插入时，把扁平数组还原为可插入的开放寻址表
+static int thawTable(HostTable* table) {
+    if (table->mapped && !detachImage(table)) return 0;
+
+    size_t capacity = TABLE_CAPACITY;
+    while ((table->size + 1) * MAX_LOAD_DEN > capacity * MAX_LOAD_NUM) capacity *= 2;
+    if (!allocSlots(table, capacity)) return 0;
+
+    for (size_t i = 0; i < table->size; i++) {
+        const uint8_t* name = table->names.data + table->entries[i].name_off;
+        uint64_t hash = hash_function((const char*)name + 1, name[0]);
+        size_t index = findEmptySlot(table, hash);
+        table->ctrl[index] = (int8_t)(hash & 0x7F);
+        table->slots[index] = table->entries[i];
+    }
+
+    free(table->entries);
+    free(table->pilots);
+    free(table->filter);
+    table->entries = NULL;
+    table->pilots = NULL;
+    table->filter = NULL;
+    table->filter_words = 0;
+    table->bucket_count = 0;
+    table->frozen = 0;
+    return 1;
+}
+
+// 查找域名对应的条目，未找到返回NULL
+static const HostSlot* lookupEntry(const HostTable* table, const char* domain, size_t len) {
+    uint64_t hash = hash_function(domain, len);
+
+    if (table->frozen) {
+        if (!filterMayContain(table, hash)) return NULL;
+        uint32_t pilot = table->pilots[mphBucket(hash, table->bucket_count)];
+        const HostSlot* entry = &table->entries[mphPosition(hash, pilot, table->size)];
+        const uint8_t* name = table->names.data + entry->name_off;
+        if (entry->hash == (uint32_t)hash && name[0] == len && memcmp(name + 1, domain, len) == 0) {
+            return entry;
+        }
+        return NULL;
+    }
+
+    long found = findSlot(table, domain, len, hash);
+    return found >= 0 ? &table->slots[found] : NULL;
+}
+
+// 从最长的父域开始逐级查找"*.后缀"规则，越具体的规则越优先
+static const HostSlot* lookupWildcard(const HostTable* table, const char* domain, size_t len) {
+    char key[MAX_DOMAIN_LEN];
+    memcpy(key, domain, len);
+
+    // 把每个'.'前面的字符改写为'*'，就地得到"*.后缀"，不需要逐级复制
+    // 后面的探测只使用更靠后的部分，所以改写过的字符不需要恢复
+    for (size_t i = 1; i < len; i++) {
+        if (key[i] != '.') continue;
+        key[i - 1] = '*';
+        const HostSlot* entry = lookupEntry(table, key + i - 1, len - i + 1);
+        if (entry) return entry;
+    }
+    return NULL;
+}
+
+// 把一组地址编码后存入IP池，全部为0.0.0.0或::时返回IPSET_BLOCKED，不保存IP集合
+static int internAddresses(const HostAddresses* addresses, uint32_t* ipset) {
+    // 全部为0.0.0.0或::的记录是拦截条目，不需要保存IP集合
+    int blocked = addresses->v4_count + addresses->v6_count > 0;
+    for (int i = 0; i < addresses->v4_count && blocked; i++) {
+        blocked = isZeroAddress(addresses->v4[i], 4);
+    }
+    for (int i = 0; i < addresses->v6_count && blocked; i++) {
+        blocked = isZeroAddress(addresses->v6[i], 16);
+    }
+    blocked = blocked && addresses->ptr_count == 0;
+    if (blocked) {
+        *ipset = IPSET_BLOCKED;
+        return 1;
+    }
+
+    uint8_t set[IPSET_HEADER_SIZE + MAX_IP_COUNT * (HOST_ANSWER_RR_SIZE + HOST_ANSWER_AAAA_RR_SIZE) + PTR_RR_MAX];
+    set[0] = addresses->v4_count;
+    set[1] = addresses->v6_count;
+    set[2] = addresses->ptr_count;
+    uint8_t* rr = set + IPSET_HEADER_SIZE;
+    for (int i = 0; i < addresses->v4_count; i++, rr += HOST_ANSWER_RR_SIZE) {
+        answerEncode(rr, DNS_TYPE_A, addresses->v4[i], 4, addresses->v4_ttl[i]);
+    }
+    for (int i = 0; i < addresses->v6_count; i++, rr += HOST_ANSWER_AAAA_RR_SIZE) {
+        answerEncode(rr, DNS_TYPE_AAAA, addresses->v6[i], 16, addresses->v6_ttl[i]);
+    }
+    memcpy(rr, addresses->ptr, addresses->ptr_length);
+    if (!ipsetIntern(g_table, set, ipsetSize(set), ipset)) {
+        log_message(ERROR, "错误：为IP池分配内存失败。\n");
+        return 0;
+    }
+    return 1;
+}
+
+// 把IP池中的集合解码为地址列表，拦截条目视为一个0.0.0.0
+static void decodeAddresses(const HostTable* table, uint32_t ipset, uint32_t blocked_ttl, HostAddresses* addresses) {
+    addresses->v4_count = 0;
+    addresses->v6_count = 0;
+    addresses->ptr_count = 0;
+    addresses->ptr_length = 0;
+    if (ipset == IPSET_BLOCKED) {
+        memset(addresses->v4[0], 0, 4);
+        addresses->v4_ttl[0] = blocked_ttl;
+        addresses->v4_count = 1;
+        return;
+    }
+
+    const uint8_t* set = table->ipsets.data + ipset;
+    const uint8_t* rr = set + IPSET_HEADER_SIZE;
+    for (int i = 0; i < set[0]; i++, rr += HOST_ANSWER_RR_SIZE) {
+        memcpy(addresses->v4[i], rr + 12, 4);
+        addresses->v4_ttl[i] = answerTtl(rr);
+    }
+    for (int i = 0; i < set[1]; i++, rr += HOST_ANSWER_AAAA_RR_SIZE) {
+        memcpy(addresses->v6[i], rr + 12, 16);
+        addresses->v6_ttl[i] = answerTtl(rr);
+    }
+    addresses->v4_count = set[0];
+    addresses->v6_count = set[1];
+    addresses->ptr_count = set[2];
+    addresses->ptr_length = ptrRecordsSize(set);
+    memcpy(addresses->ptr, rr, addresses->ptr_length);
+}
+
+// 插入一个表中尚不存在的域名
+static void placeEntry(const char* domain, size_t len, uint64_t hash, uint32_t ipset) {
+    // 超过装载因子时先扩容
+    if ((g_table->size + 1) * MAX_LOAD_DEN > g_table->capacity * MAX_LOAD_NUM && !growTable(g_table)) {
+        log_message(ERROR, "错误：哈希表扩容失败。\n");
+        return;
+    }
+
+    uint32_t name_off;
+    if (!nameAppend(g_table, domain, len, &name_off)) {
+        log_message(ERROR, "错误：为字符串池分配内存失败。\n");
+        return;
+    }
+
+    size_t index = findEmptySlot(g_table, hash);
+    g_table->ctrl[index] = (int8_t)(hash & 0x7F);
+    g_table->slots[index].hash = (uint32_t)hash;
+    g_table->slots[index].name_off = name_off;
+    g_table->slots[index].ipset = ipset;
+    g_table->size++;
+    if (len > 2 && domain[0] == '*' && domain[1] == '.') g_table->wildcard_count++;
+}
+
 void insertNode(const uint8_t IPs[][4], const uint32_t ttls[], uint8_t ip_count, const char* domain) {
-    if (!hashTable) return; // 检查是否已初始化
-    
+    if (!g_initialized) return; // 检查是否已初始化
+
     // 确保ip_count不超过最大限制
     if (ip_count > MAX_IP_COUNT) {
         ip_count = MAX_IP_COUNT;
         log_message(LOG_DEBUG, "Warning: IP count exceeds maximum limit, truncated to %d", MAX_IP_COUNT);
     }
 
-    // 默认TTL值（86400秒 = 24小时）
-    uint32_t default_ttl = 86400;
+    size_t len = strlen(domain);
+    if (len == 0 || len >= MAX_DOMAIN_LEN) {
+        log_message(LOG_DEBUG, "Warning: invalid domain length %u, ignored", (unsigned)len);
+        return;
+    }
+
+    // 已冻结的表先还原为开放寻址表再插入
+    if (g_table->frozen && !thawTable(g_table)) {
+        log_message(ERROR, "错误：还原哈希表失败。\n");
+        return;
+    }
 
-    unsigned long index = hash_function(domain) % hashTableSize;
-    HashEntry* current = hashTable[index];
+    HostAddresses addresses;
+    addresses.v4_count = ip_count;
+    addresses.v6_count = 0;
+    addresses.ptr_count = 0;
+    addresses.ptr_length = 0;
+    for (int i = 0; i < ip_count; i++) {
+        memcpy(addresses.v4[i], IPs[i], 4);
+        addresses.v4_ttl[i] = ttls ? ttls[i] : HOST_ANSWER_TTL;
+    }
+    uint32_t ipset;
+    if (!internAddresses(&addresses, &ipset)) return;
 
-    // 检查域名是否已存在，如果存在则更新其IP和TTL
-    while (current != NULL) {
-        if (strcmp(current->domain, domain) == 0) {
-            // 更新所有IP地址和TTL
-            current->ip_count = ip_count;
-            for (int i = 0; i < ip_count; i++) {
-                memcpy(current->IPs[i], IPs[i], 4);
-                current->ttls[i] = ttls ? ttls[i] : default_ttl;
-            }
-            return;
+    uint64_t hash = hash_function(domain, len);
+    long found = findSlot(g_table, domain, len, hash);
+    if (found >= 0) {
+        // 域名已存在，更新其IP集合
+        g_table->slots[found].ipset = ipset;
+        return;
+    }
+    placeEntry(domain, len, hash, ipset);
+}
+
+uint64_t domainHash(const char* domain, size_t len) {
+    return hash_function(domain, len);
+}
+
+void prefetchNode(uint64_t hash) {
+    if (!g_initialized || g_table->frozen) return;
+    size_t group = (size_t)(hash >> 7) & (g_table->capacity / GROUP_WIDTH - 1);
+    const char* ctrl = (const char*)(g_table->ctrl + group * GROUP_WIDTH);
+    const char* slots = (const char*)(g_table->slots + group * GROUP_WIDTH);
+#ifdef TABLE_USE_SSE2
+    _mm_prefetch(ctrl, _MM_HINT_T0);
+    _mm_prefetch(slots, _MM_HINT_T0);
+#elif defined(__GNUC__)
+    __builtin_prefetch(ctrl);
+    __builtin_prefetch(slots);
+#else
+    (void)ctrl;
+    (void)slots;
+#endif
+}
+
+void reserveDnsResolver(size_t entry_count, size_t name_bytes) {
+    if (!g_initialized || g_table->frozen) return;
+
+    // 一次扩容到足够的容量，避免批量插入过程中反复翻倍重建
+    while ((g_table->size + entry_count) * MAX_LOAD_DEN > g_table->capacity * MAX_LOAD_NUM) {
+        if (!growTable(g_table)) return;
+    }
+    if (g_table->names.len + name_bytes > g_table->names.cap) {
+        uint8_t* data = (uint8_t*)realloc(g_table->names.data, g_table->names.len + name_bytes);
+        if (data) {
+            g_table->names.data = data;
+            g_table->names.cap = g_table->names.len + name_bytes;
         }
-        current = current->next;
     }
+}
 
-    // 域名不存在，创建一个新条目
-    HashEntry* newEntry = (HashEntry*)malloc(sizeof(HashEntry));
-    if (!newEntry) {
-        log_message(ERROR, "错误：为哈希表新条目分配内存失败。\n");
+// 把一个地址追加到同类地址的末尾，重复或超过上限时返回0
+static int appendAddress(HostAddresses* addresses, uint16_t type, const uint8_t* address, uint32_t ttl,
+                         const char* domain, size_t len) {
+    size_t address_len = type == DNS_TYPE_AAAA ? 16 : 4;
+    uint8_t* count = type == DNS_TYPE_AAAA ? &addresses->v6_count : &addresses->v4_count;
+    uint8_t* list = type == DNS_TYPE_AAAA ? &addresses->v6[0][0] : &addresses->v4[0][0];
+    uint32_t* ttls = type == DNS_TYPE_AAAA ? addresses->v6_ttl : addresses->v4_ttl;
+    for (int i = 0; i < *count; i++) {
+        if (memcmp(list + i * address_len, address, address_len) == 0) return 0;
+    }
+    if (*count >= MAX_IP_COUNT) {
+        log_message(LOG_DEBUG, "Warning: IP count of %.*s exceeds maximum limit %d", (int)len, domain, MAX_IP_COUNT);
+        return 0;
+    }
+    memcpy(list + *count * address_len, address, address_len);
+    ttls[*count] = ttl;
+    (*count)++;
+    return 1;
+}
+
+void mergeNode(uint16_t type, const uint8_t* address, uint32_t ttl, const char* domain, size_t len, uint64_t hash) {
+    if (!g_initialized) return; // 检查是否已初始化
+
+    if (len == 0 || len >= MAX_DOMAIN_LEN) {
+        log_message(LOG_DEBUG, "Warning: invalid domain length %u, ignored", (unsigned)len);
         return;
     }
-    
-    strncpy(newEntry->domain, domain, MAX_DOMAIN_LEN - 1);
-    newEntry->domain[MAX_DOMAIN_LEN - 1] = '\0'; // 确保字符串正确结尾
-    
-    // 复制所有IP地址和TTL
-    newEntry->ip_count = ip_count;
-    for (int i = 0; i < ip_count; i++) {
-        memcpy(newEntry->IPs[i], IPs[i], 4);
-        newEntry->ttls[i] = ttls ? ttls[i] : default_ttl;
+
+    // 已冻结的表先还原为开放寻址表再插入
+    if (g_table->frozen && !thawTable(g_table)) {
+        log_message(ERROR, "错误：还原哈希表失败。\n");
+        return;
+    }
+
+    HostAddresses addresses;
+    addresses.v4_count = 0;
+    addresses.v6_count = 0;
+    addresses.ptr_count = 0;
+    addresses.ptr_length = 0;
+
+    long found = findSlot(g_table, domain, len, hash);
+    if (found >= 0) decodeAddresses(g_table, g_table->slots[found].ipset, ttl, &addresses);
+
+    if (type == DNS_TYPE_PTR) {
+        // 与hosts文件的惯例一致，一个地址在文件中最先出现的域名是它的规范名
+        if (addresses.ptr_count > 0) return;
+        size_t name_len = wireNameLength(address);
+        answerEncode(addresses.ptr, DNS_TYPE_PTR, address, name_len, ttl);
+        addresses.ptr_length = 12 + name_len;
+        addresses.ptr_count = 1;
+    } else if (!appendAddress(&addresses, type, address, ttl, domain, len)) {
+        return;
     }
 
-    // 将新条目插入到对应哈希桶链表的头部
-    newEntry->next = hashTable[index];
-    hashTable[index] = newEntry;
+    uint32_t ipset;
+    if (!internAddresses(&addresses, &ipset)) return;
+    if (found >= 0) {
+        g_table->slots[found].ipset = ipset;
+    } else {
+        placeEntry(domain, len, hash, ipset);
+    }
+}
+
+void markNode(const char* domain, size_t len, uint64_t hash) {
+    if (!g_initialized || len == 0 || len >= MAX_DOMAIN_LEN) return;
+
+    if (g_table->frozen && !thawTable(g_table)) {
+        log_message(ERROR, "错误：还原哈希表失败。\n");
+        return;
+    }
+    if (findSlot(g_table, domain, len, hash) >= 0) return;
+
+    HostAddresses addresses;
+    addresses.v4_count = 0;
+    addresses.v6_count = 0;
+    addresses.ptr_count = 0;
+    addresses.ptr_length = 0;
+    uint32_t ipset;
+    if (!internAddresses(&addresses, &ipset)) return;
+    placeEntry(domain, len, hash, ipset);
+}
+
+// 在快照中查找域名：精确匹配优先，未命中时再按后缀规则匹配
+static const HostSlot* findEntry(const HostTable* table, const char* domain, size_t len) {
+    const HostSlot* entry = lookupEntry(table, domain, len);
+    if (!entry && table->wildcard_count > 0) entry = lookupWildcard(table, domain, len);
+    return entry;
 }
 
 int queryNode(const char* domain, uint8_t ip_addrs[][4], uint8_t* ip_count) {
-    if (!hashTable) return 0; // 检查是否已初始化
-
-    unsigned long index = hash_function(domain) % hashTableSize;
-    HashEntry* current = hashTable[index];
-
-    // 遍历哈希桶的链表以查找域名
-    while (current != NULL) {
-        if (strcmp(current->domain, domain) == 0) {
-            // 复制所有IP地址到输出参数
-            *ip_count = current->ip_count;
-            for (int i = 0; i < current->ip_count; i++) {
-                memcpy(ip_addrs[i], current->IPs[i], 4);
-            }
-            return 1; // 找到
+    if (!g_initialized) return 0; // 检查是否已初始化
+
+    // 整个查询只使用同一个快照，重新加载发布的新表从下一次查询开始生效
+    const HostTable* table = g_current;
+    size_t len = strlen(domain);
+    if (len >= MAX_DOMAIN_LEN) return 0;
+
+    const HostSlot* entry = findEntry(table, domain, len);
+    if (!entry) return 0; // 未找到
+
+    uint32_t ipset = entry->ipset;
+    if (ipset == IPSET_BLOCKED) {
+        // 拦截条目统一返回一个0.0.0.0
+        *ip_count = 1;
+        memset(ip_addrs[0], 0, 4);
+        return 1;
+    }
+
+    // 从预编码的A记录中取出所有IPv4地址，只有IPv6地址的域名视为未命中
+    const uint8_t* set = table->ipsets.data + ipset;
+    if (set[0] == 0) return 0;
+    *ip_count = set[0];
+    for (int i = 0; i < set[0]; i++) {
+        memcpy(ip_addrs[i], set + IPSET_HEADER_SIZE + i * HOST_ANSWER_RR_SIZE + 12, 4);
+    }
+    return 1; // 找到
+}
+
+int queryNodeAnswer(const char* domain, size_t len, uint16_t qtype, HostAnswer* answer) {
+    if (!g_initialized || len >= MAX_DOMAIN_LEN) return 0;
+
+    const HostTable* table = g_current;
+    const HostSlot* entry = findEntry(table, domain, len);
+    if (!entry) return 0;
+
+    memset(answer, 0, sizeof(HostAnswer));
+    if (entry->ipset == IPSET_BLOCKED) {
+        answer->blocked = 1;
+        return 1;
+    }
+
+    // 与queryNode一致：第一个IPv4地址为0.0.0.0（没有IPv4地址时看第一个IPv6地址是否为::）的条目也是拦截条目
+    const uint8_t* set = table->ipsets.data + entry->ipset;
+    const uint8_t* aaaa = ipsetAAAA(set);
+    if (set[0] > 0) {
+        answer->blocked = isZeroAddress(set + IPSET_HEADER_SIZE + 12, 4);
+    } else if (set[1] > 0) {
+        answer->blocked = isZeroAddress(aaaa + 12, 16);
+    }
+    if (answer->blocked) return 1;
+
+    if (qtype == DNS_TYPE_A) {
+        answer->records = set + IPSET_HEADER_SIZE;
+        answer->count = set[0];
+        answer->length = set[0] * HOST_ANSWER_RR_SIZE;
+    } else if (qtype == DNS_TYPE_AAAA) {
+        answer->records = aaaa;
+        answer->count = set[1];
+        answer->length = set[1] * HOST_ANSWER_AAAA_RR_SIZE;
+    } else if (qtype == DNS_TYPE_PTR) {
+        answer->records = ipsetPTR(set);
+        answer->count = set[2];
+        answer->length = (int)ptrRecordsSize(set);
+    }
+    return 1;
+}
+
+int freezeDnsResolver(void) {
+    if (!g_initialized) return 0;
+    if (g_table->frozen) return 1;
+    if (g_table->size == 0) return 0;
+
+    if (!mphBuild(g_table)) {
+        log_message(LOG_ERROR, "Perfect hash build failed, keep open-addressing table");
+        return 0;
+    }
+
+    // 开放寻址表不再需要，字符串池和IP池收缩到实际大小
+    free(g_table->ctrl);
+    free(g_table->slots);
+    g_table->ctrl = NULL;
+    g_table->slots = NULL;
+    g_table->capacity = 0;
+    g_table->frozen = 1;
+
+    uint8_t* shrunk = (uint8_t*)realloc(g_table->names.data, g_table->names.len);
+    if (shrunk) {
+        g_table->names.data = shrunk;
+        g_table->names.cap = g_table->names.len;
+    }
+    if (g_table->ipsets.len > 0) {
+        shrunk = (uint8_t*)realloc(g_table->ipsets.data, g_table->ipsets.len);
+        if (shrunk) {
+            g_table->ipsets.data = shrunk;
+            g_table->ipsets.cap = g_table->ipsets.len;
+        }
+    }
+    return 1;
+}
+
+// 字节池实际占用的内存：按分配的容量计算，映射自镜像的池没有容量，按长度计算
+static size_t poolFootprint(const BytePool* pool) {
+    return pool->cap > pool->len ? pool->cap : pool->len;
+}
+
+size_t resolverMemoryUsage(size_t* entry_count) {
+    if (entry_count) *entry_count = g_table->size;
+    size_t index_bytes = g_table->frozen
+        ? g_table->size * sizeof(HostSlot) + g_table->bucket_count * sizeof(uint32_t) +
+          g_table->filter_words * sizeof(uint64_t)
+        : g_table->capacity * (sizeof(HostSlot) + 1);
+    return index_bytes + poolFootprint(&g_table->names) + poolFootprint(&g_table->ipsets) +
+           g_table->ipset_index_cap * sizeof(uint32_t);
+}
+
+// --- 快照发布与回收 ---
+
+// 释放一张表的全部内容，来自镜像的部分只需解除映射
+static void clearTable(HostTable* table) {
+    free(table->ctrl);
+    free(table->slots);
+    if (table->mapped) {
+        unmapImage(table);
+    } else {
+        free(table->entries);
+        free(table->pilots);
+        free(table->filter);
+        free(table->names.data);
+        free(table->ipsets.data);
+    }
+    free(table->ipset_index);
+    memset(table, 0, sizeof(HostTable));
+}
+
+static HostTable* createTable(void) {
+    HostTable* table = (HostTable*)calloc(1, sizeof(HostTable));
+    if (!table) return NULL;
+    if (!allocSlots(table, TABLE_CAPACITY)) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+static void freeTable(HostTable* table) {
+    if (!table) return;
+    clearTable(table);
+    free(table);
+}
+
+// 推进纪元并等待查询线程经过一次静止点，此后旧快照不再被任何查询引用
+static void waitForReaders(void) {
+    LONG64 target = InterlockedIncrement64(&g_epoch);
+    while (g_reader_epoch != 0 && g_reader_epoch < target) {
+        Sleep(1); // 事件循环至少每秒经过一次静止点
+    }
+}
+
+void resolverQuiescent(void) {
+    InterlockedExchange64(&g_reader_epoch, g_epoch);
+}
+
+int beginDnsResolverReload(void) {
+    if (!g_initialized || g_table != g_current) return 0; // 已有重新加载在进行
+
+    HostTable* table = createTable();
+    if (!table) {
+        log_message(LOG_ERROR, "Reload: failed to allocate new hosts table");
+        return 0;
+    }
+    g_table = table;
+    return 1;
+}
+
+void commitDnsResolverReload(void) {
+    if (g_table == g_current) return;
+
+    HostTable* old = (HostTable*)InterlockedExchangePointer((PVOID volatile*)&g_current, g_table);
+    waitForReaders();
+    freeTable(old);
+}
+
+void abortDnsResolverReload(void) {
+    if (g_table == g_current) return;
+
+    freeTable(g_table);
+    g_table = g_current;
+}
+
+// --- 二进制镜像 ---
+
+// 写出一段数据并补齐到IMAGE_ALIGN
+static int writeSection(FILE* file, HostImageHeader* header, int section, const void* data, size_t len) {
+    static const uint8_t padding[IMAGE_ALIGN] = { 0 };
+    long offset = ftell(file);
+    if (offset < 0) return 0;
+    header->sections[section].offset = (uint64_t)offset;
+    header->sections[section].length = len;
+    if (len > 0 && fwrite(data, 1, len, file) != len) return 0;
+    size_t pad = (IMAGE_ALIGN - len % IMAGE_ALIGN) % IMAGE_ALIGN;
+    return pad == 0 || fwrite(padding, 1, pad, file) == pad;
+}
+
+int saveDnsResolverImage(const char* path) {
+    if (!freezeDnsResolver()) {
+        log_message(LOG_ERROR, "Image: hosts table is empty or cannot be frozen");
+        return 0;
+    }
+
+    // 先写到临时文件再改名替换，写到一半失败或正被其他进程映射时都不会破坏原有镜像
+    char temp_path[MAX_PATH];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path)) {
+        log_message(LOG_ERROR, "Image: path %s is too long", path);
+        return 0;
+    }
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) {
+        log_message(LOG_ERROR, "Image: cannot open %s for writing", temp_path);
+        return 0;
+    }
+
+    // 先占位写入文件头，各段写完后再回填偏移
+    HostImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = HOST_IMAGE_VERSION;
+    header.section_count = SECTION_COUNT;
+    header.entry_count = g_table->size;
+    header.bucket_count = g_table->bucket_count;
+    header.wildcard_count = g_table->wildcard_count;
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             writeSection(file, &header, SECTION_ENTRIES, g_table->entries, g_table->size * sizeof(HostSlot)) &&
+             writeSection(file, &header, SECTION_PILOTS, g_table->pilots, g_table->bucket_count * sizeof(uint32_t)) &&
+             writeSection(file, &header, SECTION_NAMES, g_table->names.data, g_table->names.len) &&
+             writeSection(file, &header, SECTION_IPSETS, g_table->ipsets.data, g_table->ipsets.len) &&
+             writeSection(file, &header, SECTION_FILTER, g_table->filter, g_table->filter_words * sizeof(uint64_t)) &&
+             fseek(file, 0, SEEK_SET) == 0 &&
+             fwrite(&header, sizeof(header), 1, file) == 1;
+    if (fclose(file) != 0) ok = 0;
+
+    if (!ok) {
+        log_message(LOG_ERROR, "Image: failed to write %s", temp_path);
+        remove(temp_path);
+        return 0;
+    }
+    if (!MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        log_message(LOG_ERROR, "Image: cannot replace %s (error %lu)", path, (unsigned long)GetLastError());
+        remove(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// 检查一个IP集合的记录数和每条PTR记录都落在IP池内
+static int validateImageIpset(const uint8_t* ipsets, uint64_t ipsets_len, uint32_t offset) {
+    if ((uint64_t)offset + IPSET_HEADER_SIZE > ipsets_len) return 0;
+    const uint8_t* set = ipsets + offset;
+    if (set[0] > MAX_IP_COUNT || set[1] > MAX_IP_COUNT) return 0;
+    uint64_t ptr_off = (uint64_t)(ipsetPTR(set) - ipsets);
+    if (ptr_off > ipsets_len) return 0;
+    uint64_t size = 0;
+    for (int i = 0; i < set[2]; i++) {
+        if (ptr_off + size + 12 > ipsets_len) return 0;
+        const uint8_t* rr = ipsets + ptr_off + size;
+        size += 12 + (((uint64_t)rr[10] << 8) | rr[11]);
+    }
+    // 解码时PTR记录会复制到长度为PTR_RR_MAX的缓冲区
+    return size <= PTR_RR_MAX && ptr_off + size <= ipsets_len;
+}
+
+// 逐条检查条目的域名偏移、IP集合偏移和直接定位的pilot，损坏的镜像不能让查询越界读取
+static int validateImageEntries(const uint8_t* base, const HostImageHeader* header) {
+    const HostSlot* entries = (const HostSlot*)(base + header->sections[SECTION_ENTRIES].offset);
+    const uint32_t* pilots = (const uint32_t*)(base + header->sections[SECTION_PILOTS].offset);
+    const uint8_t* names = base + header->sections[SECTION_NAMES].offset;
+    const uint8_t* ipsets = base + header->sections[SECTION_IPSETS].offset;
+    uint64_t names_len = header->sections[SECTION_NAMES].length;
+    uint64_t ipsets_len = header->sections[SECTION_IPSETS].length;
+
+    for (uint64_t i = 0; i < header->bucket_count; i++) {
+        if ((pilots[i] & PILOT_DIRECT) && (pilots[i] & ~PILOT_DIRECT) >= header->entry_count) return 0;
+    }
+    for (uint64_t i = 0; i < header->entry_count; i++) {
+        // 域名记录为长度字节、域名和结尾的'\0'
+        uint64_t name_off = entries[i].name_off;
+        if (name_off >= names_len) return 0;
+        uint64_t name_end = name_off + names[name_off] + 2;
+        if (name_end > names_len || names[name_end - 1] != '\0') return 0;
+        if (entries[i].ipset != IPSET_BLOCKED && !validateImageIpset(ipsets, ipsets_len, entries[i].ipset)) return 0;
+    }
+    return 1;
+}
+
+// 检查文件头中的段是否都落在文件范围内，长度与条目数是否一致
+static int validateImage(const HostImageHeader* header, uint64_t file_size) {
+    if (header->version != HOST_IMAGE_VERSION || header->section_count < SECTION_COUNT ||
+        header->section_count > IMAGE_MAX_SECTIONS) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < header->section_count; i++) {
+        uint64_t offset = header->sections[i].offset;
+        uint64_t length = header->sections[i].length;
+        if (offset < sizeof(HostImageHeader) || offset > file_size || length > file_size - offset) return 0;
+    }
+    return header->entry_count > 0 && header->entry_count <= UINT32_MAX &&
+           header->bucket_count > 0 &&
+           header->sections[SECTION_ENTRIES].length == header->entry_count * sizeof(HostSlot) &&
+           header->sections[SECTION_PILOTS].length == header->bucket_count * sizeof(uint32_t) &&
+           header->sections[SECTION_FILTER].length % sizeof(uint64_t) == 0 &&
+           validateImageEntries((const uint8_t*)header, header);
+}
+
+int loadDnsResolverImage(const char* path) {
+    if (!g_initialized) return -1;
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || (uint64_t)file_size.QuadPart < sizeof(HostImageHeader)) {
+        CloseHandle(file);
+        return 0; // 太小，不可能是镜像
+    }
+
+    // 只读映射，多个进程加载同一镜像时共享页缓存
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!view) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return 0;
+    }
+
+    const HostImageHeader* header = (const HostImageHeader*)view;
+    int is_image = memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) == 0;
+    if (!is_image || !validateImage(header, (uint64_t)file_size.QuadPart)) {
+        if (is_image) {
+            log_message(LOG_ERROR, "Image: %s has unsupported version %u or is corrupted", path, header->version);
         }
-        current = current->next;
+        UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return is_image ? -1 : 0;
     }
- 
-    return 0; // 未找到
+
+    // 替换正在构建的表，各数组直接指向映射中的段
+    clearTable(g_table);
+    const uint8_t* base = (const uint8_t*)view;
+    g_table->entries = (HostSlot*)(base + header->sections[SECTION_ENTRIES].offset);
+    g_table->pilots = (uint32_t*)(base + header->sections[SECTION_PILOTS].offset);
+    g_table->names.data = (uint8_t*)(base + header->sections[SECTION_NAMES].offset);
+    g_table->names.len = header->sections[SECTION_NAMES].length;
+    g_table->ipsets.data = (uint8_t*)(base + header->sections[SECTION_IPSETS].offset);
+    g_table->ipsets.len = header->sections[SECTION_IPSETS].length;
+    g_table->size = (size_t)header->entry_count;
+    g_table->bucket_count = (size_t)header->bucket_count;
+    g_table->wildcard_count = (size_t)header->wildcard_count;
+    g_table->filter_words = (size_t)(header->sections[SECTION_FILTER].length / sizeof(uint64_t));
+    g_table->filter = g_table->filter_words ? (uint64_t*)(base + header->sections[SECTION_FILTER].offset) : NULL;
+    g_table->frozen = 1;
+    g_table->mapped = 1;
+    g_table->image_file = file;
+    g_table->image_mapping = mapping;
+    g_table->image_view = view;
+    return 1;
 }
 
 // --- 初始化与销毁 ---
 
 void initDnsResolver() {
-
-    hashTableSize = TABLE_CAPACITY;
-    // 使用calloc分配，它会自动将所有指针初始化为NULL
-    hashTable = (HashEntry**)calloc(hashTableSize, sizeof(HashEntry*));
-    if (!hashTable) {
+    g_table = createTable();
+    if (!g_table) {
         log_message(ERROR, "错误：为哈希表分配内存失败。\n");
         exit(1);
     }
+    g_current = g_table;
+    g_initialized = 1;
 }
 
 void destroyDnsResolver(void) {
-    if (!hashTable) return;
+    if (!g_initialized) return;
 
-    // 遍历并释放哈希表中的所有条目
-    for (int i = 0; i < hashTableSize; ++i) {
-        HashEntry* current = hashTable[i];
-        while (current != NULL) {
-            HashEntry* temp = current;
-            current = current->next;
-            free(temp);
-        }
-    }
-    // 释放哈希表本身
-    free(hashTable);
-    hashTable = NULL;
+    if (g_table != g_current) freeTable(g_table);
+    freeTable(g_current);
+    g_table = NULL;
+    g_current = NULL;
+    g_initialized = 0;
 }
-
@@ -0,0 +1,392 @@
+//本文件实现DNS over TCP服务（RFC 7766）：非阻塞监听并入事件循环，一个连接上可以流水线发来多个查询，应答按完成先后乱序写回
+#include "dns_tcp.h"
+#include "dns_server.h"
+#include "dns_pool.h"
+#include "dns_edns.h"
+#include "dns_upgrade.h"
+
+typedef struct TcpConnection {
+    SOCKET sock;                      // INVALID_SOCKET表示槽位空闲
+    uint32_t serial;
+    struct sockaddr_in peer;
+    uint8_t* in;                      // 读缓冲区，取自缓冲区池，存放尚未分派的字节
+    int in_len;
+    uint8_t* out[TCP_MAX_PIPELINE];   // 待写出的应答（含长度前缀），每个占一块缓冲区
+    int out_len[TCP_MAX_PIPELINE];
+    int out_head;
+    int out_count;
+    int out_sent;                     // 队首应答已写出的字节数
+    int pending;                      // 已分派、尚未应答的查询数
+    int closing;                      // 写出失败或连接出错，等回到事件处理时关闭
+    int eof;                          // 对方已关闭写方向，已读到的查询应答完后关闭
+    uint64_t last_active;             // 最近一次读到或写出数据的时刻（毫秒）
+} TcpConnection;
+
+static SOCKET listenSocket = INVALID_SOCKET;
+static TcpConnection connections[TCP_MAX_CONNECTIONS];
+static int connections_ready = 0;
+static uint32_t next_serial = 1;
+static int open_count = 0;
+static uint64_t last_listen_try = 0;
+static int draining = 0;             // 热升级交接后不再接受连接、读取新查询
+static uint32_t accepted_total = 0;
+static uint32_t queries_total = 0;
+
+// --- 内部辅助函数 ---
+
+static void initConnections(void) {
+    if (connections_ready) return;
+    memset(connections, 0, sizeof(connections));
+    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) connections[i].sock = INVALID_SOCKET;
+    connections_ready = 1;
+}
+
+static int setNonBlocking(SOCKET sock) {
+    u_long nonBlocking = 1;
+    return ioctlsocket(sock, FIONBIO, &nonBlocking) == 0;
+}
+
+static int openListener(void) {
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == INVALID_SOCKET) return 0;
+
+    // 独占绑定，其他进程不能用SO_REUSEADDR绑到同一端口上截走连接；热升级时监听socket随交接传给新进程
+    const int EXCLUSIVE_OPTION = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (char*)&EXCLUSIVE_OPTION, sizeof(int)) == SOCKET_ERROR) {
+        log_message(LOG_DEBUG, "setsockopt(SO_EXCLUSIVEADDRUSE) failed: %d", WSAGetLastError());
+        closesocket(sock);
+        return 0;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr = clientAddress.sin_addr; // 与UDP socket监听同一个地址
+    address.sin_port = htons(DNS_PORT);
+    if (bind(sock, (struct sockaddr*)&address, sizeof(address)) == SOCKET_ERROR ||
+        listen(sock, TCP_BACKLOG) == SOCKET_ERROR || !setNonBlocking(sock)) {
+        log_message(LOG_DEBUG, "TCP listen on port %d failed: %d", DNS_PORT, WSAGetLastError());
+        closesocket(sock);
+        return 0;
+    }
+    listenSocket = sock;
+    log_message(LOG_INFO, "Listening on TCP port %d", DNS_PORT);
+    return 1;
+}
+
+static void closeConnection(TcpConnection* c) {
+    closesocket(c->sock);
+    c->sock = INVALID_SOCKET;
+    poolRelease(c->in);
+    c->in = NULL;
+    c->in_len = 0;
+    while (c->out_count > 0) {
+        poolRelease(c->out[c->out_head]);
+        c->out_head = (c->out_head + 1) % TCP_MAX_PIPELINE;
+        c->out_count--;
+    }
+    c->out_sent = 0;
+    c->pending = 0;
+    c->closing = 0;
+    c->eof = 0;
+    open_count--;
+}
+
+// 连接满时找最久没有活动的空闲连接（没有未完成的查询和待写数据）
+static TcpConnection* oldestIdle(void) {
+    TcpConnection* oldest = NULL;
+    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
+        TcpConnection* c = &connections[i];
+        if (c->sock == INVALID_SOCKET || c->pending > 0 || c->out_count > 0) continue;
+        if (!oldest || c->last_active < oldest->last_active) oldest = c;
+    }
+    return oldest;
+}
+
+static void acceptConnections(void) {
+    for (int n = 0; n < TCP_ACCEPT_BATCH; n++) {
+        struct sockaddr_in peer;
+        int peer_len = sizeof(peer);
+        SOCKET sock = accept(listenSocket, (struct sockaddr*)&peer, &peer_len);
+        if (sock == INVALID_SOCKET) return; // 没有更多等待接受的连接
+
+        TcpConnection* c = NULL;
+        for (int i = 0; i < TCP_MAX_CONNECTIONS && !c; i++) {
+            if (connections[i].sock == INVALID_SOCKET) c = &connections[i];
+        }
+        if (!c) {
+            c = oldestIdle();
+            if (c) {
+                log_message(LOG_DEBUG, "TCP connection limit reached, closing idle connection from %s:%d",
+                            inet_ntoa(c->peer.sin_addr), ntohs(c->peer.sin_port));
+                closeConnection(c);
+            }
+        }
+        if (!c || !setNonBlocking(sock)) {
+            log_message(LOG_DEBUG, "TCP connection from %s:%d refused, %d connections busy",
+                        inet_ntoa(peer.sin_addr), ntohs(peer.sin_port), open_count);
+            closesocket(sock);
+            continue;
+        }
+
+        c->sock = sock;
+        c->serial = next_serial++;
+        c->peer = peer;
+        c->last_active = GetTickCount64();
+        open_count++;
+        accepted_total++;
+        log_message(LOG_DEBUG, "TCP connection from %s:%d", inet_ntoa(peer.sin_addr), ntohs(peer.sin_port));
+    }
+}
+
+// 流水线是否还有空位：未完成的查询和待写出的应答合计不超过TCP_MAX_PIPELINE
+static int hasRoom(const TcpConnection* c) {
+    return !c->closing && c->pending + c->out_count < TCP_MAX_PIPELINE;
+}
+
+// 尽量写出排队的应答；对方关闭或出错时标记关闭
+static void flushOutput(TcpConnection* c) {
+    while (c->out_count > 0) {
+        uint8_t* data = c->out[c->out_head];
+        int remaining = c->out_len[c->out_head] - c->out_sent;
+        int sent = send(c->sock, (const char*)data + c->out_sent, remaining, 0);
+        if (sent == SOCKET_ERROR) {
+            if (WSAGetLastError() != WSAEWOULDBLOCK) c->closing = 1;
+            return;
+        }
+        c->last_active = GetTickCount64();
+        c->out_sent += sent;
+        if (sent < remaining) return;
+
+        poolRelease(data);
+        c->out_head = (c->out_head + 1) % TCP_MAX_PIPELINE;
+        c->out_count--;
+        c->out_sent = 0;
+    }
+}
+
+// 逐个分派读缓冲区中完整的查询，直到流水线满或剩下的不足一个查询
+static void dispatchQueries(TcpConnection* c, int slot) {
+    int offset = 0;
+    while (hasRoom(c) && c->in_len - offset >= 2) {
+        int len = (c->in[offset] << 8) | c->in[offset + 1];
+        if (len < 12 || len > BUFFER_SIZE - EDNS_OPT_SIZE) {
+            log_message(LOG_DEBUG, "TCP: invalid message length %d from %s, closing", len, inet_ntoa(c->peer.sin_addr));
+            c->closing = 1;
+            return;
+        }
+        if (c->in_len - offset < 2 + len) break;
+
+        // 处理查询时报文会被改写（新ID、追加OPT），复制到单独的缓冲区
+        uint8_t* query = poolAcquire();
+        if (!query) break;
+        memcpy(query, c->in + offset + 2, len);
+        offset += 2 + len;
+
+        ClientRoute route;
+        route.address = c->peer;
+        route.tcp = slot;
+        route.serial = c->serial;
+        c->pending++;
+        queries_total++;
+        log_message(LOG_INFO, "Received TCP message from %s:%d", inet_ntoa(c->peer.sin_addr), ntohs(c->peer.sin_port));
+        handleClientRequest(query, len, &route);
+        poolRelease(query);
+    }
+    if (offset > 0) {
+        memmove(c->in, c->in + offset, c->in_len - offset);
+        c->in_len -= offset;
+    }
+}
+
+static void readInput(TcpConnection* c, int slot) {
+    if (!c->in) {
+        c->in = poolAcquire();
+        if (!c->in) return;
+    }
+    if (c->in_len == POOL_BUFFER_SIZE) {
+        dispatchQueries(c, slot); // 缓冲区已满时其中至少有一个完整的查询，先分派腾出位置
+        return;
+    }
+    int received = recv(c->sock, (char*)c->in + c->in_len, POOL_BUFFER_SIZE - c->in_len, 0);
+    if (received == 0) {
+        c->eof = 1; // 对方发完了查询，仍然写回已分派的查询的应答
+        return;
+    }
+    if (received == SOCKET_ERROR) {
+        if (WSAGetLastError() != WSAEWOULDBLOCK) c->closing = 1;
+        return;
+    }
+    c->in_len += received;
+    c->last_active = GetTickCount64();
+    dispatchQueries(c, slot);
+}
+
+// 应答写出或上游应答到达后流水线腾出了位置，继续分派读缓冲区中积压的查询；
+// 出错的连接，以及对方已关闭写方向且全部应答都已写出的连接，在这里关闭
+static void settleConnections(void) {
+    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
+        TcpConnection* c = &connections[i];
+        if (c->sock == INVALID_SOCKET) continue;
+        if (c->in_len >= 2) dispatchQueries(c, i);
+        if (c->closing || (c->eof && c->pending == 0 && c->out_count == 0)) closeConnection(c);
+    }
+}
+
+static TcpConnection* findRoute(const ClientRoute* route) {
+    if (route->tcp < 0 || route->tcp >= TCP_MAX_CONNECTIONS) return NULL;
+    TcpConnection* c = &connections[route->tcp];
+    if (c->sock == INVALID_SOCKET || c->serial != route->serial) return NULL;
+    return c;
+}
+
+// --- 公开接口实现 ---
+
+void initTcpListener(void) {
+    initConnections();
+    last_listen_try = GetTickCount64();
+    SOCKET adopted = upgradeTakeSocket(UPGRADE_SOCKET_TCP);
+    if (adopted != INVALID_SOCKET) {
+        if (setNonBlocking(adopted)) {
+            listenSocket = adopted;
+            log_message(LOG_INFO, "Took over TCP port %d from running instance", DNS_PORT);
+            return;
+        }
+        closesocket(adopted);
+    }
+    if (!openListener()) {
+        log_message(LOG_INFO, "TCP port %d busy, will retry", DNS_PORT);
+    }
+}
+
+int tcpPollFds(struct pollfd* fds, int max) {
+    int count = 0;
+    if (listenSocket != INVALID_SOCKET && count < max) {
+        fds[count].fd = listenSocket;
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+        count++;
+    }
+    for (int i = 0; i < TCP_MAX_CONNECTIONS && count < max; i++) {
+        TcpConnection* c = &connections[i];
+        if (c->sock == INVALID_SOCKET) continue;
+        short events = 0;
+        if (hasRoom(c) && !c->eof) events |= POLLIN;
+        if (c->out_count > 0) events |= POLLOUT;
+        fds[count].fd = c->sock;
+        fds[count].events = events;
+        fds[count].revents = 0;
+        count++;
+    }
+    return count;
+}
+
+void tcpHandlePoll(const struct pollfd* fds, int count) {
+    for (int k = 0; k < count; k++) {
+        if (!fds[k].revents) continue;
+        if (fds[k].fd == listenSocket) {
+            acceptConnections();
+            continue;
+        }
+        for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
+            TcpConnection* c = &connections[i];
+            if (c->sock != fds[k].fd) continue;
+            if (fds[k].revents & POLLOUT) flushOutput(c);
+            if (fds[k].revents & (POLLIN | POLLHUP | POLLERR)) readInput(c, i);
+            break;
+        }
+    }
+
+    settleConnections();
+}
+
+void tcpService(void) {
+    struct pollfd fds[1 + TCP_MAX_CONNECTIONS];
+    int count = tcpPollFds(fds, 1 + TCP_MAX_CONNECTIONS);
+    if (count == 0) return;
+    if (WSAPoll(fds, count, 0) > 0) {
+        tcpHandlePoll(fds, count);
+    }
+}
+
+void tcpTick(void) {
+    settleConnections();
+    uint64_t now = GetTickCount64();
+    if (listenSocket == INVALID_SOCKET && connections_ready && !draining && now - last_listen_try >= 1000) {
+        last_listen_try = now;
+        openListener();
+    }
+    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
+        TcpConnection* c = &connections[i];
+        if (c->sock == INVALID_SOCKET) continue;
+        int busy = c->pending > 0 || c->out_count > 0;
+        if (now - c->last_active >= (uint64_t)(busy ? TCP_STALL_TIMEOUT : TCP_IDLE_TIMEOUT)) {
+            log_message(LOG_DEBUG, "TCP connection from %s:%d %s, closing", inet_ntoa(c->peer.sin_addr),
+                        ntohs(c->peer.sin_port), busy ? "stalled" : "idle");
+            closeConnection(c);
+        }
+    }
+}
+
+void tcpSend(const ClientRoute* route, const uint8_t* reply, int len) {
+    TcpConnection* c = findRoute(route);
+    if (!c) {
+        log_message(LOG_DEBUG, "TCP connection closed before reply, dropped");
+        return;
+    }
+    if (c->pending > 0) c->pending--;
+    if (c->closing || len <= 0 || len > POOL_BUFFER_SIZE - 2) return;
+
+    uint8_t* data = poolAcquire();
+    if (!data) return;
+    data[0] = (uint8_t)(len >> 8);
+    data[1] = (uint8_t)len;
+    memcpy(data + 2, reply, len);
+
+    int tail = (c->out_head + c->out_count) % TCP_MAX_PIPELINE;
+    c->out[tail] = data;
+    c->out_len[tail] = len + 2;
+    c->out_count++;
+    flushOutput(c);
+}
+
+void tcpQueryFinished(const ClientRoute* route) {
+    TcpConnection* c = findRoute(route);
+    if (c && c->pending > 0) c->pending--;
+}
+
+void tcpDrain(void) {
+    draining = 1;
+    if (listenSocket != INVALID_SOCKET) {
+        closesocket(listenSocket);
+        listenSocket = INVALID_SOCKET;
+    }
+    // 按对方已关闭写方向处理：读缓冲区中完整的查询仍由settleConnections()分派，应答写完后关闭
+    for (int i = 0; i < TCP_MAX_CONNECTIONS && connections_ready; i++) {
+        if (connections[i].sock != INVALID_SOCKET) connections[i].eof = 1;
+    }
+    settleConnections();
+}
+
+int tcpOpenCount(void) {
+    return open_count;
+}
+
+void logTcpStats(void) {
+    log_message(LOG_DEBUG, "TCP: %d connections open, %u accepted, %u queries",
+                open_count, (unsigned)accepted_total, (unsigned)queries_total);
+}
+
+SOCKET tcpListenSocket(void) {
+    return listenSocket;
+}
+
+void closeTcpListener(void) {
+    for (int i = 0; i < TCP_MAX_CONNECTIONS && connections_ready; i++) {
+        if (connections[i].sock != INVALID_SOCKET) closeConnection(&connections[i]);
+    }
+    if (listenSocket != INVALID_SOCKET) {
+        closesocket(listenSocket);
+        listenSocket = INVALID_SOCKET;
+    }
+}
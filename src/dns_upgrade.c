@@ -0,0 +1,513 @@
+//本文件实现零停机热升级：旧进程把DNS socket、缓存和未完成的查询交接给新进程
+#include "dns_upgrade.h"
+#include "dns_server.h"
+#include "dns_tcp.h"
+#include "dns_peer.h"
+#include "dns_upstream.h"
+#include <sddl.h>
+#pragma comment(lib, "advapi32.lib") // 密钥文件的安全描述符
+
+int upgrade_mode = 0;                            // 默认正常启动
+
+static int listenSocket = INVALID_SOCKET;        // 旧进程：等待新进程连接的监听socket
+static int listen_wanted = 0;                    // 旧进程：监听端口暂时被占用时继续重试
+static uint64_t last_listen_try = 0;
+static uint8_t handoffKey[UPGRADE_KEY_SIZE];     // 旧进程：本次监听的交接密钥，与密钥文件的内容相同
+static int handoffSocket = INVALID_SOCKET;       // 新进程：与旧进程之间的交接连接
+static int adoptedSockets[UPGRADE_SOCKET_COUNT] = { INVALID_SOCKET, INVALID_SOCKET }; // 新进程：接管而尚未取走的socket
+
+// --- 内部辅助函数 ---
+
+// 发送全部数据，返回1表示成功
+static int sendAll(int sock, const void* data, int len) {
+    const char* ptr = (const char*)data;
+    while (len > 0) {
+        int sent = send(sock, ptr, len, 0);
+        if (sent <= 0) return 0;
+        ptr += sent;
+        len -= sent;
+    }
+    return 1;
+}
+
+// 接收指定长度的数据，返回1表示成功
+static int recvAll(int sock, void* data, int len) {
+    char* ptr = (char*)data;
+    while (len > 0) {
+        int got = recv(sock, ptr, len, 0);
+        if (got <= 0) return 0;
+        ptr += got;
+        len -= got;
+    }
+    return 1;
+}
+
+// 带缓冲的写入器，避免逐字段调用send
+typedef struct {
+    int sock;
+    int len;
+    int failed;
+    uint8_t data[4096];
+} HandoffWriter;
+
+static void writerFlush(HandoffWriter* w) {
+    if (!w->failed && w->len > 0 && !sendAll(w->sock, w->data, w->len)) {
+        w->failed = 1;
+    }
+    w->len = 0;
+}
+
+static void writerPut(HandoffWriter* w, const void* data, int len) {
+    if (w->len + len > (int)sizeof(w->data)) {
+        writerFlush(w);
+    }
+    memcpy(w->data + w->len, data, len);
+    w->len += len;
+}
+
+static void writerPut8(HandoffWriter* w, uint8_t value) {
+    writerPut(w, &value, 1);
+}
+
+static void writerPut16(HandoffWriter* w, uint16_t value) {
+    uint16_t net = htons(value);
+    writerPut(w, &net, 2);
+}
+
+static void writerPut32(HandoffWriter* w, uint32_t value) {
+    uint32_t net = htonl(value);
+    writerPut(w, &net, 4);
+}
+
+static int recv8(int sock, uint8_t* value) {
+    return recvAll(sock, value, 1);
+}
+
+static int recv16(int sock, uint16_t* value) {
+    uint16_t net;
+    if (!recvAll(sock, &net, 2)) return 0;
+    *value = ntohs(net);
+    return 1;
+}
+
+static int recv32(int sock, uint32_t* value) {
+    uint32_t net;
+    if (!recvAll(sock, &net, 4)) return 0;
+    *value = ntohl(net);
+    return 1;
+}
+
+// 密钥文件的路径：当前用户的临时目录下的UPGRADE_KEY_FILE
+static int keyPath(char* path, DWORD size) {
+    DWORD len = GetTempPathA(size, path);
+    if (len == 0 || len + sizeof(UPGRADE_KEY_FILE) > size) return 0;
+    strcpy(path + len, UPGRADE_KEY_FILE);
+    return 1;
+}
+
+// 旧进程：生成新的随机密钥，写入只有所有者能访问的密钥文件。新进程读出密钥随握手发来，
+// 交接端口谁都能连接，读不到密钥文件的进程拿不到socket副本
+static int writeKey(void) {
+    char path[MAX_PATH];
+    if (!keyPath(path, sizeof(path))) return 0;
+    for (int i = 0; i < UPGRADE_KEY_SIZE; i += 4) {
+        uint32_t value = secureRandom();
+        memcpy(handoffKey + i, &value, 4);
+    }
+
+    // 受保护的DACL只允许文件所有者访问，不继承临时目录的权限；先删掉旧文件再以CREATE_NEW创建，
+    // 保证文件的ACL是这里设置的，而不是沿用别人预先放好的文件
+    SECURITY_ATTRIBUTES attributes;
+    attributes.nLength = sizeof(attributes);
+    attributes.bInheritHandle = FALSE;
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorA("D:P(A;;FA;;;OW)", SDDL_REVISION_1,
+                                                              &attributes.lpSecurityDescriptor, NULL)) {
+        return 0;
+    }
+    DeleteFileA(path);
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, &attributes, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    LocalFree(attributes.lpSecurityDescriptor);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+
+    DWORD written = 0;
+    int ok = WriteFile(file, handoffKey, UPGRADE_KEY_SIZE, &written, NULL) && written == UPGRADE_KEY_SIZE;
+    CloseHandle(file);
+    if (!ok) DeleteFileA(path);
+    return ok;
+}
+
+// 新进程：读出旧进程写下的密钥
+static int readKey(uint8_t* key) {
+    char path[MAX_PATH];
+    if (!keyPath(path, sizeof(path))) return 0;
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+    DWORD got = 0;
+    int ok = ReadFile(file, key, UPGRADE_KEY_SIZE, &got, NULL) && got == UPGRADE_KEY_SIZE;
+    CloseHandle(file);
+    return ok;
+}
+
+// 比较密钥，耗时与内容无关
+static int sameKey(const uint8_t* a, const uint8_t* b) {
+    uint8_t diff = 0;
+    for (int i = 0; i < UPGRADE_KEY_SIZE; i++) diff |= (uint8_t)(a[i] ^ b[i]);
+    return diff == 0;
+}
+
+// 缓存遍历回调：写出一个条目，TTL换算为剩余秒数
+static void exportCacheNode(lruNode* node, void* ctx) {
+    HandoffWriter* w = (HandoffWriter*)ctx;
+    time_t now = time(NULL);
+    uint8_t live = 0;
+
+    if (node->type != DNS_TYPE_A) return; // 交接格式只有A记录，其他类型的条目由新进程重新收录
+
+    for (int i = 0; i < node->ip_count; i++) {
+        if ((now - node->insert_time) < node->ttls[i]) live++;
+    }
+    if (live == 0) return;
+
+    size_t name_len = strlen(node->domain);
+    if (name_len == 0 || name_len > 255) return;
+
+    writerPut8(w, (uint8_t)name_len);
+    writerPut(w, node->domain, (int)name_len);
+    writerPut8(w, live);
+    for (int i = 0; i < node->ip_count; i++) {
+        uint32_t age = (uint32_t)(now - node->insert_time);
+        if (age < node->ttls[i]) {
+            writerPut(w, node->IPs[i], 4);
+            writerPut32(w, node->ttls[i] - age);
+        }
+    }
+}
+
+// 经UDP转发、来自UDP客户端的映射交给新进程：应答到达接管的UDP socket，由新进程转发给客户端
+static int handedOver(const ClientSession* session, time_t now) {
+    return session->expireTime >= now && session->client.tcp < 0 && !session->viaTcp;
+}
+
+// 旧进程：把socket副本、缓存和IDList写给新进程
+static int sendState(int sock) {
+    char magic[4];
+    uint32_t pid;
+    uint8_t key[UPGRADE_KEY_SIZE];
+    if (!recvAll(sock, magic, 4) || memcmp(magic, UPGRADE_MAGIC, 4) != 0 || !recv32(sock, &pid) ||
+        !recvAll(sock, key, UPGRADE_KEY_SIZE)) {
+        log_message(LOG_ERROR, "Upgrade: invalid handshake from new process");
+        return 0;
+    }
+    // 先验证密钥再复制任何socket
+    if (!sameKey(key, handoffKey)) {
+        log_message(LOG_ERROR, "Upgrade: handoff request from pid %u rejected, wrong key", (unsigned)pid);
+        return 0;
+    }
+
+    WSAPROTOCOL_INFOA info;
+    if (WSADuplicateSocketA(dnsSocket, (DWORD)pid, &info) != 0) {
+        log_message(LOG_ERROR, "Upgrade: WSADuplicateSocket failed: %d", WSAGetLastError());
+        return 0;
+    }
+
+    HandoffWriter* w = (HandoffWriter*)malloc(sizeof(HandoffWriter));
+    if (!w) return 0;
+    w->sock = sock;
+    w->len = 0;
+    w->failed = 0;
+
+    writerPut(w, UPGRADE_MAGIC, 4);
+    writerPut16(w, UPGRADE_VERSION);
+    writerPut(w, &info, sizeof(info));
+
+    // TCP监听socket和对等socket：先写1字节表示有没有，有时随后是它的副本
+    SOCKET extra[UPGRADE_SOCKET_COUNT] = { tcpListenSocket(), peerPortSocket() };
+    for (int i = 0; i < UPGRADE_SOCKET_COUNT; i++) {
+        WSAPROTOCOL_INFOA extra_info;
+        int present = extra[i] != INVALID_SOCKET && WSADuplicateSocketA(extra[i], (DWORD)pid, &extra_info) == 0;
+        writerPut8(w, (uint8_t)present);
+        if (present) writerPut(w, &extra_info, sizeof(extra_info));
+    }
+    writerFlush(w);
+
+    // 缓存条目，从最旧到最新，这样新进程按顺序插入后LRU次序不变
+    cacheForEach(exportCacheNode, w);
+    writerPut8(w, 0);
+
+    // 尚未收到上游响应的ID映射。TCP连接（客户端的和上游的）不随socket交接，这些查询留在旧进程处理完：
+    // 经UDP转发的TCP客户端查询先改经上游TCP连接重发，应答才会回到旧进程；新进程只保留它们的序号
+    time_t now = time(NULL);
+    int pending = 0;
+    int held = 0;
+    for (int i = 0; i < MAX_ID_SIZE; i++) {
+        if (IDList[i].expireTime < now) continue;
+        if (IDList[i].client.tcp >= 0 && !IDList[i].viaTcp && !upstreamResendOverTcp((uint16_t)i)) {
+            log_message(LOG_DEBUG, "Upgrade: cannot resend [ID: %d] over TCP, its reply will be lost", i);
+        }
+        uint8_t handover = handedOver(&IDList[i], now);
+        writerPut16(w, (uint16_t)i);
+        writerPut8(w, handover);
+        writerPut16(w, IDList[i].wireId);
+        writerPut16(w, IDList[i].userId);
+        writerPut32(w, (uint32_t)(IDList[i].expireTime - now));
+        writerPut(w, &IDList[i].client.address.sin_addr.s_addr, 4);
+        writerPut(w, &IDList[i].client.address.sin_port, 2);
+        if (handover) pending++;
+        else held++;
+    }
+    writerPut16(w, 0xFFFF);
+    writerFlush(w);
+
+    int ok = !w->failed;
+    free(w);
+    if (ok) {
+        // 交出去的映射由新进程应答，旧进程不再等待，也不按超时处理
+        for (int i = 0; i < MAX_ID_SIZE; i++) {
+            if (handedOver(&IDList[i], now)) IDList[i].expireTime = 0;
+        }
+        log_message(LOG_INFO, "Upgrade: handed off socket, cache and %d pending queries, finishing %d here",
+                    pending, held);
+    }
+    return ok;
+}
+
+// 创建交接监听socket，成功返回1
+static int openListener(int quiet) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(UPGRADE_PORT);
+
+    last_listen_try = GetTickCount64();
+    listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listenSocket == INVALID_SOCKET) {
+        log_message(LOG_ERROR, "Upgrade: failed to create listen socket: %d", WSAGetLastError());
+        return 0;
+    }
+
+    u_long nonBlocking = 1;
+    if (bind(listenSocket, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(listenSocket, 1) == SOCKET_ERROR ||
+        ioctlsocket(listenSocket, FIONBIO, &nonBlocking) != 0) {
+        log_message(quiet ? LOG_DEBUG : LOG_ERROR, "Upgrade: port %d unavailable: %d, will retry",
+                    UPGRADE_PORT, WSAGetLastError());
+        closesocket(listenSocket);
+        listenSocket = INVALID_SOCKET;
+        return 0;
+    }
+    // 绑定成功后才写密钥文件（端口被别的实例占着时不能覆盖它的密钥）；每次开始监听都换一个密钥，被拒绝的请求之后旧密钥随之作废
+    if (!writeKey()) {
+        log_message(LOG_ERROR, "Upgrade: hot upgrade disabled, cannot write key file %s: %d",
+                    UPGRADE_KEY_FILE, GetLastError());
+        closesocket(listenSocket);
+        listenSocket = INVALID_SOCKET;
+        listen_wanted = 0;
+        return 0;
+    }
+    printf("Hot upgrade listening on 127.0.0.1:%d\n", UPGRADE_PORT);
+    return 1;
+}
+
+// 端口被占用时（如刚交接完，旧进程一侧的交接连接还没关闭）每秒重试一次
+static void retryListen() {
+    if (listen_wanted && listenSocket == INVALID_SOCKET && GetTickCount64() - last_listen_try >= 1000) {
+        openListener(1);
+    }
+}
+
+// --- 公开接口实现 ---
+
+void upgradeListen() {
+    listen_wanted = 1;
+    openListener(0);
+}
+
+int upgradeListenSocket() {
+    retryListen();
+    return listenSocket;
+}
+
+int upgradePoll() {
+    retryListen();
+    if (listenSocket == INVALID_SOCKET) return 0;
+
+    int sock = accept(listenSocket, NULL, NULL);
+    if (sock == INVALID_SOCKET) return 0; // 没有新进程连接
+
+    // 交接期间使用阻塞读写，并立即释放监听端口给新进程
+    u_long blocking = 0;
+    ioctlsocket(sock, FIONBIO, &blocking);
+    closesocket(listenSocket);
+    listenSocket = INVALID_SOCKET;
+
+    int ok = sendState(sock);
+    if (ok) {
+        // 等待新进程先关闭连接，TIME_WAIT留在对端的临时端口上，新进程才能立即重新监听UPGRADE_PORT
+        char eof;
+        recv(sock, &eof, 1, 0);
+    }
+    closesocket(sock);
+    if (!ok) {
+        log_message(LOG_ERROR, "Upgrade: handoff failed, keep serving");
+        upgradeListen();
+        return 0;
+    }
+    listen_wanted = 0; // 已交接，不再等待下一个新进程
+    return 1;
+}
+
+int upgradeAcquireSocket() {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(UPGRADE_PORT);
+
+    handoffSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (handoffSocket == INVALID_SOCKET ||
+        connect(handoffSocket, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        log_message(LOG_ERROR, "Upgrade: cannot reach running instance on port %d: %d",
+                    UPGRADE_PORT, WSAGetLastError());
+        exit(1);
+    }
+
+    uint8_t key[UPGRADE_KEY_SIZE];
+    if (!readKey(key)) {
+        log_message(LOG_ERROR, "Upgrade: cannot read key file %s of running instance: %d",
+                    UPGRADE_KEY_FILE, GetLastError());
+        exit(1);
+    }
+
+    uint32_t pid = htonl((uint32_t)GetCurrentProcessId());
+    char magic[4];
+    uint16_t version;
+    WSAPROTOCOL_INFOA info;
+    if (!sendAll(handoffSocket, UPGRADE_MAGIC, 4) || !sendAll(handoffSocket, &pid, 4) ||
+        !sendAll(handoffSocket, key, UPGRADE_KEY_SIZE) || !recvAll(handoffSocket, magic, 4) || memcmp(magic, UPGRADE_MAGIC, 4) != 0 ||
+        !recv16(handoffSocket, &version) || version != UPGRADE_VERSION ||
+        !recvAll(handoffSocket, &info, sizeof(info))) {
+        log_message(LOG_ERROR, "Upgrade: handshake with running instance failed");
+        exit(1);
+    }
+
+    int sock = WSASocketA(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &info, 0, 0);
+    if (sock == INVALID_SOCKET) {
+        log_message(LOG_ERROR, "Upgrade: WSASocket from protocol info failed: %d", WSAGetLastError());
+        exit(1);
+    }
+
+    // 旧进程的TCP监听socket和对等socket，由initTcpListener()和initPeering()取走
+    for (int i = 0; i < UPGRADE_SOCKET_COUNT; i++) {
+        uint8_t present;
+        if (!recv8(handoffSocket, &present)) {
+            log_message(LOG_ERROR, "Upgrade: handshake with running instance failed");
+            exit(1);
+        }
+        if (!present) continue;
+        WSAPROTOCOL_INFOA extra_info;
+        if (!recvAll(handoffSocket, &extra_info, sizeof(extra_info))) {
+            log_message(LOG_ERROR, "Upgrade: handshake with running instance failed");
+            exit(1);
+        }
+        adoptedSockets[i] = WSASocketA(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &extra_info, 0, 0);
+        if (adoptedSockets[i] == INVALID_SOCKET) {
+            log_message(LOG_ERROR, "Upgrade: cannot take over socket %d: %d", i, WSAGetLastError());
+        }
+    }
+    return sock;
+}
+
+int upgradeTakeSocket(int kind) {
+    if (kind < 0 || kind >= UPGRADE_SOCKET_COUNT) return INVALID_SOCKET;
+    int sock = adoptedSockets[kind];
+    adoptedSockets[kind] = INVALID_SOCKET;
+    return sock;
+}
+
+void upgradeReceiveState() {
+    if (handoffSocket == INVALID_SOCKET) return;
+
+    int cached = 0;
+    int pending = 0;
+    int ok = 1;
+
+    // 缓存条目
+    while (ok) {
+        uint8_t name_len;
+        char name[MAX_DOMAIN_LEN];
+        uint8_t ip_count;
+        uint8_t ips[MAX_IP_COUNT][4];
+        uint32_t ttls[MAX_IP_COUNT];
+
+        if (!recv8(handoffSocket, &name_len)) { ok = 0; break; }
+        if (name_len == 0) break;
+        if (!recvAll(handoffSocket, name, name_len) || !recv8(handoffSocket, &ip_count)) { ok = 0; break; }
+        name[name_len] = '\0';
+
+        uint8_t kept = 0;
+        for (int i = 0; i < ip_count; i++) {
+            uint8_t ip[4];
+            uint32_t ttl;
+            if (!recvAll(handoffSocket, ip, 4) || !recv32(handoffSocket, &ttl)) { ok = 0; break; }
+            if (kept < MAX_IP_COUNT) {
+                memcpy(ips[kept], ip, 4);
+                ttls[kept] = ttl;
+                kept++;
+            }
+        }
+        if (ok && kept > 0) {
+            cachePut(ips, ttls, kept, name, 0);
+            cached++;
+        }
+    }
+
+    // 未完成的ID映射，交过来的由新进程在上游响应到达后转发给客户端，其余的只占住序号
+    time_t now = time(NULL);
+    int held = 0;
+    while (ok) {
+        uint16_t index;
+        uint8_t handover;
+        uint16_t wireId;
+        uint16_t userId;
+        uint32_t remaining;
+        uint32_t addr;
+        uint16_t port;
+
+        if (!recv16(handoffSocket, &index)) { ok = 0; break; }
+        if (index == 0xFFFF) break;
+        if (!recv8(handoffSocket, &handover) || !recv16(handoffSocket, &wireId) || !recv16(handoffSocket, &userId) ||
+            !recv32(handoffSocket, &remaining) || !recvAll(handoffSocket, &addr, 4) ||
+            !recvAll(handoffSocket, &port, 2)) { ok = 0; break; }
+        if (index >= MAX_ID_SIZE || wireId % MAX_ID_SIZE != index) continue;
+
+        IDList[index].userId = userId;
+        IDList[index].wireId = wireId;                    // 上游应答带着旧进程发出时的事务ID
+        IDList[index].expireTime = now + remaining;
+        memset(&IDList[index].client, 0, sizeof(ClientRoute));
+        IDList[index].client.address.sin_family = AF_INET;
+        IDList[index].client.address.sin_addr.s_addr = addr;
+        IDList[index].client.address.sin_port = port;
+        IDList[index].client.tcp = -1;
+        IDList[index].viaTcp = 0;
+        IDList[index].peerOwner = 0;
+        IDList[index].retried = 0;
+        IDList[index].heldByOld = !handover;            // 旧进程还在处理：应答若经UDP到达这里就丢弃
+        IDList[index].upstream.group = FORWARD_NO_GROUP; // 发出时刻未知，不参与RTT和待应答计数
+        IDList[index].qname[0] = '\0';                    // 查询名未随映射交接，超时不记入失败缓存
+        memset(&IDList[index].edns, 0, sizeof(dns_edns));  // 客户端的EDNS能力未知，按512字节应答
+        if (handover) pending++;
+        else held++;
+    }
+
+    closesocket(handoffSocket);
+    handoffSocket = INVALID_SOCKET;
+    for (int i = 0; i < UPGRADE_SOCKET_COUNT; i++) {
+        if (adoptedSockets[i] != INVALID_SOCKET) closesocket(upgradeTakeSocket(i));
+    }
+
+    if (!ok) {
+        log_message(LOG_ERROR, "Upgrade: state transfer interrupted, continuing with partial state");
+    }
+    printf("热升级完成：接管 %d 条缓存，%d 个未完成查询（旧进程处理完 %d 个）\n", cached, pending, held);
+}
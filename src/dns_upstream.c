@@ -0,0 +1,547 @@
+//本文件实现到上游的TCP连接池：长连接上按事务ID复用多个在途查询，截断的UDP应答改经TCP重试，连接失败时按指数退避重连
+#include "dns_upstream.h"
+#include "dns_server.h"
+#include "dns_resetid.h"
+#include "dns_forward.h"
+#include "dns_pool.h"
+#include "dns_edns.h"
+#include "dns_reverse.h"
+
+#define UPSTREAM_FREE 0               // 槽位空闲
+#define UPSTREAM_CONNECTING 1         // 已发起连接，等待可写
+#define UPSTREAM_OPEN 2               // 连接已建立
+
+int upstream_tcp_only = 0;
+
+// 已写入或排队等待写出、还没有应答的查询
+typedef struct PendingQuery {
+    uint8_t* frame;                   // 带两字节长度前缀的查询，连接中断时用它重发
+    int len;                          // frame的长度
+    uint64_t sent_at;                 // 交给连接池的时刻（毫秒）
+    int resent;                       // 已经在新连接上重发过
+} PendingQuery;
+
+typedef struct UpstreamConnection {
+    SOCKET sock;
+    int state;
+    int broken;                       // 读写出错或对方关闭，等回到事件处理时关闭并重发在途查询
+    struct sockaddr_in server;
+    uint8_t* in;                      // 读缓冲区，存放尚未分派的应答字节
+    int in_len;
+    int skip;                         // 超过缓冲区大小的应答还要丢弃的字节数
+    uint8_t* out;                     // 待写出的查询，依次排列
+    int out_len;
+    int out_sent;
+    PendingQuery pending[UPSTREAM_TCP_PIPELINE];
+    int pending_count;
+    uint64_t opened_at;
+    uint64_t last_active;             // 最近一次写出查询或读到应答的时刻（毫秒）
+    uint32_t answered;                // 这条连接上收到的应答数
+} UpstreamConnection;
+
+// 上游服务器的重连退避状态
+typedef struct ServerHealth {
+    struct sockaddr_in address;
+    uint32_t failures;                // 连续失败的次数，收到应答后清零
+    uint64_t retry_at;                // 退避结束的时刻（毫秒）
+} ServerHealth;
+
+static UpstreamConnection connections[UPSTREAM_TCP_MAX_CONNECTIONS];
+static ServerHealth health[UPSTREAM_TCP_MAX_SERVERS];
+static int health_count = 0;
+static uint32_t connects_total = 0;
+static uint32_t sent_total = 0;
+static uint32_t answered_total = 0;
+static uint32_t truncated_total = 0;
+static uint32_t resent_total = 0;
+
+// --- 内部辅助函数 ---
+
+static int sameServer(const struct sockaddr_in* a, const struct sockaddr_in* b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+static uint16_t frameId(const PendingQuery* query) {
+    return (uint16_t)((query->frame[2] << 8) | query->frame[3]);
+}
+
+static ServerHealth* findHealth(const struct sockaddr_in* server, int create) {
+    for (int i = 0; i < health_count; i++) {
+        if (sameServer(&health[i].address, server)) return &health[i];
+    }
+    if (!create || health_count >= UPSTREAM_TCP_MAX_SERVERS) return NULL;
+    ServerHealth* entry = &health[health_count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->address = *server;
+    return entry;
+}
+
+static int inBackoff(const struct sockaddr_in* server, uint64_t now) {
+    ServerHealth* entry = findHealth(server, 0);
+    return entry && entry->retry_at > now;
+}
+
+// 连接失败：重连前等待的时间从1秒起每次加倍，最长30秒
+static void recordFailure(const struct sockaddr_in* server) {
+    ServerHealth* entry = findHealth(server, 1);
+    if (!entry) return;
+    uint32_t backoff = UPSTREAM_TCP_BACKOFF_MIN;
+    for (uint32_t i = 0; i < entry->failures && backoff < UPSTREAM_TCP_BACKOFF_MAX; i++) backoff *= 2;
+    if (backoff > UPSTREAM_TCP_BACKOFF_MAX) backoff = UPSTREAM_TCP_BACKOFF_MAX;
+    entry->failures++;
+    entry->retry_at = GetTickCount64() + backoff;
+    log_message(LOG_INFO, "Upstream TCP %s:%d failed, retrying in %u ms (failure %u)", inet_ntoa(server->sin_addr),
+                ntohs(server->sin_port), (unsigned)backoff, (unsigned)entry->failures);
+}
+
+static void recordSuccess(const struct sockaddr_in* server) {
+    ServerHealth* entry = findHealth(server, 0);
+    if (entry) {
+        entry->failures = 0;
+        entry->retry_at = 0;
+    }
+}
+
+static void releaseConnection(UpstreamConnection* c) {
+    closesocket(c->sock);
+    c->sock = INVALID_SOCKET;
+    c->state = UPSTREAM_FREE;
+    c->broken = 0;
+    poolRelease(c->in);
+    poolRelease(c->out);
+    c->in = NULL;
+    c->out = NULL;
+    c->in_len = 0;
+    c->skip = 0;
+    c->out_len = 0;
+    c->out_sent = 0;
+    c->pending_count = 0;
+}
+
+static void removePending(UpstreamConnection* c, int index) {
+    free(c->pending[index].frame);
+    c->pending[index] = c->pending[--c->pending_count];
+}
+
+// 在空闲槽位上发起非阻塞连接；连接立即失败时记入退避
+static UpstreamConnection* openConnection(const struct sockaddr_in* server) {
+    UpstreamConnection* c = NULL;
+    for (int i = 0; i < UPSTREAM_TCP_MAX_CONNECTIONS && !c; i++) {
+        if (connections[i].state == UPSTREAM_FREE) c = &connections[i];
+    }
+    if (!c) return NULL;
+
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == INVALID_SOCKET) return NULL;
+    u_long nonBlocking = 1;
+    if (ioctlsocket(sock, FIONBIO, &nonBlocking) != 0) {
+        closesocket(sock);
+        return NULL;
+    }
+    int state = UPSTREAM_OPEN;
+    if (connect(sock, (const struct sockaddr*)server, sizeof(*server)) == SOCKET_ERROR) {
+        int error = WSAGetLastError();
+        if (error != WSAEWOULDBLOCK && error != WSAEINPROGRESS) {
+            closesocket(sock);
+            recordFailure(server);
+            return NULL;
+        }
+        state = UPSTREAM_CONNECTING;
+    }
+    uint8_t* out = poolAcquire();
+    if (!out) {
+        closesocket(sock);
+        return NULL;
+    }
+
+    memset(c, 0, sizeof(*c));
+    c->sock = sock;
+    c->state = state;
+    c->server = *server;
+    c->out = out;
+    c->opened_at = c->last_active = GetTickCount64();
+    connects_total++;
+    log_message(LOG_DEBUG, "Upstream TCP connecting to %s:%d", inet_ntoa(server->sin_addr), ntohs(server->sin_port));
+    return c;
+}
+
+// 连接还能不能再接一个len字节的查询：流水线未满，写缓冲区放得下
+static int hasRoom(UpstreamConnection* c, int len) {
+    if (c->broken || c->pending_count >= UPSTREAM_TCP_PIPELINE) return 0;
+    if (c->out_len + len > POOL_BUFFER_SIZE && c->out_sent > 0) {
+        memmove(c->out, c->out + c->out_sent, c->out_len - c->out_sent);
+        c->out_len -= c->out_sent;
+        c->out_sent = 0;
+    }
+    return c->out_len + len <= POOL_BUFFER_SIZE;
+}
+
+// 选在途查询最少的连接；到该服务器的连接都满了才开新的
+static UpstreamConnection* pickConnection(const struct sockaddr_in* server, int len) {
+    UpstreamConnection* best = NULL;
+    int count = 0;
+    for (int i = 0; i < UPSTREAM_TCP_MAX_CONNECTIONS; i++) {
+        UpstreamConnection* c = &connections[i];
+        if (c->state == UPSTREAM_FREE || !sameServer(&c->server, server)) continue;
+        count++;
+        if (!hasRoom(c, len)) continue;
+        if (!best || c->pending_count < best->pending_count) best = c;
+    }
+    if (best || count >= UPSTREAM_TCP_PER_SERVER) return best;
+    return openConnection(server);
+}
+
+static void flushOutput(UpstreamConnection* c) {
+    while (c->out_sent < c->out_len) {
+        int sent = send(c->sock, (const char*)c->out + c->out_sent, c->out_len - c->out_sent, 0);
+        if (sent == SOCKET_ERROR) {
+            if (WSAGetLastError() != WSAEWOULDBLOCK) c->broken = 1;
+            return;
+        }
+        c->out_sent += sent;
+        c->last_active = GetTickCount64();
+    }
+    c->out_len = 0;
+    c->out_sent = 0;
+}
+
+// 把查询交给到server的某个连接；成功后query归连接所有
+static int submit(const struct sockaddr_in* server, const PendingQuery* query) {
+    if (inBackoff(server, GetTickCount64())) return 0;
+    UpstreamConnection* c = pickConnection(server, query->len);
+    if (!c) return 0;
+    memcpy(c->out + c->out_len, query->frame, query->len);
+    c->out_len += query->len;
+    c->pending[c->pending_count++] = *query;
+    if (c->state == UPSTREAM_OPEN) flushOutput(c);
+    return 1;
+}
+
+// 连接池接手不了的在途查询改经UDP发给同一个服务器，不必等客户端超时重试
+static void fallbackUdp(const struct sockaddr_in* server, PendingQuery* query) {
+    uint16_t id = frameId(query);
+    ClientSession* session = findSession(id);
+    if (session) {
+        session->viaTcp = 0;
+        sendto(dnsSocket, (const char*)query->frame + 2, query->len - 2, 0, (const struct sockaddr*)server, sizeof(*server));
+        log_message(LOG_DEBUG, "Upstream TCP query [ID: %d] sent over UDP instead", id);
+    }
+    free(query->frame);
+}
+
+// 连接中断：还没有应答的查询在新连接上重发一次，重发不了的改走UDP；一个应答都没收到就断开的算作连接失败
+static void connectionLost(UpstreamConnection* c) {
+    struct sockaddr_in server = c->server;
+    if (c->answered == 0) {
+        recordFailure(&server);
+    } else {
+        log_message(LOG_DEBUG, "Upstream TCP %s:%d closed after %u answers", inet_ntoa(server.sin_addr),
+                    ntohs(server.sin_port), (unsigned)c->answered);
+    }
+
+    PendingQuery orphans[UPSTREAM_TCP_PIPELINE];
+    int count = c->pending_count;
+    memcpy(orphans, c->pending, count * sizeof(PendingQuery));
+    c->pending_count = 0;
+    releaseConnection(c);
+
+    uint64_t now = GetTickCount64();
+    for (int i = 0; i < count; i++) {
+        PendingQuery* query = &orphans[i];
+        if (now - query->sent_at >= UPSTREAM_TCP_QUERY_TIMEOUT) {
+            free(query->frame);
+            continue;
+        }
+        if (!query->resent) {
+            query->resent = 1;
+            if (submit(&server, query)) {
+                resent_total++;
+                continue;
+            }
+        }
+        fallbackUdp(&server, query);
+    }
+}
+
+static void settleConnections(void) {
+    for (int i = 0; i < UPSTREAM_TCP_MAX_CONNECTIONS; i++) {
+        if (connections[i].state != UPSTREAM_FREE && connections[i].broken) connectionLost(&connections[i]);
+    }
+}
+
+// 逐个取出读缓冲区中完整的应答：只分派与在途查询对应的，交给handleServerResponse()按ID映射转发给客户端
+static void dispatchResponses(UpstreamConnection* c) {
+    int offset = 0;
+    while (offset < c->in_len) {
+        if (c->skip > 0) {
+            int dropped = c->in_len - offset < c->skip ? c->in_len - offset : c->skip;
+            offset += dropped;
+            c->skip -= dropped;
+            continue;
+        }
+        if (c->in_len - offset < 2) break;
+        int len = (c->in[offset] << 8) | c->in[offset + 1];
+        if (len < 12 || len > BUFFER_SIZE) {
+            // 放不下的应答整个丢弃，对应的查询等ID映射过期
+            log_message(LOG_DEBUG, "Upstream TCP: dropped %d-byte response from %s", len, inet_ntoa(c->server.sin_addr));
+            c->skip = len + 2;
+            continue;
+        }
+        if (c->in_len - offset < 2 + len) break;
+
+        uint16_t id = (uint16_t)((c->in[offset + 2] << 8) | c->in[offset + 3]);
+        int index = -1;
+        for (int i = 0; i < c->pending_count && index < 0; i++) {
+            if (frameId(&c->pending[i]) == id) index = i;
+        }
+        if (index < 0) {
+            log_message(LOG_DEBUG, "Upstream TCP: no query waiting for [ID: %d], dropped", id);
+        } else {
+            removePending(c, index);
+            c->answered++;
+            answered_total++;
+            c->last_active = GetTickCount64();
+            recordSuccess(&c->server);
+            // 转发时报文会被改写（原ID、OPT），复制到单独的缓冲区
+            uint8_t* response = poolAcquire();
+            if (response) {
+                memcpy(response, c->in + offset + 2, len);
+                log_message(LOG_INFO, "Received TCP response from %s:%d", inet_ntoa(c->server.sin_addr), ntohs(c->server.sin_port));
+                handleServerResponse(response, len);
+                poolRelease(response);
+            }
+        }
+        offset += 2 + len;
+    }
+    if (offset > 0) {
+        memmove(c->in, c->in + offset, c->in_len - offset);
+        c->in_len -= offset;
+    }
+}
+
+static void readInput(UpstreamConnection* c) {
+    if (!c->in) {
+        c->in = poolAcquire();
+        if (!c->in) return;
+    }
+    int received = recv(c->sock, (char*)c->in + c->in_len, POOL_BUFFER_SIZE - c->in_len, 0);
+    if (received == 0 || (received == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK)) {
+        c->broken = 1;
+        return;
+    }
+    if (received == SOCKET_ERROR) return;
+    c->in_len += received;
+    dispatchResponses(c);
+}
+
+// 非阻塞连接完成：SO_ERROR为0表示连接成功，写出连接期间排队的查询
+static void finishConnect(UpstreamConnection* c) {
+    int error = 0;
+    int error_len = sizeof(error);
+    if (getsockopt(c->sock, SOL_SOCKET, SO_ERROR, (char*)&error, &error_len) == SOCKET_ERROR || error != 0) {
+        c->broken = 1;
+        return;
+    }
+    c->state = UPSTREAM_OPEN;
+    c->last_active = GetTickCount64();
+    log_message(LOG_DEBUG, "Upstream TCP connected to %s:%d", inet_ntoa(c->server.sin_addr), ntohs(c->server.sin_port));
+    flushOutput(c);
+}
+
+// 给重新拼出的查询加上本地的OPT，DO标志与客户端一致
+static int addSessionOpt(const ClientSession* session, uint8_t* query, int query_len) {
+    dns_edns none;
+    memset(&none, 0, sizeof(none));
+    query_len = ednsPrepareQuery(query, query_len, BUFFER_SIZE, &none);
+    if (session->edns.flags & EDNS_DO_BIT) query[query_len - 4] |= (uint8_t)(EDNS_DO_BIT >> 8);
+    return query_len;
+}
+
+// 映射中只记了查询名和类型：重新拼出只有一个问题的递归查询（带OPT），返回长度，查询名无效时返回0
+static int sessionQuery(uint16_t id, uint8_t* query) {
+    const ClientSession* session = &IDList[id];
+    memset(query, 0, 12);
+    query[0] = (uint8_t)(session->wireId >> 8);
+    query[1] = (uint8_t)session->wireId;
+    query[2] = (uint8_t)(RD_MASK >> 8);
+    query[5] = 1;
+    size_t name_len = wireName(session->qname, strlen(session->qname), query + 12);
+    if (name_len == 0) return 0;
+    int query_len = 12 + (int)name_len;
+    query[query_len++] = (uint8_t)(session->qtype >> 8);
+    query[query_len++] = (uint8_t)session->qtype;
+    query[query_len++] = 0;
+    query[query_len++] = DNS_CLASS_IN;
+    return addSessionOpt(session, query, query_len);
+}
+
+// 经连接池发出查询，映射改为等TCP应答
+static int resendSession(ClientSession* session, const struct sockaddr_in* server, uint8_t* query, int query_len) {
+    if (!upstreamTcpSend(server, query, query_len)) return 0;
+    session->viaTcp = 1;
+    session->expireTime = time(NULL) + ID_EXPIRE_TIME;
+    return 1;
+}
+
+// --- 公开接口实现 ---
+
+int upstreamTcpSend(const struct sockaddr_in* server, const uint8_t* query, int len) {
+    if (len < 12 || len > BUFFER_SIZE) return 0;
+    PendingQuery pending;
+    pending.frame = (uint8_t*)malloc(len + 2);
+    if (!pending.frame) return 0;
+    pending.frame[0] = (uint8_t)(len >> 8);
+    pending.frame[1] = (uint8_t)len;
+    memcpy(pending.frame + 2, query, len);
+    pending.len = len + 2;
+    pending.sent_at = GetTickCount64();
+    pending.resent = 0;
+    if (!submit(server, &pending)) {
+        free(pending.frame);
+        return 0;
+    }
+    sent_total++;
+    return 1;
+}
+
+int upstreamRetryTruncated(uint16_t id, const uint8_t* response, int len) {
+    ClientSession* session = &IDList[id];
+    if (session->viaTcp) return 0;
+    const struct sockaddr_in* server = forwardAddress(session->upstream);
+    if (!server) return 0;
+
+    // 应答的报头和问题就是原来的查询：保留OPCODE、RD和CD，清掉应答的标志和各部分的计数
+    dns_edns parsed;
+    if (!ednsParse(response, len, &parsed) || parsed.question_end <= 12) return 0;
+    uint8_t query[BUFFER_SIZE];
+    int query_len = parsed.question_end;
+    if (query_len + EDNS_OPT_SIZE > BUFFER_SIZE) return 0;
+    memcpy(query, response, query_len);
+    query[2] = response[2] & (uint8_t)((OPCODE_MASK | RD_MASK) >> 8);
+    query[3] = response[3] & 0x10; // CD
+    memset(query + 6, 0, 6);
+    query_len = addSessionOpt(session, query, query_len);
+    if (!resendSession(session, server, query, query_len)) return 0;
+    truncated_total++;
+    return 1;
+}
+
+int upstreamResendOverTcp(uint16_t id) {
+    ClientSession* session = &IDList[id];
+    if (session->viaTcp || !session->qname[0]) return 0;
+    const struct sockaddr_in* server = forwardAddress(session->upstream);
+    if (!server) return 0;
+
+    uint8_t query[BUFFER_SIZE];
+    int query_len = sessionQuery(id, query);
+    return query_len > 0 && resendSession(session, server, query, query_len);
+}
+
+int upstreamRetryTimedOut(uint16_t id) {
+    ClientSession* session = &IDList[id];
+    if (session->retried || session->heldByOld || !session->qname[0]) return 0;
+    uint8_t query[BUFFER_SIZE];
+    int query_len = sessionQuery(id, query);
+    if (query_len == 0) return 0;
+    const struct sockaddr_in* server = forwardRetry(session->qname, strlen(session->qname), &session->upstream);
+    if (!server) return 0;
+
+    // 原来经TCP发出的（-t或截断后的重试）仍走TCP，连接池无法接手时改走UDP
+    session->retried = 1;
+    session->sentAt = GetTickCount64();
+    session->viaTcp = (upstream_tcp_only || session->viaTcp) && upstreamTcpSend(server, query, query_len);
+    if (!session->viaTcp) {
+        sendto(dnsSocket, (const char*)query, query_len, 0, (const struct sockaddr*)server, sizeof(*server));
+    }
+    session->expireTime = time(NULL) + ID_EXPIRE_TIME;
+    log_message(LOG_INFO, "Query [ID: %d], [Domain: %s] timed out, retrying on %s:%d", session->wireId, session->qname,
+                inet_ntoa(server->sin_addr), ntohs(server->sin_port));
+    return 1;
+}
+
+int upstreamPollFds(struct pollfd* fds, int max) {
+    int count = 0;
+    for (int i = 0; i < UPSTREAM_TCP_MAX_CONNECTIONS && count < max; i++) {
+        UpstreamConnection* c = &connections[i];
+        if (c->state == UPSTREAM_FREE) continue;
+        short events = POLLOUT;
+        if (c->state == UPSTREAM_OPEN) events = (short)(POLLIN | (c->out_sent < c->out_len ? POLLOUT : 0));
+        fds[count].fd = c->sock;
+        fds[count].events = events;
+        fds[count].revents = 0;
+        count++;
+    }
+    return count;
+}
+
+void upstreamHandlePoll(const struct pollfd* fds, int count) {
+    for (int k = 0; k < count; k++) {
+        if (!fds[k].revents) continue;
+        for (int i = 0; i < UPSTREAM_TCP_MAX_CONNECTIONS; i++) {
+            UpstreamConnection* c = &connections[i];
+            if (c->state == UPSTREAM_FREE || c->sock != fds[k].fd) continue;
+            if (c->state == UPSTREAM_CONNECTING) {
+                finishConnect(c);
+            } else {
+                if (fds[k].revents & POLLOUT) flushOutput(c);
+                if (fds[k].revents & (POLLIN | POLLHUP | POLLERR)) readInput(c);
+            }
+            break;
+        }
+    }
+    settleConnections();
+}
+
+void upstreamService(void) {
+    struct pollfd fds[UPSTREAM_TCP_MAX_CONNECTIONS];
+    int count = upstreamPollFds(fds, UPSTREAM_TCP_MAX_CONNECTIONS);
+    if (count == 0) return;
+    if (WSAPoll(fds, count, 0) > 0) {
+        upstreamHandlePoll(fds, count);
+    }
+}
+
+void upstreamTick(void) {
+    settleConnections();
+    uint64_t now = GetTickCount64();
+    for (int i = 0; i < UPSTREAM_TCP_MAX_CONNECTIONS; i++) {
+        UpstreamConnection* c = &connections[i];
+        if (c->state == UPSTREAM_FREE) continue;
+        if (c->state == UPSTREAM_CONNECTING && now - c->opened_at >= UPSTREAM_TCP_CONNECT_TIMEOUT) {
+            log_message(LOG_DEBUG, "Upstream TCP connect to %s:%d timed out", inet_ntoa(c->server.sin_addr), ntohs(c->server.sin_port));
+            connectionLost(c);
+            continue;
+        }
+        // 等不到应答的查询不再等待，ID映射随后也会过期
+        for (int j = c->pending_count - 1; j >= 0; j--) {
+            if (now - c->pending[j].sent_at >= UPSTREAM_TCP_QUERY_TIMEOUT) removePending(c, j);
+        }
+        if (c->state == UPSTREAM_OPEN && c->pending_count == 0 && c->out_len == 0 &&
+            now - c->last_active >= UPSTREAM_TCP_IDLE_TIMEOUT) {
+            log_message(LOG_DEBUG, "Upstream TCP %s:%d idle, closing", inet_ntoa(c->server.sin_addr), ntohs(c->server.sin_port));
+            releaseConnection(c);
+        }
+    }
+}
+
+void logUpstreamStats(void) {
+    int open = 0;
+    int pending = 0;
+    for (int i = 0; i < UPSTREAM_TCP_MAX_CONNECTIONS; i++) {
+        if (connections[i].state == UPSTREAM_FREE) continue;
+        open++;
+        pending += connections[i].pending_count;
+    }
+    log_message(LOG_DEBUG, "Upstream TCP: %d connections, %d pending, %u connects, %u sent, %u answered, "
+                "%u truncated retries, %u resent", open, pending, (unsigned)connects_total, (unsigned)sent_total,
+                (unsigned)answered_total, (unsigned)truncated_total, (unsigned)resent_total);
+}
+
+void closeUpstreamConnections(void) {
+    for (int i = 0; i < UPSTREAM_TCP_MAX_CONNECTIONS; i++) {
+        UpstreamConnection* c = &connections[i];
+        if (c->state == UPSTREAM_FREE) continue;
+        while (c->pending_count > 0) removePending(c, c->pending_count - 1);
+        releaseConnection(c);
+    }
+}
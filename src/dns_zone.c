@@ -0,0 +1,803 @@
+//本文件实现本地权威区：加载时把区文件编译为按名字索引的RRset，查询时直接拼出权威应答
+#include "dns_zone.h"
+#include "dns_hosts.h"
+#include "dns_reverse.h"
+#include "dns_pool.h"
+#include "uthash.h"
+#include <ctype.h>
+
+// 一个名字下同一类型的全部记录，每条记录按线上格式预编码为"类型+类+TTL+数据长度+数据"，不含所有者名
+typedef struct ZoneRRset {
+    uint16_t type;
+    uint16_t count;
+    uint8_t* data;
+    int length;
+    struct ZoneRRset* next;
+} ZoneRRset;
+
+// 区中的一个名字，没有记录的中间名字（空非终结点）也建节点，以便区分NODATA和NXDOMAIN
+typedef struct ZoneNode {
+    char* name;
+    ZoneRRset* rrsets;
+    UT_hash_handle hh;
+} ZoneNode;
+
+typedef struct Zone {
+    char* apex;
+    size_t apex_len;
+    ZoneNode* nodes;
+    uint8_t* negative_soa;         // 授权部分使用的SOA记录，TTL取SOA的TTL与MINIMUM中较小者
+    int negative_soa_length;
+    UT_hash_handle hh;
+} Zone;
+
+// 区文件解析状态
+typedef struct ZoneParser {
+    const char* path;
+    int line_no;
+    char origin[DNS_RR_NAME_MAX_SIZE + 1];
+    char owner[DNS_RR_NAME_MAX_SIZE + 1];   // 上一条记录的所有者，省略所有者时沿用
+    uint32_t default_ttl;
+    Zone* zone;
+} ZoneParser;
+
+// 拼应答时的输出缓冲区，记录已写入的名字用于压缩
+typedef struct ZoneReply {
+    uint8_t* data;                 // 取自缓冲区池，ZONE_REPLY_MAX字节
+    int len;
+    int limit;
+    int base;                      // data[0]在整个报文中的偏移
+    const char* names[ZONE_MAX_NAMES];
+    size_t name_lens[ZONE_MAX_NAMES];
+    int offsets[ZONE_MAX_NAMES];
+    int name_count;
+    uint16_t ancount;
+    uint16_t nscount;
+    uint16_t arcount;
+    int truncated;
+} ZoneReply;
+
+static Zone* g_zones = NULL;
+
+// --- 内部辅助函数 ---
+
+static ZoneNode* findNode(const Zone* zone, const char* name, size_t len) {
+    ZoneNode* node = NULL;
+    HASH_FIND(hh, zone->nodes, name, len, node);
+    return node;
+}
+
+static ZoneRRset* findRRset(const ZoneNode* node, uint16_t type) {
+    for (ZoneRRset* rrset = node->rrsets; rrset; rrset = rrset->next) {
+        if (rrset->type == type) return rrset;
+    }
+    return NULL;
+}
+
+// 从最长的后缀开始查找所属的区，代价与标签数成正比
+static Zone* findZone(const char* name, size_t len) {
+    for (size_t offset = 0; offset < len;) {
+        Zone* zone = NULL;
+        HASH_FIND(hh, g_zones, name + offset, len - offset, zone);
+        if (zone) return zone;
+        const char* dot = (const char*)memchr(name + offset, '.', len - offset);
+        if (!dot) break;
+        offset = (size_t)(dot - name) + 1;
+    }
+    return NULL;
+}
+
+static int inZone(const Zone* zone, const char* name, size_t len) {
+    if (len < zone->apex_len || memcmp(name + len - zone->apex_len, zone->apex, zone->apex_len) != 0) return 0;
+    return len == zone->apex_len || name[len - zone->apex_len - 1] == '.';
+}
+
+static ZoneNode* createNode(Zone* zone, const char* name, size_t len) {
+    ZoneNode* node = (ZoneNode*)calloc(1, sizeof(ZoneNode));
+    if (!node) return NULL;
+    node->name = (char*)malloc(len + 1);
+    if (!node->name) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->name, name, len);
+    node->name[len] = '\0';
+    HASH_ADD_KEYPTR(hh, zone->nodes, node->name, len, node);
+    return node;
+}
+
+// 取得名字对应的节点，不存在时连同它到区顶点之间的中间名字一起创建
+static ZoneNode* obtainNode(Zone* zone, const char* name, size_t len) {
+    ZoneNode* node = findNode(zone, name, len);
+    if (node) return node;
+    node = createNode(zone, name, len);
+    if (!node) return NULL;
+
+    const char* parent = name;
+    size_t parent_len = len;
+    while (parent_len > zone->apex_len) {
+        const char* dot = (const char*)memchr(parent, '.', parent_len);
+        if (!dot) break;
+        parent_len -= (size_t)(dot + 1 - parent);
+        parent = dot + 1;
+        if (findNode(zone, parent, parent_len)) break;
+        if (!createNode(zone, parent, parent_len)) return NULL;
+    }
+    return node;
+}
+
+static uint8_t* writeUint16(uint8_t* ptr, uint16_t value) {
+    ptr[0] = (uint8_t)(value >> 8);
+    ptr[1] = (uint8_t)value;
+    return ptr + 2;
+}
+
+static uint8_t* writeUint32(uint8_t* ptr, uint32_t value) {
+    ptr = writeUint16(ptr, (uint16_t)(value >> 16));
+    return writeUint16(ptr, (uint16_t)value);
+}
+
+// 不区分大小写比较，MSVC没有strcasecmp
+static int compareIgnoreCase(const char* a, const char* b) {
+    while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+        a++;
+        b++;
+    }
+    return tolower((unsigned char)*a) - tolower((unsigned char)*b);
+}
+
+static uint16_t readUint16(const uint8_t* ptr) {
+    return (uint16_t)((ptr[0] << 8) | ptr[1]);
+}
+
+// 把一条记录追加到RRset末尾；CNAME不能与其他类型共存
+static int addRecord(ZoneParser* parser, const char* owner, uint16_t type, uint32_t ttl,
+                     const uint8_t* rdata, size_t rdlength) {
+    Zone* zone = parser->zone;
+    size_t len = strlen(owner);
+    ZoneNode* node = obtainNode(zone, owner, len);
+    if (!node) return 0;
+
+    for (ZoneRRset* other = node->rrsets; other; other = other->next) {
+        if (other->type != type && (type == DNS_TYPE_CNAME || other->type == DNS_TYPE_CNAME)) {
+            log_message(LOG_ERROR, "Zone: %s:%d: CNAME cannot coexist with other data at %s",
+                        parser->path, parser->line_no, owner);
+            return 0;
+        }
+    }
+
+    ZoneRRset* rrset = findRRset(node, type);
+    if (!rrset) {
+        rrset = (ZoneRRset*)calloc(1, sizeof(ZoneRRset));
+        if (!rrset) return 0;
+        rrset->type = type;
+        ZoneRRset** tail = &node->rrsets;
+        while (*tail) tail = &(*tail)->next;
+        *tail = rrset;
+    }
+    if (type == DNS_TYPE_CNAME && rrset->count > 0) {
+        log_message(LOG_ERROR, "Zone: %s:%d: multiple CNAME records at %s", parser->path, parser->line_no, owner);
+        return 0;
+    }
+
+    uint8_t* data = (uint8_t*)realloc(rrset->data, (size_t)rrset->length + 10 + rdlength);
+    if (!data) return 0;
+    uint8_t* ptr = data + rrset->length;
+    ptr = writeUint16(ptr, type);
+    ptr = writeUint16(ptr, DNS_CLASS_IN);
+    ptr = writeUint32(ptr, ttl);
+    ptr = writeUint16(ptr, (uint16_t)rdlength);
+    memcpy(ptr, rdata, rdlength);
+    rrset->data = data;
+    rrset->length += (int)(10 + rdlength);
+    rrset->count++;
+    return 1;
+}
+
+static void freeZone(Zone* zone) {
+    ZoneNode* node;
+    ZoneNode* tmp;
+    HASH_ITER(hh, zone->nodes, node, tmp) {
+        HASH_DEL(zone->nodes, node);
+        ZoneRRset* rrset = node->rrsets;
+        while (rrset) {
+            ZoneRRset* next = rrset->next;
+            free(rrset->data);
+            free(rrset);
+            rrset = next;
+        }
+        free(node->name);
+        free(node);
+    }
+    free(zone->negative_soa);
+    free(zone->apex);
+    free(zone);
+}
+
+// --- 区文件解析 ---
+
+// 读入一条逻辑记录：去掉注释，括号内的换行合并为一行。返回0表示文件结束
+static int readRecord(FILE* file, ZoneParser* parser, char* record) {
+    char line[ZONE_RECORD_MAX];
+    size_t len = 0;
+    int depth = 0;
+    int started = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        parser->line_no++;
+        started = 1;
+        int quoted = 0;
+        for (char* p = line; *p && *p != '\n' && *p != '\r'; p++) {
+            char c = *p;
+            if (c == '\\' && p[1] && len + 2 < ZONE_RECORD_MAX) {
+                record[len++] = c;
+                record[len++] = *++p;
+                continue;
+            }
+            if (c == '"') quoted = !quoted;
+            if (!quoted) {
+                if (c == ';') break;
+                if (c == '(') { depth++; c = ' '; }
+                else if (c == ')') { depth--; c = ' '; }
+            }
+            if (len + 1 < ZONE_RECORD_MAX) record[len++] = c;
+        }
+        if (depth <= 0) break;
+        if (len + 1 < ZONE_RECORD_MAX) record[len++] = ' ';
+    }
+    record[len] = '\0';
+    return started;
+}
+
+// 按空白切分字段，引号内的字符串（可含空白）作为一个字段，返回字段数
+static int tokenize(char* record, char** tokens) {
+    int count = 0;
+    char* p = record;
+    while (*p && count < ZONE_MAX_TOKENS) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+        if (*p == '"') {
+            char* out = ++p;
+            tokens[count] = out;
+            while (*p && *p != '"') {
+                if (*p == '\\' && p[1]) p++;
+                *out++ = *p++;
+            }
+            if (*p) p++;
+            *out = '\0';
+        } else {
+            tokens[count] = p;
+            while (*p && *p != ' ' && *p != '\t') p++;
+            if (*p) *p++ = '\0';
+        }
+        count++;
+    }
+    return count;
+}
+
+// 解析TTL，支持"3600"和"1h30m"两种写法
+static int parseTtl(const char* text, uint32_t* ttl) {
+    uint64_t total = 0;
+    uint64_t value = 0;
+    int digits = 0;
+    for (const char* p = text; *p; p++) {
+        if (isdigit((unsigned char)*p)) {
+            value = value * 10 + (uint64_t)(*p - '0');
+            digits++;
+            if (value > 0xFFFFFFFFu) return 0;
+            continue;
+        }
+        if (!digits) return 0;
+        switch (tolower((unsigned char)*p)) {
+            case 's': break;
+            case 'm': value *= 60; break;
+            case 'h': value *= 3600; break;
+            case 'd': value *= 86400; break;
+            case 'w': value *= 604800; break;
+            default: return 0;
+        }
+        total += value;
+        value = 0;
+        digits = 0;
+    }
+    total += value;
+    if (total > 0x7FFFFFFFu || (!digits && total == 0 && !isdigit((unsigned char)text[0]))) return 0;
+    *ttl = (uint32_t)total;
+    return 1;
+}
+
+static int parseNumber(const char* text, uint32_t max, uint32_t* value) {
+    char* end;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (end == text || *end || parsed > max) return 0;
+    *value = (uint32_t)parsed;
+    return 1;
+}
+
+// 把区文件中的名字转为小写的完整域名（不带结尾的'.'）："@"为当前源点，不以'.'结尾的是相对名字
+static int resolveName(const ZoneParser* parser, const char* text, char* name) {
+    size_t len = strlen(text);
+    size_t origin_len = strlen(parser->origin);
+    if (strcmp(text, "@") == 0) {
+        if (origin_len == 0) return 0;
+        memcpy(name, parser->origin, origin_len + 1);
+        return 1;
+    }
+    if (len > 0 && text[len - 1] == '.') {
+        len--;
+    } else if (origin_len > 0) {
+        if (len + 1 + origin_len > DNS_RR_NAME_MAX_SIZE - 2) return 0;
+        for (size_t i = 0; i < len; i++) name[i] = (char)tolower((unsigned char)text[i]);
+        name[len] = '.';
+        memcpy(name + len + 1, parser->origin, origin_len + 1);
+        return 1;
+    }
+    if (len == 0 || len > DNS_RR_NAME_MAX_SIZE - 2) return 0;
+    for (size_t i = 0; i < len; i++) name[i] = (char)tolower((unsigned char)text[i]);
+    name[len] = '\0';
+    return 1;
+}
+
+// 把名字编码进记录数据，返回写入的字节数，失败返回0
+static size_t encodeName(const ZoneParser* parser, const char* text, uint8_t* rdata) {
+    char name[DNS_RR_NAME_MAX_SIZE + 1];
+    if (!resolveName(parser, text, name)) return 0;
+    return wireName(name, strlen(name), rdata);
+}
+
+// 按类型把数据字段编码为线上格式，返回数据长度，格式错误返回-1
+static int encodeRdata(const ZoneParser* parser, uint16_t type, char** fields, int count, uint8_t* rdata) {
+    size_t len = 0;
+    size_t used;
+    uint32_t value;
+
+    switch (type) {
+        case DNS_TYPE_A:
+            if (count != 1) return -1;
+            used = parseIPv4(fields[0], fields[0] + strlen(fields[0]), rdata);
+            return used == strlen(fields[0]) ? 4 : -1;
+        case DNS_TYPE_AAAA:
+            if (count != 1) return -1;
+            used = parseIPv6(fields[0], fields[0] + strlen(fields[0]), rdata);
+            return used == strlen(fields[0]) ? 16 : -1;
+        case DNS_TYPE_NS:
+        case DNS_TYPE_CNAME:
+        case DNS_TYPE_PTR:
+            if (count != 1) return -1;
+            used = encodeName(parser, fields[0], rdata);
+            return used ? (int)used : -1;
+        case DNS_TYPE_MX:
+            if (count != 2 || !parseNumber(fields[0], 0xFFFF, &value)) return -1;
+            writeUint16(rdata, (uint16_t)value);
+            used = encodeName(parser, fields[1], rdata + 2);
+            return used ? (int)(2 + used) : -1;
+        case DNS_TYPE_SRV:
+            if (count != 4) return -1;
+            for (int i = 0; i < 3; i++) {
+                if (!parseNumber(fields[i], 0xFFFF, &value)) return -1;
+                writeUint16(rdata + 2 * i, (uint16_t)value);
+            }
+            used = encodeName(parser, fields[3], rdata + 6);
+            return used ? (int)(6 + used) : -1;
+        case DNS_TYPE_TXT:
+            // 每个字段是一个<字符串>，长度前缀1字节
+            if (count < 1) return -1;
+            for (int i = 0; i < count; i++) {
+                size_t text_len = strlen(fields[i]);
+                if (text_len > 255 || len + 1 + text_len > ZONE_RDATA_MAX) return -1;
+                rdata[len++] = (uint8_t)text_len;
+                memcpy(rdata + len, fields[i], text_len);
+                len += text_len;
+            }
+            return (int)len;
+        case DNS_TYPE_SOA:
+            if (count != 7) return -1;
+            for (int i = 0; i < 2; i++) {
+                used = encodeName(parser, fields[i], rdata + len);
+                if (!used) return -1;
+                len += used;
+            }
+            // SERIAL为普通数字，其余四个时间字段可带单位
+            if (!parseNumber(fields[2], 0xFFFFFFFFu, &value)) return -1;
+            writeUint32(rdata + len, value);
+            len += 4;
+            for (int i = 3; i < 7; i++) {
+                if (!parseTtl(fields[i], &value)) return -1;
+                writeUint32(rdata + len, value);
+                len += 4;
+            }
+            return (int)len;
+        default:
+            return -1;
+    }
+}
+
+static uint16_t parseType(const char* text) {
+    static const struct { const char* name; uint16_t type; } types[] = {
+        { "A", DNS_TYPE_A }, { "NS", DNS_TYPE_NS }, { "CNAME", DNS_TYPE_CNAME }, { "SOA", DNS_TYPE_SOA },
+        { "PTR", DNS_TYPE_PTR }, { "MX", DNS_TYPE_MX }, { "TXT", DNS_TYPE_TXT }, { "AAAA", DNS_TYPE_AAAA },
+        { "SRV", DNS_TYPE_SRV },
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (compareIgnoreCase(text, types[i].name) == 0) return types[i].type;
+    }
+    return 0;
+}
+
+// 以SOA的所有者为顶点新建区，同时编码授权部分使用的SOA
+static int openZone(ZoneParser* parser, const char* apex, uint32_t ttl, const uint8_t* rdata, int rdlength) {
+    size_t apex_len = strlen(apex);
+    Zone* existing = NULL;
+    HASH_FIND(hh, g_zones, apex, apex_len, existing);
+    if (existing) {
+        log_message(LOG_ERROR, "Zone: %s: zone %s is already loaded", parser->path, apex);
+        return 0;
+    }
+
+    Zone* zone = (Zone*)calloc(1, sizeof(Zone));
+    if (!zone) return 0;
+    zone->apex = strdup(apex);
+    zone->apex_len = apex_len;
+    zone->negative_soa = (uint8_t*)malloc(10 + (size_t)rdlength);
+    if (!zone->apex || !zone->negative_soa) {
+        freeZone(zone);
+        return 0;
+    }
+
+    // 按RFC 2308，否定应答的缓存时间取SOA记录TTL与MINIMUM字段中较小的一个
+    uint32_t minimum = ((uint32_t)rdata[rdlength - 4] << 24) | ((uint32_t)rdata[rdlength - 3] << 16) |
+                       ((uint32_t)rdata[rdlength - 2] << 8) | rdata[rdlength - 1];
+    uint8_t* ptr = writeUint16(zone->negative_soa, DNS_TYPE_SOA);
+    ptr = writeUint16(ptr, DNS_CLASS_IN);
+    ptr = writeUint32(ptr, minimum < ttl ? minimum : ttl);
+    ptr = writeUint16(ptr, (uint16_t)rdlength);
+    memcpy(ptr, rdata, (size_t)rdlength);
+    zone->negative_soa_length = 10 + rdlength;
+    parser->zone = zone;
+    return 1;
+}
+
+// 解析一条逻辑记录，返回1表示加入了一条记录
+static int parseRecord(ZoneParser* parser, char* record) {
+    char* tokens[ZONE_MAX_TOKENS];
+    int blank_owner = record[0] == ' ' || record[0] == '\t';
+    int count = tokenize(record, tokens);
+    if (count == 0) return 0;
+
+    // 控制语句
+    if (tokens[0][0] == '$') {
+        if (compareIgnoreCase(tokens[0], "$ORIGIN") == 0 && count >= 2) {
+            char origin[DNS_RR_NAME_MAX_SIZE + 1];
+            if (resolveName(parser, tokens[1], origin)) {
+                strcpy(parser->origin, origin);
+                return 0;
+            }
+        } else if (compareIgnoreCase(tokens[0], "$TTL") == 0 && count >= 2 && parseTtl(tokens[1], &parser->default_ttl)) {
+            return 0;
+        }
+        log_message(LOG_ERROR, "Zone: %s:%d: unsupported directive %s", parser->path, parser->line_no, tokens[0]);
+        return 0;
+    }
+
+    int index = 0;
+    char owner[DNS_RR_NAME_MAX_SIZE + 1];
+    if (blank_owner) {
+        strcpy(owner, parser->owner);
+    } else if (!resolveName(parser, tokens[index++], owner)) {
+        log_message(LOG_ERROR, "Zone: %s:%d: invalid owner name", parser->path, parser->line_no);
+        return 0;
+    }
+    if (owner[0] == '\0') {
+        log_message(LOG_ERROR, "Zone: %s:%d: missing owner name", parser->path, parser->line_no);
+        return 0;
+    }
+    strcpy(parser->owner, owner);
+
+    // TTL和类可以按任意顺序出现在类型之前
+    uint32_t ttl = parser->default_ttl;
+    for (int i = 0; i < 2 && index < count; i++) {
+        if (compareIgnoreCase(tokens[index], "IN") == 0) {
+            index++;
+        } else if (isdigit((unsigned char)tokens[index][0]) && parseTtl(tokens[index], &ttl)) {
+            index++;
+        }
+    }
+    uint16_t type = index < count ? parseType(tokens[index]) : 0;
+    if (!type) {
+        log_message(LOG_ERROR, "Zone: %s:%d: unsupported record type %s", parser->path, parser->line_no,
+                    index < count ? tokens[index] : "(none)");
+        return 0;
+    }
+    index++;
+
+    uint8_t rdata[ZONE_RDATA_MAX];
+    int rdlength = encodeRdata(parser, type, tokens + index, count - index, rdata);
+    if (rdlength < 0) {
+        log_message(LOG_ERROR, "Zone: %s:%d: malformed %s record", parser->path, parser->line_no, tokens[index - 1]);
+        return 0;
+    }
+
+    if (!parser->zone) {
+        if (type != DNS_TYPE_SOA) {
+            log_message(LOG_ERROR, "Zone: %s:%d: the first record must be SOA", parser->path, parser->line_no);
+            return 0;
+        }
+        if (!openZone(parser, owner, ttl, rdata, rdlength)) return 0;
+    } else if (type == DNS_TYPE_SOA) {
+        log_message(LOG_ERROR, "Zone: %s:%d: duplicate SOA record ignored", parser->path, parser->line_no);
+        return 0;
+    }
+    if (!inZone(parser->zone, owner, strlen(owner))) {
+        log_message(LOG_ERROR, "Zone: %s:%d: %s is outside zone %s", parser->path, parser->line_no, owner,
+                    parser->zone->apex);
+        return 0;
+    }
+    return addRecord(parser, owner, type, ttl, rdata, (size_t)rdlength);
+}
+
+// --- 拼应答 ---
+
+// 写入名字，能压缩时用指向已写名字的指针。空间不足返回0
+static int writeName(ZoneReply* reply, const char* name, size_t len) {
+    size_t start = 0;
+    int pointer = -1;
+    while (start < len && pointer < 0) {
+        size_t suffix_len = len - start;
+        for (int i = 0; i < reply->name_count && pointer < 0; i++) {
+            size_t known_len = reply->name_lens[i];
+            if (known_len < suffix_len || memcmp(reply->names[i] + known_len - suffix_len, name + start, suffix_len) != 0) {
+                continue;
+            }
+            if (known_len == suffix_len || reply->names[i][known_len - suffix_len - 1] == '.') {
+                pointer = reply->offsets[i] + (int)(known_len - suffix_len);
+            }
+        }
+        if (pointer >= 0) break;
+        const char* dot = (const char*)memchr(name + start, '.', suffix_len);
+        start = dot ? (size_t)(dot - name) + 1 : len;
+    }
+
+    // 前start个字符按标签原样写出，其余部分用指针
+    size_t need = start + (pointer >= 0 ? 2 : 1) + 1;
+    if (reply->len + (int)need > reply->limit) return 0;
+    int offset = reply->base + reply->len;
+    uint8_t* ptr = reply->data + reply->len;
+    size_t label = 0;
+    while (label < start) {
+        const char* dot = (const char*)memchr(name + label, '.', start - label);
+        size_t label_len = dot ? (size_t)(dot - name) - label : start - label;
+        *ptr++ = (uint8_t)label_len;
+        memcpy(ptr, name + label, label_len);
+        ptr += label_len;
+        label += label_len + 1;
+    }
+    if (pointer >= 0) {
+        ptr = writeUint16(ptr, (uint16_t)(0xC000 | pointer));
+    } else {
+        *ptr++ = 0;
+    }
+    reply->len = (int)(ptr - reply->data);
+
+    if (start > 0 && reply->name_count < ZONE_MAX_NAMES) {
+        reply->names[reply->name_count] = name;
+        reply->name_lens[reply->name_count] = len;
+        reply->offsets[reply->name_count] = offset;
+        reply->name_count++;
+    }
+    return 1;
+}
+
+// 以owner为所有者名追加一段预编码记录；放不下时整段撤销并返回0
+static int appendRecords(ZoneReply* reply, const char* owner, size_t owner_len, const uint8_t* data, int length,
+                         uint16_t* counter) {
+    int saved_len = reply->len;
+    int saved_names = reply->name_count;
+    uint16_t added = 0;
+    for (int pos = 0; pos < length; added++) {
+        int record_len = 10 + readUint16(data + pos + 8);
+        if (!writeName(reply, owner, owner_len) || reply->len + record_len > reply->limit) {
+            reply->len = saved_len;
+            reply->name_count = saved_names;
+            return 0;
+        }
+        memcpy(reply->data + reply->len, data + pos, (size_t)record_len);
+        reply->len += record_len;
+        pos += record_len;
+    }
+    *counter = (uint16_t)(*counter + added);
+    return 1;
+}
+
+// 回答部分放不下时置TC
+static void appendAnswer(ZoneReply* reply, const char* owner, size_t owner_len, const ZoneRRset* rrset) {
+    if (reply->truncated) return;
+    if (!appendRecords(reply, owner, owner_len, rrset->data, rrset->length, &reply->ancount)) {
+        reply->truncated = 1;
+    }
+}
+
+// 取出NS/CNAME/MX/SRV记录数据中目标名字的点分形式，其他类型返回0
+static int rdataTarget(uint16_t type, const uint8_t* record, char* name) {
+    const uint8_t* rdata = record + 10;
+    if (type == DNS_TYPE_MX) rdata += 2;
+    else if (type == DNS_TYPE_SRV) rdata += 6;
+    else if (type != DNS_TYPE_NS && type != DNS_TYPE_CNAME) return 0;
+
+    size_t len = 0;
+    while (*rdata) {
+        if (len > 0) name[len++] = '.';
+        memcpy(name + len, rdata + 1, *rdata);
+        len += *rdata;
+        rdata += *rdata + 1;
+    }
+    name[len] = '\0';
+    return (int)len;
+}
+
+// 附加部分：回答中NS/MX/SRV的目标若在本地区中，附上其A和AAAA记录，放不下时直接省略
+static void appendAdditional(ZoneReply* reply, const ZoneRRset* rrset) {
+    for (int pos = 0; pos < rrset->length; pos += 10 + readUint16(rrset->data + pos + 8)) {
+        char target[DNS_RR_NAME_MAX_SIZE + 1];
+        int len = rdataTarget(rrset->type, rrset->data + pos, target);
+        if (len <= 0) return;
+
+        Zone* zone = findZone(target, (size_t)len);
+        ZoneNode* node = zone ? findNode(zone, target, (size_t)len) : NULL;
+        if (!node) continue;
+        static const uint16_t types[] = { DNS_TYPE_A, DNS_TYPE_AAAA };
+        for (int i = 0; i < 2; i++) {
+            ZoneRRset* address = findRRset(node, types[i]);
+            if (address && !appendRecords(reply, node->name, (size_t)len, address->data, address->length,
+                                          &reply->arcount)) {
+                return;
+            }
+        }
+    }
+}
+
+// CNAME链的最新目标是否已在链中出现过
+static int chainLoops(const char* qname, char targets[][DNS_RR_NAME_MAX_SIZE + 1], int step) {
+    if (strcmp(targets[step], qname) == 0) return 1;
+    for (int i = 0; i < step; i++) {
+        if (strcmp(targets[step], targets[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// --- 公开接口实现 ---
+
+int loadZoneFile(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+
+    ZoneParser parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.path = path;
+    parser.default_ttl = ZONE_DEFAULT_TTL;
+
+    char* record = (char*)malloc(ZONE_RECORD_MAX);
+    int loaded = 0;
+    while (record && readRecord(file, &parser, record)) {
+        loaded += parseRecord(&parser, record);
+    }
+    free(record);
+    fclose(file);
+
+    if (!parser.zone) {
+        log_message(LOG_ERROR, "Zone: %s has no valid SOA record", path);
+        return 0;
+    }
+    HASH_ADD_KEYPTR(hh, g_zones, parser.zone->apex, parser.zone->apex_len, parser.zone);
+    return loaded;
+}
+
+int zoneAnswer(const uint8_t* query, const dns_question_view* question, uint8_t* reply, int limit) {
+    if (!g_zones) return 0;
+
+    char qname[DNS_RR_NAME_MAX_SIZE + 1];
+    size_t qlen = question->nameLength;
+    for (size_t i = 0; i <= qlen; i++) qname[i] = (char)tolower((unsigned char)question->QNAME[i]);
+
+    Zone* zone = findZone(qname, qlen);
+    if (!zone) return 0;
+
+    ZoneReply out;
+    out.data = poolAcquire();
+    if (!out.data) return 0;
+    out.len = 0;
+    out.base = question->end;
+    if (limit > ZONE_REPLY_MAX) limit = ZONE_REPLY_MAX;
+    out.limit = limit - question->end;
+    out.names[0] = qname;
+    out.name_lens[0] = qlen;
+    out.offsets[0] = 12;
+    out.name_count = 1;
+    out.ancount = out.nscount = out.arcount = 0;
+    out.truncated = 0;
+
+    uint8_t rcode = DNS_RCODE_OK;
+    const char* name = qname;
+    size_t len = qlen;
+    char targets[ZONE_MAX_CNAME + 1][DNS_RR_NAME_MAX_SIZE + 1];  // CNAME目标，写入应答后仍被压缩表引用
+    const ZoneRRset* answered[8];
+    int answered_count = 0;
+    int negative = 0;
+
+    for (int step = 0; step <= ZONE_MAX_CNAME; step++) {
+        ZoneNode* node = findNode(zone, name, len);
+        if (!node) {
+            // 找到最近的存在的祖先，再看它下面有没有"*"通配节点
+            const char* parent = name;
+            size_t parent_len = len;
+            while (!node && parent_len > zone->apex_len) {
+                const char* dot = (const char*)memchr(parent, '.', parent_len);
+                parent_len -= (size_t)(dot + 1 - parent);
+                parent = dot + 1;
+                if (!findNode(zone, parent, parent_len)) continue;
+                char wildcard[DNS_RR_NAME_MAX_SIZE + 3];
+                wildcard[0] = '*';
+                wildcard[1] = '.';
+                memcpy(wildcard + 2, parent, parent_len);
+                node = findNode(zone, wildcard, parent_len + 2);
+                if (!node) break;
+            }
+        }
+        if (!node) {
+            rcode = DNS_RCODE_NXDOMAIN;
+            negative = 1;
+            break;
+        }
+
+        if (question->QTYPE == DNS_TYPE_ANY) {
+            for (ZoneRRset* rrset = node->rrsets; rrset; rrset = rrset->next) {
+                appendAnswer(&out, name, len, rrset);
+            }
+            negative = node->rrsets == NULL;
+            break;
+        }
+        ZoneRRset* rrset = findRRset(node, question->QTYPE);
+        if (rrset) {
+            appendAnswer(&out, name, len, rrset);
+            if (answered_count < 8) answered[answered_count++] = rrset;
+            break;
+        }
+
+        // 区内CNAME继续跟随；目标不在本地区中时只返回CNAME，由客户端继续解析
+        ZoneRRset* cname = findRRset(node, DNS_TYPE_CNAME);
+        if (!cname) {
+            negative = 1;
+            break;
+        }
+        appendAnswer(&out, name, len, cname);
+        len = (size_t)rdataTarget(DNS_TYPE_CNAME, cname->data, targets[step]);
+        name = targets[step];
+        zone = findZone(name, len);
+        if (!zone || step == ZONE_MAX_CNAME || chainLoops(qname, targets, step)) break;
+    }
+
+    // 否定应答在授权部分附带区的SOA，所有者为区顶点
+    if (negative && !out.truncated) {
+        appendRecords(&out, zone->apex, zone->apex_len, zone->negative_soa, zone->negative_soa_length, &out.nscount);
+    }
+    for (int i = 0; i < answered_count && !out.truncated; i++) {
+        appendAdditional(&out, answered[i]);
+    }
+
+    int length = composeReply(query, question, rcode, out.data, out.len, out.ancount, out.nscount, out.arcount, reply);
+    if (out.truncated) reply[2] |= (uint8_t)(TC_MASK >> 8);
+    poolRelease(out.data);
+    return length;
+}
+
+int zoneCount(void) {
+    return (int)HASH_COUNT(g_zones);
+}
+
+void destroyZones(void) {
+    Zone* zone;
+    Zone* tmp;
+    HASH_ITER(hh, g_zones, zone, tmp) {
+        HASH_DEL(g_zones, zone);
+        freeZone(zone);
+    }
+}
@@ -1,104 +1,1154 @@
+// 中继的行为测试：向各个中继实例发查询并检查应答，再用计数查询核对test-server.c的替身服务器实际收到了哪些查询
+// 编译: cmake --build <构建目录> --target test-client，或 gcc -std=c99 test-client.c -lws2_32 -o test-client
+// 用法: test-client [测试名 ...]，不带参数时运行全部测试（upgrade除外），全部通过时返回0；
+// 中继实例的启动命令见README的"行为测试"一节
+#define _WINSOCK_DEPRECATED_NO_WARNINGS // 允许使用旧的 inet_ntoa 函数
+#define _CRT_SECURE_NO_WARNINGS // 允许使用 sprintf 等函数而不显示安全警告
+
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <time.h>
 #include <winsock2.h>
-#include <ws2tcpip.h> // 包含 inet_pton
+#include <ws2tcpip.h> // 包含 inet_pton, inet_ntop
 
 #pragma comment(lib, "ws2_32.lib") // 告知编译器链接 ws2_32.lib 库
 
-#define PORT 8080
-#define SERVER_IP "127.0.0.1" // 服务器 IP 地址
-#define BUFFER_SIZE 1024
+#define DNS_PORT 53
+#define UPSTREAM_PORT 5358
+#define HIERARCHY_PORT 5399
+#define UPGRADE_PORT 5300        // 热升级的交接端口，由最先启动的实例监听
+#define BUFFER_SIZE 4096
+#define NAME_SIZE 256
+#define MAX_RECORDS 64
+#define QUERY_TIMEOUT 2000       // 等待应答的毫秒数
+#define HOST_ANSWER_TTL 120      // hosts应答的TTL
+#define BLOCK_TTL_DEFAULT 300    // 拦截应答默认的TTL（-n）
+#define BLOCK_TTL_IMAGE 60       // RELAY_IMAGE以-n 60启动
+#define RELAY_UDP_SIZE 1232      // 中继默认通告的UDP载荷大小（-e）
+#define BIG_RECORD_COUNT 20      // 替身上游对big.开头的名字回答的A记录数，与test-server.c一致
+#define CONNECTION_COUNTER "connections.tcp" // 替身上游记录接受的TCP连接数的计数名
 
-int main() {
-    WSADATA wsaData; // Winsock 初始化数据结构
-    SOCKET client_socket; // 客户端 Socket
-    struct sockaddr_in server_addr; // 服务器地址结构
-    char buffer[BUFFER_SIZE] = {0};
-    char input[BUFFER_SIZE] = {0};
+// 各中继实例的监听地址
+#define RELAY_UPGRADE "127.0.0.29"   // 单独启动，独占交接端口；upgrade测试以-u启动新进程接管它
+#define UPGRADE_COMMAND "dns_relay -a 127.0.0.29 -s 127.0.0.8:5358 -u"
+#define RELAY_MAIN "127.0.0.20"      // 大多数测试使用的实例，加载tests/下的各个数据文件
+#define RELAY_FLATTEN "127.0.0.21"   // -F
+#define RELAY_RECURSIVE "127.0.0.22" // -H tests/root.hints
+#define RELAY_FAILOVER "127.0.0.23"  // 默认组的第一个上游不应答，按RTT选择
+#define RELAY_HASH "127.0.0.24"      // 默认组的第一个上游不应答，一致性哈希选择
+#define RELAY_IMAGE "127.0.0.25"     // 加载tests/hosts.txt编译成的镜像，-b sinkhole -n 60
+#define RELAY_RELOAD "127.0.0.26"    // -p tests/reload.txt
+#define RELAY_BLOCKLIST "127.0.0.27" // 加载仓库根目录的hosts.txt
+#define RELAY_UPSTREAM_TCP "127.0.0.28" // -t
+static const char* peers[] = { "127.0.0.31", "127.0.0.32", "127.0.0.33" };
 
-    // 1. 初始化 Winsock
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        fprintf(stderr, "WSAStartup failed. Error Code : %d\n", WSAGetLastError());
-        return 1;
+// 替身服务器的地址
+#define SILENT_RULE "127.0.0.6"      // tests/forward.txt中silent.test的上游，不应答
+#define SILENT_DEFAULT "127.0.0.7"   // 故障切换测试中默认组的第一个上游，不应答
+#define UPSTREAM_PRIMARY "127.0.0.8"
+#define UPSTREAM_SECONDARY "127.0.0.9"
+#define EXAMPLE_AUTH "127.0.0.12"
+
+#define RELOAD_FILE "tests/reload.txt"
+
+#define TYPE_A 1
+#define TYPE_NS 2
+#define TYPE_CNAME 5
+#define TYPE_SOA 6
+#define TYPE_PTR 12
+#define TYPE_MX 15
+#define TYPE_TXT 16
+#define TYPE_AAAA 28
+#define TYPE_OPT 41
+#define CLASS_IN 1
+#define CLASS_CH 3
+
+#define RCODE_OK 0
+#define RCODE_SERVFAIL 2
+#define RCODE_NXDOMAIN 3
+
+enum { SECTION_ANSWER, SECTION_AUTHORITY, SECTION_ADDITIONAL };
+
+// 应答中的一条记录，data是文本形式：A和AAAA为地址，NS、CNAME、PTR和SOA为（主服务器）域名，
+// MX为"优先级 域名"，TXT为第一个字符串；OPT记录的rrclass是通告的UDP载荷大小
+typedef struct Record {
+    char name[NAME_SIZE];
+    uint16_t type;
+    uint16_t rrclass;
+    uint32_t ttl;
+    uint32_t minimum;            // SOA的MINIMUM字段
+    char data[NAME_SIZE];
+} Record;
+
+typedef struct Reply {
+    uint16_t id;
+    int rcode;
+    int aa;
+    int tc;
+    int length;                  // 报文长度
+    int count[3];
+    Record records[3][MAX_RECORDS];
+} Reply;
+
+typedef struct Test {
+    const char* name;
+    void (*run)(void);
+    int explicit_only;           // 只在命令行列出时运行
+} Test;
+
+static char tag[16];             // 本次运行的名字标签，重复运行时不会命中上一次留在中继缓存中的名字
+static int passed = 0;
+static int failed = 0;
+
+// --- 报文 ---
+
+static uint16_t get16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+static int buildQuery(uint8_t* buffer, uint16_t id, const char* name, uint16_t qtype, uint16_t qclass) {
+    memset(buffer, 0, 12);
+    buffer[0] = (uint8_t)(id >> 8);
+    buffer[1] = (uint8_t)id;
+    buffer[2] = 0x01; // RD
+    buffer[5] = 1;
+    uint8_t* p = buffer + 12;
+    while (*name) {
+        const char* dot = strchr(name, '.');
+        size_t len = dot ? (size_t)(dot - name) : strlen(name);
+        *p++ = (uint8_t)len;
+        memcpy(p, name, len);
+        p += len;
+        name += dot ? len + 1 : len;
     }
-    printf("Winsock initialized.\n");
+    *p++ = 0;
+    *p++ = (uint8_t)(qtype >> 8);
+    *p++ = (uint8_t)qtype;
+    *p++ = (uint8_t)(qclass >> 8);
+    *p++ = (uint8_t)qclass;
+    return (int)(p - buffer);
+}
 
-    // 2. 创建 Socket
-    if ((client_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET) {
-        fprintf(stderr, "Could not create socket. Error Code : %d\n", WSAGetLastError());
-        WSACleanup(); // 创建失败，清理 Winsock
-        return 1;
+// 在查询末尾追加一条通告payload字节UDP载荷的OPT记录，返回新的长度
+static int addOpt(uint8_t* buffer, int len, uint16_t payload) {
+    uint8_t* p = buffer + len;
+    *p++ = 0;                    // 根域名
+    *p++ = 0;
+    *p++ = TYPE_OPT;
+    *p++ = (uint8_t)(payload >> 8);
+    *p++ = (uint8_t)payload;
+    memset(p, 0, 6);             // 扩展RCODE、版本、标志和RDLENGTH
+    buffer[11] = 1;              // ARCOUNT
+    return len + 11;
+}
+
+// 读出pos处的（可能压缩的）域名，成功时pos移到名字之后
+static int readName(const uint8_t* msg, int len, int* pos, char* name) {
+    int at = *pos, jumps = 0, end = -1;
+    size_t name_len = 0;
+    while (at < len && msg[at] != 0) {
+        if ((msg[at] & 0xC0) == 0xC0) {
+            if (at + 1 >= len || ++jumps > 16) return 0;
+            if (end < 0) end = at + 2;
+            at = ((msg[at] & 0x3F) << 8) | msg[at + 1];
+            continue;
+        }
+        int label = msg[at++];
+        if (at + label > len || name_len + label + 1 >= NAME_SIZE) return 0;
+        if (name_len > 0) name[name_len++] = '.';
+        memcpy(name + name_len, msg + at, label);
+        name_len += label;
+        at += label;
+    }
+    if (at >= len) return 0;
+    name[name_len] = '\0';
+    *pos = end >= 0 ? end : at + 1;
+    return 1;
+}
+
+static int parseReply(const uint8_t* msg, int len, Reply* reply) {
+    memset(reply, 0, sizeof(*reply));
+    if (len < 12) return 0;
+    reply->id = get16(msg);
+    reply->rcode = msg[3] & 0x0F;
+    reply->aa = (msg[2] & 0x04) != 0;
+    reply->tc = (msg[2] & 0x02) != 0;
+    reply->length = len;
+    int pos = 12;
+    char name[NAME_SIZE];
+    for (int q = get16(msg + 4); q > 0; q--) {
+        if (!readName(msg, len, &pos, name)) return 0;
+        pos += 4;
+    }
+    for (int section = 0; section < 3; section++) {
+        int count = get16(msg + 6 + section * 2);
+        for (int i = 0; i < count; i++) {
+            Record rr;
+            if (!readName(msg, len, &pos, rr.name) || pos + 10 > len) return 0;
+            rr.type = get16(msg + pos);
+            rr.rrclass = get16(msg + pos + 2);
+            rr.ttl = get32(msg + pos + 4);
+            rr.minimum = 0;
+            int rdlen = get16(msg + pos + 8);
+            int rdata = pos + 10;
+            pos = rdata + rdlen;
+            if (pos > len) return 0;
+            rr.data[0] = '\0';
+            int at = rdata;
+            if (rr.type == TYPE_A && rdlen == 4) {
+                inet_ntop(AF_INET, (void*)(msg + at), rr.data, sizeof(rr.data));
+            } else if (rr.type == TYPE_AAAA && rdlen == 16) {
+                inet_ntop(AF_INET6, (void*)(msg + at), rr.data, sizeof(rr.data));
+            } else if (rr.type == TYPE_NS || rr.type == TYPE_CNAME || rr.type == TYPE_PTR) {
+                if (!readName(msg, len, &at, rr.data)) return 0;
+            } else if (rr.type == TYPE_SOA) {
+                if (!readName(msg, len, &at, rr.data) || !readName(msg, len, &at, name) || at + 20 > pos) return 0;
+                rr.minimum = get32(msg + at + 16);
+            } else if (rr.type == TYPE_MX) {
+                at += 2;
+                if (!readName(msg, len, &at, name)) return 0;
+                snprintf(rr.data, sizeof(rr.data), "%d %s", get16(msg + rdata), name);
+            } else if (rr.type == TYPE_TXT && rdlen > 0 && msg[at] < rdlen) {
+                memcpy(rr.data, msg + at + 1, msg[at]);
+                rr.data[msg[at]] = '\0';
+            }
+            if (reply->count[section] < MAX_RECORDS) reply->records[section][reply->count[section]++] = rr;
+        }
     }
-    printf("Client socket created.\n");
+    return 1;
+}
 
-    // 3. 配置服务器地址结构
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(PORT); // 端口号，网络字节序
+// --- 收发 ---
 
-    // 4. 将字符串 IP 转换为网络字节序的二进制形式 (推荐使用 inet_pton)
-    if (inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr) <= 0) {
-        fprintf(stderr, "Invalid address/Address not supported. Error Code: %d\n", WSAGetLastError());
-        closesocket(client_socket);
-        WSACleanup();
-        return 1;
+static void setAddress(struct sockaddr_in* address, const char* ip, int port) {
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port = htons((u_short)port);
+    inet_pton(AF_INET, ip, &address->sin_addr);
+}
+
+// 等待socket可读，超时返回0
+static int waitReadable(SOCKET sock, int timeout_ms) {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    return select((int)sock + 1, &readable, NULL, NULL, &tv) > 0;
+}
+
+// 从新的UDP socket发出查询，返回这个socket供awaitReply等待应答
+static SOCKET sendQuery(const char* ip, int port, const uint8_t* query, int len) {
+    struct sockaddr_in address;
+    setAddress(&address, ip, port);
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock != INVALID_SOCKET) sendto(sock, (const char*)query, len, 0, (struct sockaddr*)&address, sizeof(address));
+    return sock;
+}
+
+// 等待ID相同的应答；timeout_ms内没有应答时返回0
+static int awaitReply(SOCKET sock, uint16_t id, Reply* reply, int timeout_ms) {
+    uint8_t buffer[BUFFER_SIZE];
+    int got = 0;
+    while (!got && waitReadable(sock, timeout_ms)) {
+        int reply_len = recv(sock, (char*)buffer, sizeof(buffer), 0);
+        if (reply_len <= 0) break;
+        got = get16(buffer) == id && parseReply(buffer, reply_len, reply);
     }
-    printf("Server address set to %s:%d\n", SERVER_IP, PORT);
+    return got;
+}
 
-    // 5. 连接到服务器
-    if (connect(client_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
-        fprintf(stderr, "Connection failed with error code : %d\n", WSAGetLastError());
-        closesocket(client_socket);
-        WSACleanup();
-        return 1;
+// 经UDP发出查询并等待应答
+static int exchange(const char* ip, int port, const char* name, uint16_t qtype, uint16_t qclass, Reply* reply,
+                    int timeout_ms) {
+    uint8_t query[BUFFER_SIZE];
+    uint16_t id = (uint16_t)rand();
+    int len = buildQuery(query, id, name, qtype, qclass);
+    SOCKET sock = sendQuery(ip, port, query, len);
+    if (sock == INVALID_SOCKET) return 0;
+    int got = awaitReply(sock, id, reply, timeout_ms);
+    closesocket(sock);
+    return got;
+}
+
+static int ask(const char* relay, const char* name, uint16_t qtype, Reply* reply) {
+    return exchange(relay, DNS_PORT, name, qtype, CLASS_IN, reply, QUERY_TIMEOUT);
+}
+
+// 带OPT记录向中继发出查询，通告payload字节的UDP载荷
+static int askEdns(const char* relay, const char* name, uint16_t qtype, uint16_t payload, Reply* reply) {
+    uint8_t query[BUFFER_SIZE];
+    uint16_t id = (uint16_t)rand();
+    int len = addOpt(query, buildQuery(query, id, name, qtype, CLASS_IN), payload);
+    SOCKET sock = sendQuery(relay, DNS_PORT, query, len);
+    if (sock == INVALID_SOCKET) return 0;
+    int got = awaitReply(sock, id, reply, QUERY_TIMEOUT);
+    closesocket(sock);
+    return got;
+}
+
+// 替身服务器收到的该名字的查询数，取不到时返回-1
+static int served(const char* server, int port, const char* name) {
+    Reply reply;
+    if (!exchange(server, port, name, TYPE_TXT, CLASS_CH, &reply, QUERY_TIMEOUT) || reply.count[0] != 1) return -1;
+    return atoi(reply.records[SECTION_ANSWER][0].data);
+}
+
+static int upstreamServed(const char* server, const char* name) {
+    return served(server, UPSTREAM_PORT, name);
+}
+
+// --- 检查 ---
+
+static void check(int ok, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    printf("  [%s] ", ok ? "PASS" : "FAIL");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+    if (ok) {
+        passed++;
+    } else {
+        failed++;
+    }
+}
+
+// 域名比较不区分大小写，MSVC没有strcasecmp
+static int sameName(const char* a, const char* b) {
+    while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+        a++;
+        b++;
     }
-    printf("Connected to server.\n");
-
-    // 6. 循环发送和接收数据，直到用户选择退出
-    printf("Chat started (type 'exit' to quit)...\n");
-    
-    while (1) {
-        // 获取用户输入
-        printf("Enter message: ");
-        fgets(input, BUFFER_SIZE, stdin);
-        
-        // 移除换行符
-        input[strcspn(input, "\n")] = 0;
-        
-        // 检查是否退出
-        if (strcmp(input, "exit") == 0) {
-            printf("Exiting...\n");
-            break;
+    return tolower((unsigned char)*a) == tolower((unsigned char)*b);
+}
+
+// 某一部分中有没有这条记录，name为NULL时不比较所有者，data为NULL时不比较数据
+static int hasRecord(const Reply* reply, int section, const char* name, uint16_t type, const char* data) {
+    for (int i = 0; i < reply->count[section]; i++) {
+        const Record* rr = &reply->records[section][i];
+        if (rr->type == type && (!name || sameName(rr->name, name)) && (!data || strcmp(rr->data, data) == 0)) {
+            return 1;
         }
-        
-        // 发送数据
-        if (send(client_socket, input, strlen(input), 0) == SOCKET_ERROR) {
-            fprintf(stderr, "Send failed with error code : %d\n", WSAGetLastError());
-            break;
+    }
+    return 0;
+}
+
+static int countType(const Reply* reply, int section, uint16_t type) {
+    int count = 0;
+    for (int i = 0; i < reply->count[section]; i++) {
+        if (reply->records[section][i].type == type) count++;
+    }
+    return count;
+}
+
+// 拦截应答：NXDOMAIN，或者（sinkhole方式）回答0.0.0.0
+static int isBlocked(const Reply* reply) {
+    return reply->rcode == RCODE_NXDOMAIN || hasRecord(reply, SECTION_ANSWER, NULL, TYPE_A, "0.0.0.0");
+}
+
+// 两个应答的回答部分是同一组记录
+static int sameAnswers(const Reply* a, const Reply* b) {
+    if (a->rcode != b->rcode || a->count[SECTION_ANSWER] != b->count[SECTION_ANSWER]) return 0;
+    for (int i = 0; i < a->count[SECTION_ANSWER]; i++) {
+        const Record* rr = &a->records[SECTION_ANSWER][i];
+        if (!hasRecord(b, SECTION_ANSWER, rr->name, rr->type, rr->data)) return 0;
+    }
+    return 1;
+}
+
+// 反复查询名字，直到应答中有（present为1）或没有（present为0）这个hosts地址，最多等待5秒
+static int waitForHost(const char* relay, const char* name, const char* address, int present) {
+    for (int i = 0; i < 50; i++) {
+        Reply r;
+        if (ask(relay, name, TYPE_A, &r) && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, address) == present) return 1;
+        Sleep(100);
+    }
+    return 0;
+}
+
+// --- 测试 ---
+
+// 以错误的密钥连接交接端口：实例应当不交出socket，直接关闭连接
+static int refusedHandoff(void) {
+    struct sockaddr_in address;
+    setAddress(&address, "127.0.0.1", UPGRADE_PORT);
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET) return 0;
+    if (connect(sock, (struct sockaddr*)&address, sizeof(address)) == SOCKET_ERROR) {
+        closesocket(sock);
+        return 0;
+    }
+    uint8_t request[4 + 4 + 16] = { 'D', 'N', 'S', 'U' }; // 魔数、进程号和16字节全为0的密钥
+    uint32_t pid = htonl((uint32_t)GetCurrentProcessId());
+    memcpy(request + 4, &pid, 4);
+    send(sock, (const char*)request, sizeof(request), 0);
+    char byte;
+    int closed = waitReadable(sock, QUERY_TIMEOUT) && recv(sock, &byte, 1, 0) <= 0;
+    closesocket(sock);
+    return closed;
+}
+
+// 热升级：以-u启动新进程接管RELAY_UPGRADE，交接期间的查询都有应答，交接时还在等上游的查询照样得到应答，
+// 缓存随socket一起交给新进程
+static void testUpgrade(void) {
+    char name[NAME_SIZE], cached[NAME_SIZE], slow[NAME_SIZE];
+    Reply r;
+    snprintf(cached, sizeof(cached), "c.%s.upgrade.test", tag);
+    int ok = ask(RELAY_UPGRADE, cached, TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, cached, TYPE_A, "192.0.2.1"), "%s: answered before the upgrade", cached);
+
+    // 替身上游推迟1.5秒才回答slow.开头的名字，交接时这个查询还没有结果
+    uint8_t query[BUFFER_SIZE];
+    uint16_t slow_id = (uint16_t)rand();
+    snprintf(slow, sizeof(slow), "slow.%s.upgrade.test", tag);
+    SOCKET slow_sock = sendQuery(RELAY_UPGRADE, DNS_PORT, query, buildQuery(query, slow_id, slow, TYPE_A, CLASS_IN));
+
+    STARTUPINFOA startup;
+    PROCESS_INFORMATION process;
+    memset(&startup, 0, sizeof(startup));
+    startup.cb = sizeof(startup);
+    char command[] = UPGRADE_COMMAND;
+    if (!CreateProcessA(NULL, command, NULL, NULL, FALSE, CREATE_NEW_CONSOLE, NULL, NULL, &startup, &process)) {
+        check(0, "start %s", UPGRADE_COMMAND);
+        closesocket(slow_sock);
+        return;
+    }
+
+    int answered = 0;
+    for (int i = 0; i < 40; i++) {
+        snprintf(name, sizeof(name), "q%d.%s.upgrade.test", i, tag);
+        ok = exchange(RELAY_UPGRADE, DNS_PORT, name, TYPE_A, CLASS_IN, &r, 1000);
+        if (!ok) ok = ask(RELAY_UPGRADE, name, TYPE_A, &r); // 客户端重试
+        answered += ok && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1");
+        Sleep(100);
+    }
+    check(answered == 40, "%d/40 answered while the new process takes over", answered);
+
+    ok = slow_sock != INVALID_SOCKET && awaitReply(slow_sock, slow_id, &r, QUERY_TIMEOUT);
+    if (slow_sock != INVALID_SOCKET) closesocket(slow_sock);
+    check(ok && hasRecord(&r, SECTION_ANSWER, slow, TYPE_A, "192.0.2.1"), "%s: in-flight query answered across the handoff",
+          slow);
+
+    ok = ask(RELAY_UPGRADE, cached, TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, cached, TYPE_A, "192.0.2.1") &&
+          upstreamServed(UPSTREAM_PRIMARY, cached) == 1,
+          "%s: answered from the handed-over cache", cached);
+    check(WaitForSingleObject(process.hProcess, 0) == WAIT_TIMEOUT, "the new process keeps serving");
+    CloseHandle(process.hThread);
+    CloseHandle(process.hProcess);
+
+    // 此时交接端口由新进程监听，密钥不对时它照常服务
+    check(refusedHandoff(), "a handoff request with a wrong key is refused");
+    snprintf(name, sizeof(name), "k.%s.upgrade.test", tag);
+    ok = ask(RELAY_UPGRADE, name, TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1"), "%s: still served after the refused request",
+          name);
+}
+
+// hosts表（tests/hosts.txt）：表中的名字在本地回答，拦截条目不转发，其余名字转发给上游
+static void testHosts(void) {
+    char name[NAME_SIZE];
+    Reply r;
+    int ok = ask(RELAY_MAIN, "host1.lan.test", TYPE_A, &r);
+    check(ok && r.rcode == RCODE_OK && r.count[SECTION_ANSWER] == 1 &&
+          hasRecord(&r, SECTION_ANSWER, "host1.lan.test", TYPE_A, "10.1.1.1") &&
+          upstreamServed(UPSTREAM_PRIMARY, "host1.lan.test") == 0,
+          "host1.lan.test A: answered from the hosts table");
+
+    ok = ask(RELAY_MAIN, "blocked.lan.test", TYPE_A, &r);
+    check(ok && isBlocked(&r) && upstreamServed(UPSTREAM_PRIMARY, "blocked.lan.test") == 0,
+          "blocked.lan.test A: blocked without asking the upstream");
+
+    snprintf(name, sizeof(name), "m.%s.lan.test", tag);
+    ok = ask(RELAY_MAIN, name, TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1") && upstreamServed(UPSTREAM_PRIMARY, name) == 1,
+          "%s: names missing from the table are forwarded", name);
+}
+
+// 紧凑布局：同一域名的多行合并为一个地址集合，重复的地址只出现一次
+static void testMerge(void) {
+    Reply r;
+    int ok = ask(RELAY_MAIN, "multi.lan.test", TYPE_A, &r);
+    check(ok && r.count[SECTION_ANSWER] == 2 && hasRecord(&r, SECTION_ANSWER, "multi.lan.test", TYPE_A, "10.1.2.1") &&
+          hasRecord(&r, SECTION_ANSWER, "multi.lan.test", TYPE_A, "10.1.2.2"),
+          "multi.lan.test A: three lines merged into two addresses");
+
+    ok = ask(RELAY_MAIN, "same.lan.test", TYPE_A, &r);
+    check(ok && r.count[SECTION_ANSWER] == 2 && hasRecord(&r, SECTION_ANSWER, "same.lan.test", TYPE_A, "10.1.2.1") &&
+          hasRecord(&r, SECTION_ANSWER, "same.lan.test", TYPE_A, "10.1.2.2"),
+          "same.lan.test A: the same address set under another name");
+}
+
+// 完美哈希：仓库根目录hosts.txt中的每个条目都由冻结后的表在本地回答，表中没有的名字照常转发
+static void testFreeze(void) {
+    FILE* file = fopen("hosts.txt", "r");
+    if (!file) {
+        check(0, "open hosts.txt in the current directory");
+        return;
+    }
+    char line[512], address[64], name[NAME_SIZE];
+    Reply r;
+    int entries = 0, answered = 0, leaked = 0;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%63s %255s", address, name) != 2 || address[0] == '#') continue;
+        entries++;
+        int ok = ask(RELAY_BLOCKLIST, name, TYPE_A, &r);
+        if (strcmp(address, "0.0.0.0") == 0) {
+            answered += ok && isBlocked(&r);
+        } else {
+            answered += ok && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, address);
         }
-        printf("Message sent: %s\n", input);
-        
-        // 接收服务器响应
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes_received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
-        if (bytes_received == SOCKET_ERROR) {
-            fprintf(stderr, "Recv failed with error code : %d\n", WSAGetLastError());
-            break;
-        } else if (bytes_received == 0) {
-            printf("Server closed the connection.\n");
-            break;
+        leaked += upstreamServed(UPSTREAM_PRIMARY, name) > 0;
+    }
+    fclose(file);
+    check(entries > 0 && answered == entries, "%d/%d hosts.txt entries answered from the table", answered, entries);
+    check(leaked == 0, "%d hosts.txt names reached the upstream", leaked);
+
+    int forwarded = 0;
+    for (int i = 0; i < 20; i++) {
+        snprintf(name, sizeof(name), "n%d.%s.freeze.test", i, tag);
+        forwarded += ask(RELAY_BLOCKLIST, name, TYPE_A, &r) && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1") &&
+                     upstreamServed(UPSTREAM_PRIMARY, name) == 1;
+    }
+    check(forwarded == 20, "%d/20 names missing from the table forwarded", forwarded);
+}
+
+// 二进制镜像（tests/hosts.txt编译成的tests/hosts.img）：加载镜像的实例与加载文本的实例回答相同
+static void testImage(void) {
+    static const char* names[] = { "host1.lan.test", "multi.lan.test", "same.lan.test" };
+    Reply text, image;
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        int ok = ask(RELAY_MAIN, names[i], TYPE_A, &text) && ask(RELAY_IMAGE, names[i], TYPE_A, &image);
+        check(ok && image.count[SECTION_ANSWER] > 0 && sameAnswers(&text, &image) &&
+              upstreamServed(UPSTREAM_PRIMARY, names[i]) == 0,
+              "%s A: the image answers like the text file", names[i]);
+    }
+
+    int ok = ask(RELAY_IMAGE, "blocked.lan.test", TYPE_A, &image);
+    check(ok && isBlocked(&image), "blocked.lan.test A: blocked by the image");
+}
+
+// 并行解析：制表符分隔、一行多个域名和行尾注释照常识别，超长的域名和不合法的地址被跳过
+static void testParse(void) {
+    static const char* forwarded[] = { "comment.lan.test", "badip.lan.test", "bad2.lan.test" };
+    Reply r;
+    int ok = ask(RELAY_MAIN, "tab.lan.test", TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "tab.lan.test", TYPE_A, "10.1.3.1"), "tab.lan.test A: tab-separated entry");
+
+    ok = ask(RELAY_MAIN, "second.lan.test", TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "second.lan.test", TYPE_A, "10.1.3.1"),
+          "second.lan.test A: second name on the line");
+
+    ok = ask(RELAY_MAIN, "after-long.lan.test", TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "after-long.lan.test", TYPE_A, "10.1.3.2"),
+          "after-long.lan.test A: name after an over-long one");
+
+    for (int i = 0; i < (int)(sizeof(forwarded) / sizeof(forwarded[0])); i++) {
+        ok = ask(RELAY_MAIN, forwarded[i], TYPE_A, &r);
+        check(ok && hasRecord(&r, SECTION_ANSWER, forwarded[i], TYPE_A, "192.0.2.1"),
+              "%s A: not in the table, forwarded", forwarded[i]);
+    }
+}
+
+// 热重载：向tests/reload.txt追加一行后新条目生效，还原文件后条目随之消失，原有条目一直有应答
+static void testReload(void) {
+    char name[NAME_SIZE], original[BUFFER_SIZE];
+    Reply r;
+    FILE* file = fopen(RELOAD_FILE, "rb");
+    if (!file) {
+        check(0, "open %s", RELOAD_FILE);
+        return;
+    }
+    size_t len = fread(original, 1, sizeof(original), file);
+    fclose(file);
+
+    snprintf(name, sizeof(name), "%s.reload.test", tag);
+    file = fopen(RELOAD_FILE, "ab");
+    if (!file) {
+        check(0, "append to %s", RELOAD_FILE);
+        return;
+    }
+    fprintf(file, "10.3.3.3 %s\n", name);
+    fclose(file);
+    check(waitForHost(RELAY_RELOAD, name, "10.3.3.3", 1), "%s: added entry answered after the reload", name);
+
+    file = fopen(RELOAD_FILE, "wb");
+    if (!file) {
+        check(0, "restore %s", RELOAD_FILE);
+        return;
+    }
+    fwrite(original, 1, len, file);
+    fclose(file);
+    check(waitForHost(RELAY_RELOAD, name, "10.3.3.3", 0), "%s: entry gone once the file is restored", name);
+
+    int ok = ask(RELAY_RELOAD, "base.reload.test", TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "base.reload.test", TYPE_A, "10.3.3.1"),
+          "base.reload.test A: kept across both reloads");
+}
+
+// 后缀规则：*.wild.test拦截子域名但不含wild.test本身，精确条目优先；||ads.test^连同ads.test本身一起拦截
+static void testSuffix(void) {
+    static const char* blocked[] = { "x.wild.test", "a.b.wild.test", "ads.test", "sub.ads.test" };
+    Reply r;
+    for (int i = 0; i < (int)(sizeof(blocked) / sizeof(blocked[0])); i++) {
+        int ok = ask(RELAY_MAIN, blocked[i], TYPE_A, &r);
+        check(ok && isBlocked(&r) && upstreamServed(UPSTREAM_PRIMARY, blocked[i]) == 0, "%s A: blocked by a suffix rule",
+              blocked[i]);
+    }
+
+    int ok = ask(RELAY_MAIN, "ok.wild.test", TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "ok.wild.test", TYPE_A, "10.4.4.4"),
+          "ok.wild.test A: exact entry wins over the suffix rule");
+
+    ok = ask(RELAY_MAIN, "wild.test", TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "wild.test", TYPE_A, "192.0.2.1"),
+          "wild.test A: the suffix itself is forwarded");
+}
+
+// 过滤器：与hosts.txt中的名字只差一个字符的名字被过滤器或随后的比较排除，全部转发
+static void testBloom(void) {
+    FILE* file = fopen("hosts.txt", "r");
+    if (!file) {
+        check(0, "open hosts.txt in the current directory");
+        return;
+    }
+    char line[512], address[64], name[NAME_SIZE];
+    Reply r;
+    int total = 0, forwarded = 0;
+    while (total < 200 && fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%63s %254s", address, name + 1) != 2 || address[0] == '#') continue;
+        name[0] = 'x';
+        total++;
+        forwarded += ask(RELAY_BLOCKLIST, name, TYPE_A, &r) && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1");
+    }
+    fclose(file);
+    check(total > 0 && forwarded == total, "%d/%d near-miss names forwarded", forwarded, total);
+}
+
+// 模式规则（tests/patterns.txt）：通配符和正则规则不区分大小写，不命中的名字照常转发
+static void testPattern(void) {
+    static const char* blocked[] = { "foo-tracker.net", "Foo-Tracker.NET", "track1.example.com", "ad42.pattern.test" };
+    static const char* forwarded[] = { "track12.example.com", "ad.pattern.test", "bad42.pattern.test" };
+    Reply r;
+    for (int i = 0; i < (int)(sizeof(blocked) / sizeof(blocked[0])); i++) {
+        int ok = ask(RELAY_MAIN, blocked[i], TYPE_A, &r);
+        check(ok && isBlocked(&r) && upstreamServed(UPSTREAM_PRIMARY, blocked[i]) == 0, "%s A: blocked by a pattern",
+              blocked[i]);
+    }
+    for (int i = 0; i < (int)(sizeof(forwarded) / sizeof(forwarded[0])); i++) {
+        int ok = ask(RELAY_MAIN, forwarded[i], TYPE_A, &r);
+        check(ok && hasRecord(&r, SECTION_ANSWER, forwarded[i], TYPE_A, "192.0.2.1"), "%s A: no pattern matches",
+              forwarded[i]);
+    }
+}
+
+// 预编码的应答模板：所有者是指向问题的压缩指针，TTL固定，报文只有报头、问题和各条两字节名字的记录
+static void testAnswer(void) {
+    const char* name = "multi.lan.test";
+    Reply r;
+    int ok = ask(RELAY_MAIN, name, TYPE_A, &r);
+    int ttl_ok = ok && r.count[SECTION_ANSWER] == 2;
+    for (int i = 0; ttl_ok && i < r.count[SECTION_ANSWER]; i++) {
+        ttl_ok = r.records[SECTION_ANSWER][i].ttl == HOST_ANSWER_TTL && strcmp(r.records[SECTION_ANSWER][i].name, name) == 0;
+    }
+    check(ttl_ok, "%s A: owner is the question name, TTL %d", name, HOST_ANSWER_TTL);
+
+    int expected = 12 + (int)strlen(name) + 2 + 4 + 2 * (2 + 10 + 4);
+    check(ok && r.length == expected && r.count[SECTION_AUTHORITY] == 0 && r.count[SECTION_ADDITIONAL] == 0,
+          "%s A: %d-byte reply with compressed owners (expected %d)", name, r.length, expected);
+}
+
+// 拦截应答：默认回复NXDOMAIN和TTL为-n的SOA；sinkhole方式A回答0.0.0.0，AAAA回答::，其他类型NODATA
+static void testBlock(void) {
+    const char* name = "blocked.lan.test";
+    Reply r;
+    int ok = ask(RELAY_MAIN, name, TYPE_A, &r);
+    check(ok && r.rcode == RCODE_NXDOMAIN && r.count[SECTION_AUTHORITY] == 1 &&
+          hasRecord(&r, SECTION_AUTHORITY, name, TYPE_SOA, "localhost") &&
+          r.records[SECTION_AUTHORITY][0].ttl == BLOCK_TTL_DEFAULT &&
+          r.records[SECTION_AUTHORITY][0].minimum == BLOCK_TTL_DEFAULT,
+          "%s A: NXDOMAIN with a SOA whose TTL and MINIMUM are %d", name, BLOCK_TTL_DEFAULT);
+
+    ok = ask(RELAY_MAIN, name, TYPE_AAAA, &r);
+    check(ok && r.rcode == RCODE_NXDOMAIN, "%s AAAA: NXDOMAIN as well", name);
+
+    ok = ask(RELAY_IMAGE, name, TYPE_A, &r);
+    check(ok && r.rcode == RCODE_OK && r.count[SECTION_ANSWER] == 1 && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "0.0.0.0") &&
+          r.records[SECTION_ANSWER][0].ttl == BLOCK_TTL_IMAGE,
+          "%s A: sinkhole answers 0.0.0.0 with TTL %d", name, BLOCK_TTL_IMAGE);
+
+    ok = ask(RELAY_IMAGE, name, TYPE_AAAA, &r);
+    check(ok && r.count[SECTION_ANSWER] == 1 && hasRecord(&r, SECTION_ANSWER, name, TYPE_AAAA, "::"),
+          "%s AAAA: sinkhole answers ::", name);
+
+    ok = ask(RELAY_IMAGE, name, TYPE_MX, &r);
+    check(ok && r.rcode == RCODE_OK && r.count[SECTION_ANSWER] == 0 && hasRecord(&r, SECTION_AUTHORITY, name, TYPE_SOA, NULL),
+          "%s MX: sinkhole answers NODATA with the SOA", name);
+    check(upstreamServed(UPSTREAM_PRIMARY, name) == 0, "%s never reaches the upstream", name);
+}
+
+// IPv6：hosts中的AAAA在本地回答，名字在表中但没有所查地址族的记录时本地回答NODATA
+static void testAaaa(void) {
+    Reply r;
+    int ok = ask(RELAY_MAIN, "v6.lan.test", TYPE_AAAA, &r);
+    check(ok && r.count[SECTION_ANSWER] == 1 && hasRecord(&r, SECTION_ANSWER, "v6.lan.test", TYPE_AAAA, "2001:db8::10"),
+          "v6.lan.test AAAA: answered from the hosts table");
+
+    ok = ask(RELAY_MAIN, "v6.lan.test", TYPE_A, &r);
+    check(ok && r.rcode == RCODE_OK && r.count[SECTION_ANSWER] == 0, "v6.lan.test A: NODATA");
+
+    ok = ask(RELAY_MAIN, "host1.lan.test", TYPE_AAAA, &r);
+    check(ok && r.rcode == RCODE_OK && r.count[SECTION_ANSWER] == 0, "host1.lan.test AAAA: NODATA");
+
+    ok = ask(RELAY_MAIN, "dual.lan.test", TYPE_A, &r);
+    int both = ok && r.count[SECTION_ANSWER] == 1 && hasRecord(&r, SECTION_ANSWER, "dual.lan.test", TYPE_A, "10.1.8.1");
+    ok = ask(RELAY_MAIN, "dual.lan.test", TYPE_AAAA, &r);
+    both = both && ok && r.count[SECTION_ANSWER] == 1 &&
+           hasRecord(&r, SECTION_ANSWER, "dual.lan.test", TYPE_AAAA, "2001:db8::11");
+    check(both, "dual.lan.test: A and AAAA each answer their own family");
+
+    check(upstreamServed(UPSTREAM_PRIMARY, "v6.lan.test") == 0 && upstreamServed(UPSTREAM_PRIMARY, "host1.lan.test") == 0 &&
+          upstreamServed(UPSTREAM_PRIMARY, "dual.lan.test") == 0,
+          "hosts names never reach the upstream");
+}
+
+// 反向查询：hosts地址的PTR指向最先出现的名字；私有反向区中其余的名字本地回答NXDOMAIN，
+// 中间的空非终结点回答NODATA，区顶点回答SOA，都不泄漏到上游
+static void testPtr(void) {
+    static const char* v6 = "0.1.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa";
+    Reply r;
+    int ok = ask(RELAY_MAIN, "1.1.1.10.in-addr.arpa", TYPE_PTR, &r);
+    check(ok && r.count[SECTION_ANSWER] == 1 && hasRecord(&r, SECTION_ANSWER, "1.1.1.10.in-addr.arpa", TYPE_PTR, "host1.lan.test"),
+          "1.1.1.10.in-addr.arpa PTR: host1.lan.test");
+
+    ok = ask(RELAY_MAIN, "10.50.168.192.in-addr.arpa", TYPE_PTR, &r);
+    check(ok && r.count[SECTION_ANSWER] == 1 && hasRecord(&r, SECTION_ANSWER, NULL, TYPE_PTR, "nas.lan.test"),
+          "10.50.168.192.in-addr.arpa PTR: the first name for the address");
+
+    ok = ask(RELAY_MAIN, v6, TYPE_PTR, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, v6, TYPE_PTR, "v6.lan.test"), "2001:db8::10 PTR: v6.lan.test");
+
+    ok = ask(RELAY_MAIN, "11.50.168.192.in-addr.arpa", TYPE_PTR, &r);
+    check(ok && r.rcode == RCODE_NXDOMAIN && hasRecord(&r, SECTION_AUTHORITY, "168.192.in-addr.arpa", TYPE_SOA, NULL),
+          "11.50.168.192.in-addr.arpa PTR: NXDOMAIN with the zone SOA");
+
+    ok = ask(RELAY_MAIN, "50.168.192.in-addr.arpa", TYPE_PTR, &r);
+    check(ok && r.rcode == RCODE_OK && r.count[SECTION_ANSWER] == 0 &&
+          hasRecord(&r, SECTION_AUTHORITY, "168.192.in-addr.arpa", TYPE_SOA, NULL),
+          "50.168.192.in-addr.arpa PTR: empty non-terminal answers NODATA");
+
+    ok = ask(RELAY_MAIN, "168.192.in-addr.arpa", TYPE_SOA, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "168.192.in-addr.arpa", TYPE_SOA, NULL), "168.192.in-addr.arpa SOA: zone apex");
+
+    check(upstreamServed(UPSTREAM_PRIMARY, "11.50.168.192.in-addr.arpa") == 0 &&
+          upstreamServed(UPSTREAM_PRIMARY, "50.168.192.in-addr.arpa") == 0,
+          "private reverse names never reach the upstream");
+}
+
+// 本地权威区（tests/corp.zone）：以AA应答，不访问上游
+static void testZone(void) {
+    Reply r;
+    int ok = ask(RELAY_MAIN, "web.corp.test", TYPE_A, &r);
+    check(ok && r.rcode == RCODE_OK && r.aa && countType(&r, SECTION_ANSWER, TYPE_A) == 2 &&
+          hasRecord(&r, SECTION_ANSWER, "web.corp.test", TYPE_A, "10.0.0.80"),
+          "web.corp.test A: authoritative RRset of two addresses");
+
+    ok = ask(RELAY_MAIN, "www.corp.test", TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "www.corp.test", TYPE_CNAME, "web.corp.test") &&
+          hasRecord(&r, SECTION_ANSWER, "web.corp.test", TYPE_A, "10.0.0.81"),
+          "www.corp.test A: CNAME followed inside the zone");
+
+    ok = ask(RELAY_MAIN, "corp.test", TYPE_MX, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "corp.test", TYPE_MX, "10 mail.corp.test") &&
+          hasRecord(&r, SECTION_ADDITIONAL, "mail.corp.test", TYPE_A, "10.0.0.25"),
+          "corp.test MX: target address in the additional section");
+
+    ok = ask(RELAY_MAIN, "corp.test", TYPE_SOA, &r);
+    check(ok && r.aa && hasRecord(&r, SECTION_ANSWER, "corp.test", TYPE_SOA, "ns1.corp.test"), "corp.test SOA: apex SOA");
+
+    ok = ask(RELAY_MAIN, "mail.corp.test", TYPE_AAAA, &r);
+    check(ok && r.rcode == RCODE_OK && r.count[SECTION_ANSWER] == 0 &&
+          hasRecord(&r, SECTION_AUTHORITY, "corp.test", TYPE_SOA, NULL),
+          "mail.corp.test AAAA: NODATA with the SOA");
+
+    ok = ask(RELAY_MAIN, "missing.corp.test", TYPE_A, &r);
+    check(ok && r.rcode == RCODE_NXDOMAIN && r.aa && hasRecord(&r, SECTION_AUTHORITY, "corp.test", TYPE_SOA, NULL),
+          "missing.corp.test A: NXDOMAIN with the SOA");
+
+    ok = ask(RELAY_MAIN, "box.dev.corp.test", TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "box.dev.corp.test", TYPE_A, "10.9.9.9"), "box.dev.corp.test A: wildcard");
+
+    check(upstreamServed(UPSTREAM_PRIMARY, "www.corp.test") == 0, "zone names never reach the upstream");
+}
+
+// 条件转发（tests/forward.txt）：按最长后缀选择上游组
+static void testForward(void) {
+    char name[NAME_SIZE];
+    Reply r;
+    snprintf(name, sizeof(name), "www.%s.fwd.test", tag);
+    int ok = ask(RELAY_MAIN, name, TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "198.51.100.1") &&
+          upstreamServed(UPSTREAM_SECONDARY, name) == 1 && upstreamServed(UPSTREAM_PRIMARY, name) == 0,
+          "%s: routed to the fwd.test group", name);
+
+    snprintf(name, sizeof(name), "www.%s.plain.test", tag);
+    ok = ask(RELAY_MAIN, name, TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1") &&
+          upstreamServed(UPSTREAM_SECONDARY, name) == 0,
+          "%s: unmatched names use the default group", name);
+}
+
+// 默认组的第一个上游不应答：按RTT选择时它只被试探一次，之后查询都发往能应答的上游
+static void testFailover(void) {
+    char name[NAME_SIZE];
+    Reply r;
+    int first_try = 0, answered = 0, silent = 0;
+    for (int i = 0; i < 20; i++) {
+        snprintf(name, sizeof(name), "f%d.%s.rtt.test", i, tag);
+        int ok = exchange(RELAY_FAILOVER, DNS_PORT, name, TYPE_A, CLASS_IN, &r, 1500);
+        first_try += ok;
+        if (!ok) ok = ask(RELAY_FAILOVER, name, TYPE_A, &r); // 客户端重试
+        answered += ok && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1");
+        silent += upstreamServed(SILENT_DEFAULT, name);
+    }
+    check(first_try >= 17, "%d/20 answered on the first try", first_try);
+    check(answered == 20, "%d/20 answered after one client retry", answered);
+    check(silent <= 3, "the silent upstream got %d of the queries", silent);
+}
+
+// 一致性哈希：同一个名字总发往同一个上游；不应答的上游连续超时后被跳过，它的名字改投其余上游
+static void testHash(void) {
+    char name[NAME_SIZE];
+    Reply r;
+    int lost = 0;
+    for (int i = 0; i < 30; i++) {
+        snprintf(name, sizeof(name), "a%d.%s.hash.test", i, tag);
+        lost += !exchange(RELAY_HASH, DNS_PORT, name, TYPE_A, CLASS_IN, &r, 800);
+    }
+    // 上一次运行后不到30秒时不应答的上游仍在屏蔽期内，这里可能一个都不丢
+    printf("  %d/30 names owned by the silent upstream timed out\n", lost);
+
+    printf("  waiting 6 s for the timeouts to be recorded...\n");
+    Sleep(6000);
+    int answered = 0, silent = 0, primary = 0, secondary = 0, split = 0;
+    for (int i = 0; i < 30; i++) {
+        snprintf(name, sizeof(name), "b%d.%s.hash.test", i, tag);
+        answered += exchange(RELAY_HASH, DNS_PORT, name, TYPE_A, CLASS_IN, &r, 1500);
+        ask(RELAY_HASH, name, TYPE_AAAA, &r);
+        int a = upstreamServed(UPSTREAM_PRIMARY, name);
+        int b = upstreamServed(UPSTREAM_SECONDARY, name);
+        silent += upstreamServed(SILENT_DEFAULT, name);
+        primary += a > 0;
+        secondary += b > 0;
+        split += a > 0 && b > 0;
+    }
+    check(answered == 30 && silent == 0, "%d/30 answered once the silent upstream is skipped (%d sent to it)",
+          answered, silent);
+    check(primary > 0 && secondary > 0 && split == 0, "names shard across the live upstreams (%d / %d, %d split)",
+          primary, secondary, split);
+}
+
+// 递归模式：从tests/root.hints中的替身根出发跟随委派
+static void testRecursion(void) {
+    Reply r;
+    int ok = ask(RELAY_RECURSIVE, "www.example.test", TYPE_A, &r);
+    check(ok && r.rcode == RCODE_OK && hasRecord(&r, SECTION_ANSWER, "www.example.test", TYPE_A, "203.0.113.10") &&
+          hasRecord(&r, SECTION_ANSWER, "www.example.test", TYPE_A, "203.0.113.11"),
+          "www.example.test A: resolved through root and test.");
+
+    int before = served(EXAMPLE_AUTH, HIERARCHY_PORT, "www.example.test");
+    ok = ask(RELAY_RECURSIVE, "www.example.test", TYPE_A, &r);
+    check(ok && r.count[SECTION_ANSWER] == 2 && served(EXAMPLE_AUTH, HIERARCHY_PORT, "www.example.test") == before,
+          "www.example.test A: repeated query answered from the cache");
+
+    ok = ask(RELAY_RECURSIVE, "alias.example.test", TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "alias.example.test", TYPE_CNAME, "www.example.test") &&
+          countType(&r, SECTION_ANSWER, TYPE_A) == 2,
+          "alias.example.test A: CNAME chain in the answer");
+
+    ok = ask(RELAY_RECURSIVE, "ext.example.test", TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "ext.example.test", TYPE_CNAME, "www.other.test") &&
+          hasRecord(&r, SECTION_ANSWER, "www.other.test", TYPE_A, "203.0.113.20"),
+          "ext.example.test A: CNAME into other.test, whose server has no glue");
+
+    ok = ask(RELAY_RECURSIVE, "missing.example.test", TYPE_A, &r);
+    check(ok && r.rcode == RCODE_NXDOMAIN, "missing.example.test A: NXDOMAIN");
+
+    ok = ask(RELAY_RECURSIVE, "www.example.test", TYPE_TXT, &r);
+    check(ok && r.rcode == RCODE_OK && r.count[SECTION_ANSWER] == 0, "www.example.test TXT: NODATA");
+}
+
+// 授权部分的NS和辖区内的粘附地址随应答一起收入缓存
+static void testHarvest(void) {
+    char name[NAME_SIZE];
+    Reply r;
+    snprintf(name, sizeof(name), "h.%s.up.test", tag);
+    int ok = ask(RELAY_MAIN, name, TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1"), "%s: answered by the upstream", name);
+
+    int before = upstreamServed(UPSTREAM_PRIMARY, "up.test");
+    ok = ask(RELAY_MAIN, "up.test", TYPE_NS, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "up.test", TYPE_NS, "ns.up.test") &&
+          upstreamServed(UPSTREAM_PRIMARY, "up.test") == before,
+          "up.test NS: harvested from the authority section");
+
+    before = upstreamServed(UPSTREAM_PRIMARY, "ns.up.test");
+    ok = ask(RELAY_MAIN, "ns.up.test", TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, "ns.up.test", TYPE_A, UPSTREAM_PRIMARY) &&
+          upstreamServed(UPSTREAM_PRIMARY, "ns.up.test") == before,
+          "ns.up.test A: harvested in-bailiwick glue");
+}
+
+// CNAME链的每一环单独缓存
+static void testCname(void) {
+    char alias[NAME_SIZE], mid[NAME_SIZE], end[NAME_SIZE];
+    Reply r;
+    snprintf(alias, sizeof(alias), "alias.%s.up.test", tag);
+    snprintf(mid, sizeof(mid), "mid.%s.up.test", tag);
+    snprintf(end, sizeof(end), "end.%s.up.test", tag);
+
+    int ok = ask(RELAY_MAIN, alias, TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, alias, TYPE_CNAME, mid) && hasRecord(&r, SECTION_ANSWER, mid, TYPE_CNAME, end) &&
+          hasRecord(&r, SECTION_ANSWER, end, TYPE_A, "192.0.2.1"),
+          "%s: full chain from the upstream", alias);
+
+    ok = ask(RELAY_MAIN, mid, TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, mid, TYPE_CNAME, end) && hasRecord(&r, SECTION_ANSWER, end, TYPE_A, "192.0.2.1") &&
+          upstreamServed(UPSTREAM_PRIMARY, mid) == 0,
+          "%s: answered from the cached links", mid);
+
+    ok = ask(RELAY_MAIN, end, TYPE_A, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, end, TYPE_A, "192.0.2.1") && upstreamServed(UPSTREAM_PRIMARY, end) == 0,
+          "%s: answered from the cache", end);
+
+    ok = ask(RELAY_MAIN, alias, TYPE_A, &r);
+    check(ok && r.count[SECTION_ANSWER] == 3 && upstreamServed(UPSTREAM_PRIMARY, alias) == 1,
+          "%s: repeated query answered from the cache", alias);
+}
+
+// -F：缓存命中CNAME链时只回答最终地址，所有者是查询名
+static void testFlatten(void) {
+    char alias[NAME_SIZE];
+    Reply r;
+    snprintf(alias, sizeof(alias), "alias.%s.up.test", tag);
+    int ok = ask(RELAY_FLATTEN, alias, TYPE_A, &r);
+    check(ok && countType(&r, SECTION_ANSWER, TYPE_CNAME) == 2, "%s: first answer carries the upstream chain", alias);
+
+    ok = ask(RELAY_FLATTEN, alias, TYPE_A, &r);
+    check(ok && r.count[SECTION_ANSWER] == 1 && hasRecord(&r, SECTION_ANSWER, alias, TYPE_A, "192.0.2.1"),
+          "%s: cached answer is flattened to the final address", alias);
+}
+
+// 失败缓存：SERVFAIL和超时的名字在屏蔽期内直接回复SERVFAIL，按名字和类型分别记录
+static void testFailure(void) {
+    char name[NAME_SIZE];
+    Reply r;
+    snprintf(name, sizeof(name), "fail.%s.up.test", tag);
+    int ok = ask(RELAY_MAIN, name, TYPE_A, &r) && r.rcode == RCODE_SERVFAIL;
+    ok = ok && ask(RELAY_MAIN, name, TYPE_A, &r) && r.rcode == RCODE_SERVFAIL;
+    check(ok && upstreamServed(UPSTREAM_PRIMARY, name) == 1, "%s A: second SERVFAIL comes from the failure cache", name);
+
+    ok = ask(RELAY_MAIN, name, TYPE_AAAA, &r) && r.rcode == RCODE_SERVFAIL;
+    check(ok && upstreamServed(UPSTREAM_PRIMARY, name) == 2, "%s AAAA: other types still go upstream", name);
+
+    snprintf(name, sizeof(name), "nx.%s.up.test", tag);
+    ok = ask(RELAY_MAIN, name, TYPE_A, &r);
+    check(ok && r.rcode == RCODE_NXDOMAIN, "%s: NXDOMAIN is passed through", name);
+
+    snprintf(name, sizeof(name), "t.%s.silent.test", tag);
+    ok = exchange(RELAY_MAIN, DNS_PORT, name, TYPE_A, CLASS_IN, &r, 1000);
+    check(!ok, "%s: no answer from the silent upstream", name);
+    printf("  waiting 6 s for the timeout to be recorded...\n");
+    Sleep(6000);
+    ok = ask(RELAY_MAIN, name, TYPE_A, &r);
+    check(ok && r.rcode == RCODE_SERVFAIL && upstreamServed(SILENT_RULE, name) == 1,
+          "%s: timed-out name answered SERVFAIL locally", name);
+}
+
+// EDNS0：应答带中继自己的OPT；超过客户端载荷大小的应答置TC，通告了足够大小的客户端收到完整的应答
+static void testEdns(void) {
+    char name[NAME_SIZE];
+    Reply r;
+    snprintf(name, sizeof(name), "e.%s.up.test", tag);
+    int ok = askEdns(RELAY_MAIN, name, TYPE_A, 4096, &r);
+    check(ok && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1") && countType(&r, SECTION_ADDITIONAL, TYPE_OPT) == 1 &&
+          hasRecord(&r, SECTION_ADDITIONAL, "", TYPE_OPT, NULL) &&
+          r.records[SECTION_ADDITIONAL][r.count[SECTION_ADDITIONAL] - 1].rrclass == RELAY_UDP_SIZE,
+          "%s: OPT in the reply advertises %d bytes", name, RELAY_UDP_SIZE);
+
+    ok = ask(RELAY_MAIN, name, TYPE_A, &r);
+    check(ok && countType(&r, SECTION_ADDITIONAL, TYPE_OPT) == 0, "%s: no OPT for a client without EDNS", name);
+
+    snprintf(name, sizeof(name), "big.%s.up.test", tag);
+    ok = askEdns(RELAY_MAIN, name, TYPE_A, 4096, &r);
+    check(ok && !r.tc && countType(&r, SECTION_ANSWER, TYPE_A) == BIG_RECORD_COUNT && r.length > 512,
+          "%s: %d-byte answer with all %d records over EDNS", name, r.length, BIG_RECORD_COUNT);
+
+    ok = ask(RELAY_MAIN, name, TYPE_A, &r);
+    check(ok && r.tc && r.count[SECTION_ANSWER] == 0 && r.length <= 512, "%s: truncated for a client without EDNS", name);
+
+    ok = askEdns(RELAY_MAIN, name, TYPE_A, 512, &r);
+    check(ok && r.tc && countType(&r, SECTION_ADDITIONAL, TYPE_OPT) == 1, "%s: truncated for a 512-byte EDNS client", name);
+}
+
+// TCP流水线：一次写入多个查询，应答可以乱序，每个查询都要有应答
+static void testTcp(void) {
+    const int QUERY_COUNT = 6;
+    uint8_t buffer[BUFFER_SIZE];
+    uint16_t ids[6];
+    int len = 0;
+    for (int i = 0; i < QUERY_COUNT; i++) {
+        char name[NAME_SIZE];
+        if (i == 0) {
+            strcpy(name, "web.corp.test");
         } else {
-            buffer[bytes_received] = '\0'; // 添加 null 终止符
-            printf("Server reply: %s\n", buffer);
+            snprintf(name, sizeof(name), "p%d.%s.up.test", i, tag);
         }
+        ids[i] = (uint16_t)(0x1000 + i);
+        int query_len = buildQuery(buffer + len + 2, ids[i], name, TYPE_A, CLASS_IN);
+        buffer[len] = (uint8_t)(query_len >> 8);
+        buffer[len + 1] = (uint8_t)query_len;
+        len += query_len + 2;
     }
 
-    // 8. 关闭 Socket
-    closesocket(client_socket);
-    printf("Client socket closed.\n");
+    struct sockaddr_in address;
+    setAddress(&address, RELAY_MAIN, DNS_PORT);
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET || connect(sock, (struct sockaddr*)&address, sizeof(address)) == SOCKET_ERROR) {
+        check(0, "connect to %s:53 over TCP", RELAY_MAIN);
+        if (sock != INVALID_SOCKET) closesocket(sock);
+        return;
+    }
+    send(sock, (const char*)buffer, len, 0);
 
-    // 9. 清理 Winsock
-    WSACleanup();
-    printf("Winsock cleaned up.\n");
+    // 按长度前缀切出各个应答
+    int seen[6] = { 0 };
+    int received = 0, answered = 0, have = 0;
+    while (received < QUERY_COUNT && waitReadable(sock, QUERY_TIMEOUT)) {
+        int n = recv(sock, (char*)buffer + have, sizeof(buffer) - have, 0);
+        if (n <= 0) break;
+        have += n;
+        while (have >= 2 && have >= 2 + get16(buffer)) {
+            int reply_len = get16(buffer);
+            Reply r;
+            if (parseReply(buffer + 2, reply_len, &r)) {
+                for (int i = 0; i < QUERY_COUNT; i++) {
+                    if (r.id == ids[i] && !seen[i]) {
+                        seen[i] = 1;
+                        received++;
+                        answered += r.rcode == RCODE_OK && countType(&r, SECTION_ANSWER, TYPE_A) > 0;
+                    }
+                }
+            }
+            memmove(buffer, buffer + 2 + reply_len, have - 2 - reply_len);
+            have -= 2 + reply_len;
+        }
+    }
+    closesocket(sock);
+    check(received == QUERY_COUNT && answered == QUERY_COUNT, "%d/%d pipelined queries answered on one connection",
+          answered, QUERY_COUNT);
+}
 
-    return 0;
+// 上游TCP连接：截断的应答经TCP重试；-t时查询全部经TCP发出，共用池中的长连接
+static void testUpstreamTcp(void) {
+    char name[NAME_SIZE];
+    Reply r;
+    snprintf(name, sizeof(name), "tc.%s.up.test", tag);
+    int ok = ask(RELAY_MAIN, name, TYPE_A, &r);
+    check(ok && !r.tc && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1") &&
+          upstreamServed(UPSTREAM_PRIMARY, name) == 2,
+          "%s: truncated UDP reply retried over TCP", name);
+
+    int before = upstreamServed(UPSTREAM_PRIMARY, CONNECTION_COUNTER);
+    int answered = 0;
+    for (int i = 0; i < 10; i++) {
+        snprintf(name, sizeof(name), "u%d.%s.up.test", i, tag);
+        answered += ask(RELAY_UPSTREAM_TCP, name, TYPE_A, &r) && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1") &&
+                    upstreamServed(UPSTREAM_PRIMARY, name) == 1;
+    }
+    int opened = upstreamServed(UPSTREAM_PRIMARY, CONNECTION_COUNTER) - before;
+    check(answered == 10, "%d/10 answered over the upstream TCP pool", answered);
+    check(before >= 0 && opened <= 1, "%d new upstream connections for 10 queries", opened);
+}
+
+// 集群缓存：每个名字只由一个节点问一次上游，其余节点从归属节点的缓存得到应答
+static void testPeer(void) {
+    char name[NAME_SIZE];
+    Reply r;
+    int answered = 0, fetched = 0;
+    for (int node = 0; node < 3; node++) {
+        for (int i = 0; i < 30; i++) {
+            snprintf(name, sizeof(name), "s%d.%s.peer.test", i, tag);
+            answered += ask(peers[node], name, TYPE_A, &r) && hasRecord(&r, SECTION_ANSWER, name, TYPE_A, "192.0.2.1");
+        }
+    }
+    for (int i = 0; i < 30; i++) {
+        snprintf(name, sizeof(name), "s%d.%s.peer.test", i, tag);
+        fetched += upstreamServed(UPSTREAM_PRIMARY, name);
+    }
+    check(answered == 90, "%d/90 answered across three nodes", answered);
+    check(fetched == 30, "the upstream saw %d queries for 30 names", fetched);
+}
+
+static const Test tests[] = {
+    { "upgrade", testUpgrade, 1 },
+    { "hosts", testHosts, 0 },
+    { "merge", testMerge, 0 },
+    { "freeze", testFreeze, 0 },
+    { "image", testImage, 0 },
+    { "parse", testParse, 0 },
+    { "reload", testReload, 0 },
+    { "suffix", testSuffix, 0 },
+    { "bloom", testBloom, 0 },
+    { "pattern", testPattern, 0 },
+    { "answer", testAnswer, 0 },
+    { "block", testBlock, 0 },
+    { "aaaa", testAaaa, 0 },
+    { "ptr", testPtr, 0 },
+    { "zone", testZone, 0 },
+    { "forward", testForward, 0 },
+    { "failover", testFailover, 0 },
+    { "recursion", testRecursion, 0 },
+    { "harvest", testHarvest, 0 },
+    { "cname", testCname, 0 },
+    { "flatten", testFlatten, 0 },
+    { "failure", testFailure, 0 },
+    { "edns", testEdns, 0 },
+    { "tcp", testTcp, 0 },
+    { "upstream-tcp", testUpstreamTcp, 0 },
+    { "hash", testHash, 0 },
+    { "peer", testPeer, 0 },
+};
+#define TEST_COUNT ((int)(sizeof(tests) / sizeof(tests[0])))
+
+int main(int argc, char* argv[]) {
+    WSADATA wsaData; // Winsock 初始化数据结构
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        fprintf(stderr, "WSAStartup failed. Error Code : %d\n", WSAGetLastError());
+        return 1;
+    }
+    srand((unsigned)time(NULL));
+    snprintf(tag, sizeof(tag), "r%u", (unsigned)time(NULL) % 1000000);
+
+    for (int i = 0; i < TEST_COUNT; i++) {
+        int selected = argc == 1 && !tests[i].explicit_only;
+        for (int a = 1; a < argc; a++) {
+            if (strcmp(argv[a], tests[i].name) == 0) selected = 1;
+        }
+        if (!selected) continue;
+        printf("%s\n", tests[i].name);
+        tests[i].run();
+    }
+
+    printf("%d passed, %d failed\n", passed, failed);
+    WSACleanup();
+    return failed == 0 ? 0 : 1;
 }
@@ -1,131 +1,593 @@
-#define _WINSOCK_DEPRECATED_NO_WARNINGS // 允许使用旧的 inet_ntoa 函数，现代代码推荐使用 inet_ntop
+// 行为测试用的替身DNS服务器：在回环地址上同时扮演上游解析器、不应答的上游，以及一套根、顶级域和权威服务器，
+// 由test-client.c驱动各个中继实例向它们发查询。
+// 每个地址按名字记录收到的查询数，CH类的TXT查询回答这个计数
+// 编译: cmake --build <构建目录> --target test-server，或 gcc -std=c99 test-server.c -lws2_32 -o test-server
+// 用法: test-server（各中继实例的启动命令见README的"行为测试"一节）
+#define _WINSOCK_DEPRECATED_NO_WARNINGS // 允许使用旧的 inet_ntoa 函数
 #define _CRT_SECURE_NO_WARNINGS // 允许使用 sprintf 等函数而不显示安全警告
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
 #include <winsock2.h> // 包含 Winsock 函数和结构
 #include <ws2tcpip.h> // 包含 inet_pton, inet_ntop 等函数
 
 #pragma comment(lib, "ws2_32.lib") // 告知编译器链接 ws2_32.lib 库
 
-#define PORT 8080
-#define BUFFER_SIZE 1024
+#define UPSTREAM_PORT 5358     // 替身上游的端口，中继用-s 127.0.0.8:5358等指定
+#define HIERARCHY_PORT 5399    // 替身根、顶级域和权威服务器的端口，与tests/root.hints一致
+#define BUFFER_SIZE 4096
+#define NAME_SIZE 256
+#define MAX_COUNTED 8192       // 计数的(地址, 名字)数上限
+#define MAX_PENDING 64         // 等待延迟发出的应答数上限
+#define SLOW_REPLY_MS 1500     // 名字以slow.开头的查询延迟这么久才应答
+#define BIG_RECORD_COUNT 20    // 名字以big.开头的A查询回答的记录数，应答超过512字节
+#define MAX_CONNECTIONS 16     // 同时服务的TCP连接数上限
+#define CONNECTION_COUNTER "connections.tcp" // 记录接受的TCP连接数的计数名
+#define RECORD_TTL 300
 
-int main() {
-    WSADATA wsaData; // Winsock 初始化数据结构
-    SOCKET server_fd, new_socket; // 服务器监听 Socket 和新连接的 Socket
-    struct sockaddr_in server_addr, client_addr; // 服务器和客户端地址结构
-    int client_addr_len = sizeof(client_addr); // 客户端地址结构大小 (注意这里是 int*)
-    char buffer[BUFFER_SIZE] = {0};
-    int bytes_received; // 接收到的字节数
-
-    // 1. 初始化 Winsock
-    // 请求 2.2 版本的 Winsock API
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        fprintf(stderr, "WSAStartup failed. Error Code : %d\n", WSAGetLastError());
-        return 1;
+#define TYPE_A 1
+#define TYPE_NS 2
+#define TYPE_CNAME 5
+#define TYPE_SOA 6
+#define TYPE_TXT 16
+#define CLASS_IN 1
+#define CLASS_CH 3             // 计数查询用的类，中继不会转发这一类的查询
+
+#define RCODE_SERVFAIL 2
+#define RCODE_NXDOMAIN 3
+
+typedef enum {
+    ROLE_UPSTREAM,             // 递归解析器：任何名字都有答案，名字的第一个标签决定应答的样子
+    ROLE_SILENT,               // 不应答的上游：只记下查询，用来测试超时和切换
+    ROLE_AUTHORITY             // 权威服务器：按记录表回答或给出委派
+} RoleKind;
+
+// 权威服务器的一条记录，data是点分形式的地址或域名；owner为NULL的记录表示表尾
+typedef struct Record {
+    const char* owner;
+    uint16_t type;
+    const char* data;
+} Record;
+
+typedef struct Role {
+    const char* address;
+    int port;
+    RoleKind kind;
+    const char* value;         // 上游回答的A地址；权威服务器的区顶点（根为""）
+    const Record* records;
+    SOCKET sock;
+    SOCKET listener;           // 上游的TCP监听socket，其他角色为INVALID_SOCKET
+} Role;
+
+// 正在拼写的应答，各部分的记录须按回答、授权、附加的顺序追加
+typedef struct Reply {
+    uint8_t data[BUFFER_SIZE];
+    uint8_t* ptr;
+    uint16_t count[3];
+} Reply;
+
+enum { SECTION_ANSWER, SECTION_AUTHORITY, SECTION_ADDITIONAL };
+
+typedef struct Counter {
+    int role;
+    char name[NAME_SIZE];
+    int count;
+} Counter;
+
+// 延迟发出的UDP应答
+typedef struct Pending {
+    int role;
+    struct sockaddr_in to;
+    int to_len;
+    unsigned long long due;
+    int len;
+    uint8_t data[BUFFER_SIZE];
+} Pending;
+
+// 到替身上游的TCP连接，data中积累尚未处理完的带长度前缀的查询
+typedef struct Connection {
+    SOCKET sock;
+    int role;
+    int len;
+    uint8_t data[BUFFER_SIZE + 2];
+} Connection;
+
+// 根把test.委派给127.0.0.11
+static const Record rootRecords[] = {
+    { "test", TYPE_NS, "ns1.nic.test" },
+    { "ns1.nic.test", TYPE_A, "127.0.0.11" },
+    { NULL, 0, NULL },
+};
+
+// test.把example.test委派给带粘附记录的127.0.0.12，other.test委派给没有粘附记录的ns.example.test
+static const Record tldRecords[] = {
+    { "example.test", TYPE_NS, "ns1.example.test" },
+    { "ns1.example.test", TYPE_A, "127.0.0.12" },
+    { "other.test", TYPE_NS, "ns.example.test" },
+    { NULL, 0, NULL },
+};
+
+static const Record exampleRecords[] = {
+    { "example.test", TYPE_NS, "ns1.example.test" },
+    { "ns1.example.test", TYPE_A, "127.0.0.12" },
+    { "ns.example.test", TYPE_A, "127.0.0.13" },
+    { "www.example.test", TYPE_A, "203.0.113.10" },
+    { "www.example.test", TYPE_A, "203.0.113.11" },
+    { "alias.example.test", TYPE_CNAME, "www.example.test" },
+    { "ext.example.test", TYPE_CNAME, "www.other.test" },
+    { NULL, 0, NULL },
+};
+
+static const Record otherRecords[] = {
+    { "other.test", TYPE_NS, "ns.example.test" },
+    { "www.other.test", TYPE_A, "203.0.113.20" },
+    { NULL, 0, NULL },
+};
+
+static Role roles[] = {
+    { "127.0.0.6", UPSTREAM_PORT, ROLE_SILENT, NULL },
+    { "127.0.0.7", UPSTREAM_PORT, ROLE_SILENT, NULL },
+    { "127.0.0.8", UPSTREAM_PORT, ROLE_UPSTREAM, "192.0.2.1" },
+    { "127.0.0.9", UPSTREAM_PORT, ROLE_UPSTREAM, "198.51.100.1" },
+    { "127.0.0.10", HIERARCHY_PORT, ROLE_AUTHORITY, "", rootRecords },
+    { "127.0.0.11", HIERARCHY_PORT, ROLE_AUTHORITY, "test", tldRecords },
+    { "127.0.0.12", HIERARCHY_PORT, ROLE_AUTHORITY, "example.test", exampleRecords },
+    { "127.0.0.13", HIERARCHY_PORT, ROLE_AUTHORITY, "other.test", otherRecords },
+};
+#define ROLE_COUNT ((int)(sizeof(roles) / sizeof(roles[0])))
+
+static Counter counters[MAX_COUNTED];
+static int counter_count = 0;
+static Pending pending[MAX_PENDING];
+static int pending_count = 0;
+static Connection connections[MAX_CONNECTIONS];
+
+// --- 计数 ---
+
+static Counter* findCounter(int role, const char* name, int create) {
+    for (int i = 0; i < counter_count; i++) {
+        if (counters[i].role == role && strcmp(counters[i].name, name) == 0) return &counters[i];
     }
-    printf("Winsock initialized.\n");
+    if (!create || counter_count == MAX_COUNTED) return NULL;
+    Counter* c = &counters[counter_count++];
+    c->role = role;
+    strcpy(c->name, name);
+    c->count = 0;
+    return c;
+}
 
-    // 2. 创建 Socket
-    // AF_INET: IPv4 地址族
-    // SOCK_STREAM: 流式套接字 (TCP)
-    // IPPROTO_TCP: TCP 协议 (通常也可以用 0 让系统自动选择)
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET) {
-        fprintf(stderr, "Could not create socket. Error Code : %d\n", WSAGetLastError());
-        WSACleanup(); // 创建失败，清理 Winsock
-        return 1;
+// --- 报文拼写 ---
+
+static uint16_t get16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint8_t* put16(uint8_t* p, uint16_t value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+    return p + 2;
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t value) {
+    p = put16(p, (uint16_t)(value >> 16));
+    return put16(p, (uint16_t)value);
+}
+
+// 写入不压缩的域名，""是根
+static uint8_t* putName(uint8_t* p, const char* name) {
+    while (*name) {
+        const char* dot = strchr(name, '.');
+        size_t len = dot ? (size_t)(dot - name) : strlen(name);
+        *p++ = (uint8_t)len;
+        memcpy(p, name, len);
+        p += len;
+        name += dot ? len + 1 : len;
+    }
+    *p++ = 0;
+    return p;
+}
+
+// 追加一条记录，data按类型编码：A是地址，NS和CNAME是域名，SOA是区顶点，TXT是一个字符串
+static void addRecord(Reply* reply, int section, const char* owner, uint16_t type, uint16_t rrclass,
+                      const char* data) {
+    uint8_t* p = putName(reply->ptr, owner);
+    p = put16(p, type);
+    p = put16(p, rrclass);
+    p = put32(p, RECORD_TTL);
+    uint8_t* rdlen = p;
+    p += 2;
+    uint8_t* rdata = p;
+    switch (type) {
+        case TYPE_A:
+            inet_pton(AF_INET, data, p);
+            p += 4;
+            break;
+        case TYPE_NS:
+        case TYPE_CNAME:
+            p = putName(p, data);
+            break;
+        case TYPE_SOA: { // data是区顶点
+            char name[NAME_SIZE];
+            snprintf(name, sizeof(name), "ns.%s", data[0] ? data : "root.test");
+            p = putName(p, name);
+            snprintf(name, sizeof(name), "hostmaster.%s", data[0] ? data : "root.test");
+            p = putName(p, name);
+            p = put32(p, 1);
+            p = put32(p, 3600);
+            p = put32(p, 600);
+            p = put32(p, 86400);
+            p = put32(p, 60);
+            break;
+        }
+        case TYPE_TXT:
+            *p++ = (uint8_t)strlen(data);
+            memcpy(p, data, strlen(data));
+            p += strlen(data);
+            break;
     }
-    printf("Socket created successfully.\n");
+    put16(rdlen, (uint16_t)(p - rdata));
+    reply->ptr = p;
+    reply->count[section]++;
+}
+
+// --- 应答逻辑 ---
 
-    // 3. 配置服务器地址结构
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY; // 监听所有可用接口
-    server_addr.sin_port = htons(PORT);      // 端口号，网络字节序
+// name是否等于zone或在zone之下，""是根
+static int inZone(const char* name, const char* zone) {
+    size_t name_len = strlen(name), zone_len = strlen(zone);
+    if (zone_len == 0) return 1;
+    if (name_len < zone_len || strcmp(name + name_len - zone_len, zone) != 0) return 0;
+    return name_len == zone_len || name[name_len - zone_len - 1] == '.';
+}
 
-    // Optional: Set socket option to reuse address
-    // 可选：设置 Socket 选项允许地址重用
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) == SOCKET_ERROR) {
-        fprintf(stderr, "setsockopt failed with error: %d\n", WSAGetLastError());
-        // Non-fatal, continue
+// 上游：名字的第一个标签为fail时回复SERVFAIL，nx时回复NXDOMAIN，alias和mid依次是指向mid和end的CNAME，
+// big的A查询回答BIG_RECORD_COUNT条地址；其余名字的A查询回答本地址，授权部分带区（名字的最后两个标签）的NS，
+// 附加部分带这个NS的粘附地址
+static int answerUpstream(const Role* role, const char* qname, uint16_t qtype, Reply* reply) {
+    char name[NAME_SIZE];
+    strcpy(name, qname);
+    const char* zone = qname;
+    for (int dots = 0, i = (int)strlen(name) - 1; i >= 0; i--) {
+        if (name[i] == '.' && ++dots == 2) {
+            zone = qname + i + 1;
+            break;
+        }
     }
+    const char* rest = strchr(qname, '.');
+    rest = rest ? rest + 1 : "";
 
-    // 4. 绑定 Socket
-    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
-        fprintf(stderr, "Bind failed with error code : %d\n", WSAGetLastError());
-        closesocket(server_fd); // 绑定失败，关闭 Socket
-        WSACleanup();
-        return 1;
+    if (strncmp(qname, "fail.", 5) == 0) return RCODE_SERVFAIL;
+    if (strncmp(qname, "nx.", 3) == 0) {
+        addRecord(reply, SECTION_AUTHORITY, zone, TYPE_SOA, CLASS_IN, zone);
+        return RCODE_NXDOMAIN;
+    }
+    if (strncmp(qname, "big.", 4) == 0 && qtype == TYPE_A) {
+        for (int i = 0; i < BIG_RECORD_COUNT; i++) {
+            char address[16];
+            snprintf(address, sizeof(address), "192.0.2.%d", 100 + i);
+            addRecord(reply, SECTION_ANSWER, name, TYPE_A, CLASS_IN, address);
+        }
+        return 0;
     }
-    printf("Socket bound to port %d.\n", PORT);
 
-    // 5. 监听连接
-    if (listen(server_fd, 10) == SOCKET_ERROR) { // 10: 连接请求队列长度
-        fprintf(stderr, "Listen failed with error code : %d\n", WSAGetLastError());
-        closesocket(server_fd);
-        WSACleanup();
-        return 1;
+    const char* links[] = { "alias.", "mid.", "end." };
+    for (int i = 0; i < 2; i++) {
+        if (strncmp(name, links[i], strlen(links[i])) != 0 || qtype == TYPE_CNAME) continue;
+        char target[NAME_SIZE];
+        snprintf(target, sizeof(target), "%s%s", links[i + 1], rest);
+        addRecord(reply, SECTION_ANSWER, name, TYPE_CNAME, CLASS_IN, target);
+        strcpy(name, target);
     }
-    printf("Server listening on port %d...\n", PORT);
 
-    // 6. 循环接受客户端连接并处理
-    while (1) {
-        printf("Waiting for incoming connections...\n");
-        // 接受客户端连接 (阻塞)
-        if ((new_socket = accept(server_fd, (struct sockaddr *)&client_addr, &client_addr_len)) == INVALID_SOCKET) {
-            fprintf(stderr, "Accept failed with error code : %d\n", WSAGetLastError());
-            // Continue accepting other connections
-            continue;
+    if (qtype != TYPE_A) {
+        if (reply->count[SECTION_ANSWER] == 0) addRecord(reply, SECTION_AUTHORITY, zone, TYPE_SOA, CLASS_IN, zone);
+        return 0;
+    }
+    char server[NAME_SIZE];
+    snprintf(server, sizeof(server), "ns.%s", zone);
+    addRecord(reply, SECTION_ANSWER, name, TYPE_A, CLASS_IN, role->value);
+    addRecord(reply, SECTION_AUTHORITY, zone, TYPE_NS, CLASS_IN, server);
+    addRecord(reply, SECTION_ADDITIONAL, server, TYPE_A, CLASS_IN, role->address);
+    return 0;
+}
+
+// 权威服务器：查询名在某个下级委派之内时给出委派和粘附记录，否则按记录表回答，CNAME在本区内继续跟随
+static int answerAuthority(const Role* role, const char* qname, uint16_t qtype, Reply* reply, int* authoritative) {
+    const char* apex = role->value;
+    const Record* records = role->records;
+
+    for (const Record* r = records; r->owner; r++) {
+        if (r->type != TYPE_NS || strcmp(r->owner, apex) == 0 || !inZone(qname, r->owner)) continue;
+        const char* cut = r->owner;
+        for (const Record* ns = records; ns->owner; ns++) {
+            if (ns->type == TYPE_NS && strcmp(ns->owner, cut) == 0) {
+                addRecord(reply, SECTION_AUTHORITY, cut, TYPE_NS, CLASS_IN, ns->data);
+            }
         }
-        printf("Accepted connection from %s:%d\n",
-               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port)); // 注意 inet_ntoa 返回静态缓冲区
-
-        // 7. 持续处理客户端数据，直到客户端断开连接
-        printf("Start receiving client messages...\n");
-        
-        while (1) {
-            // 清空缓冲区
-            memset(buffer, 0, BUFFER_SIZE);
-            
-            // 接收数据
-            bytes_received = recv(new_socket, buffer, BUFFER_SIZE - 1, 0); // -1 留给 null 终止符
-            
-            if (bytes_received == SOCKET_ERROR) {
-                int error_code = WSAGetLastError();
-                if (error_code == WSAECONNRESET) { // 客户端突然关闭连接
-                    printf("Client disconnected unexpectedly.\n");
-                } else {
-                    fprintf(stderr, "Receive failed with error code: %d\n", error_code);
+        for (const Record* ns = records; ns->owner; ns++) {
+            if (ns->type != TYPE_NS || strcmp(ns->owner, cut) != 0) continue;
+            for (const Record* glue = records; glue->owner; glue++) {
+                if (glue->type == TYPE_A && strcmp(glue->owner, ns->data) == 0) {
+                    addRecord(reply, SECTION_ADDITIONAL, glue->owner, TYPE_A, CLASS_IN, glue->data);
                 }
-                break;
-            } else if (bytes_received == 0) { // 连接已正常关闭
-                printf("Client disconnected gracefully.\n");
-                break;
-            } else {
-                buffer[bytes_received] = '\0'; // 添加 null 终止符
-                printf("Received from client: %s\n", buffer);
-
-                // 发送确认消息
-                char response[BUFFER_SIZE];
-                sprintf_s(response, BUFFER_SIZE, "Server received: %s", buffer);
-                if (send(new_socket, response, strlen(response), 0) == SOCKET_ERROR) {
-                    fprintf(stderr, "Send failed with error code: %d\n", WSAGetLastError());
-                    break;
+            }
+        }
+        *authoritative = 0;
+        return 0;
+    }
+
+    *authoritative = 1;
+    char name[NAME_SIZE];
+    strcpy(name, qname);
+    for (int links = 0; links < 8; links++) {
+        int exists = 0, matched = 0;
+        const char* cname = NULL;
+        for (const Record* r = records; r->owner; r++) {
+            if (strcmp(r->owner, name) == 0) {
+                exists = 1;
+                if (r->type == qtype) {
+                    addRecord(reply, SECTION_ANSWER, name, r->type, CLASS_IN, r->data);
+                    matched = 1;
+                } else if (r->type == TYPE_CNAME) {
+                    cname = r->data;
                 }
+            } else if (inZone(r->owner, name)) {
+                exists = 1; // 只有子域名的中间名字
             }
         }
+        if (strcmp(name, apex) == 0 && qtype == TYPE_SOA) {
+            addRecord(reply, SECTION_ANSWER, apex, TYPE_SOA, CLASS_IN, apex);
+            matched = 1;
+        }
+        if (matched) return 0;
+        if (cname) {
+            addRecord(reply, SECTION_ANSWER, name, TYPE_CNAME, CLASS_IN, cname);
+            if (!inZone(cname, apex)) return 0;
+            strcpy(name, cname);
+            continue;
+        }
+        addRecord(reply, SECTION_AUTHORITY, apex, TYPE_SOA, CLASS_IN, apex);
+        return exists || reply->count[SECTION_ANSWER] > 0 ? 0 : RCODE_NXDOMAIN;
+    }
+    return 0;
+}
 
-        // 8. 关闭客户端连接 Socket
-        closesocket(new_socket);
-        printf("Client connection closed.\n");
+// 解析查询的问题，域名转为小写的点分形式；成功时返回问题之后的偏移，否则返回0
+static int parseQuestion(const uint8_t* query, int len, char* name, uint16_t* qtype, uint16_t* qclass) {
+    if (len < 12 + 5 || query[4] != 0 || query[5] != 1) return 0;
+    int pos = 12;
+    size_t name_len = 0;
+    while (pos < len && query[pos] != 0) {
+        int label = query[pos++];
+        if (label > 63 || pos + label > len || name_len + label + 1 >= NAME_SIZE) return 0;
+        if (name_len > 0) name[name_len++] = '.';
+        for (int i = 0; i < label; i++) name[name_len++] = (char)tolower(query[pos + i]);
+        pos += label;
     }
+    name[name_len] = '\0';
+    if (pos + 5 > len) return 0;
+    *qtype = (uint16_t)((query[pos + 1] << 8) | query[pos + 2]);
+    *qclass = (uint16_t)((query[pos + 3] << 8) | query[pos + 4]);
+    return pos + 5;
+}
 
-    // 9. 关闭监听 Socket (服务器不停止通常不会执行到这里)
-    closesocket(server_fd);
+// 处理一个查询，tcp表示查询经TCP到达；返回应答长度，不应答时返回0；delay_ms输出应答应当推迟的毫秒数
+static int handleQuery(int index, const uint8_t* query, int len, int tcp, Reply* reply, int* delay_ms) {
+    Role* role = &roles[index];
+    char name[NAME_SIZE];
+    uint16_t qtype, qclass;
+    *delay_ms = 0;
+    int question_end = parseQuestion(query, len, name, &qtype, &qclass);
+    if (question_end == 0) return 0;
 
-    // 10. 清理 Winsock
-    WSACleanup();
-    printf("Server shutting down.\n");
+    memcpy(reply->data, query, question_end);
+    reply->data[6] = reply->data[7] = reply->data[8] = reply->data[9] = reply->data[10] = reply->data[11] = 0;
+    reply->ptr = reply->data + question_end;
+    memset(reply->count, 0, sizeof(reply->count));
+
+    int rcode = 0, authoritative = 0;
+    int truncated = 0;
+    if (qclass == CLASS_CH && qtype == TYPE_TXT) {
+        // 计数查询：回答这个地址收到的该名字的查询数
+        Counter* c = findCounter(index, name, 0);
+        char text[16];
+        snprintf(text, sizeof(text), "%d", c ? c->count : 0);
+        addRecord(reply, SECTION_ANSWER, name, TYPE_TXT, CLASS_CH, text);
+    } else {
+        Counter* c = findCounter(index, name, 1);
+        if (c) c->count++;
+        printf("%s:%d <- %s type %d\n", role->address, role->port, name, qtype);
+        if (role->kind == ROLE_SILENT) return 0;
+        if (role->kind == ROLE_UPSTREAM) {
+            rcode = answerUpstream(role, name, qtype, reply);
+        } else {
+            rcode = answerAuthority(role, name, qtype, reply, &authoritative);
+        }
+        if (strncmp(name, "slow.", 5) == 0) *delay_ms = SLOW_REPLY_MS;
+        if (!tcp && strncmp(name, "tc.", 3) == 0) {
+            // 名字以tc.开头时UDP上只回复不带记录的截断应答，中继应当改经TCP重试
+            reply->ptr = reply->data + question_end;
+            memset(reply->count, 0, sizeof(reply->count));
+            truncated = 1;
+        }
+    }
+
+    uint16_t flags = 0x8000 | (query[2] & 0x01) << 8 | rcode; // QR，沿用RD
+    if (role->kind == ROLE_UPSTREAM) flags |= 0x0080;          // RA
+    if (authoritative) flags |= 0x0400;                         // AA
+    if (truncated) flags |= 0x0200;                             // TC
+    put16(reply->data + 2, flags);
+    put16(reply->data + 6, reply->count[SECTION_ANSWER]);
+    put16(reply->data + 8, reply->count[SECTION_AUTHORITY]);
+    put16(reply->data + 10, reply->count[SECTION_ADDITIONAL]);
+    return (int)(reply->ptr - reply->data);
+}
 
+// --- 延迟应答 ---
+
+static void deferReply(int index, const struct sockaddr_in* to, int to_len, const Reply* reply, int len, int delay_ms) {
+    if (pending_count == MAX_PENDING) return;
+    Pending* p = &pending[pending_count++];
+    p->role = index;
+    p->to = *to;
+    p->to_len = to_len;
+    p->due = GetTickCount64() + delay_ms;
+    p->len = len;
+    memcpy(p->data, reply->data, len);
+}
+
+// 发出到期的延迟应答，返回距下一个应答到期的毫秒数，没有待发的应答时返回-1
+static int flushPending(void) {
+    unsigned long long now = GetTickCount64();
+    int next = -1;
+    for (int i = 0; i < pending_count;) {
+        Pending* p = &pending[i];
+        if (p->due <= now) {
+            sendto(roles[p->role].sock, (const char*)p->data, p->len, 0, (struct sockaddr*)&p->to, p->to_len);
+            pending[i] = pending[--pending_count];
+            continue;
+        }
+        int wait = (int)(p->due - now);
+        if (next < 0 || wait < next) next = wait;
+        i++;
+    }
+    return next;
+}
+
+// --- TCP ---
+
+// 接受一个到替身上游的连接，计入该地址的连接数
+static void acceptConnection(int index) {
+    SOCKET sock = accept(roles[index].listener, NULL, NULL);
+    if (sock == INVALID_SOCKET) return;
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (connections[i].sock != INVALID_SOCKET) continue;
+        connections[i].sock = sock;
+        connections[i].role = index;
+        connections[i].len = 0;
+        Counter* c = findCounter(index, CONNECTION_COUNTER, 1);
+        if (c) c->count++;
+        return;
+    }
+    closesocket(sock);
+}
+
+// 读取连接上的数据，按长度前缀切出查询逐个应答（TCP上不延迟）；对端关闭时释放连接
+static void serveConnection(Connection* conn, Reply* reply) {
+    int n = recv(conn->sock, (char*)conn->data + conn->len, (int)sizeof(conn->data) - conn->len, 0);
+    if (n <= 0) {
+        closesocket(conn->sock);
+        conn->sock = INVALID_SOCKET;
+        return;
+    }
+    conn->len += n;
+    while (conn->len >= 2 && conn->len >= 2 + get16(conn->data)) {
+        int query_len = get16(conn->data);
+        int delay_ms;
+        int reply_len = handleQuery(conn->role, conn->data + 2, query_len, 1, reply, &delay_ms);
+        if (reply_len > 0) {
+            uint8_t prefix[2];
+            put16(prefix, (uint16_t)reply_len);
+            send(conn->sock, (const char*)prefix, 2, 0);
+            send(conn->sock, (const char*)reply->data, reply_len, 0);
+        }
+        memmove(conn->data, conn->data + 2 + query_len, conn->len - 2 - query_len);
+        conn->len -= 2 + query_len;
+    }
+}
+
+int main() {
+    WSADATA wsaData; // Winsock 初始化数据结构
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        fprintf(stderr, "WSAStartup failed. Error Code : %d\n", WSAGetLastError());
+        return 1;
+    }
+
+    // 1. 在每个替身服务器的地址上绑定UDP socket，上游同时在同一地址上监听TCP
+    for (int i = 0; i < MAX_CONNECTIONS; i++) connections[i].sock = INVALID_SOCKET;
+    for (int i = 0; i < ROLE_COUNT; i++) {
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons((u_short)roles[i].port);
+        inet_pton(AF_INET, roles[i].address, &address.sin_addr);
+        roles[i].sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (roles[i].sock == INVALID_SOCKET ||
+            bind(roles[i].sock, (struct sockaddr*)&address, sizeof(address)) == SOCKET_ERROR) {
+            fprintf(stderr, "Bind to %s:%d failed with error code : %d\n", roles[i].address, roles[i].port,
+                    WSAGetLastError());
+            WSACleanup();
+            return 1;
+        }
+        roles[i].listener = INVALID_SOCKET;
+        if (roles[i].kind == ROLE_UPSTREAM) {
+            roles[i].listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (roles[i].listener == INVALID_SOCKET ||
+                bind(roles[i].listener, (struct sockaddr*)&address, sizeof(address)) == SOCKET_ERROR ||
+                listen(roles[i].listener, 16) == SOCKET_ERROR) {
+                fprintf(stderr, "TCP listen on %s:%d failed with error code : %d\n", roles[i].address,
+                        roles[i].port, WSAGetLastError());
+                WSACleanup();
+                return 1;
+            }
+        }
+        printf("Serving %s on %s:%d\n",
+               roles[i].kind == ROLE_UPSTREAM ? "upstream" : roles[i].kind == ROLE_SILENT ? "silent upstream" :
+               roles[i].value[0] ? roles[i].value : "root",
+               roles[i].address, roles[i].port);
+    }
+
+    // 2. 循环等待查询并应答，名字以slow.开头的UDP查询推迟应答
+    static Reply reply;
+    uint8_t buffer[BUFFER_SIZE];
+    while (1) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        SOCKET highest = 0;
+        for (int i = 0; i < ROLE_COUNT; i++) {
+            FD_SET(roles[i].sock, &readable);
+            if (roles[i].sock > highest) highest = roles[i].sock;
+            if (roles[i].listener != INVALID_SOCKET) {
+                FD_SET(roles[i].listener, &readable);
+                if (roles[i].listener > highest) highest = roles[i].listener;
+            }
+        }
+        for (int i = 0; i < MAX_CONNECTIONS; i++) {
+            if (connections[i].sock == INVALID_SOCKET) continue;
+            FD_SET(connections[i].sock, &readable);
+            if (connections[i].sock > highest) highest = connections[i].sock;
+        }
+        int next = flushPending();
+        struct timeval wait = { next / 1000, (next % 1000) * 1000 };
+        if (select((int)highest + 1, &readable, NULL, NULL, next >= 0 ? &wait : NULL) == SOCKET_ERROR) {
+            fprintf(stderr, "select failed with error code : %d\n", WSAGetLastError());
+            break;
+        }
+        for (int i = 0; i < ROLE_COUNT; i++) {
+            if (roles[i].listener != INVALID_SOCKET && FD_ISSET(roles[i].listener, &readable)) acceptConnection(i);
+            if (!FD_ISSET(roles[i].sock, &readable)) continue;
+            struct sockaddr_in from;
+            int from_len = sizeof(from);
+            int len = recvfrom(roles[i].sock, (char*)buffer, sizeof(buffer), 0, (struct sockaddr*)&from, &from_len);
+            if (len <= 0) continue;
+            int delay_ms;
+            int reply_len = handleQuery(i, buffer, len, 0, &reply, &delay_ms);
+            if (reply_len > 0 && delay_ms > 0) {
+                deferReply(i, &from, from_len, &reply, reply_len, delay_ms);
+            } else if (reply_len > 0) {
+                sendto(roles[i].sock, (const char*)reply.data, reply_len, 0, (struct sockaddr*)&from, from_len);
+            }
+        }
+        for (int i = 0; i < MAX_CONNECTIONS; i++) {
+            if (connections[i].sock != INVALID_SOCKET && FD_ISSET(connections[i].sock, &readable)) {
+                serveConnection(&connections[i], &reply);
+            }
+        }
+    }
+
+    for (int i = 0; i < ROLE_COUNT; i++) closesocket(roles[i].sock);
+    WSACleanup();
     return 0;
 }